@@ -14,7 +14,7 @@
 # may overwrite the local copy in the libnih source tree with any installed
 # version.
 
-# serial 2 libnih.m4
+# serial 3 libnih.m4
 
 
 # NIH_COMPILER_WARNINGS
@@ -77,6 +77,21 @@ AC_DEFUN([NIH_COMPILER_COVERAGE],
 ])# NIH_COMPILER_COVERAGE
 
 
+# NIH_ALLOC_STATS
+# ---------------
+# Add configure option to attribute nih_alloc() allocations to their
+# source location, for nih_alloc_stats_init().
+AC_DEFUN([NIH_ALLOC_STATS],
+[AC_ARG_ENABLE(alloc-stats,
+	AS_HELP_STRING([--enable-alloc-stats],
+		       [Record the source location of allocations]),
+[AS_IF([test "x$enable_alloc_stats" = "xyes"],
+       [CFLAGS="$CFLAGS -DNIH_ALLOC_STATS"
+	CXXFLAGS="$CXXFLAGS -DNIH_ALLOC_STATS"])
+])dnl
+])# NIH_ALLOC_STATS
+
+
 # NIH_LINKER_VERSION_SCRIPT
 # -------------------------
 # Detect whether the linker supports version scripts
@@ -443,8 +443,10 @@ nih_dbus_add_watch (DBusWatch *watch,
 
 	dbus_watch_set_data (watch, io_watch, (DBusFreeFunction)nih_discard);
 
-	if (! dbus_watch_get_enabled (watch))
+	if (! dbus_watch_get_enabled (watch)) {
 		nih_list_remove (&io_watch->entry);
+		nih_io_watch_update (io_watch);
+	}
 
 	return TRUE;
 }
@@ -473,6 +475,7 @@ nih_dbus_remove_watch (DBusWatch *watch,
 	 * when we set the data to NULL.
 	 **/
 	nih_list_remove (&io_watch->entry);
+	nih_io_watch_update (io_watch);
 
 	dbus_watch_set_data (watch, NULL, NULL);
 }
@@ -506,11 +509,15 @@ nih_dbus_watch_toggled (DBusWatch *watch,
 	if (flags & DBUS_WATCH_WRITABLE)
 		events |= NIH_IO_WRITE;
 
+	io_watch->events = events;
+
 	if (dbus_watch_get_enabled (watch)) {
 		nih_list_add (nih_io_watches, &io_watch->entry);
 	} else {
 		nih_list_remove (&io_watch->entry);
 	}
+
+	nih_io_watch_update (io_watch);
 }
 
 /**
@@ -569,15 +576,17 @@ nih_dbus_add_timeout (DBusTimeout *timeout,
 
 	interval = dbus_timeout_get_interval (timeout);
 
-	timer = nih_timer_add_periodic (NULL, (interval - 1) / 1000 + 1,
-					(NihTimerCb)nih_dbus_timer, timeout);
+	timer = nih_timer_add_periodic_ms (NULL, nih_max (interval, 1),
+					   (NihTimerCb)nih_dbus_timer, timeout);
 	if (! timer)
 		return FALSE;
 
 	dbus_timeout_set_data (timeout, timer, (DBusFreeFunction)nih_discard);
 
-	if (! dbus_timeout_get_enabled (timeout))
+	if (! dbus_timeout_get_enabled (timeout)) {
 		nih_list_remove (&timer->entry);
+		nih_timer_update (timer);
+	}
 
 	return TRUE;
 }
@@ -605,6 +614,7 @@ nih_dbus_remove_timeout (DBusTimeout *timeout,
 	 * when we set the data to NULL.
 	 */
 	nih_list_remove (&timer->entry);
+	nih_timer_update (timer);
 
 	dbus_timeout_set_data (timeout, NULL, NULL);
 }
@@ -636,14 +646,24 @@ nih_dbus_timeout_toggled (DBusTimeout *timeout,
 
 	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
 
-	timer->period = (interval - 1) / 1000 + 1;
-	timer->due = now.tv_sec + timer->period;
+	interval = nih_max (interval, 1);
+	timer->period = interval / 1000;
+	timer->period_nsec = (interval % 1000) * 1000000;
+
+	timer->due.tv_sec = now.tv_sec + timer->period;
+	timer->due.tv_nsec = now.tv_nsec + timer->period_nsec;
+	if (timer->due.tv_nsec >= 1000000000) {
+		timer->due.tv_sec++;
+		timer->due.tv_nsec -= 1000000000;
+	}
 
 	if (dbus_timeout_get_enabled (timeout)) {
 		nih_list_add (nih_timers, &timer->entry);
 	} else {
 		nih_list_remove (&timer->entry);
 	}
+
+	nih_timer_update (timer);
 }
 
 /**
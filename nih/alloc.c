@@ -24,7 +24,10 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/logging.h>
@@ -33,34 +36,65 @@
 #include "alloc.h"
 
 
+/* Allocations made here are not attributed to a site */
+#undef nih_alloc
+
+
 /**
- * NihAllocCtx:
- * @parents: parents of this context,
- * @children: children of this context,
- * @destructor: function to be called when freed,
- * @size: allocation size.
+ * NIH_ALLOC_POOL_BITS:
  *
- * This structure is placed before all allocations in memory and is used
- * to build up an n-ary tree of them.  Allocations may have multiple
- * parent references and multiple children.  Allocations are automatically
- * freed if the last parent reference is freed.  When an allocation is
- * freed, all children are unreferenced and any destructors called.
+ * Number of bits of the NihAllocCtx structure used to store the pool
+ * that it was taken from; one more bit marks whether the context is
+ * tracked, and the remaining bits store the size.
+ **/
+#define NIH_ALLOC_POOL_BITS 4
+#define NIH_ALLOC_SIZE_BITS (sizeof (size_t) * 8 - NIH_ALLOC_POOL_BITS - 1)
+
+/**
+ * NIH_ALLOC_POOL_SLAB:
  *
- * Members of @parents and @children are both NihAllocRef objects.
+ * Size of the blocks that pools of contexts and references are carved
+ * from.
  **/
-typedef struct nih_alloc_ctx {
-	NihList       parents;
-	NihList       children;
-	NihDestructor destructor;
-	size_t        size;
-} NihAllocCtx;
+#define NIH_ALLOC_POOL_SLAB 8192
+
+/**
+ * NIH_ALLOC_POOL_ARENA:
+ *
+ * Value of the pool member of contexts that were bump-allocated from an
+ * arena.
+ **/
+#define NIH_ALLOC_POOL_ARENA ((1 << NIH_ALLOC_POOL_BITS) - 1)
+
+/**
+ * NIH_ARENA_CHUNK:
+ *
+ * Size of the chunks that arenas bump-allocate objects from; objects
+ * larger than a quarter of this are given a chunk of their own.
+ **/
+#define NIH_ARENA_CHUNK 65536
+
+/**
+ * NIH_ALLOC_SITE_BUCKETS:
+ *
+ * Number of buckets in the table of allocation sites, which are hashed
+ * by line number.
+ **/
+#define NIH_ALLOC_SITE_BUCKETS 256
+
+
+typedef struct nih_alloc_ctx NihAllocCtx;
+typedef struct nih_alloc_arena NihAllocArena;
+typedef struct nih_alloc_site NihAllocSite;
 
 /**
  * NihAllocRef:
  * @children_entry: list head in parent's children list,
  * @parents_entry: list head in child's parents list,
  * @parent: pointer to parent context,
- * @child: pointer to child context.
+ * @child: pointer to child context,
+ * @pooled: TRUE if taken from the pool of references,
+ * @in_arena: TRUE if allocated from the arena of both contexts.
  *
  * This structure is shared by both @parent and @child denoting a reference
  * between the two of them.  It is placed in @parent's children list through
@@ -71,8 +105,119 @@ typedef struct nih_alloc_ref {
 	NihList      parents_entry;
 	NihAllocCtx *parent;
 	NihAllocCtx *child;
+	int          pooled;
+	int          in_arena;
 } NihAllocRef;
 
+/**
+ * NihAllocCtx:
+ * @parents: parents of this context,
+ * @children: children of this context,
+ * @destructor: function to be called when freed,
+ * @size: allocation size,
+ * @pool: pool the context was taken from, or zero,
+ * @tracked: TRUE if preceded by an NihAllocTrack structure,
+ * @ref: storage for the first reference to this context,
+ * @arena: arena the context was allocated from, or of which it is the root.
+ *
+ * This structure is placed before all allocations in memory and is used
+ * to build up an n-ary tree of them.  Allocations may have multiple
+ * parent references and multiple children.  Allocations are automatically
+ * freed if the last parent reference is freed.  When an allocation is
+ * freed, all children are unreferenced and any destructors called.
+ *
+ * Members of @parents and @children are both NihAllocRef objects.  Since
+ * almost all allocations only ever have one parent, the reference to it is
+ * stored in @ref rather than allocated separately; @ref is in use while
+ * its parents_entry member is not empty.
+ *
+ * Contexts allocated from an arena have @pool set to NIH_ALLOC_POOL_ARENA
+ * and @arena pointing at it; the root object of an arena only has @arena
+ * set, until it is freed.
+ **/
+struct nih_alloc_ctx {
+	NihList       parents;
+	NihList       children;
+	NihDestructor destructor;
+	size_t        size : NIH_ALLOC_SIZE_BITS;
+	unsigned int  pool : NIH_ALLOC_POOL_BITS;
+	unsigned int  tracked : 1;
+
+	NihAllocRef   ref;
+	NihAllocArena *arena;
+};
+
+/**
+ * NihAllocPool:
+ * @stats: statistics for the pool, including the size of each chunk,
+ * @chunks: singly-linked list of free chunks,
+ * @slabs: singly-linked list of slabs the chunks were carved from.
+ *
+ * Pools hold contexts, or references, of the same size class.  Free chunks
+ * are linked through their first pointer, and slabs through theirs, which
+ * is why each slab begins with a padded pointer.
+ **/
+typedef struct nih_alloc_pool {
+	NihAllocPoolStats   stats;
+	void              *chunks;
+	void              *slabs;
+} NihAllocPool;
+
+/**
+ * NihAllocArena:
+ * @root: context of the arena's root object, or NULL once freed,
+ * @chunks: singly-linked list of chunks,
+ * @next: next free byte of the current chunk,
+ * @end: end of the current chunk,
+ * @live: number of objects allocated from the arena not yet freed,
+ * @destructors: number of those objects with a destructor set,
+ * @external: number of references between objects in the arena and
+ * objects outside it.
+ *
+ * State of an arena, which is kept separately from its root object since
+ * objects that escape the arena, by being referenced from outside it,
+ * keep its chunks in use after the root object has been freed.  The
+ * state and chunks are freed once both @root is NULL and @live is zero.
+ *
+ * Each chunk begins with a padded pointer to the next.
+ **/
+struct nih_alloc_arena {
+	NihAllocCtx *root;
+	void        *chunks;
+	void        *next;
+	void        *end;
+	size_t       live;
+	size_t       destructors;
+	size_t       external;
+};
+
+/**
+ * NihAllocSite:
+ * @stats: statistics for the site,
+ * @next: next site in the same bucket.
+ *
+ * Allocation sites are kept in a hash table of singly-linked lists, new
+ * sites being fully initialised before they are placed at the head of a
+ * list so that the table may be read from a signal handler.
+ **/
+struct nih_alloc_site {
+	NihAllocSiteStats stats;
+	NihAllocSite     *next;
+};
+
+/**
+ * NihAllocTrack:
+ * @site: site the object was allocated from,
+ * @children: number of references to children of the object.
+ *
+ * This structure is placed in front of the NihAllocCtx structure of
+ * objects allocated once nih_alloc_stats_init() has been called.
+ **/
+typedef struct nih_alloc_track {
+	NihAllocSite *site;
+	size_t        children;
+} NihAllocTrack;
+
 
 /**
  * NIH_ALLOC_SIZE:
@@ -90,45 +235,960 @@ typedef struct nih_alloc_ref {
  * Obtain the location of the NihAllocCtx structure given a pointer to the
  * block of memory beyond it.
  *
- * Returns: pointer to NihAllocCtx structure or NULL if @ptr is NULL.
+ * Returns: pointer to NihAllocCtx structure or NULL if @ptr is NULL.
+ **/
+#define NIH_ALLOC_CTX(ptr) (ptr ? (void *)(ptr) - NIH_ALLOC_SIZE : NULL)
+
+/**
+ * NIH_ALLOC_PTR:
+ * @ctx: pointer to NihAllocCtx structure.
+ *
+ * Obtain the location of the block of memory given a pointer to the
+ * NihAllocCtx structure in front of it.
+ *
+ * Returns: pointer to block of memory.
+ **/
+#define NIH_ALLOC_PTR(ctx) ((void *)(ctx) + NIH_ALLOC_SIZE)
+
+/**
+ * NIH_ALLOC_FINALISED:
+ *
+ * Flag placed in the destructor field of a context to indicate the
+ * destructor has been called and the object is pending being freed.
+ **/
+#define NIH_ALLOC_FINALISED ((void *)-1)
+
+/**
+ * NIH_ALLOC_TRACK_SIZE:
+ *
+ * Expands to the size of the NihAllocTrack structure plus whatever padding
+ * is needed to ensure the following context is generically aligned.
+ **/
+#define NIH_ALLOC_TRACK_SIZE (NIH_ALIGN_SIZE * (((sizeof (NihAllocTrack) - 1) \
+						 / NIH_ALIGN_SIZE) + 1))
+
+/**
+ * NIH_ALLOC_TRACK:
+ * @ctx: pointer to tracked NihAllocCtx structure.
+ *
+ * Returns: pointer to the NihAllocTrack structure in front of @ctx.
+ **/
+#define NIH_ALLOC_TRACK(ctx) ((NihAllocTrack *)((void *)(ctx)		\
+						- NIH_ALLOC_TRACK_SIZE))
+
+/**
+ * NIH_ALLOC_MEM:
+ * @ctx: pointer to NihAllocCtx structure.
+ *
+ * Obtain the start of the memory allocated for @ctx, which includes the
+ * NihAllocTrack structure in front of it if tracked.
+ *
+ * Returns: pointer to allocated memory.
+ **/
+#define NIH_ALLOC_MEM(ctx) ((void *)(ctx)				\
+			    - ((ctx)->tracked ? NIH_ALLOC_TRACK_SIZE : 0))
+
+
+/* Prototypes for static functions */
+static inline void *       nih_alloc_new            (const void *parent,
+						     size_t size,
+						     const char *file, int line)
+	__attribute__ ((malloc));
+static inline NihAllocCtx *nih_alloc_ctx_new        (size_t size,
+						     NihAllocArena *arena,
+						     NihAllocSite *site);
+static inline int          nih_alloc_context_free   (NihAllocCtx *ctx);
+static inline int          nih_alloc_context_finalise (NihAllocCtx *ctx);
+static inline size_t       nih_alloc_context_release (NihList *children,
+						      size_t limit);
+static inline int          nih_alloc_finalise       (NihAllocCtx *ctx);
+
+static inline NihAllocRef *nih_alloc_ref_new        (NihAllocCtx *parent,
+						     NihAllocCtx *child)
+	__attribute__ ((malloc));
+static inline void         nih_alloc_ref_free       (NihAllocRef *ref);
+static inline void         nih_alloc_ref_release    (NihAllocRef *ref);
+static inline void         nih_alloc_ref_cross      (NihAllocRef *ref,
+						     int delta);
+static inline void         nih_alloc_ref_relink     (NihAllocCtx *ctx,
+						     NihList *parents_prev,
+						     NihList *children_prev);
+static inline NihAllocRef *nih_alloc_ref_lookup     (NihAllocCtx *parent,
+						     NihAllocCtx *child);
+
+static inline int          nih_alloc_pool_class     (size_t size);
+static inline void *       nih_alloc_pool_get       (NihAllocPool *pool,
+						     void *(*alloc) (size_t))
+	__attribute__ ((malloc));
+static inline void         nih_alloc_pool_put       (NihAllocPool *pool,
+						     void *chunk);
+static inline void         nih_alloc_ctx_release    (NihAllocCtx *ctx);
+static void *              nih_alloc_must_malloc    (size_t size)
+	__attribute__ ((malloc));
+
+static inline void *       nih_alloc_arena_get      (NihAllocArena *arena,
+						     size_t size)
+	__attribute__ ((malloc));
+static inline void         nih_alloc_arena_put      (NihAllocArena *arena);
+static void                nih_alloc_arena_free     (NihAllocArena *arena);
+static int                 nih_arena_destroy        (NihArena *root);
+
+static NihAllocSite *      nih_alloc_site_lookup    (const char *file,
+						     int line);
+static inline int          nih_alloc_fanout_bucket  (size_t children);
+static inline void         nih_alloc_track_new      (NihAllocCtx *ctx,
+						     NihAllocSite *site);
+static inline void         nih_alloc_track_free     (NihAllocCtx *ctx);
+static inline void         nih_alloc_track_resize   (NihAllocCtx *ctx,
+						     size_t size);
+static inline void         nih_alloc_track_fanout   (NihAllocCtx *parent,
+						     int delta);
+static void                nih_alloc_dump_site      (int fd, char *buf,
+						     size_t *len,
+						     NihAllocSite *site);
+static void                nih_alloc_dump_write     (int fd, char *buf,
+						     size_t *len,
+						     const char *str,
+						     size_t num);
+
+
+/* Point to the functions we actually call for allocation. */
+void *(*__nih_malloc)  (size_t size)            = malloc;
+void *(*__nih_realloc) (void *ptr, size_t size) = realloc;
+void  (*__nih_free)    (void *ptr)              = free;
+
+
+/**
+ * nih_alloc_pools:
+ *
+ * Pools of contexts for each size class, the chunk sizes include the
+ * NihAllocCtx structure and must be a multiple of NIH_ALIGN_SIZE.  A
+ * context's pool member is its index in this array plus one.
+ **/
+static NihAllocPool nih_alloc_pools[] = {
+	{ { 128 } }, { { 144 } }, { { 160 } }, { { 192 } }, { { 224 } },
+	{ { 256 } }, { { 320 } }, { { 384 } }, { { 512 } }, { { 640 } },
+};
+
+/**
+ * nih_alloc_ref_pool:
+ *
+ * Pool of NihAllocRef structures.
+ **/
+static NihAllocPool nih_alloc_ref_pool = {
+	{ sizeof (NihAllocRef) }
+};
+
+/**
+ * nih_alloc_deferred:
+ *
+ * References to objects freed with nih_free_deferred() whose memory has
+ * not yet been released, in the order they are to be released; the
+ * reference stored in each freed object is used to place the object
+ * itself after its children.
+ **/
+static NihList nih_alloc_deferred = { &nih_alloc_deferred,
+				      &nih_alloc_deferred };
+
+/**
+ * nih_alloc_use_pools:
+ *
+ * TRUE once nih_alloc_pool_init() has been called.
+ **/
+static int nih_alloc_use_pools = FALSE;
+
+/**
+ * nih_alloc_use_stats:
+ *
+ * TRUE once nih_alloc_stats_init() has been called.
+ **/
+static int nih_alloc_use_stats = FALSE;
+
+/**
+ * nih_alloc_global_stats:
+ *
+ * Statistics for all tracked objects.
+ **/
+static NihAllocStats nih_alloc_global_stats;
+
+/**
+ * nih_alloc_sites:
+ *
+ * Hash table of allocation sites, by line number.
+ **/
+static NihAllocSite *nih_alloc_sites[NIH_ALLOC_SITE_BUCKETS];
+
+/**
+ * nih_alloc_unknown_site:
+ *
+ * Site that objects are attributed to when their allocation site isn't
+ * known, or information about a new site couldn't be allocated.
+ **/
+static NihAllocSite nih_alloc_unknown_site;
+
+
+/**
+ * nih_alloc_pool_init:
+ *
+ * Arranges for objects and the references between them to be taken from
+ * pools of free chunks of the same size class, carved from larger blocks,
+ * rather than each being allocated separately.  Chunks are returned to
+ * their pool when freed, for re-use by later allocations; the blocks are
+ * never freed.
+ *
+ * Objects larger than the largest size class are allocated as before,
+ * as are objects that grow beyond their size class when reallocated.
+ *
+ * Objects allocated before calling this function are unaffected; once
+ * called, pools cannot be disabled again.
+ **/
+void
+nih_alloc_pool_init (void)
+{
+	nih_alloc_use_pools = TRUE;
+}
+
+/**
+ * nih_alloc_pool_stats:
+ * @stats: array to store statistics in,
+ * @len: number of elements in @stats.
+ *
+ * Fills in up to @len elements of @stats with the statistics for each pool
+ * of objects, from the smallest size class to the largest, followed by the
+ * statistics for the pool of references between objects.
+ *
+ * Returns: number of pools, which may be larger than @len.
+ **/
+size_t
+nih_alloc_pool_stats (NihAllocPoolStats *stats,
+		      size_t             len)
+{
+	size_t npools, i;
+
+	nih_assert ((stats != NULL) || (len == 0));
+
+	npools = sizeof (nih_alloc_pools) / sizeof (NihAllocPool);
+
+	for (i = 0; (i < npools) && (i < len); i++)
+		memcpy (&stats[i], &nih_alloc_pools[i].stats,
+			sizeof (NihAllocPoolStats));
+
+	if (npools < len)
+		memcpy (&stats[npools], &nih_alloc_ref_pool.stats,
+			sizeof (NihAllocPoolStats));
+
+	return npools + 1;
+}
+
+/**
+ * nih_alloc_pool_class:
+ * @size: size of context and object.
+ *
+ * Returns: index of the smallest pool with chunks of at least @size
+ * bytes, or negative value if @size is too large.
+ **/
+static inline int
+nih_alloc_pool_class (size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (nih_alloc_pools) / sizeof (NihAllocPool); i++)
+		if (size <= nih_alloc_pools[i].stats.size)
+			return i;
+
+	return -1;
+}
+
+/**
+ * nih_alloc_pool_get:
+ * @pool: pool to take from,
+ * @alloc: function to allocate a new slab.
+ *
+ * Takes a free chunk from @pool, carving a new slab allocated with
+ * @alloc into chunks if there are none.
+ *
+ * Returns: chunk, or NULL if insufficient memory.
+ **/
+static inline void *
+nih_alloc_pool_get (NihAllocPool *pool,
+		    void *(*alloc) (size_t))
+{
+	void * chunk;
+	void * slab;
+	size_t offset;
+
+	nih_assert (pool != NULL);
+	nih_assert (alloc != NULL);
+
+	if (! pool->chunks) {
+		slab = alloc (NIH_ALLOC_POOL_SLAB);
+		if (! slab)
+			return NULL;
+
+		*(void **)slab = pool->slabs;
+		pool->slabs = slab;
+		pool->stats.slabs++;
+
+		for (offset = NIH_ALIGN_SIZE;
+		     offset + pool->stats.size <= NIH_ALLOC_POOL_SLAB;
+		     offset += pool->stats.size) {
+			chunk = slab + offset;
+
+			*(void **)chunk = pool->chunks;
+			pool->chunks = chunk;
+			pool->stats.free++;
+		}
+	}
+
+	chunk = pool->chunks;
+	pool->chunks = *(void **)chunk;
+
+	pool->stats.in_use++;
+	pool->stats.free--;
+	pool->stats.allocs++;
+
+	return chunk;
+}
+
+/**
+ * nih_alloc_pool_put:
+ * @pool: pool to return to,
+ * @chunk: chunk to return.
+ *
+ * Returns @chunk to the free chunks of @pool.
+ **/
+static inline void
+nih_alloc_pool_put (NihAllocPool *pool,
+		    void         *chunk)
+{
+	nih_assert (pool != NULL);
+	nih_assert (chunk != NULL);
+
+	*(void **)chunk = pool->chunks;
+	pool->chunks = chunk;
+
+	pool->stats.in_use--;
+	pool->stats.free++;
+}
+
+/**
+ * nih_alloc_ctx_release:
+ * @ctx: context to release.
+ *
+ * Returns the memory of @ctx to its pool or arena, or to the allocator if
+ * it was not taken from either.
+ **/
+static inline void
+nih_alloc_ctx_release (NihAllocCtx *ctx)
+{
+	nih_assert (ctx != NULL);
+
+	if (ctx->tracked)
+		nih_alloc_track_free (ctx);
+
+	if (ctx->pool == NIH_ALLOC_POOL_ARENA) {
+		nih_alloc_arena_put (ctx->arena);
+	} else if (ctx->pool) {
+		nih_alloc_pool_put (&nih_alloc_pools[ctx->pool - 1],
+				    NIH_ALLOC_MEM (ctx));
+	} else {
+		__nih_free (NIH_ALLOC_MEM (ctx));
+	}
+}
+
+/**
+ * nih_alloc_must_malloc:
+ * @size: size to allocate.
+ *
+ * Allocates slabs for the pool of references, which like references
+ * themselves must not fail.
+ *
+ * Returns: newly allocated memory.
+ **/
+static void *
+nih_alloc_must_malloc (size_t size)
+{
+	return NIH_MUST (malloc (size));
+}
+
+
+/**
+ * nih_arena_new:
+ * @parent: parent object for new arena.
+ *
+ * Allocates a new arena, an object which may be used as the parent of
+ * other objects in the same way as any other.  All of its descendants
+ * allocated with nih_alloc() are bump-allocated from large chunks of
+ * memory that belong to the arena, rather than being allocated
+ * separately; so long as the arena itself has not been freed.
+ *
+ * When the arena is freed, provided that no object in it has a destructor
+ * and that there are no references between objects in it and objects
+ * outside of it, every object in it is released at once by freeing the
+ * chunks, without visiting each one.  This is not done once
+ * nih_alloc_stats_init() has been called, since the statistics for each
+ * object need to be updated.
+ *
+ * Otherwise the objects are freed as normal, with destructors called and
+ * objects that have escaped the arena, by being referenced from outside
+ * it, remaining allocated until their last parent reference is removed.
+ * The chunks are freed once no object in them remains.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned arena.  When all parents of
+ * the returned arena are freed, the returned arena will also be freed.
+ *
+ * The arena is given a destructor of its own, which must not be replaced.
+ *
+ * Returns: newly allocated arena or NULL if insufficient memory.
+ **/
+NihArena *
+nih_arena_new (const void *parent)
+{
+	NihAllocArena *arena;
+	NihAllocCtx *  ctx;
+
+	arena = __nih_malloc (sizeof (NihAllocArena));
+	if (! arena)
+		return NULL;
+
+	memset (arena, 0, sizeof (NihAllocArena));
+
+	ctx = nih_alloc_ctx_new (0, NULL, NULL);
+	if (! ctx) {
+		__nih_free (arena);
+		return NULL;
+	}
+
+	ctx->destructor = (NihDestructor)nih_arena_destroy;
+	ctx->arena = arena;
+	arena->root = ctx;
+
+	nih_alloc_ref_new (NIH_ALLOC_CTX (parent), ctx);
+
+	return NIH_ALLOC_PTR (ctx);
+}
+
+/**
+ * nih_arena_destroy:
+ * @root: arena being freed.
+ *
+ * Destructor for an arena's root object; if nothing outside the arena
+ * refers into it, and no object inside it needs to be finalised, its
+ * children are discarded and all of its memory freed immediately.
+ * Otherwise its memory is freed once its last object has been.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_arena_destroy (NihArena *root)
+{
+	NihAllocCtx *  ctx;
+	NihAllocArena *arena;
+
+	nih_assert (root != NULL);
+
+	ctx = NIH_ALLOC_CTX (root);
+	arena = ctx->arena;
+	nih_assert (arena != NULL);
+	nih_assert (arena->root == ctx);
+
+	/* @ctx keeps pointing at the arena while its children are
+	 * finalised, so that references from it into the arena aren't
+	 * counted as external, unless the arena is freed now.
+	 */
+	arena->root = NULL;
+
+	if ((! arena->external) && (! arena->destructors)
+	    && (! nih_alloc_use_stats)) {
+		nih_list_init (&ctx->children);
+		arena->live = 0;
+	}
+
+	if (! arena->live) {
+		ctx->arena = NULL;
+		nih_alloc_arena_free (arena);
+	}
+
+	return 0;
+}
+
+/**
+ * nih_alloc_arena_get:
+ * @arena: arena to allocate from,
+ * @size: size to allocate.
+ *
+ * Allocates @size bytes from the current chunk of @arena, allocating a
+ * new chunk if there is insufficient room left in it; or a chunk just
+ * for this allocation if @size is particularly large.
+ *
+ * Returns: newly allocated memory or NULL if insufficient memory.
+ **/
+static inline void *
+nih_alloc_arena_get (NihAllocArena *arena,
+		     size_t         size)
+{
+	void *chunk;
+	void *ptr;
+
+	nih_assert (arena != NULL);
+
+	size = NIH_ALIGN_SIZE * (((size - 1) / NIH_ALIGN_SIZE) + 1);
+
+	if (size > NIH_ARENA_CHUNK / 4) {
+		chunk = __nih_malloc (NIH_ALIGN_SIZE + size);
+		if (! chunk)
+			return NULL;
+
+		*(void **)chunk = arena->chunks;
+		arena->chunks = chunk;
+
+		return chunk + NIH_ALIGN_SIZE;
+	}
+
+	if ((! arena->next) || (size > (size_t)(arena->end - arena->next))) {
+		chunk = __nih_malloc (NIH_ARENA_CHUNK);
+		if (! chunk)
+			return NULL;
+
+		*(void **)chunk = arena->chunks;
+		arena->chunks = chunk;
+
+		arena->next = chunk + NIH_ALIGN_SIZE;
+		arena->end = chunk + NIH_ARENA_CHUNK;
+	}
+
+	ptr = arena->next;
+	arena->next += size;
+
+	return ptr;
+}
+
+/**
+ * nih_alloc_arena_put:
+ * @arena: arena an object was allocated from.
+ *
+ * Called when an object allocated from @arena is freed, freeing @arena
+ * if it was the last object and the root has already been freed.
+ **/
+static inline void
+nih_alloc_arena_put (NihAllocArena *arena)
+{
+	nih_assert (arena != NULL);
+	nih_assert (arena->live > 0);
+
+	if ((! --arena->live) && (! arena->root))
+		nih_alloc_arena_free (arena);
+}
+
+/**
+ * nih_alloc_arena_free:
+ * @arena: arena to free.
+ *
+ * Frees all of the chunks of @arena, and its state.
+ **/
+static void
+nih_alloc_arena_free (NihAllocArena *arena)
+{
+	nih_assert (arena != NULL);
+
+	while (arena->chunks) {
+		void *chunk = arena->chunks;
+
+		arena->chunks = *(void **)chunk;
+		__nih_free (chunk);
+	}
+
+	__nih_free (arena);
+}
+
+
+/**
+ * nih_alloc_stats_init:
+ *
+ * Arranges for objects allocated from now on to be tracked, so that
+ * statistics about the number and size of live objects, the sites that
+ * allocated them and how many children they have may be obtained with
+ * nih_alloc_stats() and nih_alloc_site_stats(), or written out with
+ * nih_alloc_stats_dump().
+ *
+ * Objects are attributed to the source file and line that allocated them
+ * when allocated with nih_alloc_at(), which nih_alloc() and nih_new()
+ * expand to when NIH_ALLOC_STATS is defined; otherwise they are attributed
+ * to a site with a NULL file.
+ *
+ * Objects allocated before calling this function are not tracked; once
+ * called, tracking cannot be disabled again.
+ **/
+void
+nih_alloc_stats_init (void)
+{
+	nih_alloc_use_stats = TRUE;
+}
+
+/**
+ * nih_alloc_stats:
+ * @stats: structure to store statistics in.
+ *
+ * Fills in @stats with the statistics for all tracked objects.
+ **/
+void
+nih_alloc_stats (NihAllocStats *stats)
+{
+	nih_assert (stats != NULL);
+
+	memcpy (stats, &nih_alloc_global_stats, sizeof (NihAllocStats));
+}
+
+/**
+ * nih_alloc_site_stats:
+ * @stats: array to store statistics in,
+ * @len: number of elements in @stats.
+ *
+ * Fills in up to @len elements of @stats with the statistics for each
+ * site that has allocated tracked objects, in no particular order.
+ *
+ * Returns: number of sites, which may be larger than @len.
+ **/
+size_t
+nih_alloc_site_stats (NihAllocSiteStats *stats,
+		      size_t             len)
+{
+	NihAllocSite *site;
+	size_t        nsites = 0;
+	size_t        i;
+
+	nih_assert ((stats != NULL) || (len == 0));
+
+	if (nih_alloc_unknown_site.stats.allocs) {
+		if (nsites < len)
+			memcpy (&stats[nsites], &nih_alloc_unknown_site.stats,
+				sizeof (NihAllocSiteStats));
+		nsites++;
+	}
+
+	for (i = 0; i < NIH_ALLOC_SITE_BUCKETS; i++) {
+		for (site = nih_alloc_sites[i]; site; site = site->next) {
+			if (nsites < len)
+				memcpy (&stats[nsites], &site->stats,
+					sizeof (NihAllocSiteStats));
+			nsites++;
+		}
+	}
+
+	return nsites;
+}
+
+/**
+ * nih_alloc_stats_dump:
+ * @fd: file descriptor to write to.
+ *
+ * Writes the statistics for all tracked objects to @fd, followed by the
+ * fanout histogram and the statistics for each site with live objects;
+ * a report of objects that have not been freed, if called on exit.
+ *
+ * This function only uses write() and does not allocate memory, so may
+ * be called from a signal handler.
+ **/
+void
+nih_alloc_stats_dump (int fd)
+{
+	NihAllocStats *stats = &nih_alloc_global_stats;
+	NihAllocSite * site;
+	char           buf[256];
+	size_t         len = 0;
+	size_t         i;
+
+	nih_alloc_dump_write (fd, buf, &len, "nih_alloc: ", stats->objects);
+	nih_alloc_dump_write (fd, buf, &len, " objects, ", stats->bytes);
+	nih_alloc_dump_write (fd, buf, &len, " bytes; peak ",
+			      stats->peak_objects);
+	nih_alloc_dump_write (fd, buf, &len, " objects, ", stats->peak_bytes);
+	nih_alloc_dump_write (fd, buf, &len, " bytes; ", stats->allocs);
+	nih_alloc_dump_write (fd, buf, &len, " allocations\n", (size_t)-1);
+
+	nih_alloc_dump_write (fd, buf, &len, "nih_alloc: fanout", (size_t)-1);
+	for (i = 0; i < NIH_ALLOC_FANOUT_BUCKETS; i++) {
+		nih_alloc_dump_write (fd, buf, &len, " ",
+				      i ? (size_t)1 << (i - 1) : 0);
+		nih_alloc_dump_write (fd, buf, &len, ":", stats->fanout[i]);
+	}
+	nih_alloc_dump_write (fd, buf, &len, "\n", (size_t)-1);
+
+	nih_alloc_dump_site (fd, buf, &len, &nih_alloc_unknown_site);
+	for (i = 0; i < NIH_ALLOC_SITE_BUCKETS; i++)
+		for (site = nih_alloc_sites[i]; site; site = site->next)
+			nih_alloc_dump_site (fd, buf, &len, site);
+
+	if (len)
+		while ((write (fd, buf, len) < 0) && (errno == EINTR))
+			;
+}
+
+/**
+ * nih_alloc_dump_site:
+ * @fd: file descriptor to write to,
+ * @buf: buffer of at least 256 bytes,
+ * @len: number of bytes used in @buf,
+ * @site: site to write.
+ *
+ * Appends the statistics for @site to @buf, if it has live objects.
+ **/
+static void
+nih_alloc_dump_site (int           fd,
+		     char         *buf,
+		     size_t       *len,
+		     NihAllocSite *site)
+{
+	nih_assert (site != NULL);
+
+	if (! site->stats.objects)
+		return;
+
+	nih_alloc_dump_write (fd, buf, len, "nih_alloc: ", (size_t)-1);
+	nih_alloc_dump_write (fd, buf, len, site->stats.file ?: "(unknown)",
+			      (size_t)-1);
+	nih_alloc_dump_write (fd, buf, len, ":", site->stats.line);
+	nih_alloc_dump_write (fd, buf, len, ": ", site->stats.objects);
+	nih_alloc_dump_write (fd, buf, len, " objects, ", site->stats.bytes);
+	nih_alloc_dump_write (fd, buf, len, " bytes; peak ",
+			      site->stats.peak_bytes);
+	nih_alloc_dump_write (fd, buf, len, " bytes; ", site->stats.allocs);
+	nih_alloc_dump_write (fd, buf, len, " allocations\n", (size_t)-1);
+}
+
+/**
+ * nih_alloc_dump_write:
+ * @fd: file descriptor to write to,
+ * @buf: buffer of at least 256 bytes,
+ * @len: number of bytes used in @buf,
+ * @str: string to append,
+ * @num: number to append, or (size_t)-1.
+ *
+ * Appends @str and then, unless it is (size_t)-1, the decimal form of
+ * @num to @buf; writing @buf out to @fd first if there may not be room.
+ **/
+static void
+nih_alloc_dump_write (int         fd,
+		      char       *buf,
+		      size_t     *len,
+		      const char *str,
+		      size_t      num)
+{
+	char   digits[24];
+	size_t ndigits = 0;
+
+	nih_assert (buf != NULL);
+	nih_assert (len != NULL);
+	nih_assert (str != NULL);
+
+	for (; *str; str++) {
+		if (*len >= 256 - sizeof (digits)) {
+			while ((write (fd, buf, *len) < 0) && (errno == EINTR))
+				;
+			*len = 0;
+		}
+
+		buf[(*len)++] = *str;
+	}
+
+	if (num == (size_t)-1)
+		return;
+
+	do {
+		digits[ndigits++] = '0' + num % 10;
+		num /= 10;
+	} while (num);
+
+	while (ndigits)
+		buf[(*len)++] = digits[--ndigits];
+}
+
+/**
+ * nih_alloc_site_lookup:
+ * @file: source file, or NULL,
+ * @line: line number in @file.
+ *
+ * Looks up the site for @file and @line, adding it if not yet known.
+ *
+ * Returns: site, which is the unknown site if @file is NULL or
+ * insufficient memory.
+ **/
+static NihAllocSite *
+nih_alloc_site_lookup (const char *file,
+		       int         line)
+{
+	NihAllocSite **bucket;
+	NihAllocSite * site;
+
+	if (! file)
+		return &nih_alloc_unknown_site;
+
+	bucket = &nih_alloc_sites[(unsigned int)line % NIH_ALLOC_SITE_BUCKETS];
+	for (site = *bucket; site; site = site->next)
+		if ((site->stats.line == line)
+		    && ((site->stats.file == file)
+			|| (! strcmp (site->stats.file, file))))
+			return site;
+
+	/* Not allocated with __nih_malloc, since this isn't an object and
+	 * shouldn't be counted by the test suite.
+	 */
+	site = malloc (sizeof (NihAllocSite));
+	if (! site)
+		return &nih_alloc_unknown_site;
+
+	memset (site, 0, sizeof (NihAllocSite));
+	site->stats.file = file;
+	site->stats.line = line;
+	site->next = *bucket;
+
+	*bucket = site;
+	nih_alloc_global_stats.sites++;
+
+	return site;
+}
+
+/**
+ * nih_alloc_fanout_bucket:
+ * @children: number of children.
+ *
+ * Returns: index of the fanout histogram bucket for @children, the first
+ * is for no children and each after is for up to twice as many as the
+ * last.
+ **/
+static inline int
+nih_alloc_fanout_bucket (size_t children)
+{
+	int bucket = 0;
+
+	while (children && (bucket < NIH_ALLOC_FANOUT_BUCKETS - 1)) {
+		children >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/**
+ * nih_alloc_track_new:
+ * @ctx: tracked context,
+ * @site: site it was allocated from.
+ *
+ * Initialises the tracking information of the newly allocated @ctx and
+ * adds it to the statistics.
  **/
-#define NIH_ALLOC_CTX(ptr) (ptr ? (void *)(ptr) - NIH_ALLOC_SIZE : NULL)
+static inline void
+nih_alloc_track_new (NihAllocCtx * ctx,
+		     NihAllocSite *site)
+{
+	NihAllocStats *stats = &nih_alloc_global_stats;
+	NihAllocTrack *track;
+
+	nih_assert (ctx != NULL);
+	nih_assert (ctx->tracked);
+	nih_assert (site != NULL);
+
+	track = NIH_ALLOC_TRACK (ctx);
+	track->site = site;
+	track->children = 0;
+
+	site->stats.objects++;
+	site->stats.bytes += ctx->size;
+	site->stats.allocs++;
+	if (site->stats.bytes > site->stats.peak_bytes)
+		site->stats.peak_bytes = site->stats.bytes;
+
+	stats->objects++;
+	stats->bytes += ctx->size;
+	stats->allocs++;
+	if (stats->objects > stats->peak_objects)
+		stats->peak_objects = stats->objects;
+	if (stats->bytes > stats->peak_bytes)
+		stats->peak_bytes = stats->bytes;
+
+	stats->fanout[0]++;
+}
 
 /**
- * NIH_ALLOC_PTR:
- * @ctx: pointer to NihAllocCtx structure.
- *
- * Obtain the location of the block of memory given a pointer to the
- * NihAllocCtx structure in front of it.
+ * nih_alloc_track_free:
+ * @ctx: tracked context.
  *
- * Returns: pointer to block of memory.
+ * Removes @ctx, which is being freed, from the statistics.
  **/
-#define NIH_ALLOC_PTR(ctx) ((void *)(ctx) + NIH_ALLOC_SIZE)
+static inline void
+nih_alloc_track_free (NihAllocCtx *ctx)
+{
+	NihAllocStats *stats = &nih_alloc_global_stats;
+	NihAllocTrack *track;
+
+	nih_assert (ctx != NULL);
+	nih_assert (ctx->tracked);
+
+	track = NIH_ALLOC_TRACK (ctx);
+
+	track->site->stats.objects--;
+	track->site->stats.bytes -= ctx->size;
+
+	stats->objects--;
+	stats->bytes -= ctx->size;
+
+	stats->fanout[nih_alloc_fanout_bucket (track->children)]--;
+}
 
 /**
- * NIH_ALLOC_FINALISED:
+ * nih_alloc_track_resize:
+ * @ctx: tracked context,
+ * @size: new size.
  *
- * Flag placed in the destructor field of a context to indicate the
- * destructor has been called and the object is pending being freed.
+ * Updates the statistics for @ctx changing size to @size, this must be
+ * called before its size member is changed.
  **/
-#define NIH_ALLOC_FINALISED ((void *)-1)
+static inline void
+nih_alloc_track_resize (NihAllocCtx *ctx,
+			size_t       size)
+{
+	NihAllocStats *stats = &nih_alloc_global_stats;
+	NihAllocSite * site;
 
+	nih_assert (ctx != NULL);
+	nih_assert (ctx->tracked);
 
-/* Prototypes for static functions */
-static inline int          nih_alloc_context_free   (NihAllocCtx *ctx);
+	site = NIH_ALLOC_TRACK (ctx)->site;
 
-static inline NihAllocRef *nih_alloc_ref_new        (NihAllocCtx *parent,
-						     NihAllocCtx *child)
-	__attribute__ ((malloc));
-static inline void         nih_alloc_ref_free       (NihAllocRef *ref);
-static inline NihAllocRef *nih_alloc_ref_lookup     (NihAllocCtx *parent,
-						     NihAllocCtx *child);
+	site->stats.bytes = site->stats.bytes - ctx->size + size;
+	if (site->stats.bytes > site->stats.peak_bytes)
+		site->stats.peak_bytes = site->stats.bytes;
 
+	stats->bytes = stats->bytes - ctx->size + size;
+	if (stats->bytes > stats->peak_bytes)
+		stats->peak_bytes = stats->bytes;
+}
 
-/* Point to the functions we actually call for allocation. */
-void *(*__nih_malloc)  (size_t size)            = malloc;
-void *(*__nih_realloc) (void *ptr, size_t size) = realloc;
-void  (*__nih_free)    (void *ptr)              = free;
+/**
+ * nih_alloc_track_fanout:
+ * @parent: tracked context,
+ * @delta: change in number of children.
+ *
+ * Moves @parent between buckets of the fanout histogram as it gains or
+ * loses references to children.
+ **/
+static inline void
+nih_alloc_track_fanout (NihAllocCtx *parent,
+			int          delta)
+{
+	NihAllocStats *stats = &nih_alloc_global_stats;
+	NihAllocTrack *track;
+
+	nih_assert (parent != NULL);
+	nih_assert (parent->tracked);
+
+	track = NIH_ALLOC_TRACK (parent);
+
+	stats->fanout[nih_alloc_fanout_bucket (track->children)]--;
+	track->children += delta;
+	stats->fanout[nih_alloc_fanout_bucket (track->children)]++;
+}
 
 
 /**
@@ -153,21 +1213,138 @@ void *
 nih_alloc (const void *parent,
 	   size_t      size)
 {
-	NihAllocCtx *ctx;
+	return nih_alloc_new (parent, size, NULL, 0);
+}
+
+/**
+ * nih_alloc_at:
+ * @parent: parent object for new object,
+ * @size: size of requested object,
+ * @file: source file of the caller,
+ * @line: line number in @file.
+ *
+ * Behaves as nih_alloc(), except that once nih_alloc_stats_init() has been
+ * called the object is attributed to @file and @line in the statistics.
+ *
+ * Normally you would define NIH_ALLOC_STATS before including this header,
+ * which makes nih_alloc() and the macros that use it expand to this
+ * function with the location of the call.
+ *
+ * Returns: newly allocated object or NULL if insufficient memory.
+ **/
+void *
+nih_alloc_at (const void *parent,
+	      size_t      size,
+	      const char *file,
+	      int         line)
+{
+	return nih_alloc_new (parent, size, file, line);
+}
+
+/**
+ * nih_alloc_new:
+ * @parent: parent object for new object,
+ * @size: size of requested object,
+ * @file: source file of the caller, or NULL,
+ * @line: line number in @file.
+ *
+ * This is the internal function used by nih_alloc() and nih_alloc_at() to
+ * allocate an object.
+ *
+ * Returns: newly allocated object or NULL if insufficient memory.
+ **/
+static inline void *
+nih_alloc_new (const void *parent,
+	       size_t      size,
+	       const char *file,
+	       int         line)
+{
+	NihAllocCtx *  ctx;
+	NihAllocArena *arena = NULL;
+	NihAllocSite * site = NULL;
+
+	/* Descendants of an arena's root object are allocated from the
+	 * arena, so long as the root hasn't been freed.
+	 */
+	if (parent)
+		arena = ((NihAllocCtx *)NIH_ALLOC_CTX (parent))->arena;
+	if (arena && (! arena->root))
+		arena = NULL;
 
-	ctx = __nih_malloc (NIH_ALLOC_SIZE + size);
+	if (nih_alloc_use_stats)
+		site = nih_alloc_site_lookup (file, line);
+
+	ctx = nih_alloc_ctx_new (size, arena, site);
 	if (! ctx)
 		return NULL;
 
+	nih_alloc_ref_new (NIH_ALLOC_CTX (parent), ctx);
+
+	return NIH_ALLOC_PTR (ctx);
+}
+
+/**
+ * nih_alloc_ctx_new:
+ * @size: size of requested object,
+ * @arena: arena to allocate from, or NULL,
+ * @site: site to attribute the object to, or NULL.
+ *
+ * This is the internal function used by nih_alloc() and nih_arena_new()
+ * to allocate a new context for an object of @size bytes, from @arena if
+ * not NULL or otherwise from a pool if possible.  The context has no
+ * references.  If @site is not NULL, the context is tracked.
+ *
+ * Returns: newly allocated context or NULL if insufficient memory.
+ **/
+static inline NihAllocCtx *
+nih_alloc_ctx_new (size_t         size,
+		   NihAllocArena *arena,
+		   NihAllocSite * site)
+{
+	NihAllocCtx *ctx;
+	void *       mem;
+	size_t       extra;
+	int          pool = -1;
+
+	extra = site ? NIH_ALLOC_TRACK_SIZE : 0;
+
+	if (arena) {
+		mem = nih_alloc_arena_get (arena, extra + NIH_ALLOC_SIZE + size);
+	} else {
+		if (nih_alloc_use_pools)
+			pool = nih_alloc_pool_class (extra + NIH_ALLOC_SIZE
+						     + size);
+
+		if (pool >= 0) {
+			mem = nih_alloc_pool_get (&nih_alloc_pools[pool],
+						  __nih_malloc);
+		} else {
+			mem = __nih_malloc (extra + NIH_ALLOC_SIZE + size);
+		}
+	}
+	if (! mem)
+		return NULL;
+
+	ctx = mem + extra;
+
 	nih_list_init (&ctx->parents);
 	nih_list_init (&ctx->children);
 
 	ctx->destructor = NULL;
 	ctx->size = size;
+	ctx->pool = arena ? NIH_ALLOC_POOL_ARENA : pool + 1;
+	ctx->tracked = site ? TRUE : FALSE;
+	ctx->arena = arena;
 
-	nih_alloc_ref_new (NIH_ALLOC_CTX (parent), ctx);
+	if (arena)
+		arena->live++;
+	if (site)
+		nih_alloc_track_new (ctx, site);
 
-	return NIH_ALLOC_PTR (ctx);
+	nih_list_init (&ctx->ref.children_entry);
+	nih_list_init (&ctx->ref.parents_entry);
+
+	return ctx;
 }
 
 
@@ -195,8 +1372,15 @@ nih_realloc (void *      ptr,
 	     size_t      size)
 {
 	NihAllocCtx *ctx;
+	NihAllocCtx *new_ctx;
 	NihList *    first_parent = NULL;
 	NihList *    first_child = NULL;
+	NihList *    ref_parents_prev = NULL;
+	NihList *    ref_children_prev = NULL;
+	int          ref_in_use;
+	void *       mem;
+	void *       new_mem;
+	size_t       extra;
 
 	if (! ptr)
 		return nih_alloc (parent, size);
@@ -204,6 +1388,23 @@ nih_realloc (void *      ptr,
 	ctx = NIH_ALLOC_CTX (ptr);
 	nih_assert (ctx->destructor != NIH_ALLOC_FINALISED);
 
+	mem = NIH_ALLOC_MEM (ctx);
+	extra = (void *)ctx - mem;
+
+	/* A context taken from a pool may have room to spare, and one
+	 * allocated from an arena may always shrink in place.
+	 */
+	if (((ctx->pool == NIH_ALLOC_POOL_ARENA) && (size <= ctx->size))
+	    || (ctx->pool && (ctx->pool != NIH_ALLOC_POOL_ARENA)
+		&& (extra + NIH_ALLOC_SIZE + size
+		    <= nih_alloc_pools[ctx->pool - 1].stats.size))) {
+		if (ctx->tracked)
+			nih_alloc_track_resize (ctx, size);
+
+		ctx->size = size;
+		return ptr;
+	}
+
 	/* This is somewhat more difficult than alloc or free because we
 	 * have two lists of pointers to worry about.  Fortunately the
 	 * properties of NihList help us a lot here.
@@ -232,18 +1433,67 @@ nih_realloc (void *      ptr,
 	 * or NULL if the list is empty.
 	 */
 
+	/* The reference stored in the context moves with it, so it's
+	 * taken out of both lists it's in and put back afterwards in the
+	 * same position; remembering whether it followed our own parents
+	 * list head, since that moves too.
+	 */
+	ref_in_use = ! NIH_LIST_EMPTY (&ctx->ref.parents_entry);
+	if (ref_in_use) {
+		if (ctx->ref.parents_entry.prev != &ctx->parents)
+			ref_parents_prev = ctx->ref.parents_entry.prev;
+		if (! NIH_LIST_EMPTY (&ctx->ref.children_entry))
+			ref_children_prev = ctx->ref.children_entry.prev;
+
+		nih_list_remove (&ctx->ref.parents_entry);
+		nih_list_remove (&ctx->ref.children_entry);
+	}
+
 	if (! NIH_LIST_EMPTY (&ctx->parents))
 		first_parent = ctx->parents.next;
 	if (! NIH_LIST_EMPTY (&ctx->children))
 		first_child = ctx->children.next;
 
-	/* Now do the actual realloc(), if this fails then we can just
-	 * return NULL since we've not actually changed anything.
+	/* A context taken from a pool can't be reallocated, so it has
+	 * to be copied into a new allocation, which isn't taken from a
+	 * pool so it may be reallocated again.  One allocated from an
+	 * arena is copied to fresh space in the same arena, the old
+	 * space is only reclaimed with the arena itself.
+	 *
+	 * Otherwise do the actual realloc(); if any fails then we can
+	 * just return NULL since we've not actually changed anything.
 	 */
-	ctx = __nih_realloc (ctx, NIH_ALLOC_SIZE + size);
-	if (! ctx)
+	if (ctx->pool == NIH_ALLOC_POOL_ARENA) {
+		new_mem = nih_alloc_arena_get (ctx->arena, (extra
+							    + NIH_ALLOC_SIZE
+							    + size));
+		if (new_mem)
+			memcpy (new_mem, mem, extra + NIH_ALLOC_SIZE + ctx->size);
+	} else if (ctx->pool) {
+		new_mem = __nih_malloc (extra + NIH_ALLOC_SIZE + size);
+		if (new_mem) {
+			memcpy (new_mem, mem, extra + NIH_ALLOC_SIZE + ctx->size);
+			nih_alloc_pool_put (&nih_alloc_pools[ctx->pool - 1],
+					    mem);
+
+			((NihAllocCtx *)(new_mem + extra))->pool = 0;
+		}
+	} else {
+		new_mem = __nih_realloc (mem, extra + NIH_ALLOC_SIZE + size);
+	}
+
+	new_ctx = new_mem ? new_mem + extra : NULL;
+	if (! new_ctx) {
+		if (ref_in_use)
+			nih_alloc_ref_relink (ctx, ref_parents_prev,
+					      ref_children_prev);
+
 		return NULL;
+	}
 
+	ctx = new_ctx;
+	if (ctx->tracked)
+		nih_alloc_track_resize (ctx, size);
 	ctx->size = size;
 
 	/* Now update our parents and children lists, or reinitialise,
@@ -261,6 +1511,10 @@ nih_realloc (void *      ptr,
 		nih_list_init (&ctx->children);
 	}
 
+	if (ref_in_use)
+		nih_alloc_ref_relink (ctx, ref_parents_prev,
+				      ref_children_prev);
+
 	/* We still have to fix up the parent and child pointers, but
 	 * that's easy.
 	 */
@@ -281,6 +1535,32 @@ nih_realloc (void *      ptr,
 	return NIH_ALLOC_PTR (ctx);
 }
 
+/**
+ * nih_alloc_ref_relink:
+ * @ctx: context,
+ * @parents_prev: entry in @ctx's parents list to follow, or NULL,
+ * @children_prev: entry in the parent's children list to follow, or NULL.
+ *
+ * Places the reference stored in @ctx back into @ctx's parents list after
+ * @parents_prev, or at the start if NULL, and into its parent's children
+ * list after @children_prev if not NULL.
+ **/
+static inline void
+nih_alloc_ref_relink (NihAllocCtx *ctx,
+		      NihList     *parents_prev,
+		      NihList     *children_prev)
+{
+	nih_assert (ctx != NULL);
+
+	nih_list_init (&ctx->ref.parents_entry);
+	nih_list_init (&ctx->ref.children_entry);
+
+	nih_list_add_after (parents_prev ?: &ctx->parents,
+			    &ctx->ref.parents_entry);
+	if (children_prev)
+		nih_list_add_after (children_prev, &ctx->ref.children_entry);
+}
+
 
 /**
  * nih_free:
@@ -332,6 +1612,86 @@ nih_free (void *ptr)
 	return nih_alloc_context_free (ctx);
 }
 
+/**
+ * nih_free_deferred:
+ * @ptr: object to free.
+ *
+ * Behaves as nih_free(), discarding all parent references and calling the
+ * destructors of @ptr and all of its children that have no remaining
+ * parent references, except that the memory of the freed objects is not
+ * returned to the allocator immediately.
+ *
+ * Instead it is returned a limited number of objects at a time by calls
+ * to nih_free_deferred_poll(), which the main loop makes each time round,
+ * so that freeing a large hierarchy does not hold it up.
+ *
+ * The objects may not be used once this function returns.
+ *
+ * Returns: return value from @ptr's destructor, or 0.
+ **/
+int
+nih_free_deferred (void *ptr)
+{
+	NihAllocCtx *ctx;
+	int          ret;
+
+	nih_assert (ptr != NULL);
+
+	ctx = NIH_ALLOC_CTX (ptr);
+	nih_assert (ctx->destructor != NIH_ALLOC_FINALISED);
+
+	NIH_LIST_FOREACH_SAFE (&ctx->parents, iter) {
+		NihAllocRef *ref = NIH_LIST_ITER (iter, NihAllocRef,
+						  parents_entry);
+
+		nih_alloc_ref_free (ref);
+	}
+
+	ret = nih_alloc_context_finalise (ctx);
+
+	/* Move the references to the finalised children onto the end of
+	 * the deferred list, followed by the reference stored in the
+	 * context (which is unused, since it has no parents) to free the
+	 * context itself.
+	 */
+	if (! NIH_LIST_EMPTY (&ctx->children)) {
+		ctx->children.next->prev = nih_alloc_deferred.prev;
+		nih_alloc_deferred.prev->next = ctx->children.next;
+		ctx->children.prev->next = &nih_alloc_deferred;
+		nih_alloc_deferred.prev = ctx->children.prev;
+
+		nih_list_init (&ctx->children);
+	}
+
+	ctx->ref.parent = NULL;
+	ctx->ref.child = ctx;
+	ctx->ref.pooled = FALSE;
+	ctx->ref.in_arena = FALSE;
+	nih_list_add (&nih_alloc_deferred, &ctx->ref.children_entry);
+
+	return ret;
+}
+
+/**
+ * nih_free_deferred_poll:
+ * @limit: maximum number of objects to release, or zero.
+ *
+ * Returns the memory of up to @limit objects freed by nih_free_deferred()
+ * to the allocator, or of all of them if @limit is zero.  This is called
+ * by the main loop each time round, so does not normally need to be
+ * called otherwise.
+ *
+ * Returns: TRUE if there are objects remaining to be released, FALSE
+ * otherwise.
+ **/
+int
+nih_free_deferred_poll (size_t limit)
+{
+	nih_alloc_context_release (&nih_alloc_deferred, limit);
+
+	return NIH_LIST_EMPTY (&nih_alloc_deferred) ? FALSE : TRUE;
+}
+
 /**
  * nih_discard:
  * @ptr: object to discard.
@@ -414,6 +1774,36 @@ _nih_discard_local (void *ptraddr)
  **/
 static inline int
 nih_alloc_context_free (NihAllocCtx *ctx)
+{
+	int ret;
+
+	ret = nih_alloc_context_finalise (ctx);
+	nih_alloc_context_release (&ctx->children, 0);
+
+	/* And now we can free ourselves. */
+	nih_alloc_ctx_release (ctx);
+
+	return ret;
+}
+
+/**
+ * nih_alloc_context_finalise:
+ * @ctx: context to finalise.
+ *
+ * Calls the destructor of @ctx, and then recursively unreferences its
+ * children.  Those that have no remaining parent references will also
+ * have their destructors called and their children unreferenced, etc.
+ *
+ * On return the children list of @ctx contains the references to every
+ * finalised descendant, to be freed by nih_alloc_context_release().
+ *
+ * All parent references must have been discarded prior to calling this
+ * function.
+ *
+ * Returns: return value from @ptr's destructor, or 0.
+ **/
+static inline int
+nih_alloc_context_finalise (NihAllocCtx *ctx)
 {
 	int ret = 0;
 
@@ -425,9 +1815,7 @@ nih_alloc_context_free (NihAllocCtx *ctx)
 	 * to our children.  Save the return value, since this is what
 	 * we return.
 	 */
-	if (ctx->destructor)
-		ret = ctx->destructor (NIH_ALLOC_PTR (ctx));
-	ctx->destructor = NIH_ALLOC_FINALISED;
+	ret = nih_alloc_finalise (ctx);
 
 	/* Recursively finalise all of our children. */
 	NIH_LIST_FOREACH_SAFE (&ctx->children, iter) {
@@ -441,17 +1829,18 @@ nih_alloc_context_free (NihAllocCtx *ctx)
 		 */
 		nih_list_destroy (&ref->parents_entry);
 		if (! NIH_LIST_EMPTY (&ref->child->parents)) {
+			if (ref->parent->tracked)
+				nih_alloc_track_fanout (ref->parent, -1);
+			nih_alloc_ref_cross (ref, -1);
 			nih_list_destroy (&ref->children_entry);
-			free (ref);
+			nih_alloc_ref_release (ref);
 			continue;
 		}
 
 		/* Child is to be destroyed and has no links back to its
 		 * parents.  We call the destructor now.
 		 */
-		if (ref->child->destructor)
-			ref->child->destructor (NIH_ALLOC_PTR (ref->child));
-		ref->child->destructor = NIH_ALLOC_FINALISED;
+		nih_alloc_finalise (ref->child);
 
 		/* Reparent all of its own children to us so that they too
 		 * will be finalised if the last reference is removed.
@@ -473,21 +1862,70 @@ nih_alloc_context_free (NihAllocCtx *ctx)
 	/* We now have a single list of children all of which have no
 	 * references back to us as their parent, and all of had their
 	 * destructors called.
-	 *
-	 * Now we free them.
 	 */
-	NIH_LIST_FOREACH_SAFE (&ctx->children, iter) {
+	return ret;
+}
+
+/**
+ * nih_alloc_context_release:
+ * @children: list of references to finalised contexts,
+ * @limit: maximum number of contexts to free, or zero.
+ *
+ * Frees the contexts referenced from @children, and the references, as
+ * left by nih_alloc_context_finalise(); stopping after @limit contexts
+ * unless that is zero.
+ *
+ * Returns: number of contexts freed.
+ **/
+static inline size_t
+nih_alloc_context_release (NihList *children,
+			   size_t   limit)
+{
+	size_t count = 0;
+
+	nih_assert (children != NULL);
+
+	NIH_LIST_FOREACH_SAFE (children, iter) {
 		NihAllocRef *ref = NIH_LIST_ITER (iter, NihAllocRef,
 						  children_entry);
 
-		__nih_free (ref->child);
+		NihAllocCtx *child = ref->child;
 
+		/* The reference may be stored in the child */
 		nih_list_destroy (&ref->children_entry);
-		free (ref);
+		nih_alloc_ref_release (ref);
+
+		nih_alloc_ctx_release (child);
+
+		if (++count == limit)
+			break;
 	}
 
-	/* And now we can free ourselves. */
-	__nih_free (ctx);
+	return count;
+}
+
+/**
+ * nih_alloc_finalise:
+ * @ctx: context to finalise.
+ *
+ * Calls the destructor of @ctx, if any, and marks it as finalised.
+ *
+ * Returns: return value from the destructor, or 0.
+ **/
+static inline int
+nih_alloc_finalise (NihAllocCtx *ctx)
+{
+	int ret = 0;
+
+	nih_assert (ctx != NULL);
+
+	if (ctx->destructor) {
+		if (ctx->pool == NIH_ALLOC_POOL_ARENA)
+			ctx->arena->destructors--;
+
+		ret = ctx->destructor (NIH_ALLOC_PTR (ctx));
+	}
+	ctx->destructor = NIH_ALLOC_FINALISED;
 
 	return ret;
 }
@@ -533,6 +1971,16 @@ nih_alloc_real_set_destructor (const void *  ptr,
 	ctx = NIH_ALLOC_CTX (ptr);
 	nih_assert (ctx->destructor != NIH_ALLOC_FINALISED);
 
+	/* Arenas need to know whether any of their objects have
+	 * destructors to decide how they may be freed.
+	 */
+	if (ctx->pool == NIH_ALLOC_POOL_ARENA) {
+		if (destructor && (! ctx->destructor))
+			ctx->arena->destructors++;
+		if (ctx->destructor && (! destructor))
+			ctx->arena->destructors--;
+	}
+
 	ctx->destructor = destructor;
 }
 
@@ -586,7 +2034,27 @@ nih_alloc_ref_new (NihAllocCtx *parent,
 	nih_assert (child != NULL);
 	nih_assert (child->destructor != NIH_ALLOC_FINALISED);
 
-	ref = NIH_MUST (malloc (sizeof (NihAllocRef)));
+	if (NIH_LIST_EMPTY (&child->ref.parents_entry)) {
+		ref = &child->ref;
+		ref->pooled = FALSE;
+		ref->in_arena = FALSE;
+	} else if (parent && (child->pool == NIH_ALLOC_POOL_ARENA)
+		   && (parent->arena == child->arena)
+		   && child->arena->root) {
+		ref = NIH_MUST (nih_alloc_arena_get (child->arena,
+						     sizeof (NihAllocRef)));
+		ref->pooled = FALSE;
+		ref->in_arena = TRUE;
+	} else if (nih_alloc_use_pools) {
+		ref = nih_alloc_pool_get (&nih_alloc_ref_pool,
+					  nih_alloc_must_malloc);
+		ref->pooled = TRUE;
+		ref->in_arena = FALSE;
+	} else {
+		ref = NIH_MUST (malloc (sizeof (NihAllocRef)));
+		ref->pooled = FALSE;
+		ref->in_arena = FALSE;
+	}
 
 	nih_list_init (&ref->children_entry);
 	nih_list_init (&ref->parents_entry);
@@ -598,6 +2066,10 @@ nih_alloc_ref_new (NihAllocCtx *parent,
 		nih_list_add_after (&parent->children, &ref->children_entry);
 	nih_list_add_after (&child->parents, &ref->parents_entry);
 
+	nih_alloc_ref_cross (ref, 1);
+	if (parent && parent->tracked)
+		nih_alloc_track_fanout (parent, 1);
+
 	return ref;
 }
 
@@ -653,10 +2125,78 @@ nih_alloc_ref_free (NihAllocRef *ref)
 {
 	nih_assert (ref != NULL);
 
+	nih_alloc_ref_cross (ref, -1);
+	if (ref->parent && ref->parent->tracked)
+		nih_alloc_track_fanout (ref->parent, -1);
+
 	nih_list_destroy (&ref->children_entry);
 	nih_list_destroy (&ref->parents_entry);
 
-	free (ref);
+	nih_alloc_ref_release (ref);
+}
+
+/**
+ * nih_alloc_ref_release:
+ * @ref: reference to release.
+ *
+ * Returns the memory of @ref to the pool of references if it was taken
+ * from there, otherwise to the allocator; unless it is the reference
+ * stored in the child context, which is simply marked as no longer in
+ * use, or was allocated from an arena, which is reclaimed with the arena.
+ **/
+static inline void
+nih_alloc_ref_release (NihAllocRef *ref)
+{
+	nih_assert (ref != NULL);
+
+	if (ref == &ref->child->ref) {
+		nih_list_init (&ref->children_entry);
+		nih_list_init (&ref->parents_entry);
+		return;
+	}
+
+	if (ref->in_arena) {
+		return;
+	} else if (ref->pooled) {
+		nih_alloc_pool_put (&nih_alloc_ref_pool, ref);
+	} else {
+		free (ref);
+	}
+}
+
+/**
+ * nih_alloc_ref_cross:
+ * @ref: reference,
+ * @delta: amount to adjust by.
+ *
+ * Adjusts the count of external references of the arenas of the parent
+ * and child of @ref by @delta, if @ref is between objects inside and
+ * outside an arena.  This must be called while both are still allocated.
+ **/
+static inline void
+nih_alloc_ref_cross (NihAllocRef *ref,
+		     int          delta)
+{
+	NihAllocArena *parent_arena;
+	NihAllocArena *child_arena;
+
+	nih_assert (ref != NULL);
+
+	parent_arena = ref->parent ? ref->parent->arena : NULL;
+	child_arena = (ref->child->pool == NIH_ALLOC_POOL_ARENA
+		       ? ref->child->arena : NULL);
+
+	if (parent_arena == child_arena)
+		return;
+
+	if (parent_arena) {
+		nih_assert ((delta > 0) || (parent_arena->external > 0));
+		parent_arena->external += delta;
+	}
+	if (child_arena) {
+		nih_assert ((delta > 0) || (child_arena->external > 0));
+		child_arena->external += delta;
+	}
 }
 
 
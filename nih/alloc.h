@@ -68,6 +68,26 @@
  *
  * Such constructs are often better handled using nih_local variables.
  *
+ * Freeing a large hierarchy from within the main loop may instead be done
+ * with nih_free_deferred(), which calls the destructors immediately but
+ * leaves the main loop to release the memory a little at a time.
+ *
+ * Programs that allocate and free large numbers of small objects may call
+ * nih_alloc_pool_init() so that objects, and the references between them,
+ * are taken from pools of the same size class rather than allocated
+ * separately; nih_alloc_pool_stats() reports how the pools are used.
+ *
+ * Calling nih_alloc_stats_init() tracks the number and size of objects
+ * allocated from then on, and by defining NIH_ALLOC_STATS before
+ * including this header, the source location that allocated them; see
+ * nih_alloc_stats(), nih_alloc_site_stats() and nih_alloc_stats_dump().
+ *
+ * Trees of objects that are built up and then freed together, such as a
+ * parsed file, may be allocated beneath an arena created with
+ * nih_arena_new().  Its descendants are bump-allocated from large chunks,
+ * and when it is freed they are released in one go unless they need
+ * finalising or have been referenced from outside the arena.
+ *
  *
  * = Common patterns =
  *
@@ -229,6 +249,88 @@
  **/
 typedef int (*NihDestructor) (void *ptr);
 
+/**
+ * NihAllocPoolStats:
+ * @size: size of each chunk in the pool,
+ * @slabs: number of blocks allocated for the pool,
+ * @in_use: number of chunks in use,
+ * @free: number of chunks free for re-use,
+ * @allocs: number of times a chunk has been taken from the pool.
+ *
+ * Statistics for a pool of objects or references, see
+ * nih_alloc_pool_init() and nih_alloc_pool_stats().  @size includes
+ * the space used by nih_alloc() in front of each object.
+ **/
+typedef struct nih_alloc_pool_stats {
+	size_t size;
+	size_t slabs;
+	size_t in_use;
+	size_t free;
+	size_t allocs;
+} NihAllocPoolStats;
+
+/**
+ * NihArena:
+ *
+ * Opaque type of the root object of an arena, see nih_arena_new().
+ **/
+typedef struct nih_arena NihArena;
+
+/**
+ * NIH_ALLOC_FANOUT_BUCKETS:
+ *
+ * Number of buckets in the fanout histogram of NihAllocStats.
+ **/
+#define NIH_ALLOC_FANOUT_BUCKETS 16
+
+/**
+ * NihAllocStats:
+ * @objects: number of live objects,
+ * @bytes: total size of live objects,
+ * @peak_objects: largest number of live objects,
+ * @peak_bytes: largest total size of live objects,
+ * @allocs: number of objects allocated,
+ * @sites: number of allocation sites,
+ * @fanout: histogram of live objects by number of children.
+ *
+ * Statistics for objects tracked since nih_alloc_stats_init() was called,
+ * see nih_alloc_stats().  Sizes do not include the space used by
+ * nih_alloc() in front of each object.
+ *
+ * The first element of @fanout counts objects with no children, each
+ * subsequent element counts objects with at least 1, 2, 4, 8, etc.
+ **/
+typedef struct nih_alloc_stats {
+	size_t objects;
+	size_t bytes;
+	size_t peak_objects;
+	size_t peak_bytes;
+	size_t allocs;
+	size_t sites;
+	size_t fanout[NIH_ALLOC_FANOUT_BUCKETS];
+} NihAllocStats;
+
+/**
+ * NihAllocSiteStats:
+ * @file: source file of the site, or NULL if unknown,
+ * @line: line number in @file,
+ * @objects: number of live objects allocated there,
+ * @bytes: total size of those objects,
+ * @peak_bytes: largest total size of those objects,
+ * @allocs: number of objects allocated there.
+ *
+ * Statistics for tracked objects allocated at a particular site, see
+ * nih_alloc_site_stats().
+ **/
+typedef struct nih_alloc_site_stats {
+	const char *file;
+	int         line;
+	size_t      objects;
+	size_t      bytes;
+	size_t      peak_bytes;
+	size_t      allocs;
+} NihAllocSiteStats;
+
 
 /**
  * nih_new:
@@ -314,6 +416,8 @@ void * nih_realloc                   (void *ptr, const void *parent,
 	__attribute__ ((warn_unused_result, malloc));
 
 int    nih_free                      (void *ptr);
+int    nih_free_deferred             (void *ptr);
+int    nih_free_deferred_poll        (size_t limit);
 int    nih_discard                   (void *ptr);
 void   _nih_discard_local            (void *ptraddr);
 
@@ -327,6 +431,35 @@ int    nih_alloc_parent              (const void *ptr, const void *parent);
 
 size_t nih_alloc_size                (const void *ptr);
 
+void   nih_alloc_pool_init           (void);
+size_t nih_alloc_pool_stats          (NihAllocPoolStats *stats, size_t len);
+
+NihArena *nih_arena_new              (const void *parent)
+	__attribute__ ((warn_unused_result, malloc));
+
+void * nih_alloc_at                  (const void *parent, size_t size,
+				      const char *file, int line)
+	__attribute__ ((warn_unused_result, malloc));
+
+void   nih_alloc_stats_init          (void);
+void   nih_alloc_stats               (NihAllocStats *stats);
+size_t nih_alloc_site_stats          (NihAllocSiteStats *stats, size_t len);
+void   nih_alloc_stats_dump          (int fd);
+
 NIH_END_EXTERN
 
+/**
+ * nih_alloc:
+ * @parent: parent object for new object,
+ * @size: size of requested object.
+ *
+ * When NIH_ALLOC_STATS is defined, nih_alloc() and the macros that use it
+ * pass the location of the call to nih_alloc_at() so that the allocation
+ * is attributed to it.
+ **/
+#ifdef NIH_ALLOC_STATS
+# define nih_alloc(parent, size) \
+	nih_alloc_at ((parent), (size), __FILE__, __LINE__)
+#endif /* NIH_ALLOC_STATS */
+
 #endif /* NIH_ALLOC_H */
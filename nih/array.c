@@ -0,0 +1,207 @@
+/* libnih
+ *
+ * array.c - growable array of pointers
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <nih/macros.h>
+#include <nih/logging.h>
+#include <nih/alloc.h>
+
+#include "array.h"
+
+
+/**
+ * NIH_ARRAY_MIN_SIZE:
+ *
+ * Number of elements there is room for when the first is added.
+ **/
+#define NIH_ARRAY_MIN_SIZE 4
+
+
+/**
+ * nih_array_init:
+ * @array: array to initialise,
+ * @parent: parent of elements array,
+ * @elems: existing NULL-terminated array,
+ * @len: number of elements in @elems.
+ *
+ * Initialise @array, which is usually allocated on the stack, to append
+ * to @elems; this may be NULL, in which case the elements array will be
+ * allocated when needed.  @elems must have been allocated with
+ * nih_alloc(), and @len must be its number of elements excluding the
+ * final NULL.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the elements array when it is allocated.
+ * It is ignored when @elems is given.
+ **/
+void
+nih_array_init (NihArray    *array,
+		const void  *parent,
+		void       **elems,
+		size_t       len)
+{
+	nih_assert (array != NULL);
+	nih_assert ((elems != NULL) || (len == 0));
+
+	array->elems = elems;
+	array->len = len;
+	array->size = elems ? nih_alloc_size (elems) / sizeof (void *) - 1 : 0;
+	array->parent = parent;
+
+	nih_assert (array->size >= len);
+}
+
+
+/**
+ * nih_array_reserve:
+ * @array: array to grow,
+ * @len: number of elements needed.
+ *
+ * Ensures that @array has room for at least @len elements, so that they
+ * can be added without failing.  Unlike the growth when adding elements,
+ * exactly the room asked for is allocated.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+int
+nih_array_reserve (NihArray *array,
+		   size_t    len)
+{
+	void **elems;
+
+	nih_assert (array != NULL);
+
+	if (array->elems && (len <= array->size))
+		return 0;
+
+	elems = nih_realloc (array->elems, array->parent,
+			     sizeof (void *) * (len + 1));
+	if (! elems)
+		return -1;
+
+	array->elems = elems;
+	array->size = len;
+
+	array->elems[array->len] = NULL;
+
+	return 0;
+}
+
+/**
+ * nih_array_addp:
+ * @array: array to add to,
+ * @ptr: pointer to add.
+ *
+ * Appends the nih_alloc() allocated object @ptr to @array, doubling the
+ * room in the elements array if it is full.
+ *
+ * @ptr will be referenced by the elements array.  After calling this
+ * function, you should never use nih_free() to free @ptr and instead use
+ * nih_unref() or nih_discard() if you no longer need to use it.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+int
+nih_array_addp (NihArray *array,
+		void     *ptr)
+{
+	nih_assert (array != NULL);
+	nih_assert (ptr != NULL);
+
+	if ((! array->elems) || (array->len == array->size)) {
+		size_t size;
+
+		size = nih_max (array->size * 2, (size_t)NIH_ARRAY_MIN_SIZE);
+		if (nih_array_reserve (array, size) < 0)
+			return -1;
+	}
+
+	nih_ref (ptr, array->elems);
+
+	array->elems[array->len++] = ptr;
+	array->elems[array->len] = NULL;
+
+	return 0;
+}
+
+/**
+ * nih_array_truncate:
+ * @array: array to truncate,
+ * @len: new number of elements.
+ *
+ * Removes the elements of @array after the first @len, dropping the
+ * elements array's reference to each; those without any other parent are
+ * freed.  The room allocated is not changed.
+ **/
+void
+nih_array_truncate (NihArray *array,
+		    size_t    len)
+{
+	nih_assert (array != NULL);
+	nih_assert (len <= array->len);
+
+	while (array->len > len)
+		nih_unref (array->elems[--array->len], array->elems);
+
+	if (array->elems)
+		array->elems[array->len] = NULL;
+}
+
+
+/**
+ * nih_array_trim:
+ * @array: array to trim.
+ *
+ * Reallocates the elements array of @array so that there is no spare
+ * room, allocating it with no elements if none were added; the array
+ * may be added to afterwards.
+ *
+ * Returns: NULL-terminated elements array or NULL on insufficient memory,
+ * in which case @array is unchanged.
+ **/
+void **
+nih_array_trim (NihArray *array)
+{
+	nih_assert (array != NULL);
+
+	if (array->elems && (array->size == array->len))
+		return array->elems;
+
+	if (array->elems) {
+		void **elems;
+
+		elems = nih_realloc (array->elems, array->parent,
+				     sizeof (void *) * (array->len + 1));
+		if (! elems)
+			return NULL;
+
+		array->elems = elems;
+		array->size = array->len;
+	} else if (nih_array_reserve (array, 0) < 0) {
+		return NULL;
+	}
+
+	return array->elems;
+}
@@ -0,0 +1,78 @@
+/* libnih
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NIH_ARRAY_H
+#define NIH_ARRAY_H
+
+/**
+ * Provides a growable NULL-terminated array of pointers, such as the
+ * string arrays returned by nih_str_split().  The array keeps count of
+ * both the number of elements and the room allocated for them, doubling
+ * the room as needed, so building an array of n elements copies O(n)
+ * pointers rather than reallocating for every element as
+ * nih_str_array_addp() must.
+ *
+ * An NihArray is normally declared on the stack and initialised with
+ * nih_array_init(), given the parent for the elements; these are held in
+ * an ordinary NULL-terminated array allocated with nih_alloc(), which
+ * references each element added with nih_array_addp().
+ *
+ * Once built, nih_array_trim() gives up any spare room and returns the
+ * elements array, which may be used and freed as any other; there is no
+ * need to free the NihArray itself.
+ **/
+
+#include <nih/macros.h>
+
+
+/**
+ * NihArray:
+ * @elems: NULL-terminated array of elements, or NULL if not yet allocated,
+ * @len: number of elements,
+ * @size: number of elements there is room for, excluding the NULL,
+ * @parent: parent of @elems.
+ *
+ * This structure represents a growable array; @elems may be read and the
+ * elements changed, but the other members should not be changed directly.
+ **/
+typedef struct nih_array {
+	void       **elems;
+	size_t       len;
+	size_t       size;
+	const void  *parent;
+} NihArray;
+
+
+NIH_BEGIN_EXTERN
+
+void   nih_array_init     (NihArray *array, const void *parent,
+			   void **elems, size_t len);
+
+int    nih_array_reserve  (NihArray *array, size_t len)
+	__attribute__ ((warn_unused_result));
+int    nih_array_addp     (NihArray *array, void *ptr)
+	__attribute__ ((warn_unused_result));
+void   nih_array_truncate (NihArray *array, size_t len);
+
+void **nih_array_trim     (NihArray *array)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* NIH_ARRAY_H */
@@ -0,0 +1,922 @@
+/* libnih
+ *
+ * btree.c - ordered B-tree implementation
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/logging.h>
+#include <nih/alloc.h>
+
+#include "btree.h"
+
+
+/* Prototypes for static functions */
+static size_t        nih_btree_search      (NihBTree *btree,
+					    NihBTreeNode *node,
+					    const void *key, int upper);
+static NihBTreeNode *nih_btree_descend     (NihBTree *btree, const void *key,
+					    int upper, size_t *pos);
+static size_t        nih_btree_child_index (NihBTreeNode *parent,
+					    NihBTreeNode *child);
+static void          nih_btree_split       (NihBTree *btree,
+					    NihBTreeNode *node,
+					    NihBTreeNode **spare);
+static void          nih_btree_shift_right (NihBTree *btree,
+					    NihBTreeNode *parent, size_t i,
+					    NihBTreeCursor *cursor);
+static void          nih_btree_shift_left  (NihBTree *btree,
+					    NihBTreeNode *parent, size_t i,
+					    NihBTreeCursor *cursor);
+static void          nih_btree_merge       (NihBTree *btree,
+					    NihBTreeNode *parent, size_t i,
+					    NihBTreeCursor *cursor);
+static void          nih_btree_rebalance   (NihBTree *btree,
+					    NihBTreeNode *node,
+					    NihBTreeCursor *cursor);
+
+
+/**
+ * nih_btree_new:
+ * @parent: parent of new B-tree,
+ * @cmp_function: function used to compare keys.
+ *
+ * Allocates a new, empty, B-tree whose entries are ordered by their keys
+ * as compared by @cmp_function, which must return an integer less than,
+ * equal to or greater than zero as strcmp() does.
+ *
+ * The nodes of the B-tree are allocated as children of it, and freed
+ * along with it.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned B-tree.  When all parents
+ * of the returned B-tree are freed, the returned B-tree will also be
+ * freed.
+ *
+ * Returns: the new B-tree or NULL if the allocation failed.
+ **/
+NihBTree *
+nih_btree_new (const void     *parent,
+	       NihCmpFunction  cmp_function)
+{
+	NihBTree *btree;
+
+	nih_assert (cmp_function != NULL);
+
+	btree = nih_new (parent, NihBTree);
+	if (! btree)
+		return NULL;
+
+	btree->root = NULL;
+	btree->first = NULL;
+	btree->last = NULL;
+	btree->entries = 0;
+
+	btree->cmp_function = cmp_function;
+
+	return btree;
+}
+
+
+/**
+ * nih_btree_search:
+ * @btree: B-tree containing @node,
+ * @node: node to search,
+ * @key: key to look for,
+ * @upper: whether to find the position after equal keys.
+ *
+ * Performs a binary search of the keys of @node for @key.
+ *
+ * Returns: index of the first key of @node not less than @key, or
+ * greater than @key if @upper is TRUE; or the number of keys in @node if
+ * there is none.
+ **/
+static size_t
+nih_btree_search (NihBTree     *btree,
+		  NihBTreeNode *node,
+		  const void   *key,
+		  int           upper)
+{
+	size_t lo = 0, hi = node->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int    cmp;
+
+		cmp = btree->cmp_function (key, node->keys[mid]);
+		if ((cmp > 0) || (upper && (cmp == 0))) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * nih_btree_descend:
+ * @btree: non-empty B-tree to search,
+ * @key: key to look for,
+ * @upper: whether to find the position after equal keys,
+ * @pos: pointer to store index within leaf.
+ *
+ * Descends from the root of @btree to the leaf that would hold @key,
+ * following the children before any separators equal to it unless @upper
+ * is TRUE, and searches it as nih_btree_search() does.
+ *
+ * Returns: leaf found, with the index within it stored in @pos.
+ **/
+static NihBTreeNode *
+nih_btree_descend (NihBTree   *btree,
+		   const void *key,
+		   int         upper,
+		   size_t     *pos)
+{
+	NihBTreeNode *node;
+
+	nih_assert (btree->root != NULL);
+
+	node = btree->root;
+	while (! node->leaf)
+		node = node->children[nih_btree_search (btree, node,
+							key, upper)];
+
+	*pos = nih_btree_search (btree, node, key, upper);
+
+	return node;
+}
+
+/**
+ * nih_btree_child_index:
+ * @parent: internal node,
+ * @child: child of @parent.
+ *
+ * Returns: index of @child within the children of @parent.
+ **/
+static size_t
+nih_btree_child_index (NihBTreeNode *parent,
+		       NihBTreeNode *child)
+{
+	size_t i;
+
+	for (i = 0; parent->children[i] != child; i++)
+		nih_assert (i < parent->count);
+
+	return i;
+}
+
+
+/**
+ * nih_btree_split:
+ * @btree: B-tree containing @node,
+ * @node: full node to split,
+ * @spare: list of spare nodes.
+ *
+ * Moves the upper half of the keys of @node into a new node taken from
+ * @spare, and adds that to the parent of @node after it.  The parent is
+ * split first if it is also full, and when @node is the root a new root
+ * is also taken from @spare.
+ *
+ * The spare nodes are linked through their parent pointers, and must
+ * number enough for every split needed.
+ **/
+static void
+nih_btree_split (NihBTree      *btree,
+		 NihBTreeNode  *node,
+		 NihBTreeNode **spare)
+{
+	NihBTreeNode *right, *parent;
+	const void   *key;
+	size_t        half, i;
+
+	nih_assert (node->count == NIH_BTREE_KEYS);
+
+	right = *spare;
+	nih_assert (right != NULL);
+	*spare = right->parent;
+
+	half = NIH_BTREE_KEYS / 2;
+
+	right->leaf = node->leaf;
+	right->prev = right->next = NULL;
+
+	if (node->leaf) {
+		/* Leaves keep every key, so the separator is a copy of the
+		 * first key moved.
+		 */
+		right->count = node->count - half;
+		memcpy (right->keys, &node->keys[half],
+			sizeof (const void *) * right->count);
+		memcpy (right->values, &node->values[half],
+			sizeof (void *) * right->count);
+
+		key = right->keys[0];
+
+		right->prev = node;
+		right->next = node->next;
+		if (node->next) {
+			node->next->prev = right;
+		} else {
+			btree->last = right;
+		}
+		node->next = right;
+	} else {
+		/* The middle key moves up to become the separator */
+		key = node->keys[half];
+
+		right->count = node->count - half - 1;
+		memcpy (right->keys, &node->keys[half + 1],
+			sizeof (const void *) * right->count);
+		memcpy (right->children, &node->children[half + 1],
+			sizeof (NihBTreeNode *) * (right->count + 1));
+
+		for (i = 0; i <= right->count; i++)
+			right->children[i]->parent = right;
+	}
+
+	node->count = half;
+
+	parent = node->parent;
+	if (! parent) {
+		parent = *spare;
+		nih_assert (parent != NULL);
+		*spare = parent->parent;
+
+		parent->parent = NULL;
+		parent->leaf = FALSE;
+		parent->count = 0;
+		parent->children[0] = node;
+		parent->prev = parent->next = NULL;
+
+		node->parent = parent;
+		btree->root = parent;
+	} else if (parent->count == NIH_BTREE_KEYS) {
+		nih_btree_split (btree, parent, spare);
+		parent = node->parent;
+	}
+
+	i = nih_btree_child_index (parent, node);
+
+	memmove (&parent->keys[i + 1], &parent->keys[i],
+		 sizeof (const void *) * (parent->count - i));
+	memmove (&parent->children[i + 2], &parent->children[i + 1],
+		 sizeof (NihBTreeNode *) * (parent->count - i));
+
+	parent->keys[i] = key;
+	parent->children[i + 1] = right;
+	parent->count++;
+
+	right->parent = parent;
+}
+
+/**
+ * nih_btree_add:
+ * @btree: B-tree to add to,
+ * @key: key of entry,
+ * @value: value of entry.
+ *
+ * Adds an entry to @btree with the given @key and @value, in order of
+ * its key; where there are already entries with the same key, it is
+ * placed after them.  Neither @key nor @value are copied, and @key must
+ * not change in a way that changes its order while the entry is in
+ * @btree.
+ *
+ * Any nodes needed are allocated before @btree is changed, so when
+ * allocation fails it is left as it was.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+int
+nih_btree_add (NihBTree   *btree,
+	       const void *key,
+	       void       *value)
+{
+	NihBTreeNode *node, *tmp, *spare = NULL;
+	size_t        pos, needed;
+
+	nih_assert (btree != NULL);
+
+	if (! btree->root) {
+		node = nih_new (btree, NihBTreeNode);
+		if (! node)
+			return -1;
+
+		node->parent = NULL;
+		node->leaf = TRUE;
+		node->count = 0;
+		node->prev = node->next = NULL;
+
+		btree->root = btree->first = btree->last = node;
+		pos = 0;
+	} else {
+		node = nih_btree_descend (btree, key, TRUE, &pos);
+	}
+
+	/* Count the full nodes from the leaf upwards, each of which will
+	 * be split, and a new root if they reach it.
+	 */
+	needed = 0;
+	for (tmp = node; tmp->count == NIH_BTREE_KEYS; tmp = tmp->parent) {
+		needed++;
+
+		if (! tmp->parent) {
+			needed++;
+			break;
+		}
+	}
+
+	while (needed--) {
+		tmp = nih_new (btree, NihBTreeNode);
+		if (! tmp) {
+			while (spare) {
+				tmp = spare;
+				spare = spare->parent;
+				nih_free (tmp);
+			}
+
+			return -1;
+		}
+
+		tmp->parent = spare;
+		spare = tmp;
+	}
+
+	if (node->count == NIH_BTREE_KEYS) {
+		nih_btree_split (btree, node, &spare);
+
+		if (pos > node->count) {
+			pos -= node->count;
+			node = node->next;
+		}
+	}
+
+	nih_assert (spare == NULL);
+
+	memmove (&node->keys[pos + 1], &node->keys[pos],
+		 sizeof (const void *) * (node->count - pos));
+	memmove (&node->values[pos + 1], &node->values[pos],
+		 sizeof (void *) * (node->count - pos));
+
+	node->keys[pos] = key;
+	node->values[pos] = value;
+	node->count++;
+
+	btree->entries++;
+
+	return 0;
+}
+
+
+/**
+ * nih_btree_lookup:
+ * @btree: B-tree to search,
+ * @key: key to look for.
+ *
+ * Finds the first entry in @btree whose key is equal to @key.
+ *
+ * Returns: value of the entry found, or NULL if there is no entry with
+ * that key.
+ **/
+void *
+nih_btree_lookup (NihBTree   *btree,
+		  const void *key)
+{
+	NihBTreeCursor cursor;
+
+	nih_assert (btree != NULL);
+
+	if (nih_btree_lower_bound (btree, key, &cursor)
+	    && (btree->cmp_function (key, nih_btree_cursor_key (&cursor)) == 0))
+		return nih_btree_cursor_value (&cursor);
+
+	return NULL;
+}
+
+/**
+ * nih_btree_remove:
+ * @btree: B-tree to remove from,
+ * @key: key of entry.
+ *
+ * Removes the first entry in @btree whose key is equal to @key; neither
+ * the key nor value are freed.
+ *
+ * Returns: TRUE if an entry was removed, FALSE if there was no entry
+ * with that key.
+ **/
+int
+nih_btree_remove (NihBTree   *btree,
+		  const void *key)
+{
+	NihBTreeCursor cursor;
+
+	nih_assert (btree != NULL);
+
+	if (nih_btree_lower_bound (btree, key, &cursor)
+	    && (btree->cmp_function (key,
+				     nih_btree_cursor_key (&cursor)) == 0)) {
+		nih_btree_cursor_remove (&cursor);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/**
+ * nih_btree_first:
+ * @btree: B-tree to search,
+ * @cursor: cursor to position.
+ *
+ * Positions @cursor at the first entry of @btree, or at the end if
+ * @btree is empty.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_first (NihBTree       *btree,
+		 NihBTreeCursor *cursor)
+{
+	nih_assert (btree != NULL);
+	nih_assert (cursor != NULL);
+
+	cursor->btree = btree;
+	cursor->node = btree->first;
+	cursor->pos = 0;
+
+	return cursor->node != NULL;
+}
+
+/**
+ * nih_btree_last:
+ * @btree: B-tree to search,
+ * @cursor: cursor to position.
+ *
+ * Positions @cursor at the last entry of @btree, or at the end if
+ * @btree is empty.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_last (NihBTree       *btree,
+		NihBTreeCursor *cursor)
+{
+	nih_assert (btree != NULL);
+	nih_assert (cursor != NULL);
+
+	cursor->btree = btree;
+	cursor->node = btree->last;
+	cursor->pos = cursor->node ? cursor->node->count - 1 : 0;
+
+	return cursor->node != NULL;
+}
+
+/**
+ * nih_btree_lower_bound:
+ * @btree: B-tree to search,
+ * @key: key to look for,
+ * @cursor: cursor to position.
+ *
+ * Positions @cursor at the first entry of @btree whose key is not less
+ * than @key, or at the end if every key is less.  A range of keys may be
+ * iterated by then calling nih_btree_cursor_next() until the key at the
+ * cursor is past the range.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_lower_bound (NihBTree       *btree,
+		       const void     *key,
+		       NihBTreeCursor *cursor)
+{
+	nih_assert (btree != NULL);
+	nih_assert (cursor != NULL);
+
+	cursor->btree = btree;
+
+	if (! btree->root) {
+		cursor->node = NULL;
+		cursor->pos = 0;
+
+		return FALSE;
+	}
+
+	cursor->node = nih_btree_descend (btree, key, FALSE, &cursor->pos);
+	if (cursor->pos == cursor->node->count) {
+		cursor->node = cursor->node->next;
+		cursor->pos = 0;
+	}
+
+	return cursor->node != NULL;
+}
+
+/**
+ * nih_btree_upper_bound:
+ * @btree: B-tree to search,
+ * @key: key to look for,
+ * @cursor: cursor to position.
+ *
+ * Positions @cursor at the first entry of @btree whose key is greater
+ * than @key, or at the end if there is none.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_upper_bound (NihBTree       *btree,
+		       const void     *key,
+		       NihBTreeCursor *cursor)
+{
+	nih_assert (btree != NULL);
+	nih_assert (cursor != NULL);
+
+	cursor->btree = btree;
+
+	if (! btree->root) {
+		cursor->node = NULL;
+		cursor->pos = 0;
+
+		return FALSE;
+	}
+
+	cursor->node = nih_btree_descend (btree, key, TRUE, &cursor->pos);
+	if (cursor->pos == cursor->node->count) {
+		cursor->node = cursor->node->next;
+		cursor->pos = 0;
+	}
+
+	return cursor->node != NULL;
+}
+
+
+/**
+ * nih_btree_cursor_next:
+ * @cursor: cursor at an entry.
+ *
+ * Moves @cursor to the following entry, or to the end if it was at the
+ * last.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_cursor_next (NihBTreeCursor *cursor)
+{
+	nih_assert (cursor != NULL);
+	nih_assert (cursor->node != NULL);
+
+	if (++cursor->pos == cursor->node->count) {
+		cursor->node = cursor->node->next;
+		cursor->pos = 0;
+	}
+
+	return cursor->node != NULL;
+}
+
+/**
+ * nih_btree_cursor_prev:
+ * @cursor: cursor to move.
+ *
+ * Moves @cursor to the previous entry, or to the last entry if it was at
+ * the end.  If it was at the first entry, it's moved to the end.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_cursor_prev (NihBTreeCursor *cursor)
+{
+	nih_assert (cursor != NULL);
+
+	if (! cursor->node)
+		return nih_btree_last (cursor->btree, cursor);
+
+	if (cursor->pos > 0) {
+		cursor->pos--;
+	} else {
+		cursor->node = cursor->node->prev;
+		cursor->pos = cursor->node ? cursor->node->count - 1 : 0;
+	}
+
+	return cursor->node != NULL;
+}
+
+
+/**
+ * nih_btree_shift_right:
+ * @btree: B-tree containing @parent,
+ * @parent: internal node,
+ * @i: index of separator,
+ * @cursor: cursor to keep at the same entry.
+ *
+ * Moves the last key of the child of @parent before separator @i into
+ * the child after it, through the separator for internal nodes.
+ **/
+static void
+nih_btree_shift_right (NihBTree       *btree,
+		       NihBTreeNode   *parent,
+		       size_t          i,
+		       NihBTreeCursor *cursor)
+{
+	NihBTreeNode *left, *right;
+
+	left = parent->children[i];
+	right = parent->children[i + 1];
+
+	memmove (&right->keys[1], &right->keys[0],
+		 sizeof (const void *) * right->count);
+
+	if (right->leaf) {
+		memmove (&right->values[1], &right->values[0],
+			 sizeof (void *) * right->count);
+
+		right->keys[0] = left->keys[left->count - 1];
+		right->values[0] = left->values[left->count - 1];
+
+		parent->keys[i] = right->keys[0];
+	} else {
+		memmove (&right->children[1], &right->children[0],
+			 sizeof (NihBTreeNode *) * (right->count + 1));
+
+		right->keys[0] = parent->keys[i];
+		right->children[0] = left->children[left->count];
+		right->children[0]->parent = right;
+
+		parent->keys[i] = left->keys[left->count - 1];
+	}
+
+	left->count--;
+	right->count++;
+
+	if (cursor->node == right) {
+		cursor->pos++;
+	} else if ((cursor->node == left) && (cursor->pos >= left->count)) {
+		cursor->node = right;
+		cursor->pos -= left->count;
+	}
+}
+
+/**
+ * nih_btree_shift_left:
+ * @btree: B-tree containing @parent,
+ * @parent: internal node,
+ * @i: index of separator,
+ * @cursor: cursor to keep at the same entry.
+ *
+ * Moves the first key of the child of @parent after separator @i into
+ * the child before it, through the separator for internal nodes.
+ **/
+static void
+nih_btree_shift_left (NihBTree       *btree,
+		      NihBTreeNode   *parent,
+		      size_t          i,
+		      NihBTreeCursor *cursor)
+{
+	NihBTreeNode *left, *right;
+
+	left = parent->children[i];
+	right = parent->children[i + 1];
+
+	if (right->leaf) {
+		left->keys[left->count] = right->keys[0];
+		left->values[left->count] = right->values[0];
+
+		memmove (&right->values[0], &right->values[1],
+			 sizeof (void *) * (right->count - 1));
+	} else {
+		left->keys[left->count] = parent->keys[i];
+		left->children[left->count + 1] = right->children[0];
+		left->children[left->count + 1]->parent = left;
+
+		parent->keys[i] = right->keys[0];
+
+		memmove (&right->children[0], &right->children[1],
+			 sizeof (NihBTreeNode *) * right->count);
+	}
+
+	memmove (&right->keys[0], &right->keys[1],
+		 sizeof (const void *) * (right->count - 1));
+
+	left->count++;
+	right->count--;
+
+	if (right->leaf)
+		parent->keys[i] = right->keys[0];
+
+	if (cursor->node == right) {
+		if (cursor->pos > 0) {
+			cursor->pos--;
+		} else {
+			cursor->node = left;
+			cursor->pos = left->count - 1;
+		}
+	}
+}
+
+/**
+ * nih_btree_merge:
+ * @btree: B-tree containing @parent,
+ * @parent: internal node,
+ * @i: index of separator,
+ * @cursor: cursor to keep at the same entry.
+ *
+ * Moves all of the keys of the child of @parent after separator @i into
+ * the child before it, along with the separator for internal nodes, then
+ * removes the separator and frees the emptied child.
+ **/
+static void
+nih_btree_merge (NihBTree       *btree,
+		 NihBTreeNode   *parent,
+		 size_t          i,
+		 NihBTreeCursor *cursor)
+{
+	NihBTreeNode *left, *right;
+	size_t        j;
+
+	left = parent->children[i];
+	right = parent->children[i + 1];
+
+	if (right->leaf) {
+		memcpy (&left->keys[left->count], right->keys,
+			sizeof (const void *) * right->count);
+		memcpy (&left->values[left->count], right->values,
+			sizeof (void *) * right->count);
+
+		if (cursor->node == right) {
+			cursor->node = left;
+			cursor->pos += left->count;
+		}
+
+		left->count += right->count;
+
+		left->next = right->next;
+		if (right->next) {
+			right->next->prev = left;
+		} else {
+			btree->last = left;
+		}
+	} else {
+		left->keys[left->count] = parent->keys[i];
+		memcpy (&left->keys[left->count + 1], right->keys,
+			sizeof (const void *) * right->count);
+		memcpy (&left->children[left->count + 1], right->children,
+			sizeof (NihBTreeNode *) * (right->count + 1));
+
+		for (j = 0; j <= right->count; j++)
+			right->children[j]->parent = left;
+
+		left->count += right->count + 1;
+	}
+
+	nih_assert (left->count <= NIH_BTREE_KEYS);
+
+	memmove (&parent->keys[i], &parent->keys[i + 1],
+		 sizeof (const void *) * (parent->count - i - 1));
+	memmove (&parent->children[i + 1], &parent->children[i + 2],
+		 sizeof (NihBTreeNode *) * (parent->count - i - 1));
+	parent->count--;
+
+	nih_free (right);
+}
+
+/**
+ * nih_btree_rebalance:
+ * @btree: B-tree containing @node,
+ * @node: node that a key was removed from,
+ * @cursor: cursor to keep at the same entry.
+ *
+ * Restores the minimum number of keys in @node by moving one from a
+ * sibling, or if neither has any to spare by merging it with one; in
+ * which case the parent lost a key, and is checked in turn.  The root
+ * is freed once it has no keys, its only child replacing it.
+ **/
+static void
+nih_btree_rebalance (NihBTree       *btree,
+		     NihBTreeNode   *node,
+		     NihBTreeCursor *cursor)
+{
+	while (node->parent && (node->count < NIH_BTREE_MIN_KEYS)) {
+		NihBTreeNode *parent = node->parent;
+		NihBTreeNode *left, *right;
+		size_t        i;
+
+		i = nih_btree_child_index (parent, node);
+		left = (i > 0) ? parent->children[i - 1] : NULL;
+		right = (i < parent->count) ? parent->children[i + 1] : NULL;
+
+		if (left && (left->count > NIH_BTREE_MIN_KEYS)) {
+			nih_btree_shift_right (btree, parent, i - 1, cursor);
+			return;
+		} else if (right && (right->count > NIH_BTREE_MIN_KEYS)) {
+			nih_btree_shift_left (btree, parent, i, cursor);
+			return;
+		} else if (left) {
+			nih_btree_merge (btree, parent, i - 1, cursor);
+		} else {
+			nih_btree_merge (btree, parent, i, cursor);
+		}
+
+		node = parent;
+	}
+
+	if (node->parent || node->count)
+		return;
+
+	if (node->leaf) {
+		btree->root = btree->first = btree->last = NULL;
+
+		if (cursor->node == node) {
+			cursor->node = NULL;
+			cursor->pos = 0;
+		}
+	} else {
+		btree->root = node->children[0];
+		btree->root->parent = NULL;
+	}
+
+	nih_free (node);
+}
+
+/**
+ * nih_btree_cursor_remove:
+ * @cursor: cursor at an entry.
+ *
+ * Removes the entry at @cursor from its B-tree, neither the key nor value
+ * are freed, and moves @cursor to the following entry.  Other cursors
+ * into the same B-tree are invalidated.
+ *
+ * Returns: TRUE if @cursor is at an entry, FALSE if at the end.
+ **/
+int
+nih_btree_cursor_remove (NihBTreeCursor *cursor)
+{
+	NihBTree     *btree;
+	NihBTreeNode *node;
+	const void   *key;
+
+	nih_assert (cursor != NULL);
+	nih_assert (cursor->btree != NULL);
+	nih_assert (cursor->node != NULL);
+	nih_assert (cursor->pos < cursor->node->count);
+
+	btree = cursor->btree;
+	node = cursor->node;
+	key = node->keys[cursor->pos];
+
+	memmove (&node->keys[cursor->pos], &node->keys[cursor->pos + 1],
+		 sizeof (const void *) * (node->count - cursor->pos - 1));
+	memmove (&node->values[cursor->pos], &node->values[cursor->pos + 1],
+		 sizeof (void *) * (node->count - cursor->pos - 1));
+
+	node->count--;
+	btree->entries--;
+
+	/* The first key of every leaf but the first is also the separator
+	 * before the highest subtree it begins, which must be replaced
+	 * since the caller may free the key once removed.  Leaves other
+	 * than the root never become empty here.
+	 */
+	if (cursor->pos == 0) {
+		NihBTreeNode *child = node, *parent = node->parent;
+
+		while (parent && (parent->children[0] == child)) {
+			child = parent;
+			parent = parent->parent;
+		}
+
+		if (parent) {
+			size_t i = nih_btree_child_index (parent, child);
+
+			nih_assert (parent->keys[i - 1] == key);
+			parent->keys[i - 1] = node->keys[0];
+		}
+	}
+
+	nih_btree_rebalance (btree, node, cursor);
+
+	if (cursor->node && (cursor->pos == cursor->node->count)) {
+		cursor->node = cursor->node->next;
+		cursor->pos = 0;
+	}
+
+	return cursor->node != NULL;
+}
@@ -0,0 +1,224 @@
+/* libnih
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NIH_BTREE_H
+#define NIH_BTREE_H
+
+/**
+ * Provides an ordered map from constant keys to values, stored in a
+ * B-tree whose nodes each hold many entries.  Compared with a binary tree
+ * such as NihTreeIndex this needs far fewer nodes, and so fewer pointers
+ * followed and cache lines touched, to find an entry; and since all
+ * entries are kept in the leaf nodes, which are linked in order, ranges
+ * are iterated by simply stepping along an array.
+ *
+ * As with NihMap, each entry holds a pointer to a key and a pointer to
+ * the value, both of which remain owned by the caller.  More than one
+ * entry may have the same key, they are kept in the order added.
+ *
+ * B-trees are created with nih_btree_new(), which is given the comparison
+ * function for the keys.  The nodes are allocated as children of the
+ * B-tree, so are freed along with it.
+ *
+ * Entries are added with nih_btree_add(), found with nih_btree_lookup()
+ * and removed with nih_btree_remove().
+ *
+ * Entries are visited in order using an NihBTreeCursor, positioned with
+ * nih_btree_first(), nih_btree_last(), nih_btree_lower_bound() or
+ * nih_btree_upper_bound() and moved with nih_btree_cursor_next() and
+ * nih_btree_cursor_prev().  The entry under a cursor may be removed with
+ * nih_btree_cursor_remove(), which moves the cursor on to the following
+ * entry; otherwise any change to the B-tree invalidates all cursors.
+ *
+ * NIH_BTREE_FOREACH() expands to a for loop that iterates over each entry.
+ **/
+
+#include <nih/macros.h>
+#include <nih/hash.h>
+
+
+/**
+ * NIH_BTREE_KEYS:
+ *
+ * Maximum number of keys in each node of a B-tree; nodes other than the
+ * root always hold at least NIH_BTREE_MIN_KEYS.
+ **/
+#define NIH_BTREE_KEYS 16
+
+/**
+ * NIH_BTREE_MIN_KEYS:
+ *
+ * Minimum number of keys in each node of a B-tree, other than the root.
+ **/
+#define NIH_BTREE_MIN_KEYS ((NIH_BTREE_KEYS - 1) / 2)
+
+
+/**
+ * NihBTreeNode:
+ * @parent: parent node, or NULL for the root,
+ * @leaf: TRUE if this is a leaf node,
+ * @count: number of keys,
+ * @keys: keys of entries in a leaf, or separating children otherwise,
+ * @values: values of entries in a leaf,
+ * @children: child nodes otherwise,
+ * @prev: previous leaf node,
+ * @next: next leaf node.
+ *
+ * This structure represents a node of a B-tree; the members should not
+ * be changed directly.
+ *
+ * All keys in @children[i] are ordered after @keys[i - 1] and before
+ * @keys[i], or equal to them.  Each of @keys in an internal node is the
+ * same pointer as the first key of the first leaf under the child after
+ * it, so that no key remains in the B-tree once its entry is removed.
+ **/
+typedef struct nih_btree_node {
+	struct nih_btree_node  *parent;
+	int                     leaf;
+	size_t                  count;
+
+	const void             *keys[NIH_BTREE_KEYS];
+	union {
+		void                  *values[NIH_BTREE_KEYS];
+		struct nih_btree_node *children[NIH_BTREE_KEYS + 1];
+	};
+
+	struct nih_btree_node  *prev;
+	struct nih_btree_node  *next;
+} NihBTreeNode;
+
+/**
+ * NihBTree:
+ * @root: root node, or NULL if empty,
+ * @first: first leaf node, or NULL if empty,
+ * @last: last leaf node, or NULL if empty,
+ * @entries: number of entries,
+ * @cmp_function: function used to compare keys.
+ *
+ * This structure represents a B-tree; the members should not be changed
+ * directly.
+ **/
+typedef struct nih_btree {
+	NihBTreeNode   *root;
+	NihBTreeNode   *first;
+	NihBTreeNode   *last;
+	size_t          entries;
+
+	NihCmpFunction  cmp_function;
+} NihBTree;
+
+/**
+ * NihBTreeCursor:
+ * @btree: B-tree the cursor is in,
+ * @node: leaf node of current entry, or NULL at the end,
+ * @pos: index of current entry within @node.
+ *
+ * This structure represents a position in a B-tree, either at an entry
+ * or after the last entry.  It is usually allocated on the stack, and
+ * positioned with one of the functions taking it.
+ **/
+typedef struct nih_btree_cursor {
+	NihBTree     *btree;
+	NihBTreeNode *node;
+	size_t        pos;
+} NihBTreeCursor;
+
+
+/**
+ * nih_btree_cursor_key:
+ * @cursor: cursor at an entry.
+ *
+ * Expands to the key of the entry at @cursor, which must not be at the
+ * end of the B-tree.
+ **/
+#define nih_btree_cursor_key(cursor) \
+	((cursor)->node->keys[(cursor)->pos])
+
+/**
+ * nih_btree_cursor_value:
+ * @cursor: cursor at an entry.
+ *
+ * Expands to the value of the entry at @cursor, which must not be at the
+ * end of the B-tree; this may be assigned to.
+ **/
+#define nih_btree_cursor_value(cursor) \
+	((cursor)->node->values[(cursor)->pos])
+
+/**
+ * NIH_BTREE_FOREACH:
+ * @btree: B-tree to iterate,
+ * @iter: name of iterator variable.
+ *
+ * Expands to a for statement that iterates over each entry in @btree in
+ * order, setting @iter to a cursor at each entry for the block within the
+ * loop.  A variable named _@iter_cursor is used to hold the cursor.
+ *
+ * The entry at @iter may be removed with nih_btree_cursor_remove(), but
+ * then the loop must be left or the entry following it would be skipped;
+ * no other changes may be made to the B-tree while iterating.
+ **/
+#define NIH_BTREE_FOREACH(btree, iter)					\
+	for (NihBTreeCursor _##iter##_cursor = { (btree), (btree)->first, 0 }, \
+		     *iter = &_##iter##_cursor;				\
+	     iter->node; nih_btree_cursor_next (iter))
+
+/**
+ * nih_btree_string_new:
+ * @parent: parent of new B-tree.
+ *
+ * Allocates a new B-tree keyed by constant strings, which are ordered
+ * as by strcmp().
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned B-tree.  When all parents
+ * of the returned B-tree are freed, the returned B-tree will also be
+ * freed.
+ *
+ * Returns: the new B-tree or NULL if the allocation failed.
+ **/
+#define nih_btree_string_new(parent) \
+	nih_btree_new (parent, (NihCmpFunction)nih_hash_string_cmp)
+
+
+NIH_BEGIN_EXTERN
+
+NihBTree *nih_btree_new           (const void *parent,
+				   NihCmpFunction cmp_function)
+	__attribute__ ((warn_unused_result, malloc));
+
+int       nih_btree_add           (NihBTree *btree, const void *key,
+				   void *value)
+	__attribute__ ((warn_unused_result));
+void *    nih_btree_lookup        (NihBTree *btree, const void *key);
+int       nih_btree_remove        (NihBTree *btree, const void *key);
+
+int       nih_btree_first         (NihBTree *btree, NihBTreeCursor *cursor);
+int       nih_btree_last          (NihBTree *btree, NihBTreeCursor *cursor);
+int       nih_btree_lower_bound   (NihBTree *btree, const void *key,
+				   NihBTreeCursor *cursor);
+int       nih_btree_upper_bound   (NihBTree *btree, const void *key,
+				   NihBTreeCursor *cursor);
+
+int       nih_btree_cursor_next   (NihBTreeCursor *cursor);
+int       nih_btree_cursor_prev   (NihBTreeCursor *cursor);
+int       nih_btree_cursor_remove (NihBTreeCursor *cursor);
+
+NIH_END_EXTERN
+
+#endif /* NIH_BTREE_H */
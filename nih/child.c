@@ -26,12 +26,18 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 
+#include <errno.h>
+#include <stddef.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/io.h>
 #include <nih/logging.h>
 
 #include "child.h"
@@ -44,6 +50,70 @@
  **/
 #define WAITOPTS (WEXITED | WSTOPPED | WCONTINUED)
 
+/**
+ * P_PIDFD_ID:
+ *
+ * Identifier type to pass to waitid() to wait for the child referred to
+ * by a pidfd; older C libraries don't define P_PIDFD.
+ **/
+#define P_PIDFD_ID ((idtype_t) 3)
+
+/**
+ * NIH_CHILD_EXIT_EVENTS:
+ *
+ * Events that signify the termination of a child, which are the only
+ * events that a pidfd will wake the main loop for.
+ **/
+#define NIH_CHILD_EXIT_EVENTS (NIH_CHILD_EXITED | NIH_CHILD_KILLED \
+			       | NIH_CHILD_DUMPED)
+
+
+/**
+ * NihChildPid:
+ * @entry: list header for hash table,
+ * @pid: process id or -1,
+ * @watches: list of watches on @pid,
+ * @dispatching: TRUE while handlers are being called,
+ * @pidfd: pidfd for @pid or -1,
+ * @io_watch: watch on @pidfd.
+ *
+ * Watches on the same process id are collected into one of these records,
+ * which are held in a hash table so that the watches for a process can be
+ * found without iterating every watch.
+ *
+ * Once nih_child_init_pidfd() has been called, a pidfd is opened for
+ * processes where every watch is only for events that signify
+ * termination; these are reaped when the pidfd becomes readable rather
+ * than by nih_child_poll().
+ **/
+typedef struct nih_child_pid {
+	NihList     entry;
+	pid_t       pid;
+	NihList     watches;
+	int         dispatching;
+
+	int         pidfd;
+	NihIoWatch *io_watch;
+} NihChildPid;
+
+
+/* Prototypes for static functions */
+static const void * nih_child_pid_key      (NihList *entry);
+static uint32_t     nih_child_pid_hash     (const pid_t *pid);
+static int          nih_child_pid_cmp      (const pid_t *pid1,
+					    const pid_t *pid2);
+static NihChildPid *nih_child_pid_lookup   (pid_t pid);
+static int          nih_child_pid_destroy  (NihChildPid *pid_rec);
+static void         nih_child_pid_update   (NihChildPid *pid_rec);
+static void         nih_child_pid_reader   (NihChildPid *pid_rec,
+					    NihIoWatch *io_watch,
+					    NihIoEvents events);
+static int          nih_child_watch_destroy (NihChildWatch *watch);
+static void         nih_child_dispatch     (const siginfo_t *info);
+static void         nih_child_pid_dispatch (NihChildPid *pid_rec, pid_t pid,
+					    NihChildEvents event, int status,
+					    int free_watch);
+
 
 /**
  * nih_child_watches:
@@ -53,6 +123,29 @@
  **/
 NihList *nih_child_watches = NULL;
 
+/**
+ * nih_child_pids:
+ *
+ * Hash table of NihChildPid records for each process id that has
+ * watches, including -1.
+ **/
+static NihHash *nih_child_pids = NULL;
+
+/**
+ * nih_child_polled:
+ *
+ * Number of records in @nih_child_pids that rely on nih_child_poll()
+ * calling waitid() for any child, rather than having a pidfd.
+ **/
+static size_t nih_child_polled = 0;
+
+/**
+ * nih_child_use_pidfd:
+ *
+ * TRUE once nih_child_init_pidfd() has been called.
+ **/
+static int nih_child_use_pidfd = FALSE;
+
 
 /**
  * nih_child_init:
@@ -64,6 +157,223 @@ nih_child_init (void)
 {
 	if (! nih_child_watches)
 		nih_child_watches = NIH_MUST (nih_list_new (NULL));
+
+	if (! nih_child_pids)
+		nih_child_pids = NIH_MUST (nih_hash_new (
+			NULL, 1024, nih_child_pid_key,
+			(NihHashFunction)nih_child_pid_hash,
+			(NihCmpFunction)nih_child_pid_cmp));
+}
+
+/**
+ * nih_child_init_pidfd:
+ *
+ * Arranges for a pidfd to be opened for each child process watched only
+ * for termination, registered with the main loop so that the child is
+ * reaped and its watches called as soon as it terminates.
+ *
+ * Once this has been called, nih_child_poll() only calls waitid() for any
+ * child while there are watches that cannot use a pidfd: those with a @pid
+ * of -1 or for events other than termination.  Other children are left
+ * to be reaped by whoever started them, rather than racing them.
+ *
+ * If the kernel does not support pidfds, children continue to be reaped
+ * by nih_child_poll().
+ **/
+void
+nih_child_init_pidfd (void)
+{
+	nih_child_init ();
+
+	nih_child_use_pidfd = TRUE;
+
+	NIH_HASH_FOREACH_SAFE (nih_child_pids, iter) {
+		NihChildPid *pid_rec = (NihChildPid *)iter;
+
+		nih_child_pid_update (pid_rec);
+	}
+}
+
+
+/**
+ * nih_child_pid_key:
+ * @entry: record to key.
+ *
+ * Returns: pointer to the process id of the record.
+ **/
+static const void *
+nih_child_pid_key (NihList *entry)
+{
+	nih_assert (entry != NULL);
+
+	return &((NihChildPid *)entry)->pid;
+}
+
+/**
+ * nih_child_pid_hash:
+ * @pid: process id to hash.
+ *
+ * Returns: hash of @pid.
+ **/
+static uint32_t
+nih_child_pid_hash (const pid_t *pid)
+{
+	nih_assert (pid != NULL);
+
+	return (uint32_t)*pid * 2654435761U;
+}
+
+/**
+ * nih_child_pid_cmp:
+ * @pid1: process id to compare,
+ * @pid2: process id to compare against.
+ *
+ * Returns: zero if @pid1 and @pid2 are equal, non-zero otherwise.
+ **/
+static int
+nih_child_pid_cmp (const pid_t *pid1,
+		   const pid_t *pid2)
+{
+	nih_assert (pid1 != NULL);
+	nih_assert (pid2 != NULL);
+
+	return *pid1 != *pid2;
+}
+
+/**
+ * nih_child_pid_lookup:
+ * @pid: process id to look up.
+ *
+ * Returns: record for @pid, or NULL if there are no watches on it.
+ **/
+static NihChildPid *
+nih_child_pid_lookup (pid_t pid)
+{
+	return (NihChildPid *)nih_hash_lookup (nih_child_pids, &pid);
+}
+
+/**
+ * nih_child_pid_destroy:
+ * @pid_rec: record to be destroyed.
+ *
+ * Removes @pid_rec from the hash table and closes its pidfd.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_child_pid_destroy (NihChildPid *pid_rec)
+{
+	nih_assert (pid_rec != NULL);
+
+	nih_list_destroy (&pid_rec->entry);
+
+	if (pid_rec->pidfd >= 0) {
+		nih_free (pid_rec->io_watch);
+		close (pid_rec->pidfd);
+	} else {
+		nih_child_polled--;
+	}
+
+	return 0;
+}
+
+/**
+ * nih_child_pid_update:
+ * @pid_rec: record to update.
+ *
+ * Opens a pidfd for the process of @pid_rec if every watch on it is only
+ * for termination, or closes it if that is no longer true.
+ **/
+static void
+nih_child_pid_update (NihChildPid *pid_rec)
+{
+	int want_pidfd;
+
+	nih_assert (pid_rec != NULL);
+
+	want_pidfd = nih_child_use_pidfd && (pid_rec->pid != -1);
+
+	NIH_LIST_FOREACH (&pid_rec->watches, iter) {
+		NihChildWatch *watch = NIH_LIST_ITER (iter, NihChildWatch,
+						      pid_entry);
+
+		if (watch->events & ~NIH_CHILD_EXIT_EVENTS)
+			want_pidfd = FALSE;
+	}
+
+	if ((pid_rec->pidfd >= 0) && (! want_pidfd)) {
+		nih_free (pid_rec->io_watch);
+		close (pid_rec->pidfd);
+
+		pid_rec->io_watch = NULL;
+		pid_rec->pidfd = -1;
+		nih_child_polled++;
+
+	} else if ((pid_rec->pidfd < 0) && want_pidfd) {
+#ifdef SYS_pidfd_open
+		pid_rec->pidfd = syscall (SYS_pidfd_open, pid_rec->pid, 0);
+#endif /* SYS_pidfd_open */
+		if (pid_rec->pidfd < 0) {
+			pid_rec->pidfd = -1;
+			return;
+		}
+
+		pid_rec->io_watch = nih_io_add_watch (
+			pid_rec, pid_rec->pidfd, NIH_IO_READ,
+			(NihIoWatcher)nih_child_pid_reader, pid_rec);
+		if (! pid_rec->io_watch) {
+			close (pid_rec->pidfd);
+			pid_rec->pidfd = -1;
+			return;
+		}
+
+		nih_child_polled--;
+	}
+}
+
+/**
+ * nih_child_pid_reader:
+ * @pid_rec: record for child,
+ * @io_watch: watch on pidfd,
+ * @events: events that occurred.
+ *
+ * Called when the pidfd of @pid_rec becomes readable because the child
+ * has terminated; reaps only that child and calls its watches.
+ **/
+static void
+nih_child_pid_reader (NihChildPid *pid_rec,
+		      NihIoWatch  *io_watch,
+		      NihIoEvents  events)
+{
+	siginfo_t info;
+
+	nih_assert (pid_rec != NULL);
+	nih_assert (io_watch != NULL);
+
+	memset (&info, 0, sizeof (info));
+
+	while (waitid (P_PIDFD_ID, pid_rec->pidfd, &info,
+		       WEXITED | WNOHANG) < 0) {
+		if (errno == EINTR)
+			continue;
+
+		/* Reaped by someone else, which means we'll never see
+		 * it; stop watching the pidfd and hope that's
+		 * nih_child_poll().
+		 */
+		nih_free (pid_rec->io_watch);
+		close (pid_rec->pidfd);
+
+		pid_rec->io_watch = NULL;
+		pid_rec->pidfd = -1;
+		nih_child_polled++;
+		return;
+	}
+
+	if (info.si_pid)
+		nih_child_dispatch (&info);
 }
 
 
@@ -102,6 +412,7 @@ nih_child_add_watch (const void      *parent,
 		     void            *data)
 {
 	NihChildWatch *watch;
+	NihChildPid *  pid_rec;
 
 	nih_assert (pid != 0);
 	nih_assert (handler != NULL);
@@ -113,8 +424,9 @@ nih_child_add_watch (const void      *parent,
 		return NULL;
 
 	nih_list_init (&watch->entry);
+	nih_list_init (&watch->pid_entry);
 
-	nih_alloc_set_destructor (watch, nih_list_destroy);
+	nih_alloc_set_destructor (watch, nih_child_watch_destroy);
 
 	watch->pid = pid;
 	watch->events = events;
@@ -122,19 +434,88 @@ nih_child_add_watch (const void      *parent,
 	watch->handler = handler;
 	watch->data = data;
 
+	pid_rec = nih_child_pid_lookup (pid);
+	if (! pid_rec) {
+		pid_rec = nih_new (NULL, NihChildPid);
+		if (! pid_rec) {
+			nih_free (watch);
+			return NULL;
+		}
+
+		nih_list_init (&pid_rec->entry);
+		pid_rec->pid = pid;
+		nih_list_init (&pid_rec->watches);
+		pid_rec->dispatching = FALSE;
+
+		pid_rec->pidfd = -1;
+		pid_rec->io_watch = NULL;
+		nih_child_polled++;
+
+		nih_alloc_set_destructor (pid_rec, nih_child_pid_destroy);
+
+		nih_hash_add (nih_child_pids, &pid_rec->entry);
+	}
+
 	nih_list_add (nih_child_watches, &watch->entry);
+	nih_list_add (&pid_rec->watches, &watch->pid_entry);
+
+	nih_child_pid_update (pid_rec);
 
 	return watch;
 }
 
+/**
+ * nih_child_watch_destroy:
+ * @watch: watch to be destroyed.
+ *
+ * Removes @watch from the list of watches and the record for its process
+ * id, freeing the record if there are no other watches on it.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_child_watch_destroy (NihChildWatch *watch)
+{
+	NihChildPid *pid_rec;
+
+	nih_assert (watch != NULL);
+
+	nih_list_destroy (&watch->entry);
+
+	if (NIH_LIST_EMPTY (&watch->pid_entry))
+		return 0;
+
+	nih_list_destroy (&watch->pid_entry);
+
+	pid_rec = nih_child_pid_lookup (watch->pid);
+	nih_assert (pid_rec != NULL);
+
+	if (pid_rec->dispatching)
+		return 0;
+
+	if (NIH_LIST_EMPTY (&pid_rec->watches)) {
+		nih_free (pid_rec);
+	} else {
+		nih_child_pid_update (pid_rec);
+	}
+
+	return 0;
+}
+
 
 /**
  * nih_child_poll:
  *
  * Repeatedly call waitid() until there are no children waiting to be
- * reaped.  For each child that an event occurs for, the list of child
- * watches is iterated and the handler function for appropriate entries
- * is called.
+ * reaped.  For each child that an event occurs for, the watches on that
+ * process id and on any process are looked up and the handler function for
+ * appropriate entries is called; those on that process id first, then
+ * those on any process, each in the order they were added.
+ *
+ * Once nih_child_init_pidfd() has been called, this does nothing unless
+ * there are watches that do not have a pidfd.
  *
  * It is safe for the handler to remove itself.
  **/
@@ -145,6 +526,9 @@ nih_child_poll (void)
 
 	nih_child_init ();
 
+	if (nih_child_use_pidfd && (! nih_child_polled))
+		return;
+
 	/* NOTE: there's a strange kernel inconsistency, when the waitid()
 	 * syscall is native, it takes special care to zero this struct
 	 * before returning ... but when it's a compat syscall, it
@@ -155,72 +539,149 @@ nih_child_poll (void)
 	memset (&info, 0, sizeof (info));
 
 	while (waitid (P_ALL, 0, &info, WAITOPTS | WNOHANG) == 0) {
-		pid_t          pid;
-		NihChildEvents event;
-		int            status, free_watch = TRUE;
-
-		pid = info.si_pid;
-		if (! pid)
+		if (! info.si_pid)
 			break;
 
-		/* Convert siginfo information to handler function arguments;
-		 * in practice this is mostly just copying, with a few bits
-		 * of lore.
-		 */
-		switch (info.si_code) {
-		case CLD_EXITED:
-			event = NIH_CHILD_EXITED;
-			status = info.si_status;
-			break;
-		case CLD_KILLED:
-			event = NIH_CHILD_KILLED;
-			status = info.si_status;
-			break;
-		case CLD_DUMPED:
-			event = NIH_CHILD_DUMPED;
-			status = info.si_status;
-			break;
-		case CLD_TRAPPED:
-			if (((info.si_status & 0x7f) == SIGTRAP)
-			    && (info.si_status & ~0x7f)) {
-				event = NIH_CHILD_PTRACE;
-				status = info.si_status >> 8;
-			} else {
-				event = NIH_CHILD_TRAPPED;
-				status = info.si_status;
-			}
-			free_watch = FALSE;
-			break;
-		case CLD_STOPPED:
-			event = NIH_CHILD_STOPPED;
-			status = info.si_status;
-			free_watch = FALSE;
-			break;
-		case CLD_CONTINUED:
-			event = NIH_CHILD_CONTINUED;
-			status = info.si_status;
-			free_watch = FALSE;
-			break;
-		default:
-			nih_assert_not_reached ();
+		nih_child_dispatch (&info);
+
+		/* For next waitid call */
+		memset (&info, 0, sizeof (info));
+	}
+}
+
+/**
+ * nih_child_dispatch:
+ * @info: information returned by waitid().
+ *
+ * Converts @info into the event and status for the handler functions,
+ * and calls the handler of each watch on that process and on any process
+ * interested in the event.
+ **/
+static void
+nih_child_dispatch (const siginfo_t *info)
+{
+	NihChildPid *  pid_rec;
+	pid_t          pid;
+	NihChildEvents event;
+	int            status, free_watch = TRUE;
+
+	nih_assert (info != NULL);
+
+	pid = info->si_pid;
+
+	/* Convert siginfo information to handler function arguments;
+	 * in practice this is mostly just copying, with a few bits
+	 * of lore.
+	 */
+	switch (info->si_code) {
+	case CLD_EXITED:
+		event = NIH_CHILD_EXITED;
+		status = info->si_status;
+		break;
+	case CLD_KILLED:
+		event = NIH_CHILD_KILLED;
+		status = info->si_status;
+		break;
+	case CLD_DUMPED:
+		event = NIH_CHILD_DUMPED;
+		status = info->si_status;
+		break;
+	case CLD_TRAPPED:
+		if (((info->si_status & 0x7f) == SIGTRAP)
+		    && (info->si_status & ~0x7f)) {
+			event = NIH_CHILD_PTRACE;
+			status = info->si_status >> 8;
+		} else {
+			event = NIH_CHILD_TRAPPED;
+			status = info->si_status;
 		}
+		free_watch = FALSE;
+		break;
+	case CLD_STOPPED:
+		event = NIH_CHILD_STOPPED;
+		status = info->si_status;
+		free_watch = FALSE;
+		break;
+	case CLD_CONTINUED:
+		event = NIH_CHILD_CONTINUED;
+		status = info->si_status;
+		free_watch = FALSE;
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	pid_rec = nih_child_pid_lookup (pid);
+	if (pid_rec)
+		nih_child_pid_dispatch (pid_rec, pid, event, status,
+					free_watch);
+
+	pid_rec = nih_child_pid_lookup (-1);
+	if (pid_rec)
+		nih_child_pid_dispatch (pid_rec, pid, event, status, FALSE);
+}
+
+/**
+ * nih_child_pid_dispatch:
+ * @pid_rec: record of watches to call,
+ * @pid: process that changed,
+ * @event: event that occurred on the child,
+ * @status: exit status of process, signal that killed it or ptrace event,
+ * @free_watch: whether to free the watches once called.
+ *
+ * Calls the handler of each watch in @pid_rec that is interested in
+ * @event, freeing it afterwards if @free_watch is TRUE.  @pid_rec itself
+ * is freed afterwards if no watches remain.
+ *
+ * The list is walked using a cursor that is itself an inactive watch,
+ * so that handlers may remove any watch on the same process id.
+ **/
+static void
+nih_child_pid_dispatch (NihChildPid    *pid_rec,
+			pid_t           pid,
+			NihChildEvents  event,
+			int             status,
+			int             free_watch)
+{
+	NihChildWatch  cursor;
+	NihList       *iter;
+	int            dispatching;
+
+	nih_assert (pid_rec != NULL);
+
+	nih_list_init (&cursor.entry);
+	nih_list_init (&cursor.pid_entry);
+	cursor.events = NIH_CHILD_NONE;
 
-		NIH_LIST_FOREACH_SAFE (nih_child_watches, iter) {
-			NihChildWatch *watch = (NihChildWatch *)iter;
+	dispatching = pid_rec->dispatching;
+	pid_rec->dispatching = TRUE;
 
-			if ((watch->pid != pid) && (watch->pid != -1))
-				continue;
+	iter = pid_rec->watches.next;
+	while (iter != &pid_rec->watches) {
+		NihChildWatch *watch = NIH_LIST_ITER (iter, NihChildWatch,
+						      pid_entry);
 
-			if (! (watch->events & event))
-				continue;
+		nih_list_add_after (iter, &cursor.pid_entry);
 
+		if ((! NIH_LIST_EMPTY (&watch->entry))
+		    && (watch->events & event)) {
 			watch->handler (watch->data, pid, event, status);
 
-			if (free_watch && (watch->pid != -1))
+			if (free_watch)
 				nih_free (watch);
 		}
 
-		/* For next waitid call */
-		memset (&info, 0, sizeof (info));
+		iter = cursor.pid_entry.next;
+		nih_list_remove (&cursor.pid_entry);
+	}
+
+	pid_rec->dispatching = dispatching;
+	if (dispatching)
+		return;
+
+	if (NIH_LIST_EMPTY (&pid_rec->watches)) {
+		nih_free (pid_rec);
+	} else {
+		nih_child_pid_update (pid_rec);
 	}
 }
@@ -68,7 +68,8 @@ typedef void (*NihChildHandler) (void *data, pid_t pid,
  * @pid: process id to watch or -1,
  * @events: events to watch for,
  * @handler: function called when events occur to child,
- * @data: pointer passed to @reaper.
+ * @data: pointer passed to @reaper,
+ * @pid_entry: list header for other watches on @pid (used internally).
  *
  * This structure represents a watch on a particular child, the @reaper
  * function is called when an event in @events occurs to a child with
@@ -76,7 +77,8 @@ typedef void (*NihChildHandler) (void *data, pid_t pid,
  * occur for all processes.
  *
  * The watch can be cancelled by calling nih_list_remove() on the structure
- * as they are held in a list internally.
+ * as they are held in a list internally.  Watches are also indexed by
+ * @pid, which must not be changed.
  **/
 typedef struct nih_child_watch {
 	NihList          entry;
@@ -85,6 +87,8 @@ typedef struct nih_child_watch {
 
 	NihChildHandler  handler;
 	void            *data;
+
+	NihList          pid_entry;
 } NihChildWatch;
 
 
@@ -94,6 +98,7 @@ extern NihList *nih_child_watches;
 
 
 void           nih_child_init      (void);
+void           nih_child_init_pidfd (void);
 
 NihChildWatch *nih_child_add_watch (const void *parent, pid_t pid,
 				    NihChildEvents events,
@@ -31,6 +31,7 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/array.h>
 #include <nih/string.h>
 #include <nih/file.h>
 #include <nih/config.h>
@@ -584,33 +585,26 @@ nih_config_parse_args (const void *parent,
 		       size_t     *pos,
 		       size_t     *lineno)
 {
-	char   **args;
-	size_t   p, nargs;
+	NihArray  array;
+	char    **args;
+	size_t    p;
 
 	nih_assert (file != NULL);
 
-	/* Begin with an empty array */
-	nargs = 0;
-	args = nih_str_array_new (parent);
-	if (! args)
-		nih_return_system_error (NULL);
+	nih_array_init (&array, parent, NULL, 0);
 
 	/* Loop through the arguments until we hit a comment or newline */
 	p = (pos ? *pos : 0);
 	while (nih_config_has_token (file, len, &p, lineno)) {
-		char *arg;
+		nih_local char *arg = NULL;
 
-		arg = nih_config_next_arg (args, file, len, &p, lineno);
-		if (! arg) {
-			nih_free (args);
-			args = NULL;
-			goto finish;
-		}
+		arg = nih_config_next_arg (NULL, file, len, &p, lineno);
+		if (! arg)
+			goto error;
 
-		if (! nih_str_array_addp (&args, parent, &nargs, arg)) {
+		if (nih_array_addp (&array, arg) < 0) {
 			nih_error_raise_system ();
-			nih_free (args);
-			return NULL;
+			goto error;
 		}
 	}
 
@@ -620,6 +614,17 @@ nih_config_parse_args (const void *parent,
 	if (nih_config_skip_comment (file, len, &p, lineno) < 0)
 		nih_assert_not_reached ();
 
+	args = (char **)nih_array_trim (&array);
+	if (args)
+		goto finish;
+
+	nih_error_raise_system ();
+
+error:
+	if (array.elems)
+		nih_free (array.elems);
+	args = NULL;
+
 finish:
 	if (pos)
 		*pos = p;
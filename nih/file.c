@@ -38,6 +38,7 @@
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/array.h>
 #include <nih/string.h>
 #include <nih/io.h>
 #include <nih/file.h>
@@ -617,8 +618,7 @@ nih_dir_walk_scan (const char    *path,
 {
 	DIR            *dir;
 	struct dirent  *ent;
-	char          **paths;
-	size_t          npaths;
+	NihArray        paths;
 
 	nih_assert (path != NULL);
 
@@ -626,8 +626,7 @@ nih_dir_walk_scan (const char    *path,
 	if (! dir)
 		nih_return_system_error (NULL);
 
-	npaths = 0;
-	paths = NIH_MUST (nih_str_array_new (NULL));
+	nih_array_init (&paths, NULL, NULL, 0);
 
 	while ((ent = readdir (dir)) != NULL) {
 		nih_local char *subpath = NULL;
@@ -643,14 +642,16 @@ nih_dir_walk_scan (const char    *path,
 		if (filter && filter (data, subpath, ent->d_type == DT_DIR))
 			continue;
 
-		NIH_MUST (nih_str_array_addp (&paths, NULL, &npaths, subpath));
+		NIH_ZERO (nih_array_addp (&paths, subpath));
 	}
 
 	closedir (dir);
 
-	qsort (paths, npaths, sizeof (char *), nih_dir_walk_sort);
+	NIH_MUST (nih_array_trim (&paths));
 
-	return paths;
+	qsort (paths.elems, paths.len, sizeof (char *), nih_dir_walk_sort);
+
+	return (char **)paths.elems;
 }
 
 
@@ -24,7 +24,13 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <sys/types.h>
+
+#include <time.h>
+#include <fcntl.h>
+#include <endian.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/logging.h>
@@ -49,6 +55,40 @@
  **/
 #define FNV_OFFSET_BASIS 2166136261UL
 
+/**
+ * WORD_P0, WORD_P1, WORD_P2:
+ *
+ * Odd 64-bit constants with well mixed bits used by
+ * nih_hash_string_word_hash(), as chosen for wyhash.
+ **/
+#define WORD_P0 0xa0761d6478bd642fULL
+#define WORD_P1 0xe7037ed1a0b428dbULL
+#define WORD_P2 0x8ebc6af09c88c6e3ULL
+
+/**
+ * NIH_HASH_LOAD_FACTOR:
+ *
+ * Once the estimated number of entries exceeds this multiple of the number
+ * of bins, the entries are counted to see whether the hash should grow.
+ **/
+#define NIH_HASH_LOAD_FACTOR 2
+
+/**
+ * NIH_HASH_MOVE_BINS:
+ *
+ * Number of old bins whose entries are moved on each addition or lookup
+ * while the hash is growing.
+ **/
+#define NIH_HASH_MOVE_BINS 4
+
+/**
+ * NIH_HASH_SCAN_BINS:
+ *
+ * Number of bins whose entries are counted on each addition or lookup
+ * while deciding whether the hash should grow.
+ **/
+#define NIH_HASH_SCAN_BINS 16
+
 
 /**
  * primes:
@@ -69,6 +109,39 @@ static const uint32_t primes[] = {
  **/
 static const size_t num_primes = sizeof (primes) / sizeof (uint32_t);
 
+/**
+ * seed:
+ *
+ * Seed mixed into nih_hash_string_word_hash(), zero until
+ * nih_hash_seed_init() is called.
+ **/
+static uint64_t seed = 0;
+
+
+/**
+ * nih_hash_string_function:
+ *
+ * Function used to hash the keys of hash tables created by
+ * nih_hash_string_new() and similar macros, selected with
+ * nih_hash_set_string_hash().  Changing it does not affect hash tables
+ * that already exist.
+ **/
+NihHashFunction nih_hash_string_function = (NihHashFunction)nih_hash_string_hash;
+
+
+/* Prototypes for static functions */
+static void     nih_hash_grow     (NihHash *hash);
+static void     nih_hash_move_bin (NihHash *hash, NihList *old_bin);
+static void     nih_hash_step     (NihHash *hash);
+static NihList *nih_hash_bin      (NihHash *hash, uint32_t hashval,
+				   NihList **old_bin);
+static void     nih_hash_added    (NihHash *hash, NihList *bin,
+				   NihList *entry, uint32_t hashval);
+static inline int nih_hash_match  (NihHash *hash, NihList *entry,
+				   const void *key, uint32_t hashval);
+static inline uint64_t nih_hash_mum  (uint64_t a, uint64_t b);
+static inline uint64_t nih_hash_read (const unsigned char *p, size_t len);
+
 
 /**
  * nih_hash_new:
@@ -80,7 +153,8 @@ static const size_t num_primes = sizeof (primes) / sizeof (uint32_t);
  *
  * Allocates a new hash table, the number of buckets selected is a prime
  * number that is no larger than @entries; this should be set to a rough
- * number of expected entries to ensure optimum distribution.
+ * number of expected entries to ensure optimum distribution.  The number
+ * of buckets grows if many more entries than this are added.
  *
  * Individual members of the hash table are NihList members, so to
  * associate them with a constant key @key_function must be provided, to
@@ -137,11 +211,304 @@ nih_hash_new (const void      *parent,
 	hash->key_function = key_function;
 	hash->hash_function = hash_function;
 	hash->cmp_function = cmp_function;
+	hash->cached = FALSE;
+
+	hash->old_bins = NULL;
+	hash->old_size = 0;
+	hash->moved = 0;
+
+	hash->entries = 0;
+	hash->scanning = FALSE;
+	hash->scanned = 0;
+	hash->scan_entries = 0;
+
+	hash->iterating = 0;
+
+	return hash;
+}
+
+/**
+ * nih_hash_cached_new:
+ * @parent: parent of new hash,
+ * @entries: rough number of entries expected,
+ * @key_function: function used to obtain keys for entries,
+ * @hash_function: function used to obtain hash for keys,
+ * @cmp_function: function used to compare keys.
+ *
+ * Allocates a new hash table in the same manner as nih_hash_new(), except
+ * that individual members must begin with an NihHashEntry rather than an
+ * NihList.  The hash of each member's key is stored in it when added, so
+ * @key_function and @cmp_function are only called for members whose
+ * stored hash matches that of the key being looked up; and members need
+ * not be hashed again when the table grows.
+ *
+ * Entries are still passed to and returned from the other functions as
+ * pointers to their list header.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned hash table.  When all parents
+ * of the returned hash table are freed, the returned hash table will also be
+ * freed.
+ *
+ * Returns: the new hash table or NULL if the allocation failed.
+ **/
+NihHash *
+nih_hash_cached_new (const void      *parent,
+		     size_t           entries,
+		     NihKeyFunction   key_function,
+		     NihHashFunction  hash_function,
+		     NihCmpFunction   cmp_function)
+{
+	NihHash *hash;
+
+	hash = nih_hash_new (parent, entries,
+			     key_function, hash_function, cmp_function);
+	if (! hash)
+		return NULL;
+
+	hash->cached = TRUE;
 
 	return hash;
 }
 
 
+/**
+ * nih_hash_grow:
+ * @hash: hash table to grow.
+ *
+ * Allocates a larger array of bins for @hash, sized for the number of
+ * entries that were last counted, and makes the current bins the old
+ * bins whose entries will be moved by nih_hash_step().
+ *
+ * If there is no larger size, or the allocation fails, @hash is left
+ * unchanged and will try again once more entries have been added.
+ **/
+static void
+nih_hash_grow (NihHash *hash)
+{
+	NihList *bins;
+	size_t   size = 0;
+	size_t   i;
+
+	nih_assert (hash != NULL);
+	nih_assert (hash->old_bins == NULL);
+
+	/* Pick the smallest prime number larger than the number of entries */
+	for (i = 0; i < num_primes; i++) {
+		if (primes[i] > hash->entries) {
+			size = primes[i];
+			break;
+		}
+	}
+
+	if (size <= hash->size)
+		return;
+
+	bins = nih_alloc (hash, sizeof (NihList) * size);
+	if (! bins)
+		return;
+
+	for (i = 0; i < size; i++)
+		nih_list_init (&bins[i]);
+
+	hash->old_bins = hash->bins;
+	hash->old_size = hash->size;
+	hash->moved = 0;
+
+	hash->bins = bins;
+	hash->size = size;
+}
+
+/**
+ * nih_hash_move_bin:
+ * @hash: hash table,
+ * @old_bin: old bin to move.
+ *
+ * Moves each entry in @old_bin into the appropriate bin of @hash, keeping
+ * entries with the same key in the same order.
+ **/
+static void
+nih_hash_move_bin (NihHash *hash,
+		   NihList *old_bin)
+{
+	nih_assert (hash != NULL);
+	nih_assert (old_bin != NULL);
+
+	while (! NIH_LIST_EMPTY (old_bin)) {
+		NihList  *entry = old_bin->next;
+		uint32_t  hashval;
+
+		if (hash->cached) {
+			hashval = ((NihHashEntry *)entry)->hash;
+		} else {
+			hashval = hash->hash_function (
+				hash->key_function (entry));
+		}
+
+		nih_list_add (&hash->bins[hashval % hash->size], entry);
+	}
+}
+
+/**
+ * nih_hash_step:
+ * @hash: hash table.
+ *
+ * Performs a small amount of the work needed to grow @hash; while the
+ * hash is growing the entries of the next few old bins are moved into
+ * the new bins, and while deciding whether to grow the entries of the
+ * next few bins are counted.
+ *
+ * Nothing is done while @hash is being iterated.
+ **/
+static void
+nih_hash_step (NihHash *hash)
+{
+	size_t i;
+
+	nih_assert (hash != NULL);
+
+	if (hash->iterating)
+		return;
+
+	if (hash->old_bins) {
+		for (i = 0; ((i < NIH_HASH_MOVE_BINS)
+			     && (hash->moved < hash->old_size)); i++)
+			nih_hash_move_bin (hash,
+					   &hash->old_bins[hash->moved++]);
+
+		if (hash->moved == hash->old_size) {
+			nih_free (hash->old_bins);
+
+			hash->old_bins = NULL;
+			hash->old_size = 0;
+			hash->moved = 0;
+		}
+
+	} else if (hash->scanning) {
+		for (i = 0; ((i < NIH_HASH_SCAN_BINS)
+			     && (hash->scanned < hash->size)); i++) {
+			NIH_LIST_FOREACH (&hash->bins[hash->scanned], iter)
+				hash->scan_entries++;
+
+			hash->scanned++;
+		}
+
+		if (hash->scanned == hash->size) {
+			hash->scanning = FALSE;
+			hash->entries = hash->scan_entries;
+
+			if (hash->entries > hash->size)
+				nih_hash_grow (hash);
+		}
+	}
+}
+
+/**
+ * nih_hash_bin:
+ * @hash: hash table,
+ * @hashval: hash of key to look for,
+ * @old_bin: pointer to store old bin.
+ *
+ * Steps the growth of @hash and returns the bin that a key with the hash
+ * @hashval belongs in.
+ *
+ * While @hash is growing, the old bin for the key is moved first unless
+ * @hash is being iterated; if it could not be moved and still contains
+ * entries then it is stored in @old_bin, and should be searched before
+ * the returned bin and have any new entries added to it.  Otherwise
+ * @old_bin is set to NULL.
+ *
+ * Returns: bin for @key.
+ **/
+static NihList *
+nih_hash_bin (NihHash   *hash,
+	      uint32_t   hashval,
+	      NihList  **old_bin)
+{
+	nih_assert (hash != NULL);
+	nih_assert (old_bin != NULL);
+
+	nih_hash_step (hash);
+
+	*old_bin = NULL;
+	if (hash->old_bins) {
+		NihList *bin = &hash->old_bins[hashval % hash->old_size];
+
+		if (! hash->iterating) {
+			nih_hash_move_bin (hash, bin);
+		} else if (! NIH_LIST_EMPTY (bin)) {
+			*old_bin = bin;
+		}
+	}
+
+	return &hash->bins[hashval % hash->size];
+}
+
+/**
+ * nih_hash_added:
+ * @hash: hash table,
+ * @bin: bin entry was added to,
+ * @entry: entry added,
+ * @hashval: hash of entry's key.
+ *
+ * Stores @hashval in @entry if @hash caches them, and counts an entry
+ * added to @bin of @hash, beginning to count all of the entries once the
+ * estimated number of entries is large enough that the hash may need to
+ * grow.
+ **/
+static void
+nih_hash_added (NihHash  *hash,
+		NihList  *bin,
+		NihList  *entry,
+		uint32_t  hashval)
+{
+	nih_assert (hash != NULL);
+	nih_assert (bin != NULL);
+	nih_assert (entry != NULL);
+
+	if (hash->cached)
+		((NihHashEntry *)entry)->hash = hashval;
+
+	hash->entries++;
+
+	if (hash->scanning) {
+		/* Bins already counted won't be counted again */
+		if ((size_t)(bin - hash->bins) < hash->scanned)
+			hash->scan_entries++;
+
+	} else if ((! hash->old_bins)
+		   && (hash->entries > hash->size * NIH_HASH_LOAD_FACTOR)) {
+		hash->scanning = TRUE;
+		hash->scanned = 0;
+		hash->scan_entries = 0;
+	}
+}
+
+/**
+ * nih_hash_match:
+ * @hash: hash table,
+ * @entry: entry to compare,
+ * @key: key to look for,
+ * @hashval: hash of @key.
+ *
+ * Compares the key of @entry with @key, when @hash caches the hash of
+ * each entry the comparison is only made if @hashval matches.
+ *
+ * Returns: TRUE if @entry has the key @key, FALSE otherwise.
+ **/
+static inline int
+nih_hash_match (NihHash    *hash,
+		NihList    *entry,
+		const void *key,
+		uint32_t    hashval)
+{
+	if (hash->cached && (((NihHashEntry *)entry)->hash != hashval))
+		return FALSE;
+
+	return ! hash->cmp_function (key, hash->key_function (entry));
+}
+
+
 /**
  * nih_hash_add:
  * @hash: destination hash table,
@@ -165,16 +532,19 @@ nih_hash_add (NihHash *hash,
 {
 	const void *key;
 	uint32_t    hashval;
-	NihList    *bin;
+	NihList    *bin, *old_bin;
 
 	nih_assert (hash != NULL);
 	nih_assert (entry != NULL);
 
 	key = hash->key_function (entry);
-	hashval = hash->hash_function (key) % hash->size;
-	bin = &hash->bins[hashval];
+	hashval = hash->hash_function (key);
+	bin = nih_hash_bin (hash, hashval, &old_bin);
 
-	return nih_list_add (bin, entry);
+	nih_list_add (old_bin ? old_bin : bin, entry);
+	nih_hash_added (hash, bin, entry, hashval);
+
+	return entry;
 }
 
 /**
@@ -203,21 +573,31 @@ nih_hash_add_unique (NihHash *hash,
 {
 	const void *key;
 	uint32_t    hashval;
-	NihList    *bin;
+	NihList    *bin, *old_bin;
 
 	nih_assert (hash != NULL);
 	nih_assert (entry != NULL);
 
 	key = hash->key_function (entry);
-	hashval = hash->hash_function (key) % hash->size;
-	bin = &hash->bins[hashval];
+	hashval = hash->hash_function (key);
+	bin = nih_hash_bin (hash, hashval, &old_bin);
+
+	if (old_bin) {
+		NIH_LIST_FOREACH (old_bin, iter) {
+			if (nih_hash_match (hash, iter, key, hashval))
+				return NULL;
+		}
+	}
 
 	NIH_LIST_FOREACH (bin, iter) {
-		if (! hash->cmp_function (key, hash->key_function (iter)))
+		if (nih_hash_match (hash, iter, key, hashval))
 			return NULL;
 	}
 
-	return nih_list_add (bin, entry);
+	nih_list_add (old_bin ? old_bin : bin, entry);
+	nih_hash_added (hash, bin, entry, hashval);
+
+	return entry;
 }
 
 /**
@@ -249,23 +629,43 @@ nih_hash_replace (NihHash *hash,
 {
 	const void *key;
 	uint32_t    hashval;
-	NihList    *bin, *ret = NULL;
+	NihList    *bin, *old_bin, *ret = NULL;
 
 	nih_assert (hash != NULL);
 	nih_assert (entry != NULL);
 
 	key = hash->key_function (entry);
-	hashval = hash->hash_function (key) % hash->size;
-	bin = &hash->bins[hashval];
+	hashval = hash->hash_function (key);
+	bin = nih_hash_bin (hash, hashval, &old_bin);
 
-	NIH_LIST_FOREACH (bin, iter) {
-		if (! hash->cmp_function (key, hash->key_function (iter))) {
-			ret = nih_list_remove (iter);
-			break;
+	if (old_bin) {
+		NIH_LIST_FOREACH (old_bin, iter) {
+			if (nih_hash_match (hash, iter, key, hashval)) {
+				ret = nih_list_remove (iter);
+				break;
+			}
+		}
+	}
+
+	if (! ret) {
+		NIH_LIST_FOREACH (bin, iter) {
+			if (nih_hash_match (hash, iter, key, hashval)) {
+				ret = nih_list_remove (iter);
+				break;
+			}
 		}
 	}
 
-	nih_list_add (bin, entry);
+	/* The old bin may now be empty, in which case the new bin is used */
+	if (old_bin && NIH_LIST_EMPTY (old_bin))
+		old_bin = NULL;
+
+	nih_list_add (old_bin ? old_bin : bin, entry);
+	if (! ret) {
+		nih_hash_added (hash, bin, entry, hashval);
+	} else if (hash->cached) {
+		((NihHashEntry *)entry)->hash = hashval;
+	}
 
 	return ret;
 }
@@ -291,13 +691,27 @@ nih_hash_search (NihHash    *hash,
 		 NihList    *entry)
 {
 	uint32_t  hashval;
-	NihList  *bin;
+	NihList  *bin, *old_bin;
 
 	nih_assert (hash != NULL);
 	nih_assert (key != NULL);
 
-	hashval = hash->hash_function (key) % hash->size;
-	bin = &hash->bins[hashval];
+	hashval = hash->hash_function (key);
+	bin = nih_hash_bin (hash, hashval, &old_bin);
+
+	/* Entries in the old bin were added before those in the new one */
+	if (old_bin) {
+		NIH_LIST_FOREACH (old_bin, iter) {
+			if (iter == entry) {
+				entry = NULL;
+				continue;
+			} else if (entry) {
+				continue;
+			} else if (nih_hash_match (hash, iter, key, hashval)) {
+				return iter;
+			}
+		}
+	}
 
 	NIH_LIST_FOREACH (bin, iter) {
 		if (iter == entry) {
@@ -305,7 +719,7 @@ nih_hash_search (NihHash    *hash,
 			continue;
 		} else if (entry) {
 			continue;
-		} else if (! hash->cmp_function (key, hash->key_function (iter))) {
+		} else if (nih_hash_match (hash, iter, key, hashval)) {
 			return iter;
 		}
 	}
@@ -351,6 +765,24 @@ nih_hash_string_key (NihList *entry)
 	return *((const char **)((char *)entry + sizeof (NihList)));
 }
 
+/**
+ * nih_hash_entry_string_key:
+ * @entry: entry to create key for.
+ *
+ * Key function that can be used for any hash entry where the first member
+ * immediately after the NihHashEntry header is a pointer to the string
+ * containing the name.
+ *
+ * Returns: pointer to that string.
+ **/
+const char *
+nih_hash_entry_string_key (NihList *entry)
+{
+	nih_assert (entry != NULL);
+
+	return *((const char **)((char *)entry + sizeof (NihHashEntry)));
+}
+
 /**
  * nih_hash_string_hash:
  * @key: string key to hash.
@@ -378,6 +810,121 @@ nih_hash_string_hash (const char *key)
 	return hash;
 }
 
+/**
+ * nih_hash_mum:
+ * @a: first value,
+ * @b: second value.
+ *
+ * Multiplies @a and @b to give a 128-bit result, and folds the two
+ * halves together; every bit of the result depends on every bit of the
+ * inputs.
+ *
+ * Returns: 64-bit result.
+ **/
+static inline uint64_t
+nih_hash_mum (uint64_t a,
+	      uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else /* __SIZEOF_INT128__ */
+	uint64_t ha = a >> 32, la = (uint32_t)a;
+	uint64_t hb = b >> 32, lb = (uint32_t)b;
+	uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+	uint64_t lo, carry;
+
+	lo = ll + (hl << 32);
+	carry = lo < ll;
+	lo += lh << 32;
+	carry += lo < (lh << 32);
+
+	return lo ^ (hh + (hl >> 32) + (lh >> 32) + carry);
+#endif /* __SIZEOF_INT128__ */
+}
+
+/**
+ * nih_hash_read:
+ * @p: bytes to read,
+ * @len: number of bytes, no more than eight.
+ *
+ * Reads @len bytes from @p, which need not be aligned, as a little-endian
+ * integer.
+ *
+ * Returns: integer read.
+ **/
+static inline uint64_t
+nih_hash_read (const unsigned char *p,
+	       size_t               len)
+{
+	uint64_t value = 0;
+
+	memcpy (&value, p, len);
+
+	return le64toh (value);
+}
+
+/**
+ * nih_hash_string_word_hash:
+ * @key: string key to hash.
+ *
+ * Generates and returns a 32-bit hash for the given string key eight or
+ * sixteen bytes at a time, in the manner of wyhash, rather than a byte at
+ * a time as nih_hash_string_hash() does; it is much faster for longer
+ * keys such as D-Bus object paths and file paths.
+ *
+ * After nih_hash_seed_init() has been called, the hash also depends on a
+ * seed chosen at random for the process.
+ *
+ * The returned key will need to be bounded within the number of bins
+ * used in the hash table.
+ *
+ * Returns: 32-bit hash.
+ **/
+uint32_t
+nih_hash_string_word_hash (const char *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	size_t               len, left;
+	uint64_t             a, b, hash;
+
+	nih_assert (key != NULL);
+
+	len = left = strlen (key);
+	hash = seed ^ nih_hash_mum (seed ^ WORD_P0, WORD_P1);
+
+	while (left > 16) {
+		hash = nih_hash_mum (nih_hash_read (p, 8) ^ WORD_P1,
+				     nih_hash_read (p + 8, 8) ^ hash);
+		p += 16;
+		left -= 16;
+	}
+
+	/* The last one to sixteen bytes are read as two overlapping
+	 * halves; anything shorter as two overlapping quarters, or for
+	 * under four bytes the first, middle and last bytes.
+	 */
+	if (left >= 8) {
+		a = nih_hash_read (p, 8);
+		b = nih_hash_read (p + left - 8, 8);
+	} else if (left >= 4) {
+		a = nih_hash_read (p, 4);
+		b = nih_hash_read (p + left - 4, 4);
+	} else if (left) {
+		a = ((uint64_t)p[0] << 16) | ((uint64_t)p[left / 2] << 8)
+			| p[left - 1];
+		b = 0;
+	} else {
+		a = b = 0;
+	}
+
+	hash = nih_hash_mum (a ^ WORD_P1, b ^ hash);
+	hash = nih_hash_mum (hash ^ WORD_P0 ^ len, WORD_P2);
+
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
 /**
  * nih_hash_string_cmp:
  * @key1: key to compare,
@@ -397,3 +944,97 @@ nih_hash_string_cmp (const char *key1,
 
 	return strcmp (key1, key2);
 }
+
+
+/**
+ * nih_hash_set_string_hash:
+ * @hash_function: new hash function.
+ *
+ * Sets the function used to hash the keys of hash tables created by
+ * nih_hash_string_new(), nih_hash_string_cached_new() and
+ * nih_map_string_new() from then on; nih_hash_string_hash() is the
+ * default and nih_hash_string_word_hash() another.
+ **/
+void
+nih_hash_set_string_hash (NihHashFunction hash_function)
+{
+	nih_assert (hash_function != NULL);
+
+	nih_hash_string_function = hash_function;
+}
+
+/**
+ * nih_hash_seed_init:
+ *
+ * Chooses a seed at random for nih_hash_string_word_hash(), so that the
+ * hash of a string differs in each process and names received from
+ * untrusted sources cannot be chosen to have the same hash.
+ *
+ * This must be called before any hash table using that function is
+ * created, since the hash of the keys of existing entries would change;
+ * generally at the start of main().
+ **/
+void
+nih_hash_seed_init (void)
+{
+	uint64_t value = 0;
+	int      fd;
+
+	fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		if (read (fd, &value, sizeof (value)) != sizeof (value))
+			value = 0;
+
+		close (fd);
+	}
+
+	/* Fall back to something that at least differs between processes */
+	if (! value) {
+		struct timespec ts;
+
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		value = nih_hash_mum ((uint64_t)getpid () ^ WORD_P0,
+				      ((uint64_t)ts.tv_sec << 32)
+				      ^ ts.tv_nsec ^ WORD_P1);
+	}
+
+	seed = value;
+}
+
+
+/**
+ * _nih_hash_iter_begin:
+ * @hash: hash table being iterated.
+ *
+ * Marks @hash as being iterated so that entries are not moved between
+ * bins; used by NIH_HASH_FOREACH() and NIH_HASH_FOREACH_SAFE() and
+ * undone by _nih_hash_iter_end() when the loop exits.
+ *
+ * Returns: @hash.
+ **/
+NihHash *
+_nih_hash_iter_begin (NihHash *hash)
+{
+	nih_assert (hash != NULL);
+
+	hash->iterating++;
+
+	return hash;
+}
+
+/**
+ * _nih_hash_iter_end:
+ * @hash: pointer to hash table being iterated.
+ *
+ * Undoes _nih_hash_iter_begin() for the hash table pointed to by @hash,
+ * called when the variable holding it goes out of scope.
+ **/
+void
+_nih_hash_iter_end (NihHash **hash)
+{
+	nih_assert (hash != NULL);
+	nih_assert (*hash != NULL);
+	nih_assert ((*hash)->iterating > 0);
+
+	(*hash)->iterating--;
+}
@@ -37,6 +37,12 @@
  * one found as the first member in the structure after the list head.
  * For this case, you may use nih_hash_string_new() instead.
  *
+ * String keys are hashed by nih_hash_string_hash() unless another function
+ * is selected with nih_hash_set_string_hash(); nih_hash_string_word_hash()
+ * hashes a word at a time so is faster for longer strings, and after
+ * nih_hash_seed_init() uses a seed chosen at random for the process so
+ * that untrusted names cannot be chosen to fall into the same bin.
+ *
  * Entries may be added to a hash table using nih_hash_add(), no assumption
  * is made about whether duplicate entries are permitted or not.  To add
  * and fail if the entry already exists use nih_hash_add_unique(), to add
@@ -47,6 +53,19 @@
  *
  * To lookup the first value nih_hash_lookup() is a convenient simpler
  * function.
+ *
+ * The number of bins grows as entries are added, the entries being moved
+ * to the new bins a few at a time by subsequent additions and lookups so
+ * that no single call has to move them all.  Since entries may be removed
+ * with nih_list_remove() without the hash table knowing, it counts them
+ * again before deciding whether to grow.
+ *
+ * A hash table created with nih_hash_cached_new() instead requires each
+ * member to begin with an NihHashEntry rather than an NihList, which
+ * stores the hash of the member's key when it is added.  Lookups compare
+ * the stored hash before calling the key and comparison functions, and
+ * members need not be hashed again when the table grows.  For string
+ * keys following the NihHashEntry, use nih_hash_string_cached_new().
  **/
 
 #include <nih/macros.h>
@@ -88,13 +107,38 @@ typedef uint32_t (*NihHashFunction) (const void *key);
 typedef int (*NihCmpFunction) (const void *key1, const void *key2);
 
 
+/**
+ * NihHashEntry:
+ * @entry: list header,
+ * @hash: 32-bit hash of the key.
+ *
+ * This structure is placed at the start of members of hash tables created
+ * with nih_hash_cached_new(), in place of the NihList header; @hash is set
+ * when the member is added and should not be changed.  As with NihList,
+ * a member can be removed with nih_list_remove() on @entry.
+ **/
+typedef struct nih_hash_entry {
+	NihList  entry;
+	uint32_t hash;
+} NihHashEntry;
+
+
 /**
  * NihHash:
  * @bins: array of bins,
  * @size: size of bins array,
  * @key_function: function used to obtain keys for entries,
  * @hash_function: function used to obtain hash of keys,
- * @cmp_function: function used to compare keys.
+ * @cmp_function: function used to compare keys,
+ * @cached: TRUE if members begin with an NihHashEntry,
+ * @old_bins: array of bins entries are being moved from, or NULL,
+ * @old_size: size of old_bins array, or zero,
+ * @moved: number of old bins moved so far,
+ * @entries: estimated number of entries,
+ * @scanning: TRUE while counting entries,
+ * @scanned: number of bins counted so far,
+ * @scan_entries: number of entries in those bins,
+ * @iterating: number of iterations in progress.
  *
  * This structure represents a hash table which is more efficient for
  * looking up members than an ordinary list.
@@ -102,6 +146,10 @@ typedef int (*NihCmpFunction) (const void *key1, const void *key2);
  * Individual members of the hash table are NihList members as are the
  * bins themselves, so to remove an entry from the table you can just
  * use nih_list_remove().
+ *
+ * While the table is growing, entries may be in either @bins or
+ * @old_bins; the remaining members are private and should not be used
+ * directly.
  **/
 typedef struct nih_hash {
 	NihList         *bins;
@@ -110,9 +158,50 @@ typedef struct nih_hash {
 	NihKeyFunction   key_function;
 	NihHashFunction  hash_function;
 	NihCmpFunction   cmp_function;
+	int              cached;
+
+	NihList         *old_bins;
+	size_t           old_size;
+	size_t           moved;
+
+	size_t           entries;
+	int              scanning;
+	size_t           scanned;
+	size_t           scan_entries;
+
+	unsigned int     iterating;
 } NihHash;
 
 
+/**
+ * _NIH_HASH_BIN:
+ * @hash: hash table,
+ * @i: index.
+ *
+ * Expands to the @i'th bin of @hash for iteration, counting the bins
+ * being moved from before the current ones.
+ **/
+#define _NIH_HASH_BIN(hash, i)						\
+	((i) < (hash)->old_size ? &(hash)->old_bins[(i)]		\
+	 : &(hash)->bins[(i) - (hash)->old_size])
+
+/**
+ * _NIH_HASH_ITER:
+ * @hash: hash table to iterate,
+ * @iter: name of iterator variable.
+ *
+ * Expands to a for statement that executes once, marking @hash as being
+ * iterated until it exits so that entries are not moved between bins
+ * during iteration.  Variables named _@iter_hash and _@iter_once are
+ * used.
+ **/
+#define _NIH_HASH_ITER(hash, iter)					\
+	for (NihHash *_##iter##_hash					\
+		     __attribute__((cleanup(_nih_hash_iter_end)))	\
+		     = _nih_hash_iter_begin (hash),			\
+		     *_##iter##_once = _##iter##_hash;			\
+	     _##iter##_once; _##iter##_once = NULL)
+
 /**
  * NIH_HASH_FOREACH:
  * @hash: hash table to iterate,
@@ -121,7 +210,8 @@ typedef struct nih_hash {
  * Expands to nested for statements that iterate over each entry in each
  * bin of @hash, except the bin head pointer, setting @iter to each entry
  * for the block within the loop.  A variable named _@iter_i is used to
- * iterate the hash bins.
+ * iterate the hash bins, and entries are not moved between bins until
+ * the loop exits.
  *
  * This is the cheapest form of iteration, however it is not safe to perform
  * various modifications to the hash; most importantly, you must not change
@@ -132,9 +222,11 @@ typedef struct nih_hash {
  * is safe to traverse or iterate the hash again while iterating.
  **/
 #define NIH_HASH_FOREACH(hash, iter)					\
-	for (size_t _##iter##_i = 0; _##iter##_i < (hash)->size;	\
+	_NIH_HASH_ITER (hash, iter)					\
+	for (size_t _##iter##_i = 0;					\
+	     _##iter##_i < (hash)->old_size + (hash)->size;		\
 	     _##iter##_i++)						\
-		NIH_LIST_FOREACH (&(hash)->bins[_##iter##_i], iter)
+		NIH_LIST_FOREACH (_NIH_HASH_BIN (hash, _##iter##_i), iter)
 
 /**
  * NIH_HASH_FOREACH_SAFE:
@@ -144,7 +236,8 @@ typedef struct nih_hash {
  * Expands to nested for statements that iterate over each entry in each
  * bin of @hash, except for the bin head pointer, setting @iter to each
  * entry for the block within the loop.  A variable named _@iter_i is used
- * to iterate the hash bins.
+ * to iterate the hash bins, and entries are not moved between bins until
+ * the loop exits.
  *
  * The iteration is performed safely by placing a cursor node after @iter;
  * this means that any node including @iter can be removed from the hash,
@@ -161,9 +254,12 @@ typedef struct nih_hash {
  * of a node, you must use NIH_HASH_FOREACH().
  **/
 #define NIH_HASH_FOREACH_SAFE(hash, iter)				\
-	for (size_t _##iter##_i = 0; _##iter##_i < (hash)->size;	\
+	_NIH_HASH_ITER (hash, iter)					\
+	for (size_t _##iter##_i = 0;					\
+	     _##iter##_i < (hash)->old_size + (hash)->size;		\
 	     _##iter##_i++)						\
-		NIH_LIST_FOREACH_SAFE (&(hash)->bins[_##iter##_i], iter)
+		NIH_LIST_FOREACH_SAFE (_NIH_HASH_BIN (hash, _##iter##_i), \
+				       iter)
 
 
 /**
@@ -177,7 +273,8 @@ typedef struct nih_hash {
  *
  * Individual members of the hash table are NihList member which have
  * a constant string as the first member that can be used as the hash key,
- * these will be compared case sensitively.
+ * these will be hashed by the function selected with
+ * nih_hash_set_string_hash() and compared case sensitively.
  *
  * The structure is allocated using nih_alloc() so it can be used as a
  * context to other allocations; there is no non-allocated version of this
@@ -193,17 +290,50 @@ typedef struct nih_hash {
 #define nih_hash_string_new(parent, entries)		     \
 	nih_hash_new (parent, entries,			     \
 		      (NihKeyFunction)nih_hash_string_key,   \
-		      (NihHashFunction)nih_hash_string_hash, \
+		      nih_hash_string_function,		     \
 		      (NihCmpFunction)nih_hash_string_cmp)
 
+/**
+ * nih_hash_string_cached_new:
+ * @parent: parent of new hash,
+ * @entries: rough number of entries expected,
+ *
+ * Allocates a new hash table, the number of buckets selected is a prime
+ * number that is no larger than @entries; this should be set to a rough
+ * number of expected entries to ensure optimum distribution.
+ *
+ * Individual members of the hash table begin with an NihHashEntry which
+ * is followed by a constant string that can be used as the hash key,
+ * these will be compared case sensitively only when their hashes match.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned hash table.  When all parents
+ * of the returned hash table are freed, the returned hash table will also be
+ * freed.
+ *
+ * Returns: the new hash table or NULL if the allocation failed.
+ **/
+#define nih_hash_string_cached_new(parent, entries)		\
+	nih_hash_cached_new (parent, entries,			\
+			     (NihKeyFunction)nih_hash_entry_string_key, \
+			     nih_hash_string_function,		\
+			     (NihCmpFunction)nih_hash_string_cmp)
+
 
 NIH_BEGIN_EXTERN
 
+extern NihHashFunction nih_hash_string_function;
+
 NihHash *   nih_hash_new          (const void *parent, size_t entries,
 				   NihKeyFunction key_function,
 				   NihHashFunction hash_function,
 				   NihCmpFunction cmp_function)
 	__attribute__ ((warn_unused_result, malloc));
+NihHash *   nih_hash_cached_new   (const void *parent, size_t entries,
+				   NihKeyFunction key_function,
+				   NihHashFunction hash_function,
+				   NihCmpFunction cmp_function)
+	__attribute__ ((warn_unused_result, malloc));
 
 NihList *   nih_hash_add          (NihHash *hash, NihList *entry);
 NihList *   nih_hash_add_unique   (NihHash *hash, NihList *entry);
@@ -214,9 +344,17 @@ NihList *   nih_hash_search       (NihHash *hash, const void *key,
 NihList *   nih_hash_lookup       (NihHash *hash, const void *key);
 
 const char *nih_hash_string_key   (NihList *entry);
+const char *nih_hash_entry_string_key (NihList *entry);
 uint32_t    nih_hash_string_hash  (const char *key);
+uint32_t    nih_hash_string_word_hash (const char *key);
 int         nih_hash_string_cmp   (const char *key1, const char *key2);
 
+void        nih_hash_set_string_hash (NihHashFunction hash_function);
+void        nih_hash_seed_init    (void);
+
+NihHash *   _nih_hash_iter_begin  (NihHash *hash);
+void        _nih_hash_iter_end    (NihHash **hash);
+
 NIH_END_EXTERN
 
 #endif /* NIH_HASH_H */
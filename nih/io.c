@@ -25,9 +25,11 @@
 
 
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -38,6 +40,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -51,17 +54,152 @@
 #include "io.h"
 
 
+/**
+ * NIH_IO_EPOLL_EVENTS:
+ *
+ * Maximum number of ready descriptors retrieved from the kernel by a
+ * single call to nih_io_epoll_wait().
+ **/
+#define NIH_IO_EPOLL_EVENTS 64
+
+/**
+ * NIH_IO_FDS_PAGE:
+ *
+ * Number of NihIoFd structures allocated at once.
+ **/
+#define NIH_IO_FDS_PAGE 256
+
+/**
+ * NIH_IO_WRITEV_MAX:
+ *
+ * Maximum number of pieces of data sent by a single call to writev().
+ **/
+#define NIH_IO_WRITEV_MAX 64
+
+/**
+ * NIH_IO_SENDMMSG_MAX:
+ *
+ * Maximum number of messages sent by a single call to sendmmsg().
+ **/
+#define NIH_IO_SENDMMSG_MAX 64
+
+/**
+ * NIH_IO_RECORDS_MAX:
+ *
+ * Maximum number of records handed to an NihIoRecordReader at once.
+ **/
+#define NIH_IO_RECORDS_MAX 64
+
+/**
+ * NIH_IO_RECV_CONTROL:
+ *
+ * Space for control messages in each slot of an NihIoRecvBatch.
+ **/
+#define NIH_IO_RECV_CONTROL BUFSIZ
+
+/**
+ * NIH_IO_RECV_DEFAULT:
+ *
+ * Size of each slot of an NihIoRecvBatch when none is given, the largest
+ * datagram that can be received on an internet socket.
+ **/
+#define NIH_IO_RECV_DEFAULT 65535
+
+
+/**
+ * NihIoFd:
+ * @entry: list header, used when @fd cannot be polled,
+ * @fd: file descriptor,
+ * @watches: watches on @fd, linked by their fd_entry member,
+ * @events: events currently registered with the epoll instance,
+ * @pollable: FALSE if the kernel refused to register @fd.
+ *
+ * This structure aggregates all of the watches on a single file descriptor
+ * since the kernel only permits one epoll registration per descriptor; it
+ * is pointed to by the registration so that ready events can be dispatched
+ * directly to the interested watches.
+ *
+ * These are allocated in pages that are never freed or moved, since the
+ * kernel may still hold a pointer to them in an event that has not yet
+ * been dispatched.
+ **/
+typedef struct nih_io_fd {
+	NihList     entry;
+	int         fd;
+	NihList     watches;
+	NihIoEvents events;
+	int         pollable;
+} NihIoFd;
+
+/**
+ * NihIoRecvBatch:
+ * @slots: number of slots,
+ * @size: space for data in each slot,
+ * @addrlen: space for the address in each slot,
+ * @msgs: headers of each slot passed to recvmmsg(),
+ * @iov: data of each slot,
+ * @addrs: address of each slot,
+ * @control: control messages of each slot, NIH_IO_RECV_CONTROL apiece,
+ * @data: data of each slot, @size apiece.
+ *
+ * This structure holds the slots into which messages are received by a
+ * single call to recvmmsg(); it's allocated once and reused for each
+ * call, with the messages copied out of it into the receive queue.
+ **/
+struct nih_io_recv_batch {
+	size_t                   slots;
+	size_t                   size;
+	socklen_t                addrlen;
+
+	struct mmsghdr          *msgs;
+	struct iovec            *iov;
+	struct sockaddr_storage *addrs;
+	char                    *control;
+	char                    *data;
+};
+
+
 /* Prototypes for static functions */
+static int            nih_io_watch_destroy  (NihIoWatch *watch);
+static int            nih_io_buffer_slide   (NihIoBuffer *buffer,
+					     size_t new_len);
+static NihIoFd *      nih_io_fd_lookup      (int fd)
+	__attribute__ ((warn_unused_result));
+static NihIoEvents    nih_io_fd_wanted      (NihIoFd *fd_rec);
+static void           nih_io_fd_event       (NihIoFd *fd_rec,
+					     NihIoEvents events,
+					     struct epoll_event *event);
+static int            nih_io_fd_update      (NihIoFd *fd_rec);
+static void           nih_io_fd_reset       (NihIoFd *fd_rec);
+static int            nih_io_fd_dispatch    (NihIoFd *fd_rec,
+					     NihIoEvents events);
 static void           nih_io_watcher        (NihIo *io, NihIoWatch *watch,
 					     NihIoEvents events);
 static inline ssize_t nih_io_watcher_read   (NihIo *io, NihIoWatch *watch)
 	__attribute__ ((warn_unused_result));
 static inline ssize_t nih_io_watcher_write  (NihIo *io, NihIoWatch *watch)
 	__attribute__ ((warn_unused_result));
+static void           nih_io_watcher_records (NihIo *io, int *caught_free);
+static NihIoChunk *   nih_io_chunk_new      (NihIo *io, size_t room)
+	__attribute__ ((warn_unused_result, malloc));
+static int            nih_io_chunk_copy     (NihIo *io, const char *str,
+					     size_t len)
+	__attribute__ ((warn_unused_result));
+static ssize_t        nih_io_chunk_writev   (NihIo *io, int fd)
+	__attribute__ ((warn_unused_result));
+static socklen_t      nih_io_family_addrlen (int family);
+static NihIoMessage * nih_io_message_recv_family (const void *parent, int fd,
+						  int family, size_t *len)
+	__attribute__ ((warn_unused_result, malloc));
+static ssize_t        nih_io_message_recv_batch (NihIo *io, int fd)
+	__attribute__ ((warn_unused_result));
+static ssize_t        nih_io_message_send_batch (NihIo *io, int fd)
+	__attribute__ ((warn_unused_result));
 static void           nih_io_closed         (NihIo *io);
 static void           nih_io_error          (NihIo *io);
 static void           nih_io_shutdown_check (NihIo *io);
 static NihIoMessage * nih_io_first_message  (NihIo *io);
+static void           nih_io_fork_child     (void);
 
 
 /**
@@ -73,17 +211,91 @@ static NihIoMessage * nih_io_first_message  (NihIo *io);
  **/
 NihList *nih_io_watches = NULL;
 
+/**
+ * nih_io_forks:
+ *
+ * Incremented in the child process each time the process calls fork()
+ * once nih_io_init() has been called, so that a descriptor the child
+ * shares with its parent, such as an epoll instance, can be recognised
+ * by comparing this against the value recorded when it was created.
+ * Starts at one, so that a recorded value of zero never matches.
+ **/
+unsigned int nih_io_forks = 1;
+
+/**
+ * nih_io_fds:
+ *
+ * Array of pages of NihIoFd structures indexed by file descriptor, each
+ * page holds NIH_IO_FDS_PAGE structures and is allocated when a watch is
+ * first added for a descriptor within it; @nih_io_fds_pages contains the
+ * number of entries in the array.
+ **/
+static NihIoFd **nih_io_fds = NULL;
+static int       nih_io_fds_pages = 0;
+
+/**
+ * nih_io_unpollable:
+ *
+ * List of NihIoFd structures for descriptors that the kernel refused to
+ * register with the epoll instance, such as regular files.  These are
+ * always treated as ready, just as select() would.
+ **/
+static NihList *nih_io_unpollable = NULL;
+
+/**
+ * nih_io_epoll:
+ *
+ * epoll instance that all watches are registered with, created by
+ * nih_io_epoll_fd() when @nih_io_forks had the value in
+ * @nih_io_epoll_forks.  Set to -2 if the instance could not be created,
+ * in which case callers must fall back to nih_io_select_fds().  Setting
+ * @nih_io_epoll_forks to zero causes a new instance to be created when
+ * next used.
+ **/
+static int          nih_io_epoll = -1;
+static unsigned int nih_io_epoll_forks = 0;
+
 
 /**
  * nih_io_init:
  *
- * Initialise the list of I/O watches.
+ * Initialise the list of I/O watches, and arrange for @nih_io_forks to be
+ * incremented in the child process after fork().
  **/
 void
 nih_io_init (void)
 {
+	static int atfork = FALSE;
+
+	if (! atfork) {
+		NIH_ZERO (pthread_atfork (NULL, NULL, nih_io_fork_child));
+		atfork = TRUE;
+	}
+
 	if (! nih_io_watches)
 		nih_io_watches = NIH_MUST (nih_list_new (NULL));
+
+	if (! nih_io_unpollable)
+		nih_io_unpollable = NIH_MUST (nih_list_new (NULL));
+
+	/* Allocate the first page of descriptors now, since there's
+	 * almost always going to be something watched within it.
+	 */
+	if (! nih_io_fds)
+		NIH_MUST (nih_io_fd_lookup (0));
+}
+
+/**
+ * nih_io_fork_child:
+ *
+ * Called in the child process after fork() to increment @nih_io_forks,
+ * so that descriptors shared with the parent are replaced when next used
+ * without each of their users having to call getpid() to find out.
+ **/
+static void
+nih_io_fork_child (void)
+{
+	nih_io_forks++;
 }
 
 /**
@@ -120,6 +332,7 @@ nih_io_add_watch (const void   *parent,
 		  void         *data)
 {
 	NihIoWatch *watch;
+	NihIoFd *   fd_rec;
 
 	nih_assert (fd >= 0);
 	nih_assert (watcher != NULL);
@@ -131,8 +344,9 @@ nih_io_add_watch (const void   *parent,
 		return NULL;
 
 	nih_list_init (&watch->entry);
+	nih_list_init (&watch->fd_entry);
 
-	nih_alloc_set_destructor (watch, nih_list_destroy);
+	nih_alloc_set_destructor (watch, nih_io_watch_destroy);
 
 	watch->fd = fd;
 	watch->events = events;
@@ -140,11 +354,370 @@ nih_io_add_watch (const void   *parent,
 	watch->watcher = watcher;
 	watch->data = data;
 
+	fd_rec = nih_io_fd_lookup (fd);
+	if (! fd_rec) {
+		nih_free (watch);
+		return NULL;
+	}
+
 	nih_list_add (nih_io_watches, &watch->entry);
+	nih_list_add (&fd_rec->watches, &watch->fd_entry);
+
+	if (nih_io_fd_update (fd_rec) < 0) {
+		nih_free (watch);
+		return NULL;
+	}
 
 	return watch;
 }
 
+/**
+ * nih_io_watch_destroy:
+ * @watch: watch to be destroyed.
+ *
+ * Removes @watch from the list of watches and from the set of watches on
+ * its file descriptor, updating the events the kernel reports for it.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_io_watch_destroy (NihIoWatch *watch)
+{
+	nih_assert (watch != NULL);
+
+	nih_list_destroy (&watch->entry);
+
+	if (! NIH_LIST_EMPTY (&watch->fd_entry)) {
+		nih_list_destroy (&watch->fd_entry);
+
+		/* Failure only leaves us interested in more than we
+		 * need to be, which is corrected when an event arrives.
+		 */
+		nih_io_fd_update (nih_io_fd_lookup (watch->fd));
+	}
+
+	return 0;
+}
+
+/**
+ * nih_io_watch_update:
+ * @watch: watch that has changed.
+ *
+ * This function must be called whenever the events member of @watch has
+ * been modified, or the watch has been placed back into the list of
+ * watches after being removed, so that the kernel is told which events
+ * are now of interest.
+ *
+ * Removing a watch from the list, or removing events from it, is noticed
+ * without calling this function but calling it avoids a spurious wakeup.
+ **/
+void
+nih_io_watch_update (NihIoWatch *watch)
+{
+	nih_assert (watch != NULL);
+	nih_assert (! NIH_LIST_EMPTY (&watch->fd_entry));
+
+	/* Failure leaves the previous registration in place, which
+	 * we can do nothing about other than report it.
+	 */
+	if (nih_io_fd_update (nih_io_fd_lookup (watch->fd)) < 0)
+		nih_warn ("%s: %s", _("Unable to update I/O watch"),
+			  strerror (errno));
+}
+
+
+/**
+ * nih_io_fd_lookup:
+ * @fd: file descriptor.
+ *
+ * Looks up the NihIoFd structure for @fd, allocating the page containing
+ * it if necessary.  This always succeeds for a descriptor that has a watch
+ * on it.
+ *
+ * Returns: structure for @fd, or NULL if insufficient memory.
+ **/
+static NihIoFd *
+nih_io_fd_lookup (int fd)
+{
+	NihIoFd *page;
+	int      page_num, i;
+
+	nih_assert (fd >= 0);
+
+	page_num = fd / NIH_IO_FDS_PAGE;
+	if (page_num >= nih_io_fds_pages) {
+		NihIoFd **new_fds;
+		int       new_pages;
+
+		new_pages = nih_max (nih_io_fds_pages * 2, page_num + 1);
+
+		new_fds = nih_realloc (nih_io_fds, NULL,
+				       sizeof (NihIoFd *) * new_pages);
+		if (! new_fds)
+			return NULL;
+
+		memset (new_fds + nih_io_fds_pages, 0,
+			sizeof (NihIoFd *) * (new_pages - nih_io_fds_pages));
+
+		nih_io_fds = new_fds;
+		nih_io_fds_pages = new_pages;
+	}
+
+	if (nih_io_fds[page_num])
+		return &nih_io_fds[page_num][fd % NIH_IO_FDS_PAGE];
+
+	page = nih_alloc (nih_io_fds, sizeof (NihIoFd) * NIH_IO_FDS_PAGE);
+	if (! page)
+		return NULL;
+
+	for (i = 0; i < NIH_IO_FDS_PAGE; i++) {
+		nih_list_init (&page[i].entry);
+		page[i].fd = page_num * NIH_IO_FDS_PAGE + i;
+		nih_list_init (&page[i].watches);
+		page[i].events = NIH_IO_NONE;
+		page[i].pollable = TRUE;
+	}
+
+	nih_io_fds[page_num] = page;
+
+	return &page[fd % NIH_IO_FDS_PAGE];
+}
+
+/**
+ * nih_io_fd_wanted:
+ * @fd_rec: descriptor to check.
+ *
+ * Returns: events that the watches in the list on @fd_rec are
+ * interested in.
+ **/
+static NihIoEvents
+nih_io_fd_wanted (NihIoFd *fd_rec)
+{
+	NihIoEvents events;
+
+	nih_assert (fd_rec != NULL);
+
+	events = NIH_IO_NONE;
+	NIH_LIST_FOREACH (&fd_rec->watches, iter) {
+		NihIoWatch *watch = NIH_LIST_ITER (iter, NihIoWatch, fd_entry);
+
+		if (! NIH_LIST_EMPTY (&watch->entry))
+			events |= watch->events;
+	}
+
+	return events;
+}
+
+/**
+ * nih_io_fd_event:
+ * @fd_rec: descriptor to register,
+ * @events: events to register for,
+ * @event: structure to fill.
+ *
+ * Fills @event with the registration of @fd_rec for @events with the
+ * epoll instance.
+ **/
+static void
+nih_io_fd_event (NihIoFd            *fd_rec,
+		 NihIoEvents         events,
+		 struct epoll_event *event)
+{
+	nih_assert (fd_rec != NULL);
+	nih_assert (event != NULL);
+
+	memset (event, 0, sizeof (struct epoll_event));
+	if (events & NIH_IO_READ)
+		event->events |= EPOLLIN;
+	if (events & NIH_IO_WRITE)
+		event->events |= EPOLLOUT;
+	if (events & NIH_IO_EXCEPT)
+		event->events |= EPOLLPRI;
+	event->data.ptr = fd_rec;
+}
+
+/**
+ * nih_io_fd_update:
+ * @fd_rec: descriptor to update.
+ *
+ * Calculates the events that the watches in the list on @fd_rec are
+ * interested in, and if that differs from the events registered with
+ * the epoll instance, modifies the registration.
+ *
+ * Descriptors that cannot be polled, such as regular files, are placed
+ * in a separate list and always treated as being ready, since that is
+ * how select() treats them; so are any that the kernel refuses to
+ * register for reasons other than a lack of resources.
+ *
+ * Returns: zero on success, negative value with errno set if the kernel
+ * lacked the resources to register the descriptor.
+ **/
+static int
+nih_io_fd_update (NihIoFd *fd_rec)
+{
+	struct epoll_event event;
+	NihIoEvents        events;
+	int                epoll_fd, op;
+
+	nih_assert (fd_rec != NULL);
+
+	events = nih_io_fd_wanted (fd_rec);
+	if (events == fd_rec->events)
+		return 0;
+
+	epoll_fd = nih_io_epoll_fd ();
+	if ((epoll_fd < 0) || (! fd_rec->pollable)) {
+		/* Once nothing is interested, the descriptor number may be
+		 * reused for something we can poll.
+		 */
+		if (! events) {
+			nih_list_remove (&fd_rec->entry);
+			fd_rec->pollable = TRUE;
+		}
+
+		fd_rec->events = events;
+		return 0;
+	}
+
+	nih_io_fd_event (fd_rec, events, &event);
+
+	if (! events) {
+		op = EPOLL_CTL_DEL;
+	} else if (! fd_rec->events) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	if (epoll_ctl (epoll_fd, op, fd_rec->fd, &event) < 0) {
+		/* The descriptor may have been closed and reopened behind
+		 * our back, in which case the kernel dropped or kept the
+		 * old registration and we just need to switch operation.
+		 */
+		if ((op == EPOLL_CTL_MOD) && (errno == ENOENT)) {
+			op = EPOLL_CTL_ADD;
+		} else if ((op == EPOLL_CTL_ADD) && (errno == EEXIST)) {
+			op = EPOLL_CTL_MOD;
+		} else {
+			op = -1;
+		}
+
+		if ((op < 0) || (epoll_ctl (epoll_fd, op, fd_rec->fd,
+					    &event) < 0)) {
+			/* Running out of resources is temporary, so leave
+			 * things as they were for the caller to retry.
+			 * Failing to remove a registration is corrected
+			 * by nih_io_fd_reset() should it ever wake us.
+			 * Anything else means we can't poll the descriptor
+			 * (EPERM for regular files, EBADF if it's already
+			 * closed) so it's treated as always ready, which
+			 * hands the problem to its watchers.
+			 */
+			if ((errno == ENOMEM) || (errno == ENOSPC)) {
+				return -1;
+			} else if (events) {
+				fd_rec->pollable = FALSE;
+				nih_list_add (nih_io_unpollable,
+					      &fd_rec->entry);
+			}
+		}
+	}
+
+	fd_rec->events = events;
+
+	return 0;
+}
+
+/**
+ * nih_io_fd_reset:
+ * @fd_rec: descriptor to reset.
+ *
+ * Called when the epoll instance reports events for @fd_rec that no
+ * watch is interested in, meaning that its registration isn't what we
+ * think it is; most likely the descriptor was closed before its last
+ * watch was freed while a duplicate of it remained open, so the kernel
+ * kept the registration and we couldn't remove it.
+ *
+ * The registration is replaced with one for the events that are wanted,
+ * or removed if none are; should that fail, a new epoll instance is
+ * created when next used so that the old registration is lost with the
+ * old instance.
+ **/
+static void
+nih_io_fd_reset (NihIoFd *fd_rec)
+{
+	struct epoll_event event;
+	NihIoEvents        events;
+	int                epoll_fd;
+
+	nih_assert (fd_rec != NULL);
+
+	events = nih_io_fd_wanted (fd_rec);
+	if ((events != fd_rec->events) || (! fd_rec->pollable)) {
+		nih_io_fd_update (fd_rec);
+		return;
+	}
+
+	epoll_fd = nih_io_epoll_fd ();
+	if (epoll_fd < 0)
+		return;
+
+	nih_io_fd_event (fd_rec, events, &event);
+
+	if (epoll_ctl (epoll_fd, events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL,
+		       fd_rec->fd, &event) < 0)
+		nih_io_epoll_forks = 0;
+}
+
+/**
+ * nih_io_fd_dispatch:
+ * @fd_rec: descriptor events occurred on,
+ * @events: events that occurred.
+ *
+ * Calls the watcher of each watch in the list on @fd_rec that is
+ * interested in any of @events.
+ *
+ * The list is walked using a cursor that is itself an inactive watch,
+ * so that watchers may remove any watch on the same descriptor or cause
+ * the list to be walked again by nih_io_fd_update().
+ *
+ * Returns: TRUE if any watcher was called, FALSE otherwise.
+ **/
+static int
+nih_io_fd_dispatch (NihIoFd     *fd_rec,
+		    NihIoEvents  events)
+{
+	NihIoWatch  cursor;
+	NihList    *iter;
+	int         handled = FALSE;
+
+	nih_assert (fd_rec != NULL);
+
+	nih_list_init (&cursor.entry);
+	nih_list_init (&cursor.fd_entry);
+	cursor.events = NIH_IO_NONE;
+
+	iter = fd_rec->watches.next;
+	while (iter != &fd_rec->watches) {
+		NihIoWatch *watch = NIH_LIST_ITER (iter, NihIoWatch, fd_entry);
+
+		nih_list_add_after (iter, &cursor.fd_entry);
+
+		if ((! NIH_LIST_EMPTY (&watch->entry))
+		    && (watch->events & events)) {
+			handled = TRUE;
+			watch->watcher (watch->data, watch,
+					watch->events & events);
+		}
+
+		iter = cursor.fd_entry.next;
+		nih_list_remove (&cursor.fd_entry);
+	}
+
+	return handled;
+}
+
 
 /**
  * nih_io_select_fds:
@@ -239,6 +812,155 @@ nih_io_handle_fds (fd_set *readfds,
 }
 
 
+/**
+ * nih_io_epoll_fd:
+ *
+ * Returns the epoll instance that watches are registered with, creating
+ * it if necessary.  Since an epoll instance is shared with any child
+ * process after fork(), a child gets a new instance the first time this
+ * is called and all existing watches are registered with it.
+ *
+ * Returns: epoll file descriptor, or negative value if epoll cannot be
+ * used and nih_io_select_fds() should be used instead.
+ **/
+int
+nih_io_epoll_fd (void)
+{
+	int old_fd, page_num, i;
+
+	if (nih_io_epoll == -2)
+		return -1;
+
+	if ((nih_io_epoll >= 0) && (nih_io_epoll_forks == nih_io_forks))
+		return nih_io_epoll;
+
+	/* Make sure a fork() is noticed before there's an instance to
+	 * share.
+	 */
+	nih_io_init ();
+
+	/* Create the new instance before closing any old one so the
+	 * descriptor number always changes.
+	 */
+	old_fd = nih_io_epoll;
+	nih_io_epoll = epoll_create1 (EPOLL_CLOEXEC);
+	if (old_fd >= 0)
+		close (old_fd);
+
+	if (nih_io_epoll < 0) {
+		nih_io_epoll = -2;
+		return -1;
+	}
+
+	nih_io_epoll_forks = nih_io_forks;
+
+	/* Register everything again, by forgetting what we registered
+	 * with the old instance.
+	 */
+	for (page_num = 0; page_num < nih_io_fds_pages; page_num++) {
+		if (! nih_io_fds[page_num])
+			continue;
+
+		for (i = 0; i < NIH_IO_FDS_PAGE; i++) {
+			NihIoFd *fd_rec = &nih_io_fds[page_num][i];
+
+			if (! fd_rec->events)
+				continue;
+
+			if (! fd_rec->pollable) {
+				nih_list_remove (&fd_rec->entry);
+				fd_rec->pollable = TRUE;
+			}
+
+			fd_rec->events = NIH_IO_NONE;
+			if (nih_io_fd_update (fd_rec) < 0)
+				nih_warn ("%s: %s",
+					  _("Unable to update I/O watch"),
+					  strerror (errno));
+		}
+	}
+
+	return nih_io_epoll;
+}
+
+/**
+ * nih_io_epoll_wait:
+ * @timeout: maximum time to wait in milliseconds, or -1 for no limit.
+ *
+ * Waits up to @timeout milliseconds for events to occur on any of the
+ * watches registered with the epoll instance returned by nih_io_epoll_fd(),
+ * and calls the watcher of each watch interested in them.  Unlike
+ * nih_io_handle_fds() only watches on descriptors that are ready are
+ * examined.
+ *
+ * Other descriptors may be registered with the epoll instance to interrupt
+ * the wait provided that their data pointer is NULL; no attempt is made to
+ * clear their events.
+ *
+ * It is safe for watches to remove the watch, or any other watch, during
+ * their call.
+ *
+ * Returns: number of descriptors that were ready, or negative value with
+ * errno set on failure.
+ **/
+int
+nih_io_epoll_wait (int timeout)
+{
+	struct epoll_event events[NIH_IO_EPOLL_EVENTS];
+	int                epoll_fd, nevents, i;
+
+	nih_io_init ();
+
+	epoll_fd = nih_io_epoll_fd ();
+	nih_assert (epoll_fd >= 0);
+
+	/* Don't sleep when there are descriptors that are always ready */
+	if (! NIH_LIST_EMPTY (nih_io_unpollable))
+		timeout = 0;
+
+	nevents = epoll_wait (epoll_fd, events, NIH_IO_EPOLL_EVENTS, timeout);
+	if (nevents < 0)
+		return -1;
+
+	for (i = 0; i < nevents; i++) {
+		NihIoFd     *fd_rec = events[i].data.ptr;
+		NihIoEvents  ready;
+		int          handled;
+
+		if (! fd_rec)
+			continue;
+
+		/* Match the conditions under which select() considers a
+		 * descriptor ready.
+		 */
+		ready = NIH_IO_NONE;
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			ready |= NIH_IO_READ;
+		if (events[i].events & (EPOLLOUT | EPOLLERR))
+			ready |= NIH_IO_WRITE;
+		if (events[i].events & EPOLLPRI)
+			ready |= NIH_IO_EXCEPT;
+
+		handled = nih_io_fd_dispatch (fd_rec, ready);
+
+		/* Nothing wanted the event, so a watch was removed or had
+		 * events taken away without telling us, or the registration
+		 * was left behind; fix it so we don't get woken again.
+		 */
+		if (! handled)
+			nih_io_fd_reset (fd_rec);
+	}
+
+	NIH_LIST_FOREACH_SAFE (nih_io_unpollable, iter) {
+		NihIoFd *fd_rec = (NihIoFd *)iter;
+
+		nih_io_fd_dispatch (fd_rec, NIH_IO_READ | NIH_IO_WRITE);
+	}
+
+	return nevents;
+}
+
+
 /**
  * nih_io_buffer_new:
  * @parent: parent object for new buffer.
@@ -270,9 +992,38 @@ nih_io_buffer_new (const void *parent)
 	buffer->size = 0;
 	buffer->len = 0;
 
+	buffer->offset = 0;
+	buffer->sliding = FALSE;
+
 	return buffer;
 }
 
+/**
+ * nih_io_buffer_set_sliding:
+ * @buffer: buffer to change.
+ *
+ * Arranges for bytes to be consumed from @buffer by advancing its buf
+ * member, rather than by moving the rest of the data up each time; the
+ * data is only moved back to the start of the allocation once at least
+ * as many bytes have been consumed as remain, so each byte is moved at
+ * most once on average.  The allocation is doubled whenever more room is
+ * needed, and is kept when the buffer empties so that it can be reused;
+ * call nih_io_buffer_resize() with zero to release it.
+ *
+ * This suits the send and receive buffers of busy streams, where many
+ * small writes or lines are consumed from the front at a time.
+ *
+ * Note that the buf member of a sliding buffer may not be the start of
+ * its allocation, so must not be passed to nih_alloc functions.
+ **/
+void
+nih_io_buffer_set_sliding (NihIoBuffer *buffer)
+{
+	nih_assert (buffer != NULL);
+
+	buffer->sliding = TRUE;
+}
+
 /**
  * nih_io_buffer_resize:
  * @buffer: buffer to be resized,
@@ -281,7 +1032,8 @@ nih_io_buffer_new (const void *parent)
  * This function resizes the given @buffer so there is enough space for
  * both the current data and @grow additional bytes (which may be zero).
  * If there is more room than there needs to be, the buffer may actually
- * be decreased in size.
+ * be decreased in size; a sliding buffer is only decreased in size when
+ * it is empty and @grow is zero, in which case its memory is freed.
  *
  * Returns: zero on success, negative value if insufficient memory.
  **/
@@ -298,14 +1050,18 @@ nih_io_buffer_resize (NihIoBuffer *buffer,
 	if (! new_len) {
 		/* No bytes to store, so clean up the buffer */
 		if (buffer->buf)
-			nih_unref (buffer->buf, buffer);
+			nih_unref (buffer->buf - buffer->offset, buffer);
 
 		buffer->buf = NULL;
 		buffer->size = 0;
+		buffer->offset = 0;
 
 		return 0;
 	}
 
+	if (buffer->sliding)
+		return nih_io_buffer_slide (buffer, new_len);
+
 	/* Round buffer to next largest multiple of BUFSIZ */
 	new_size = ((new_len - 1) / BUFSIZ) * BUFSIZ + BUFSIZ;
 	if (new_size == buffer->size)
@@ -330,6 +1086,67 @@ nih_io_buffer_resize (NihIoBuffer *buffer,
 	return 0;
 }
 
+/**
+ * nih_io_buffer_slide:
+ * @buffer: sliding buffer to be resized,
+ * @new_len: number of bytes needed.
+ *
+ * Ensures that there is room for @new_len bytes beyond the buf member of
+ * the sliding @buffer, moving the data back to the start of the allocation
+ * if enough bytes have been consumed from it to make that worthwhile, and
+ * otherwise doubling the size of the allocation until there is.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+nih_io_buffer_slide (NihIoBuffer *buffer,
+		     size_t       new_len)
+{
+	char   *mem, *new_mem;
+	size_t  total, new_total;
+
+	nih_assert (buffer != NULL);
+	nih_assert (buffer->sliding);
+
+	if (new_len <= buffer->size)
+		return 0;
+
+	mem = buffer->buf ? buffer->buf - buffer->offset : NULL;
+	total = buffer->offset + buffer->size;
+
+	/* Move the data back to the start when at least as many bytes have
+	 * been consumed as need to be moved, or when the allocation has to
+	 * grow anyway, so that the consumed bytes aren't copied with it.
+	 */
+	if (buffer->offset
+	    && ((buffer->offset >= buffer->len) || (new_len > total))) {
+		memmove (mem, buffer->buf, buffer->len);
+
+		buffer->buf = mem;
+		buffer->size = total;
+		buffer->offset = 0;
+
+		if (new_len <= buffer->size)
+			return 0;
+	}
+
+	new_total = total ? total : BUFSIZ;
+	while (new_total - buffer->offset < new_len)
+		new_total *= 2;
+
+	new_mem = nih_realloc (mem, buffer, new_total);
+	if (! new_mem)
+		return -1;
+
+	/* Clear the new area, as above */
+	memset (new_mem + total, '\0', new_total - total);
+
+	buffer->buf = new_mem + buffer->offset;
+	buffer->size = new_total - buffer->offset;
+
+	return 0;
+}
+
 /**
  * nih_io_buffer_pop:
  * @parent: parent object for new object,
@@ -385,7 +1202,8 @@ nih_io_buffer_pop (const void  *parent,
  * @len: bytes to remove from the front.
  *
  * Removes @len bytes from the beginning of @buffer and moves the rest
- * of the data up to begin there.
+ * of the data up to begin there; for a sliding buffer, the start of the
+ * buffer is advanced past them instead.
  **/
 void
 nih_io_buffer_shrink (NihIoBuffer *buffer,
@@ -395,6 +1213,23 @@ nih_io_buffer_shrink (NihIoBuffer *buffer,
 
 	len = nih_min (len, buffer->len);
 
+	if (buffer->sliding) {
+		buffer->len -= len;
+
+		if (buffer->len) {
+			buffer->buf += len;
+			buffer->size -= len;
+			buffer->offset += len;
+		} else if (buffer->buf) {
+			/* Start again from the beginning */
+			buffer->buf -= buffer->offset;
+			buffer->size += buffer->offset;
+			buffer->offset = 0;
+		}
+
+		return;
+	}
+
 	memmove (buffer->buf, buffer->buf + len, buffer->len - len);
 	buffer->len -= len;
 
@@ -433,6 +1268,58 @@ nih_io_buffer_push (NihIoBuffer *buffer,
 	return 0;
 }
 
+/**
+ * nih_io_buffer_reserve:
+ * @buffer: buffer to extend,
+ * @min: bytes of room needed,
+ * @len: pointer to store room available in.
+ *
+ * Ensures that there are at least @min bytes of room at the end of
+ * @buffer, increasing the size if necessary, so that data may be read
+ * or written directly into it; the number of bytes of room, which may be
+ * more than @min, is stored in @len.
+ *
+ * Once data has been placed in the room, nih_io_buffer_commit() should
+ * be called to add it to the buffer.  The room is only valid until the
+ * buffer is next changed.
+ *
+ * Returns: start of the room, or NULL if insufficient memory.
+ **/
+char *
+nih_io_buffer_reserve (NihIoBuffer *buffer,
+		       size_t       min,
+		       size_t      *len)
+{
+	nih_assert (buffer != NULL);
+	nih_assert (min > 0);
+	nih_assert (len != NULL);
+
+	if (nih_io_buffer_resize (buffer, min) < 0)
+		return NULL;
+
+	*len = buffer->size - buffer->len;
+
+	return buffer->buf + buffer->len;
+}
+
+/**
+ * nih_io_buffer_commit:
+ * @buffer: buffer to extend,
+ * @len: bytes placed in room.
+ *
+ * Adds @len bytes placed in the room returned by nih_io_buffer_reserve()
+ * to the end of @buffer.
+ **/
+void
+nih_io_buffer_commit (NihIoBuffer *buffer,
+		      size_t       len)
+{
+	nih_assert (buffer != NULL);
+	nih_assert (len <= buffer->size - buffer->len);
+
+	buffer->len += len;
+}
+
 
 /**
  * nih_io_message_new:
@@ -577,6 +1464,53 @@ NihIoMessage *
 nih_io_message_recv  (const void *parent,
 		      int         fd,
 		      size_t     *len)
+{
+	nih_assert (fd >= 0);
+	nih_assert (len != NULL);
+
+	return nih_io_message_recv_family (parent, fd, nih_io_get_family (fd),
+					   len);
+}
+
+/**
+ * nih_io_family_addrlen:
+ * @family: family of socket.
+ *
+ * Returns: space needed for an address of a socket in @family, or zero
+ * if unknown.
+ **/
+static socklen_t
+nih_io_family_addrlen (int family)
+{
+	switch (family) {
+	case PF_UNIX:
+		return sizeof (struct sockaddr_un);
+	case PF_INET:
+		return sizeof (struct sockaddr_in);
+	case PF_INET6:
+		return sizeof (struct sockaddr_in6);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * nih_io_message_recv_family:
+ * @parent: parent object for new message,
+ * @fd: file descriptor to read from,
+ * @family: family of socket @fd,
+ * @len: number of bytes read.
+ *
+ * Receives a message on @fd as nih_io_message_recv() does, given the
+ * @family of the socket rather than querying it.
+ *
+ * Returns: new message, or NULL on raised error.
+ **/
+static NihIoMessage *
+nih_io_message_recv_family (const void *parent,
+			    int         fd,
+			    int         family,
+			    size_t     *len)
 {
 	NihIoMessage          *message;
 	nih_local NihIoBuffer *ctrl_buf = NULL;
@@ -598,19 +1532,7 @@ nih_io_message_recv  (const void *parent,
 		goto error;
 
 	/* Reserve enough space to hold the name based on the socket type */
-	switch (nih_io_get_family (fd)) {
-	case PF_UNIX:
-		message->addrlen = sizeof (struct sockaddr_un);
-		break;
-	case PF_INET:
-		message->addrlen = sizeof (struct sockaddr_in);
-		break;
-	case PF_INET6:
-		message->addrlen = sizeof (struct sockaddr_in6);
-		break;
-	default:
-		message->addrlen = 0;
-	}
+	message->addrlen = nih_io_family_addrlen (family);
 
 	if (message->addrlen) {
 		message->addr = nih_alloc (message, message->addrlen);
@@ -681,21 +1603,133 @@ nih_io_message_recv  (const void *parent,
 	     cmsg = CMSG_NXTHDR (&msghdr, cmsg)) {
 		size_t len;
 
-		len = cmsg->cmsg_len - CMSG_ALIGN (sizeof (struct cmsghdr));
-		NIH_ZERO (nih_io_message_add_control (message,
-						      cmsg->cmsg_level,
-						      cmsg->cmsg_type,
-						      len,
-						      CMSG_DATA (cmsg)));
+		len = cmsg->cmsg_len - CMSG_ALIGN (sizeof (struct cmsghdr));
+		NIH_ZERO (nih_io_message_add_control (message,
+						      cmsg->cmsg_level,
+						      cmsg->cmsg_type,
+						      len,
+						      CMSG_DATA (cmsg)));
+	}
+
+	return message;
+
+error:
+	nih_error_raise_system ();
+	if (message)
+		nih_free (message);
+	return NULL;
+}
+
+/**
+ * nih_io_message_recv_batch:
+ * @io: structure to receive messages for,
+ * @fd: file descriptor to read from.
+ *
+ * Receives as many messages from @fd as there are slots in the receive
+ * batch of @io with a single call to recvmmsg(), and copies each into
+ * a new NihIoMessage structure added to the receive queue of @io.
+ *
+ * Messages too large for their slot are discarded rather than being
+ * queued truncated, and the EMSGSIZE error is raised after the others
+ * have been queued.
+ *
+ * Returns: number of messages received, or negative value on raised error.
+ **/
+static ssize_t
+nih_io_message_recv_batch (NihIo *io,
+			   int    fd)
+{
+	NihIoRecvBatch *batch;
+	int             count, truncated = FALSE;
+	size_t          i;
+
+	nih_assert (io != NULL);
+	nih_assert (io->recv_batch != NULL);
+	nih_assert (fd >= 0);
+
+	batch = io->recv_batch;
+
+	for (i = 0; i < batch->slots; i++) {
+		struct msghdr *msghdr = &batch->msgs[i].msg_hdr;
+
+		msghdr->msg_namelen = batch->addrlen;
+		msghdr->msg_controllen = NIH_IO_RECV_CONTROL;
+		msghdr->msg_flags = 0;
+	}
+
+	count = recvmmsg (fd, batch->msgs, batch->slots, 0, NULL);
+	if (count < 0)
+		nih_return_system_error (-1);
+
+	/* The messages have been taken from the socket so we can't fail
+	 * now, copy each one out of its slot into the receive queue.
+	 */
+	for (i = 0; i < (size_t)count; i++) {
+		struct msghdr  *msghdr = &batch->msgs[i].msg_hdr;
+		NihIoMessage   *message;
+		struct cmsghdr *cmsg;
+
+		/* A message too large for its slot can't be received again
+		 * once taken, so rather than queue part of it we drop it,
+		 * closing any file descriptors it carried, and raise an
+		 * error once the rest have been queued.
+		 */
+		if (msghdr->msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+			for (cmsg = CMSG_FIRSTHDR (msghdr); cmsg;
+			     cmsg = CMSG_NXTHDR (msghdr, cmsg)) {
+				int    *fds;
+				size_t  nfds, j;
+
+				if ((cmsg->cmsg_level != SOL_SOCKET)
+				    || (cmsg->cmsg_type != SCM_RIGHTS))
+					continue;
+
+				fds = (int *)CMSG_DATA (cmsg);
+				nfds = ((cmsg->cmsg_len - CMSG_LEN (0))
+					/ sizeof (int));
+				for (j = 0; j < nfds; j++)
+					close (fds[j]);
+			}
+
+			truncated = TRUE;
+			continue;
+		}
+
+		message = NIH_MUST (nih_io_message_new (io));
+
+		NIH_ZERO (nih_io_buffer_push (message->data,
+					      msghdr->msg_iov->iov_base,
+					      batch->msgs[i].msg_len));
+
+		if (batch->addrlen) {
+			message->addr = NIH_MUST (nih_alloc (message,
+							     batch->addrlen));
+			memcpy (message->addr, msghdr->msg_name,
+				msghdr->msg_namelen);
+		}
+		message->addrlen = msghdr->msg_namelen;
+
+		for (cmsg = CMSG_FIRSTHDR (msghdr); cmsg;
+		     cmsg = CMSG_NXTHDR (msghdr, cmsg)) {
+			size_t len;
+
+			len = (cmsg->cmsg_len
+			       - CMSG_ALIGN (sizeof (struct cmsghdr)));
+			NIH_ZERO (nih_io_message_add_control (
+					  message, cmsg->cmsg_level,
+					  cmsg->cmsg_type, len,
+					  CMSG_DATA (cmsg)));
+		}
+
+		nih_list_add (io->recv_q, &message->entry);
 	}
 
-	return message;
+	if (truncated) {
+		errno = EMSGSIZE;
+		nih_return_system_error (-1);
+	}
 
-error:
-	nih_error_raise_system ();
-	if (message)
-		nih_free (message);
-	return NULL;
+	return count;
 }
 
 /**
@@ -766,6 +1800,80 @@ nih_io_message_send (NihIoMessage *message,
 }
 
 
+/**
+ * nih_io_message_send_batch:
+ * @io: structure with queue to send,
+ * @fd: file descriptor to send to.
+ *
+ * Sends as many of the messages at the front of the send queue of @io
+ * as will fit in a single call to sendmmsg(), and frees those that were
+ * sent.  Messages with control data are sent alone with
+ * nih_io_message_send(), so a batch ends before any such message.
+ *
+ * Returns: size of last message sent, or negative value on raised error.
+ **/
+static ssize_t
+nih_io_message_send_batch (NihIo *io,
+			   int    fd)
+{
+	struct mmsghdr  msgs[NIH_IO_SENDMMSG_MAX];
+	struct iovec    iov[NIH_IO_SENDMMSG_MAX];
+	NihIoMessage   *message;
+	int             count = 0, sent, i;
+	ssize_t         len;
+
+	nih_assert (io != NULL);
+	nih_assert (fd >= 0);
+
+	message = (NihIoMessage *)io->send_q->next;
+	if (message->control[0]) {
+		len = nih_io_message_send (message, fd);
+		if (len < 0)
+			return -1;
+
+		nih_list_remove (&message->entry);
+		nih_unref (message, io);
+
+		return len;
+	}
+
+	memset (msgs, 0, sizeof (msgs));
+
+	NIH_LIST_FOREACH (io->send_q, iter) {
+		message = (NihIoMessage *)iter;
+		if (message->control[0] || (count == NIH_IO_SENDMMSG_MAX))
+			break;
+
+		iov[count].iov_base = message->data->buf;
+		iov[count].iov_len = message->data->len;
+
+		msgs[count].msg_hdr.msg_name = message->addr;
+		msgs[count].msg_hdr.msg_namelen = message->addrlen;
+		msgs[count].msg_hdr.msg_iov = &iov[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+
+		count++;
+	}
+
+	sent = sendmmsg (fd, msgs, count, 0);
+	if (sent < 0)
+		nih_return_system_error (-1);
+
+	/* Free the messages that were sent; should the batch only have been
+	 * partly sent, the rest remain at the front of the queue and the
+	 * next call reports the error that stopped it.
+	 */
+	for (i = 0; i < sent; i++) {
+		message = (NihIoMessage *)io->send_q->next;
+
+		nih_list_remove (&message->entry);
+		nih_unref (message, io);
+	}
+
+	return msgs[sent - 1].msg_len;
+}
+
+
 /**
  * nih_io_reopen:
  * @parent: parent object for new structure,
@@ -787,6 +1895,12 @@ nih_io_message_send (NihIoMessage *message,
  * managed in message mode; individual messages are queued to be sent and
  * are received into a queue as discreet messages.
  *
+ * Busy streams, consuming many small writes or lines at a time, may call
+ * nih_io_buffer_set_sliding() on the send_buf and recv_buf members of the
+ * returned structure so that data isn't moved up each time.  Busy datagram
+ * sockets may likewise call nih_io_set_recv_batch() to receive messages in
+ * batches.
+ *
  * Data is automatically read from the file descriptor whenever it is
  * available, and stored in the receive buffer or queue.  If @reader is
  * given, this function is called whenever new data has been received.
@@ -839,6 +1953,15 @@ nih_io_reopen (const void        *parent,
 	io->shutdown = FALSE;
 	io->free = NULL;
 
+	nih_list_init (&io->send_chunks);
+
+	io->family = -1;
+	io->recv_batch = NULL;
+
+	io->record_reader = NULL;
+	io->record_delim = '\0';
+	io->record_scan = 0;
+
 	switch (io->type) {
 	case NIH_IO_STREAM:
 		io->send_buf = nih_io_buffer_new (io);
@@ -859,6 +1982,9 @@ nih_io_reopen (const void        *parent,
 		if (! io->recv_q)
 			goto error;
 
+		/* Remember the family, since we need it for every message */
+		io->family = nih_io_get_family (fd);
+
 		break;
 	default:
 		nih_assert_not_reached ();
@@ -938,15 +2064,19 @@ nih_io_watcher (NihIo       *io,
 		 * latter case, it means we give it once last chance to
 		 * process the messages.
 		 */
-		if (io->reader) {
+		if (io->reader || io->record_reader) {
 			nih_error_push_context();
 
 			switch (io->type) {
 			case NIH_IO_STREAM:
-				if (io->recv_buf->len)
+				if (io->record_reader) {
+					nih_io_watcher_records (io,
+								&caught_free);
+				} else if (io->recv_buf->len) {
 					io->reader (io->data, io,
 						    io->recv_buf->buf,
 						    io->recv_buf->len);
+				}
 
 				break;
 			case NIH_IO_MESSAGE: {
@@ -1054,7 +2184,7 @@ finish:
  * small.
  *
  * It returns once a call errors or returns zero to indicate that the
- * remote end closed.
+ * remote end closed, or once recvmmsg() doesn't fill the receive batch.
  *
  * Returns: size of last read, zero if remote end closed and negative
  * value on raised error.
@@ -1063,7 +2193,9 @@ static inline ssize_t
 nih_io_watcher_read (NihIo      *io,
 		     NihIoWatch *watch)
 {
-	ssize_t len = 0;
+	char    *room;
+	size_t   room_len;
+	ssize_t  len = 0;
 
 	nih_assert (io != NULL);
 	nih_assert (watch != NULL);
@@ -1076,26 +2208,41 @@ nih_io_watcher_read (NihIo      *io,
 			/* Make sure there's room for at least 80 bytes
 			 * (random minimum read).
 			 */
-			if (nih_io_buffer_resize (io->recv_buf, 80) < 0)
+			room = nih_io_buffer_reserve (io->recv_buf, 80,
+						      &room_len);
+			if (! room)
 				nih_return_system_error (-1);
 
-			len = read (watch->fd,
-				    io->recv_buf->buf + io->recv_buf->len,
-				    io->recv_buf->size - io->recv_buf->len);
+			len = read (watch->fd, room, room_len);
 			if (len < 0) {
 				nih_return_system_error (-1);
 			} else if (len > 0) {
-				io->recv_buf->len += len;
+				nih_io_buffer_commit (io->recv_buf, len);
 			} else {
 				return 0;
 			}
 
 			break;
 		case NIH_IO_MESSAGE:
+			/* Receive a batch of messages if we can, once one
+			 * isn't filled there's nothing left to receive.
+			 */
+			if (io->recv_batch) {
+				len = nih_io_message_recv_batch (io,
+								 watch->fd);
+				if (len < 0)
+					return -1;
+				if ((size_t)len < io->recv_batch->slots)
+					return len;
+
+				break;
+			}
+
 			/* Use BUFSIZ as the maximum message size. */
 			len = BUFSIZ;
-			message = nih_io_message_recv (io, watch->fd,
-						       (size_t *)&len);
+			message = nih_io_message_recv_family (io, watch->fd,
+							      io->family,
+							      (size_t *)&len);
 			if (! message) {
 				return -1;
 			} else {
@@ -1111,6 +2258,74 @@ nih_io_watcher_read (NihIo      *io,
 	return len;
 }
 
+/**
+ * nih_io_chunk_writev:
+ * @io: structure with chain to send,
+ * @fd: file descriptor to write to.
+ *
+ * Sends the data in the send buffer of @io followed by as much of its
+ * chain as will fit in a single call to writev(), and removes what was
+ * sent; chunks referencing data are freed once sent, releasing it.
+ *
+ * Returns: number of bytes sent, or negative value on raised error.
+ **/
+static ssize_t
+nih_io_chunk_writev (NihIo *io,
+		     int    fd)
+{
+	struct iovec iov[NIH_IO_WRITEV_MAX];
+	int          iovcnt = 0;
+	ssize_t      len;
+	size_t       left;
+
+	nih_assert (io != NULL);
+	nih_assert (fd >= 0);
+
+	if (io->send_buf->len) {
+		iov[iovcnt].iov_base = io->send_buf->buf;
+		iov[iovcnt].iov_len = io->send_buf->len;
+		iovcnt++;
+	}
+
+	NIH_LIST_FOREACH (&io->send_chunks, iter) {
+		NihIoChunk *chunk = (NihIoChunk *)iter;
+
+		if (iovcnt == NIH_IO_WRITEV_MAX)
+			break;
+
+		iov[iovcnt].iov_base = (void *)chunk->data;
+		iov[iovcnt].iov_len = chunk->len;
+		iovcnt++;
+	}
+
+	len = writev (fd, iov, iovcnt);
+	if (len < 0)
+		nih_return_system_error (-1);
+
+	left = len;
+	if (io->send_buf->len) {
+		size_t sent = nih_min (left, io->send_buf->len);
+
+		nih_io_buffer_shrink (io->send_buf, sent);
+		left -= sent;
+	}
+
+	NIH_LIST_FOREACH_SAFE (&io->send_chunks, iter) {
+		NihIoChunk *chunk = (NihIoChunk *)iter;
+
+		if (left < chunk->len) {
+			chunk->data += left;
+			chunk->len -= left;
+			break;
+		}
+
+		left -= chunk->len;
+		nih_free (chunk);
+	}
+
+	return len;
+}
+
 /**
  * nih_io_watcher_write:
  * @io: NihIo structure,
@@ -1118,7 +2333,7 @@ nih_io_watcher_read (NihIo      *io,
  *
  * Write data directly from the buffer or receive queue into the socket to
  * save hauling temporary blocks around.  This function will call write()
- * or sendmsg() as many times as possible to keep the buffer or queue
+ * or sendmmsg() as many times as possible to keep the buffer or queue
  * small.
  *
  * It returns once a call errors or returns zero to indicate that the
@@ -1138,6 +2353,13 @@ nih_io_watcher_write (NihIo      *io,
 
 	switch (io->type) {
 	case NIH_IO_STREAM:
+		while (! NIH_LIST_EMPTY (&io->send_chunks)) {
+			len = nih_io_chunk_writev (io, watch->fd);
+
+			if (len < 0)
+				return -1;
+		}
+
 		while (io->send_buf->len) {
 			len = write (watch->fd, io->send_buf->buf,
 				     io->send_buf->len);
@@ -1149,26 +2371,25 @@ nih_io_watcher_write (NihIo      *io,
 		}
 
 		/* Don't check for writability if we have nothing to write */
-		if (! io->send_buf->len)
+		if (! io->send_buf->len) {
 			watch->events &= ~NIH_IO_WRITE;
+			nih_io_watch_update (watch);
+		}
 
 		break;
 	case NIH_IO_MESSAGE:
 		while (! NIH_LIST_EMPTY (io->send_q)) {
-			NihIoMessage *message;
-
-			message = (NihIoMessage *)io->send_q->next;
-			len = nih_io_message_send (message, watch->fd);
+			len = nih_io_message_send_batch (io, watch->fd);
 
 			if (len < 0)
 				return -1;
-
-			nih_unref (message, io);
 		}
 
 		/* Don't check for writability if we have nothing to write */
-		if (NIH_LIST_EMPTY (io->send_q))
+		if (NIH_LIST_EMPTY (io->send_q)) {
 			watch->events &= ~NIH_IO_WRITE;
+			nih_io_watch_update (watch);
+		}
 
 		break;
 	default:
@@ -1179,6 +2400,87 @@ nih_io_watcher_write (NihIo      *io,
 }
 
 
+/**
+ * nih_io_watcher_records:
+ * @io: NihIo structure,
+ * @caught_free: set to TRUE if @io is freed.
+ *
+ * Searches the receive buffer of @io for complete records, starting
+ * from the point the last search ended, and calls the record reader with
+ * them in batches; once it returns, the records are removed from the
+ * buffer.
+ **/
+static void
+nih_io_watcher_records (NihIo *io,
+			int   *caught_free)
+{
+	NihIoRecord records[NIH_IO_RECORDS_MAX];
+	size_t      nrecords;
+
+	nih_assert (io != NULL);
+	nih_assert (io->type == NIH_IO_STREAM);
+	nih_assert (caught_free != NULL);
+
+	do {
+		const char *buf, *end, *start, *ptr, *delim;
+
+		if (! io->record_reader)
+			return;
+
+		/* An empty buffer may have no storage at all, and can't
+		 * contain any records anyway.
+		 */
+		if (! io->recv_buf->len)
+			return;
+
+		buf = io->recv_buf->buf;
+		end = buf + io->recv_buf->len;
+
+		/* Anything before the point we reached last time can't
+		 * contain the delimiter, so only search what's new.
+		 */
+		start = buf;
+		ptr = buf + nih_min (io->record_scan, io->recv_buf->len);
+
+		nrecords = 0;
+		while (nrecords < NIH_IO_RECORDS_MAX) {
+			delim = memchr (ptr, io->record_delim, end - ptr);
+			if (! delim)
+				break;
+
+			records[nrecords].buf = start;
+			records[nrecords].len = delim - start;
+			nrecords++;
+
+			start = ptr = delim + 1;
+		}
+
+		if (nrecords < NIH_IO_RECORDS_MAX) {
+			io->record_scan = end - buf;
+		} else {
+			io->record_scan = ptr - buf;
+		}
+
+		if (! nrecords)
+			return;
+
+		io->record_reader (io->data, io, records, nrecords);
+		if (*caught_free)
+			return;
+
+		/* Remove the records and their delimiters, the reader may
+		 * have started again with a new delimiter.
+		 */
+		nih_io_buffer_shrink (io->recv_buf, start - buf);
+		if (io->record_scan > (size_t)(start - buf)) {
+			io->record_scan -= start - buf;
+		} else {
+			io->record_scan = 0;
+		}
+	} while (nrecords == NIH_IO_RECORDS_MAX);
+}
+
+
 /**
  * nih_io_error:
  * @io: structure error occurred for.
@@ -1276,7 +2578,8 @@ nih_io_shutdown_check (NihIo *io)
 
 	switch (io->type) {
 	case NIH_IO_STREAM:
-		if ((! io->send_buf->len) && (! io->recv_buf->len))
+		if ((! io->send_buf->len) && (! io->recv_buf->len)
+		    && NIH_LIST_EMPTY (&io->send_chunks))
 			nih_io_closed (io);
 
 		break;
@@ -1307,12 +2610,21 @@ nih_io_shutdown_check (NihIo *io)
 int
 nih_io_destroy (NihIo *io)
 {
+	int fd;
+
 	nih_assert (io != NULL);
 
 	if (io->free)
 		*(io->free) = TRUE;
 
-	if ((close (io->watch->fd) < 0) && io->error_handler) {
+	/* Free the watch before closing the descriptor, otherwise the
+	 * kernel keeps its registration should a duplicate remain open.
+	 */
+	fd = io->watch->fd;
+	nih_free (io->watch);
+	io->watch = NULL;
+
+	if ((close (fd) < 0) && io->error_handler) {
 		nih_error_raise_system ();
 		io->error_handler (io->data, io);
 	}
@@ -1415,6 +2727,121 @@ nih_io_send_message (NihIo        *io,
 	nih_ref (message, io);
 
 	io->watch->events |= NIH_IO_WRITE;
+	nih_io_watch_update (io->watch);
+}
+
+/**
+ * nih_io_set_recv_batch:
+ * @io: structure to change,
+ * @slots: number of messages to receive at once,
+ * @size: largest message that can be received.
+ *
+ * Arranges for the messages received by @io to be received in batches of
+ * up to @slots with a single call to recvmmsg(), rather than with several
+ * calls each, so that a burst of messages costs only one.  The slots are
+ * allocated once and reused for each batch.
+ *
+ * @size is the space for each message, larger messages being discarded
+ * with the EMSGSIZE error passed to the error handler of @io; if zero,
+ * the largest datagram that can be received on an internet socket
+ * (65535 bytes) is used.
+ *
+ * Passing zero for @slots returns @io to receiving messages one at a time.
+ *
+ * This may only be used when @io is in message mode.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+nih_io_set_recv_batch (NihIo  *io,
+		       size_t  slots,
+		       size_t  size)
+{
+	NihIoRecvBatch *batch;
+	size_t          i;
+
+	nih_assert (io != NULL);
+	nih_assert (io->type == NIH_IO_MESSAGE);
+
+	if (! size)
+		size = NIH_IO_RECV_DEFAULT;
+
+	if (io->recv_batch) {
+		nih_free (io->recv_batch);
+		io->recv_batch = NULL;
+	}
+
+	if (! slots)
+		return 0;
+
+	batch = nih_new (io, NihIoRecvBatch);
+	if (! batch)
+		nih_return_no_memory_error (-1);
+
+	batch->slots = slots;
+	batch->size = size;
+	batch->addrlen = nih_io_family_addrlen (io->family);
+
+	batch->msgs = nih_alloc (batch, sizeof (struct mmsghdr) * slots);
+	batch->iov = nih_alloc (batch, sizeof (struct iovec) * slots);
+	batch->addrs = nih_alloc (batch,
+				  sizeof (struct sockaddr_storage) * slots);
+	batch->control = nih_alloc (batch, NIH_IO_RECV_CONTROL * slots);
+	batch->data = nih_alloc (batch, size * slots);
+	if ((! batch->msgs) || (! batch->iov) || (! batch->addrs)
+	    || (! batch->control) || (! batch->data)) {
+		nih_free (batch);
+		nih_return_no_memory_error (-1);
+	}
+
+	memset (batch->msgs, 0, sizeof (struct mmsghdr) * slots);
+
+	for (i = 0; i < slots; i++) {
+		struct msghdr *msghdr = &batch->msgs[i].msg_hdr;
+
+		batch->iov[i].iov_base = batch->data + size * i;
+		batch->iov[i].iov_len = size;
+
+		msghdr->msg_name = batch->addrlen ? &batch->addrs[i] : NULL;
+		msghdr->msg_iov = &batch->iov[i];
+		msghdr->msg_iovlen = 1;
+		msghdr->msg_control = batch->control + NIH_IO_RECV_CONTROL * i;
+	}
+
+	io->recv_batch = batch;
+
+	return 0;
+}
+
+
+/**
+ * nih_io_set_record_reader:
+ * @io: structure to change,
+ * @delim: character that ends each record,
+ * @reader: function to call with records received.
+ *
+ * Splits the data received by @io into records ended by @delim, such as
+ * lines when @delim is '\n', and arranges for @reader to be called with
+ * the complete records received each time rather than the reader given
+ * to nih_io_reopen() being called with the whole receive buffer.
+ *
+ * The receive buffer is searched for @delim only once, so that a long
+ * record arriving in many pieces isn't searched again each time one does;
+ * passing NULL for @reader returns @io to calling its usual reader.
+ *
+ * This may only be used when @io is in stream mode.
+ **/
+void
+nih_io_set_record_reader (NihIo             *io,
+			  char               delim,
+			  NihIoRecordReader  reader)
+{
+	nih_assert (io != NULL);
+	nih_assert (io->type == NIH_IO_STREAM);
+
+	io->record_reader = reader;
+	io->record_delim = delim;
+	io->record_scan = 0;
 }
 
 
@@ -1499,7 +2926,8 @@ finish:
  *
  * Writes @len bytes from @str into the send buffer of @io, or into a new
  * message placed in the send queue.  The data will not be sent immediately
- * but whenever possible.
+ * but whenever possible.  If data referenced with nih_io_write_ref() is
+ * still waiting to be sent, @str is copied into the chain after it.
  *
  * Care should be taken to ensure @len does not include the NULL
  * terminator unless you really want that sent.
@@ -1519,6 +2947,9 @@ nih_io_write (NihIo      *io,
 
 	switch (io->type) {
 	case NIH_IO_STREAM:
+		if (! NIH_LIST_EMPTY (&io->send_chunks))
+			return nih_io_chunk_copy (io, str, len);
+
 		message = NULL;
 		buf = io->send_buf;
 		break;
@@ -1540,8 +2971,125 @@ nih_io_write (NihIo      *io,
 		nih_io_send_message (io, message);
 	} else if (buf->len) {
 		io->watch->events |= NIH_IO_WRITE;
+		nih_io_watch_update (io->watch);
+	}
+
+	return 0;
+}
+
+/**
+ * nih_io_write_ref:
+ * @io: structure to write to,
+ * @ptr: data to write,
+ * @len: length of @ptr.
+ *
+ * Queues @len bytes from @ptr to be sent on the NIH_IO_STREAM @io after
+ * any data already waiting, without copying them; a reference to @ptr,
+ * which must have been allocated with nih_alloc(), is held until they
+ * have been sent, and @ptr must not be changed until then.  The data
+ * will not be sent immediately but whenever possible, together with
+ * the data around it in a single writev() call.
+ *
+ * This is only worthwhile for large pieces of data, since small ones
+ * cost less to copy with nih_io_write() than to send separately.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+int
+nih_io_write_ref (NihIo      *io,
+		  const void *ptr,
+		  size_t      len)
+{
+	NihIoChunk *chunk;
+
+	nih_assert (io != NULL);
+	nih_assert (io->type == NIH_IO_STREAM);
+	nih_assert (ptr != NULL);
+
+	if (! len)
+		return 0;
+
+	chunk = nih_io_chunk_new (io, 0);
+	if (! chunk)
+		return -1;
+
+	nih_ref (ptr, chunk);
+	chunk->data = ptr;
+	chunk->len = len;
+
+	return 0;
+}
+
+/**
+ * nih_io_chunk_new:
+ * @io: structure to add to,
+ * @room: room for copied data.
+ *
+ * Allocates a new chunk as a child of @io with @room bytes of room for
+ * copied data following it, and places it at the end of the chain of
+ * @io, arranging for it to be sent.
+ *
+ * Returns: new chunk, or NULL if insufficient memory.
+ **/
+static NihIoChunk *
+nih_io_chunk_new (NihIo  *io,
+		  size_t  room)
+{
+	NihIoChunk *chunk;
+
+	nih_assert (io != NULL);
+
+	chunk = nih_alloc (io, sizeof (NihIoChunk) + room);
+	if (! chunk)
+		return NULL;
+
+	nih_list_init (&chunk->entry);
+	nih_alloc_set_destructor (chunk, nih_list_destroy);
+
+	chunk->data = (char *)chunk + sizeof (NihIoChunk);
+	chunk->len = 0;
+	chunk->room = room;
+
+	nih_list_add (&io->send_chunks, &chunk->entry);
+
+	io->watch->events |= NIH_IO_WRITE;
+	nih_io_watch_update (io->watch);
+
+	return chunk;
+}
+
+/**
+ * nih_io_chunk_copy:
+ * @io: structure to write to,
+ * @str: data to write,
+ * @len: length of @str.
+ *
+ * Copies @len bytes from @str onto the end of the chain of @io, into the
+ * last chunk if it has room or a new one if not.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+nih_io_chunk_copy (NihIo      *io,
+		   const char *str,
+		   size_t      len)
+{
+	NihIoChunk *chunk;
+
+	nih_assert (io != NULL);
+	nih_assert (str != NULL);
+
+	chunk = (NihIoChunk *)io->send_chunks.prev;
+	if (chunk->room < len) {
+		chunk = nih_io_chunk_new (io, nih_max (len, (size_t)BUFSIZ));
+		if (! chunk)
+			return -1;
 	}
 
+	memcpy ((char *)chunk->data + chunk->len, str, len);
+	chunk->len += len;
+	chunk->room -= len;
+
 	return 0;
 }
 
@@ -1581,7 +3129,7 @@ nih_io_get (const void *parent,
 {
 	NihIoMessage *message;
 	NihIoBuffer  *buf;
-	char         *str;
+	char         *str, *end, *nul;
 	size_t        i;
 
 	nih_assert (io != NULL);
@@ -1605,19 +3153,44 @@ nih_io_get (const void *parent,
 		nih_assert_not_reached ();
 	}
 
-	/* Find the end of the string */
-	for (i = 0; i < buf->len; i++) {
-		if (strchr (delim, buf->buf[i]) || (buf->buf[i] == '\0')) {
-			/* Remove the string, and then the delimiter */
-			str = nih_io_buffer_pop (parent, buf, &i);
-			if (! str)
-				return NULL;
+	/* Find the end of the string; a single delimiter is common enough
+	 * to be searched for with memchr(), otherwise each character is
+	 * looked up in a table of delimiters.  The buffer of an empty
+	 * NihIoBuffer may be NULL, which memchr() must not be given.
+	 */
+	end = NULL;
+	if (buf->len && delim[0] && (! delim[1])) {
+		end = memchr (buf->buf, delim[0], buf->len);
+		nul = memchr (buf->buf, '\0',
+			      end ? (size_t)(end - buf->buf) : buf->len);
+		if (nul)
+			end = nul;
+	} else if (buf->len) {
+		char table[256];
+
+		memset (table, 0, sizeof (table));
+		for (; *delim; delim++)
+			table[(unsigned char)*delim] = TRUE;
+		table[0] = TRUE;
 
-			nih_io_buffer_shrink (buf, 1);
-			break;
+		for (i = 0; i < buf->len; i++) {
+			if (table[(unsigned char)buf->buf[i]]) {
+				end = buf->buf + i;
+				break;
+			}
 		}
 	}
 
+	if (end) {
+		/* Remove the string, and then the delimiter */
+		i = end - buf->buf;
+		str = nih_io_buffer_pop (parent, buf, &i);
+		if (! str)
+			return NULL;
+
+		nih_io_buffer_shrink (buf, 1);
+	}
+
 	if (message && (! message->data->len))
 		nih_unref (message, io);
 
@@ -53,8 +53,9 @@ typedef enum {
 
 
 /* Predefine the typedefs as we use them in the callbacks */
-typedef struct nih_io_watch NihIoWatch;
-typedef struct nih_io       NihIo;
+typedef struct nih_io_watch  NihIoWatch;
+typedef struct nih_io        NihIo;
+typedef struct nih_io_record NihIoRecord;
 
 /**
  * NihIoWatcher:
@@ -98,6 +99,30 @@ typedef void (*NihIoWatcher) (void *data, NihIoWatch *watch,
 typedef void (*NihIoReader) (void *data, NihIo *io,
 			     const char *buf, size_t len);
 
+/**
+ * NihIoRecordReader:
+ * @data: data pointer given when registered,
+ * @io: NihIo with records to be read,
+ * @records: complete records received,
+ * @nrecords: number of records in @records.
+ *
+ * A record reader is a function that is called instead of an NihIoReader
+ * for a stream split into records by nih_io_set_record_reader(), whenever
+ * complete records have been received.
+ *
+ * Each record points into the receive buffer and does not include its
+ * delimiter; the records are removed from the buffer once the function
+ * returns, so it must copy any it wishes to keep, and must not remove
+ * data from the buffer itself.  A record that has not yet been completed
+ * by its delimiter is left in the buffer until it has been.
+ *
+ * As with an NihIoReader, you must not nih_free() @io or cause it to be
+ * freed from within this function, except by nih_io_close().
+ **/
+typedef void (*NihIoRecordReader) (void *data, NihIo *io,
+				   const NihIoRecord *records,
+				   size_t nrecords);
+
 /**
  * NihIoCloseHandler:
  * @data: data pointer given when registered.
@@ -135,14 +160,17 @@ typedef void (*NihIoErrorHandler) (void *data, NihIo *io);
  * @fd: file descriptor,
  * @events: events to watch for,
  * @watcher: function called when @events occur on @fd,
- * @data: pointer passed to @watcher.
+ * @data: pointer passed to @watcher,
+ * @fd_entry: list header for other watches on @fd (used internally).
  *
  * This structure represents the most basic kind of I/O handling, a watch
  * on a file descriptor or socket that causes a function to be called
  * when listed events occur.
  *
  * The watch can be cancelled by calling nih_list_remove() on the structure
- * as they are held in a list internally.
+ * as they are held in a list internally.  If you change @events, or place
+ * the watch back into the list, you must call nih_io_watch_update()
+ * afterwards so that the main loop notices.
  **/
 struct nih_io_watch {
 	NihList       entry;
@@ -151,21 +179,35 @@ struct nih_io_watch {
 
 	NihIoWatcher  watcher;
 	void         *data;
+
+	NihList       fd_entry;
 };
 
 /**
  * NihIoBuffer:
  * @buf: memory allocated for buffer,
  * @size: allocated size of @buf,
- * @len: number of bytes of @buf used.
+ * @len: number of bytes of @buf used,
+ * @offset: bytes consumed from the allocation before @buf,
+ * @sliding: TRUE if bytes are consumed by advancing @buf.
  *
  * This structure is used to represent a buffer holding data that is
  * waiting to be sent or processed.
+ *
+ * The data always begins at @buf and is contiguous.  Normally bytes are
+ * consumed by moving the rest of the data up, and the allocation is kept
+ * to the next multiple of BUFSIZ; once nih_io_buffer_set_sliding() has
+ * been called, bytes are consumed by advancing @buf into the allocation
+ * instead, so that @size is the room left beyond @buf, and the allocation
+ * is doubled as needed.
  **/
 typedef struct nih_io_buffer {
 	char   *buf;
 	size_t  size;
 	size_t  len;
+
+	size_t  offset;
+	int     sliding;
 } NihIoBuffer;
 
 /**
@@ -202,6 +244,50 @@ typedef struct nih_io_message {
 	};
 } NihIoMessage;
 
+/**
+ * NihIoChunk:
+ * @entry: list header,
+ * @data: data still to be sent,
+ * @len: length of @data,
+ * @room: bytes of room after @data for copied data.
+ *
+ * This structure represents a piece of data waiting to be sent in the
+ * chain of an NIH_IO_STREAM, after the data in its send buffer.  Data
+ * written with nih_io_write_ref() is referenced by the chunk until it
+ * has been sent, and @room is zero; data copied by nih_io_write() once
+ * the chain is in use is placed in chunks that follow the structure in
+ * memory, and @room is the space left in the chunk for more.
+ **/
+typedef struct nih_io_chunk {
+	NihList     entry;
+
+	const char *data;
+	size_t      len;
+	size_t      room;
+} NihIoChunk;
+
+/**
+ * NihIoRecord:
+ * @buf: start of record,
+ * @len: length of record, not including the delimiter.
+ *
+ * This structure describes a complete record in the receive buffer of a
+ * stream, handed to an NihIoRecordReader without being copied.
+ **/
+struct nih_io_record {
+	const char *buf;
+	size_t      len;
+};
+
+/**
+ * NihIoRecvBatch:
+ *
+ * This opaque structure holds the reusable slots into which messages are
+ * received by an NIH_IO_MESSAGE structure with a single call to recvmmsg(),
+ * it's created by nih_io_set_recv_batch().
+ **/
+typedef struct nih_io_recv_batch NihIoRecvBatch;
+
 /**
  * NihIo:
  * @type: type of structure,
@@ -210,6 +296,12 @@ typedef struct nih_io_message {
  * @send_q: queue of messages to be sent (NIH_IO_MESSAGE),
  * @recv_buf: buffer that pools data received (NIH_IO_STREAM),
  * @recv_q: queue of messages received (NIH_IO_MESSAGE),
+ * @send_chunks: chain of data to be sent after @send_buf (NIH_IO_STREAM),
+ * @family: family of the socket, or -1 if unknown (NIH_IO_MESSAGE),
+ * @recv_batch: slots to receive messages in batches (NIH_IO_MESSAGE),
+ * @record_reader: function called with records in @recv_buf (NIH_IO_STREAM),
+ * @record_delim: delimiter between records (NIH_IO_STREAM),
+ * @record_scan: bytes of @recv_buf already searched for it (NIH_IO_STREAM),
  * @reader: function called when new data in @recv_buf or @recv_q,
  * @close_handler: function called when socket closes,
  * @error_handler: function called when an error occurs,
@@ -232,9 +324,22 @@ typedef struct nih_io_message {
  * receive much data as possible, and have the data sent in the background
  * or processed at your leisure.
  *
+ * Large pieces of data may be queued for sending without being copied
+ * into the send buffer with nih_io_write_ref(), they are then held in the
+ * @send_chunks chain and sent together with writev().
+ *
  * When used in the message mode (@type is NIH_IO_MESSAGE), it combines the
  * NihIoWatch with an NihList of NihIoMessage structures to implement
  * asynchronous handling of datagram sockets.
+ *
+ * Busy datagram sockets may be given a @recv_batch with
+ * nih_io_set_recv_batch() so that a burst of messages is received by a
+ * single call to recvmmsg().
+ *
+ * A stream of delimited records, such as lines, may instead be given a
+ * @record_reader with nih_io_set_record_reader(); the receive buffer is
+ * then searched for the delimiter only once, each wakeup handing the
+ * function the records completed.
  **/
 struct nih_io {
 	NihIoType            type;
@@ -248,6 +353,14 @@ struct nih_io {
 		NihIoBuffer *recv_buf;
 		NihList     *recv_q;
 	};
+	NihList              send_chunks;
+
+	int                  family;
+	NihIoRecvBatch      *recv_batch;
+
+	NihIoRecordReader    record_reader;
+	char                 record_delim;
+	size_t               record_scan;
 
 	NihIoReader          reader;
 	NihIoCloseHandler    close_handler;
@@ -261,7 +374,8 @@ struct nih_io {
 
 NIH_BEGIN_EXTERN
 
-extern NihList *nih_io_watches;
+extern NihList      *nih_io_watches;
+extern unsigned int  nih_io_forks;
 
 
 void          nih_io_init                (void);
@@ -271,11 +385,16 @@ NihIoWatch *  nih_io_add_watch           (const void *parent, int fd,
 					  NihIoWatcher watcher, void *data)
 	__attribute__ ((warn_unused_result, malloc));
 
+void          nih_io_watch_update        (NihIoWatch *watch);
+
 void          nih_io_select_fds          (int *nfds, fd_set *readfds,
 					  fd_set *writefds, fd_set *exceptfds);
 void          nih_io_handle_fds          (fd_set *readfds, fd_set *writewfds,
 					  fd_set *exceptfds);
 
+int           nih_io_epoll_fd            (void);
+int           nih_io_epoll_wait          (int timeout);
+
 
 NihIoBuffer * nih_io_buffer_new          (const void *parent)
 	__attribute__ ((warn_unused_result, malloc));
@@ -288,6 +407,11 @@ void          nih_io_buffer_shrink       (NihIoBuffer *buffer, size_t len);
 int           nih_io_buffer_push         (NihIoBuffer *buffer,
 					  const char *str, size_t len)
 	__attribute__ ((warn_unused_result));
+void          nih_io_buffer_set_sliding  (NihIoBuffer *buffer);
+char *        nih_io_buffer_reserve      (NihIoBuffer *buffer, size_t min,
+					  size_t *len)
+	__attribute__ ((warn_unused_result));
+void          nih_io_buffer_commit       (NihIoBuffer *buffer, size_t len);
 
 
 NihIoMessage *nih_io_message_new         (const void *parent)
@@ -316,6 +440,11 @@ int           nih_io_destroy             (NihIo *io);
 
 NihIoMessage *nih_io_read_message        (const void *parent, NihIo *io);
 void          nih_io_send_message        (NihIo *io, NihIoMessage *message);
+int           nih_io_set_recv_batch      (NihIo *io, size_t slots,
+					  size_t size)
+	__attribute__ ((warn_unused_result));
+void          nih_io_set_record_reader   (NihIo *io, char delim,
+					  NihIoRecordReader reader);
 
 char *        nih_io_read                (const void *parent, NihIo *io,
 					  size_t *len)
@@ -323,6 +452,9 @@ char *        nih_io_read                (const void *parent, NihIo *io,
 int           nih_io_write               (NihIo *io, const char *str,
 					  size_t len)
 	__attribute__ ((warn_unused_result));
+int           nih_io_write_ref           (NihIo *io, const void *ptr,
+					  size_t len)
+	__attribute__ ((warn_unused_result));
 
 char *        nih_io_get                 (const void *parent, NihIo *io,
 					  const char *delim)
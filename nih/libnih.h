@@ -22,10 +22,14 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/array.h>
 #include <nih/string.h>
 #include <nih/list.h>
 #include <nih/hash.h>
+#include <nih/map.h>
 #include <nih/tree.h>
+#include <nih/btree.h>
+#include <nih/trie.h>
 #include <nih/timer.h>
 #include <nih/signal.h>
 #include <nih/child.h>
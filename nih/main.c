@@ -26,10 +26,12 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
 
 #include <time.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <signal.h>
 #include <string.h>
@@ -63,6 +65,14 @@
  **/
 #define DEV_NULL "/dev/null"
 
+/**
+ * NIH_MAIN_LOOP_FREE_LIMIT:
+ *
+ * Maximum number of objects freed with nih_free_deferred() whose memory
+ * is released each time round the main loop.
+ **/
+#define NIH_MAIN_LOOP_FREE_LIMIT 1024
+
 
 /**
  * program_name:
@@ -136,6 +146,15 @@ static char *pid_file = NULL;
  **/
 static int interrupt_pipe[2] = { -1, -1 };
 
+/**
+ * interrupt_epoll:
+ *
+ * epoll instance that the reading end of @interrupt_pipe has been
+ * registered with, when nih_io_forks had the value in @interrupt_forks.
+ **/
+static int          interrupt_epoll = -1;
+static unsigned int interrupt_forks = 0;
+
 /**
  * exit_loop:
  *
@@ -543,47 +562,102 @@ nih_main_loop (void)
 	nih_signal_set_handler (SIGCHLD, nih_signal_handler);
 
 	while (! exit_loop) {
-		NihTimer       *next_timer;
-		struct timespec now;
+		struct timespec next_timeout;
 		struct timeval  timeout;
 		fd_set          readfds, writefds, exceptfds;
 		char            buf[1];
-		int             nfds, ret;
+		long long       timeout_ms;
+		int             has_timeout, epoll_fd, nfds, ret;
 
 		/* Use the due time of the next timer to calculate how long
-		 * to spend in select().  That way we don't sleep for any
-		 * less or more time than we need to.
+		 * to spend in select(); timers triggered by a timerfd are
+		 * left to wake us themselves.  Since the wait is in
+		 * microseconds or milliseconds, round up so we don't wake
+		 * just before the timer is due.
 		 */
-		next_timer = nih_timer_next_due ();
-		if (next_timer) {
-			nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+		has_timeout = nih_timer_next_timeout (&next_timeout);
 
-			timeout.tv_sec = next_timer->due - now.tv_sec;
-			timeout.tv_usec = 0;
+		/* Release some of the memory of objects freed with
+		 * nih_free_deferred(), and if there's more to do don't
+		 * spend any time waiting.
+		 */
+		if (nih_free_deferred_poll (NIH_MAIN_LOOP_FREE_LIMIT)) {
+			has_timeout = TRUE;
+			next_timeout.tv_sec = 0;
+			next_timeout.tv_nsec = 0;
 		}
 
-		/* Start off with empty watch lists */
-		FD_ZERO (&readfds);
-		FD_ZERO (&writefds);
-		FD_ZERO (&exceptfds);
-
-		/* Always look for changes in the interrupt pipe */
-		FD_SET (interrupt_pipe[0], &readfds);
-		nfds = interrupt_pipe[0] + 1;
-
-		/* And look for changes in anything we're watching */
-		nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+		if (has_timeout) {
+			timeout.tv_sec = next_timeout.tv_sec;
+			timeout.tv_usec = (next_timeout.tv_nsec + 999) / 1000;
+			if (timeout.tv_usec >= 1000000) {
+				timeout.tv_sec++;
+				timeout.tv_usec -= 1000000;
+			}
+		}
 
-		/* Now we hang around until either a signal comes in (and
-		 * calls nih_main_loop_interrupt), a file descriptor we're
-		 * watching changes in some way or it's time to run a timer.
+		/* Prefer epoll, where only the descriptors that are ready
+		 * are examined; the interrupt pipe needs to be registered
+		 * with it directly, again after a fork since the child gets
+		 * a new instance.
 		 */
-		ret = select (nfds, &readfds, &writefds, &exceptfds,
-			      (next_timer ? &timeout : NULL));
+		epoll_fd = nih_io_epoll_fd ();
+		if ((epoll_fd >= 0)
+		    && ((epoll_fd != interrupt_epoll)
+			|| (interrupt_forks != nih_io_forks))) {
+			struct epoll_event event;
+
+			memset (&event, 0, sizeof (event));
+			event.events = EPOLLIN;
+			event.data.ptr = NULL;
+
+			if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD,
+				       interrupt_pipe[0], &event) < 0) {
+				epoll_fd = -1;
+			} else {
+				interrupt_epoll = epoll_fd;
+				interrupt_forks = nih_io_forks;
+			}
+		}
 
-		/* Deal with events */
-		if (ret > 0)
-			nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+		if (epoll_fd >= 0) {
+			/* Now we hang around until either a signal comes in
+			 * (and calls nih_main_loop_interrupt), a file
+			 * descriptor we're watching changes in some way or
+			 * it's time to run a timer.  A timer further away
+			 * than we can wait for just means we go round again.
+			 */
+			timeout_ms = -1;
+			if (has_timeout) {
+				timeout_ms = ((long long)timeout.tv_sec * 1000
+					      + (timeout.tv_usec + 999) / 1000);
+				if (timeout_ms > INT_MAX)
+					timeout_ms = INT_MAX;
+			}
+
+			nih_io_epoll_wait (timeout_ms);
+		} else {
+			/* Start off with empty watch lists */
+			FD_ZERO (&readfds);
+			FD_ZERO (&writefds);
+			FD_ZERO (&exceptfds);
+
+			/* Always look for changes in the interrupt pipe */
+			FD_SET (interrupt_pipe[0], &readfds);
+			nfds = interrupt_pipe[0] + 1;
+
+			/* And look for changes in anything we're watching */
+			nih_io_select_fds (&nfds, &readfds, &writefds,
+					   &exceptfds);
+
+			ret = select (nfds, &readfds, &writefds, &exceptfds,
+				      (has_timeout ? &timeout : NULL));
+
+			/* Deal with events */
+			if (ret > 0)
+				nih_io_handle_fds (&readfds, &writefds,
+						   &exceptfds);
+		}
 
 		/* Deal with signals.
 		 *
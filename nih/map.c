@@ -0,0 +1,590 @@
+/* libnih
+ *
+ * map.c - open addressing map implementation
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <endian.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/logging.h>
+#include <nih/alloc.h>
+#include <nih/hash.h>
+
+#include "map.h"
+
+
+/**
+ * NIH_MAP_GROUP:
+ *
+ * Number of slots whose control bytes are examined together; the number
+ * of slots in a map is always a power of two multiple of this.
+ **/
+#define NIH_MAP_GROUP 8
+
+/**
+ * NIH_MAP_EMPTY:
+ *
+ * Control byte of a slot that has never held an entry since the map last
+ * grew; a lookup stops at any group containing one.
+ **/
+#define NIH_MAP_EMPTY 0x80
+
+/**
+ * NIH_MAP_DELETED:
+ *
+ * Control byte of a slot whose entry was removed; lookups continue past
+ * it, but it may be reused.  The control byte of a slot holding an entry
+ * has the top bit clear, and the lower seven bits of its hash.
+ **/
+#define NIH_MAP_DELETED 0xfe
+
+/**
+ * NIH_MAP_LSB, NIH_MAP_MSB:
+ *
+ * Lowest and highest bit of each byte of a group of control bytes.
+ **/
+#define NIH_MAP_LSB 0x0101010101010101ULL
+#define NIH_MAP_MSB 0x8080808080808080ULL
+
+
+/* Prototypes for static functions */
+static inline uint64_t nih_map_group      (NihMap *map, size_t group);
+static inline uint64_t nih_map_match      (uint64_t ctrl, uint8_t h2);
+static inline uint64_t nih_map_match_empty (uint64_t ctrl);
+static inline size_t   nih_map_first      (uint64_t match);
+static NihMapSlot *    nih_map_find       (NihMap *map, const void *key,
+					   uint32_t hashval);
+static size_t          nih_map_find_free  (NihMap *map, uint32_t hashval);
+static int             nih_map_resize     (NihMap *map, size_t size);
+
+
+/**
+ * nih_map_new:
+ * @parent: parent of new map,
+ * @entries: rough number of entries expected,
+ * @hash_function: function used to obtain hash for keys,
+ * @cmp_function: function used to compare keys.
+ *
+ * Allocates a new map with enough slots for @entries, which will grow as
+ * necessary.  Keys are converted into a hash by @hash_function and
+ * compared with @cmp_function.  The nih_map_string_new() and
+ * nih_map_int_new() macros wrap this function for string and integer
+ * keys.
+ *
+ * The structure is allocated using nih_alloc() so it can be used as a
+ * context to other allocations; there is no non-allocated version of this
+ * function because the map must be usable as a parent context to its slots.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned map.  When all parents
+ * of the returned map are freed, the returned map will also be
+ * freed.
+ *
+ * Returns: the new map or NULL if the allocation failed.
+ **/
+NihMap *
+nih_map_new (const void      *parent,
+	     size_t           entries,
+	     NihHashFunction  hash_function,
+	     NihCmpFunction   cmp_function)
+{
+	NihMap *map;
+	size_t  size;
+
+	nih_assert (hash_function != NULL);
+	nih_assert (cmp_function != NULL);
+
+	/* Pick the smallest power of two that isn't more than 7/8 full */
+	size = NIH_MAP_GROUP;
+	while (entries > size - size / NIH_MAP_GROUP)
+		size *= 2;
+
+	map = nih_new (parent, NihMap);
+	if (! map)
+		return NULL;
+
+	map->slots = NULL;
+	map->ctrl = NULL;
+	map->size = 0;
+	map->entries = 0;
+	map->empty = 0;
+
+	map->hash_function = hash_function;
+	map->cmp_function = cmp_function;
+
+	map->iterating = 0;
+
+	if (nih_map_resize (map, size) < 0) {
+		nih_free (map);
+		return NULL;
+	}
+
+	return map;
+}
+
+
+/**
+ * nih_map_group:
+ * @map: map,
+ * @group: group number.
+ *
+ * Returns: the control bytes of @group in @map, with the byte of the
+ * first slot in the lowest bits.
+ **/
+static inline uint64_t
+nih_map_group (NihMap *map,
+	       size_t  group)
+{
+	uint64_t ctrl;
+
+	memcpy (&ctrl, map->ctrl + group * NIH_MAP_GROUP, sizeof (ctrl));
+
+	return le64toh (ctrl);
+}
+
+/**
+ * nih_map_match:
+ * @ctrl: control bytes of group,
+ * @h2: lower seven bits of hash.
+ *
+ * Finds the slots in the group with control bytes @ctrl that may hold an
+ * entry with the hash @h2.  Occasionally a slot is included that does not,
+ * but never a slot without an entry.
+ *
+ * Returns: mask with the top bit of the byte of each such slot set.
+ **/
+static inline uint64_t
+nih_map_match (uint64_t ctrl,
+	       uint8_t  h2)
+{
+	uint64_t x = ctrl ^ (NIH_MAP_LSB * h2);
+
+	return (x - NIH_MAP_LSB) & ~x & NIH_MAP_MSB;
+}
+
+/**
+ * nih_map_match_empty:
+ * @ctrl: control bytes of group.
+ *
+ * Finds the empty slots in the group with control bytes @ctrl, which
+ * have the top bit set and, unlike deleted slots, the second lowest bit
+ * clear.
+ *
+ * Returns: mask with the top bit of the byte of each empty slot set.
+ **/
+static inline uint64_t
+nih_map_match_empty (uint64_t ctrl)
+{
+	return ctrl & ~(ctrl << 6) & NIH_MAP_MSB;
+}
+
+/**
+ * nih_map_first:
+ * @match: non-zero mask returned by a match function.
+ *
+ * Returns: index within the group of the first slot in @match.
+ **/
+static inline size_t
+nih_map_first (uint64_t match)
+{
+	return __builtin_ctzll (match) / 8;
+}
+
+
+/**
+ * nih_map_find:
+ * @map: map to search,
+ * @key: key to look for,
+ * @hashval: hash of @key.
+ *
+ * Examines each group of slots that @key may be in, in the order that it
+ * would have been placed in them, until it is found or a group with an
+ * empty slot is reached.
+ *
+ * Returns: slot holding @key or NULL if not found.
+ **/
+static NihMapSlot *
+nih_map_find (NihMap     *map,
+	      const void *key,
+	      uint32_t    hashval)
+{
+	size_t mask, group, step;
+
+	nih_assert (map != NULL);
+
+	mask = map->size / NIH_MAP_GROUP - 1;
+	group = (hashval >> 7) & mask;
+
+	for (step = 1; ; step++) {
+		uint64_t ctrl, match;
+
+		ctrl = nih_map_group (map, group);
+		for (match = nih_map_match (ctrl, hashval & 0x7f); match;
+		     match &= match - 1) {
+			NihMapSlot *slot;
+
+			slot = &map->slots[group * NIH_MAP_GROUP
+					   + nih_map_first (match)];
+			if (! map->cmp_function (key, slot->key))
+				return slot;
+		}
+
+		if (nih_map_match_empty (ctrl))
+			return NULL;
+
+		group = (group + step) & mask;
+	}
+}
+
+/**
+ * nih_map_find_free:
+ * @map: map to search,
+ * @hashval: hash of key.
+ *
+ * Examines each group of slots that a key with the hash @hashval may be
+ * in until one is found that is either empty or deleted.
+ *
+ * Returns: index of slot found.
+ **/
+static size_t
+nih_map_find_free (NihMap   *map,
+		   uint32_t  hashval)
+{
+	size_t mask, group, step;
+
+	nih_assert (map != NULL);
+
+	mask = map->size / NIH_MAP_GROUP - 1;
+	group = (hashval >> 7) & mask;
+
+	for (step = 1; ; step++) {
+		uint64_t match;
+
+		match = nih_map_group (map, group) & NIH_MAP_MSB;
+		if (match)
+			return group * NIH_MAP_GROUP + nih_map_first (match);
+
+		group = (group + step) & mask;
+	}
+}
+
+/**
+ * nih_map_resize:
+ * @map: map to resize,
+ * @size: new number of slots.
+ *
+ * Allocates @size slots for @map and places each existing entry into
+ * them, discarding deleted slots, then frees the previous slots.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+nih_map_resize (NihMap *map,
+		size_t  size)
+{
+	NihMapSlot *old_slots;
+	uint8_t    *old_ctrl;
+	size_t      old_size;
+	size_t      i;
+
+	nih_assert (map != NULL);
+	nih_assert (size >= map->entries);
+	nih_assert (! map->iterating);
+
+	old_slots = map->slots;
+	old_ctrl = map->ctrl;
+	old_size = map->size;
+
+	/* Slots and control bytes are allocated together */
+	map->slots = nih_alloc (map, (sizeof (NihMapSlot) + 1) * size);
+	if (! map->slots) {
+		map->slots = old_slots;
+		return -1;
+	}
+
+	map->ctrl = (uint8_t *)(map->slots + size);
+	map->size = size;
+	map->empty = size - map->entries;
+
+	memset (map->ctrl, NIH_MAP_EMPTY, size);
+
+	for (i = 0; i < old_size; i++) {
+		uint32_t hashval;
+		size_t   j;
+
+		if (old_ctrl[i] & 0x80)
+			continue;
+
+		hashval = map->hash_function (old_slots[i].key);
+		j = nih_map_find_free (map, hashval);
+
+		map->ctrl[j] = hashval & 0x7f;
+		map->slots[j] = old_slots[i];
+	}
+
+	if (old_slots)
+		nih_free (old_slots);
+
+	return 0;
+}
+
+
+/**
+ * nih_map_set:
+ * @map: map to change,
+ * @key: key of entry,
+ * @value: value of entry.
+ *
+ * Sets the value of the entry with the key @key in @map to @value, adding
+ * a new entry if there is none.  Both @key and @value are stored as
+ * pointers, so must remain valid while the entry is in @map; when an
+ * existing entry is changed, @key replaces its key.
+ *
+ * @map may need to grow to add the entry, this will fail if there is
+ * insufficient memory or while @map is being iterated by
+ * NIH_MAP_FOREACH_SAFE() and no slot can be found.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+int
+nih_map_set (NihMap     *map,
+	     const void *key,
+	     void       *value)
+{
+	NihMapSlot *slot;
+	uint32_t    hashval;
+	size_t      i;
+
+	nih_assert (map != NULL);
+
+	hashval = map->hash_function (key);
+
+	slot = nih_map_find (map, key, hashval);
+	if (slot) {
+		slot->key = key;
+		slot->value = value;
+		return 0;
+	}
+
+	i = nih_map_find_free (map, hashval);
+	if (map->ctrl[i] == NIH_MAP_EMPTY) {
+		/* Keep an eighth of the slots empty so that lookups end
+		 * quickly; while iterating there must still be one.
+		 */
+		if (map->iterating) {
+			if (map->empty <= 1)
+				return -1;
+		} else if (map->empty <= map->size / NIH_MAP_GROUP) {
+			size_t size = map->size;
+
+			/* Grow unless many slots are only deleted */
+			if (map->entries >= (size - size / NIH_MAP_GROUP) / 2)
+				size *= 2;
+
+			if (nih_map_resize (map, size) < 0)
+				return -1;
+
+			i = nih_map_find_free (map, hashval);
+		}
+
+		map->empty--;
+	}
+
+	map->ctrl[i] = hashval & 0x7f;
+	map->slots[i].key = key;
+	map->slots[i].value = value;
+	map->entries++;
+
+	return 0;
+}
+
+/**
+ * nih_map_lookup:
+ * @map: map to search,
+ * @key: key to look for.
+ *
+ * Finds the entry in @map with the key @key.
+ *
+ * Returns: value of entry found or NULL if no entry existed.
+ **/
+void *
+nih_map_lookup (NihMap     *map,
+		const void *key)
+{
+	NihMapSlot *slot;
+
+	nih_assert (map != NULL);
+
+	slot = nih_map_find (map, key, map->hash_function (key));
+
+	return slot ? slot->value : NULL;
+}
+
+/**
+ * nih_map_remove:
+ * @map: map to change,
+ * @key: key of entry to remove.
+ *
+ * Removes the entry in @map with the key @key; the key and value are not
+ * freed.
+ *
+ * Returns: TRUE if the entry was removed, FALSE if no entry existed.
+ **/
+int
+nih_map_remove (NihMap     *map,
+		const void *key)
+{
+	NihMapSlot *slot;
+	size_t      i;
+
+	nih_assert (map != NULL);
+
+	slot = nih_map_find (map, key, map->hash_function (key));
+	if (! slot)
+		return FALSE;
+
+	i = slot - map->slots;
+
+	/* A lookup never continues past a group with an empty slot, so in
+	 * such a group the slot can be made empty rather than deleted.
+	 */
+	if (nih_map_match_empty (nih_map_group (map, i / NIH_MAP_GROUP))) {
+		map->ctrl[i] = NIH_MAP_EMPTY;
+		map->empty++;
+	} else {
+		map->ctrl[i] = NIH_MAP_DELETED;
+	}
+
+	slot->key = NULL;
+	slot->value = NULL;
+	map->entries--;
+
+	return TRUE;
+}
+
+
+/**
+ * nih_map_int_hash:
+ * @key: integer key to hash.
+ *
+ * Generates and returns a 32-bit hash for an integer key converted with
+ * NIH_MAP_INT_KEY() by Fibonacci hashing, which spreads consecutive
+ * integers across the map.
+ *
+ * Returns: 32-bit hash.
+ **/
+uint32_t
+nih_map_int_hash (const void *key)
+{
+	return (uint32_t)(((uint64_t)(uintptr_t)key
+			   * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+/**
+ * nih_map_int_cmp:
+ * @key1: key to compare,
+ * @key2: key to compare against.
+ *
+ * Compares the integer keys @key1 and @key2.
+ *
+ * Returns: integer less than, equal to or greater than zero if @key1 is
+ * respectively less then, equal to or greater than @key2.
+ **/
+int
+nih_map_int_cmp (const void *key1,
+		 const void *key2)
+{
+	if ((uintptr_t)key1 < (uintptr_t)key2) {
+		return -1;
+	} else if ((uintptr_t)key1 > (uintptr_t)key2) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+
+/**
+ * _nih_map_next:
+ * @map: map being iterated,
+ * @slot: previous slot or NULL.
+ *
+ * Finds the first slot in @map holding an entry after @slot, or from the
+ * start if @slot is NULL; used by NIH_MAP_FOREACH() and
+ * NIH_MAP_FOREACH_SAFE().
+ *
+ * Returns: next slot or NULL if there are no more entries.
+ **/
+NihMapSlot *
+_nih_map_next (NihMap     *map,
+	       NihMapSlot *slot)
+{
+	size_t i;
+
+	nih_assert (map != NULL);
+
+	for (i = slot ? slot - map->slots + 1 : 0; i < map->size; i++)
+		if (! (map->ctrl[i] & 0x80))
+			return &map->slots[i];
+
+	return NULL;
+}
+
+/**
+ * _nih_map_iter_begin:
+ * @map: map being iterated.
+ *
+ * Marks @map as being iterated so that it does not grow; used by
+ * NIH_MAP_FOREACH_SAFE() and undone by _nih_map_iter_end() when the loop
+ * exits.
+ *
+ * Returns: @map.
+ **/
+NihMap *
+_nih_map_iter_begin (NihMap *map)
+{
+	nih_assert (map != NULL);
+
+	map->iterating++;
+
+	return map;
+}
+
+/**
+ * _nih_map_iter_end:
+ * @map: pointer to map being iterated.
+ *
+ * Undoes _nih_map_iter_begin() for the map pointed to by @map, called
+ * when the variable holding it goes out of scope.
+ **/
+void
+_nih_map_iter_end (NihMap **map)
+{
+	nih_assert (map != NULL);
+	nih_assert (*map != NULL);
+	nih_assert ((*map)->iterating > 0);
+
+	(*map)->iterating--;
+}
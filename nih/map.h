@@ -0,0 +1,206 @@
+/* libnih
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NIH_MAP_H
+#define NIH_MAP_H
+
+/**
+ * Provides a map from constant keys to values, stored in a flat array of
+ * slots rather than in lists as with NihHash.  This is better suited to
+ * tables that are looked up far more often than they are changed, since
+ * a lookup usually examines a single group of adjacent slots, while
+ * entries cannot be moved between maps and lists.
+ *
+ * Each slot holds a pointer to a key and a pointer to the value, both of
+ * which remain owned by the caller; the key commonly points into the
+ * value.  A control byte for each slot holds seven bits of the key's
+ * hash, so groups of eight slots are compared with a single word operation
+ * and the comparison function is rarely called for keys that differ.
+ *
+ * Maps are created with nih_map_new(), which is given the hash and
+ * comparison functions for the keys, or nih_map_string_new() and
+ * nih_map_int_new() for string and integer keys.
+ *
+ * Entries are added or replaced with nih_map_set(), found with
+ * nih_map_lookup() and removed with nih_map_remove().  The map grows as
+ * entries are added.
+ *
+ * The map may be iterated with NIH_MAP_FOREACH(), or NIH_MAP_FOREACH_SAFE()
+ * if entries will be added or removed while doing so.
+ **/
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+#include <nih/hash.h>
+
+
+/**
+ * NihMapSlot:
+ * @key: key of entry,
+ * @value: value of entry.
+ *
+ * This structure represents an entry in a map; a pointer to it is given
+ * to the iteration macros, and its @value may be changed.
+ **/
+typedef struct nih_map_slot {
+	const void *key;
+	void       *value;
+} NihMapSlot;
+
+/**
+ * NihMap:
+ * @slots: array of slots,
+ * @ctrl: array of control bytes, one for each slot,
+ * @size: number of slots,
+ * @entries: number of entries,
+ * @empty: number of empty slots,
+ * @hash_function: function used to obtain hash of keys,
+ * @cmp_function: function used to compare keys,
+ * @iterating: number of NIH_MAP_FOREACH_SAFE() iterations in progress.
+ *
+ * This structure represents a map; the members should not be changed
+ * directly.
+ **/
+typedef struct nih_map {
+	NihMapSlot      *slots;
+	uint8_t         *ctrl;
+	size_t           size;
+	size_t           entries;
+	size_t           empty;
+
+	NihHashFunction  hash_function;
+	NihCmpFunction   cmp_function;
+
+	unsigned int     iterating;
+} NihMap;
+
+
+/**
+ * NIH_MAP_INT_KEY:
+ * @_i: integer key.
+ *
+ * Converts the integer @_i, which may be no wider than a pointer, into a
+ * key for a map created with nih_map_int_new().
+ **/
+#define NIH_MAP_INT_KEY(_i) ((const void *)(uintptr_t)(_i))
+
+/**
+ * NIH_MAP_FOREACH:
+ * @map: map to iterate,
+ * @iter: name of iterator variable.
+ *
+ * Expands to a for statement that iterates over each entry in @map,
+ * setting @iter to the NihMapSlot of each entry for the block within
+ * the loop.  Entries are visited in no particular order.
+ *
+ * This is the cheapest form of iteration, however it is not safe to add
+ * or remove entries while iterating; the value of @iter may be changed.
+ * If you need to do more, use NIH_MAP_FOREACH_SAFE() instead.
+ **/
+#define NIH_MAP_FOREACH(map, iter)					\
+	for (NihMapSlot *iter = _nih_map_next ((map), NULL);		\
+	     iter; iter = _nih_map_next ((map), iter))
+
+/**
+ * NIH_MAP_FOREACH_SAFE:
+ * @map: map to iterate,
+ * @iter: name of iterator variable.
+ *
+ * Expands to a for statement that iterates over each entry in @map,
+ * setting @iter to the NihMapSlot of each entry for the block within
+ * the loop.  Entries are visited in no particular order.
+ *
+ * The map does not grow until the loop exits, so any entry including
+ * @iter can be removed and entries added while iterating; entries added
+ * may or may not be visited.  Variables named _@iter_map and _@iter_once
+ * are used to mark the map as being iterated.
+ **/
+#define NIH_MAP_FOREACH_SAFE(map, iter)					\
+	for (NihMap *_##iter##_map					\
+		     __attribute__((cleanup(_nih_map_iter_end)))	\
+		     = _nih_map_iter_begin (map),			\
+		     *_##iter##_once = _##iter##_map;			\
+	     _##iter##_once; _##iter##_once = NULL)			\
+		for (NihMapSlot *iter = _nih_map_next ((map), NULL);	\
+		     iter; iter = _nih_map_next ((map), iter))
+
+/**
+ * nih_map_string_new:
+ * @parent: parent of new map,
+ * @entries: rough number of entries expected.
+ *
+ * Allocates a new map with enough slots for @entries, keyed by constant
+ * strings which are hashed by the function selected with
+ * nih_hash_set_string_hash() and compared case sensitively.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned map.  When all parents
+ * of the returned map are freed, the returned map will also be
+ * freed.
+ *
+ * Returns: the new map or NULL if the allocation failed.
+ **/
+#define nih_map_string_new(parent, entries)			     \
+	nih_map_new (parent, entries,				     \
+		     nih_hash_string_function,			     \
+		     (NihCmpFunction)nih_hash_string_cmp)
+
+/**
+ * nih_map_int_new:
+ * @parent: parent of new map,
+ * @entries: rough number of entries expected.
+ *
+ * Allocates a new map with enough slots for @entries, keyed by integers
+ * converted with NIH_MAP_INT_KEY().
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned map.  When all parents
+ * of the returned map are freed, the returned map will also be
+ * freed.
+ *
+ * Returns: the new map or NULL if the allocation failed.
+ **/
+#define nih_map_int_new(parent, entries)			     \
+	nih_map_new (parent, entries,				     \
+		     nih_map_int_hash, nih_map_int_cmp)
+
+
+NIH_BEGIN_EXTERN
+
+NihMap *    nih_map_new         (const void *parent, size_t entries,
+				 NihHashFunction hash_function,
+				 NihCmpFunction cmp_function)
+	__attribute__ ((warn_unused_result, malloc));
+
+int         nih_map_set         (NihMap *map, const void *key, void *value)
+	__attribute__ ((warn_unused_result));
+void *      nih_map_lookup      (NihMap *map, const void *key);
+int         nih_map_remove      (NihMap *map, const void *key);
+
+uint32_t    nih_map_int_hash    (const void *key);
+int         nih_map_int_cmp     (const void *key1, const void *key2);
+
+NihMapSlot *_nih_map_next       (NihMap *map, NihMapSlot *slot);
+NihMap *    _nih_map_iter_begin (NihMap *map);
+void        _nih_map_iter_end   (NihMap **map);
+
+NIH_END_EXTERN
+
+#endif /* NIH_MAP_H */
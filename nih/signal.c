@@ -24,12 +24,18 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <sys/types.h>
+#include <sys/signalfd.h>
+
+#include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/io.h>
 #include <nih/main.h>
 #include <nih/logging.h>
 #include <nih/error.h>
@@ -45,6 +51,13 @@
  **/
 #define NUM_SIGNALS 32
 
+/**
+ * NIH_SIGNAL_FD_BATCH:
+ *
+ * Number of signals read from the signalfd at once.
+ **/
+#define NIH_SIGNAL_FD_BATCH 16
+
 /**
  * SignalName:
  * @num: number of signal,
@@ -122,6 +135,61 @@ static const SignalName signal_names[] = {
  **/
 static volatile sig_atomic_t signals_caught[NUM_SIGNALS];
 
+/**
+ * signals_pending:
+ *
+ * Set by the signal handler when any element of @signals_caught has
+ * been incremented, so that nih_signal_poll() need not check them all
+ * when no signal has been raised.
+ **/
+static volatile sig_atomic_t signals_pending = 0;
+
+/**
+ * signal_fd:
+ *
+ * signalfd that signals set to nih_signal_handler() are read from once
+ * nih_signal_init_fd() has been called, or -1.
+ **/
+static int signal_fd = -1;
+
+/**
+ * signal_fd_forks:
+ *
+ * Value of nih_io_forks when @signal_fd was created; a child process must
+ * create its own since it would otherwise share the mask with its parent.
+ **/
+static unsigned int signal_fd_forks = 0;
+
+/**
+ * signal_fd_mask:
+ *
+ * Signals read from @signal_fd, these are blocked from normal delivery.
+ **/
+static sigset_t signal_fd_mask;
+
+/**
+ * signal_fd_watch:
+ *
+ * Watch on @signal_fd.
+ **/
+static NihIoWatch *signal_fd_watch = NULL;
+
+/**
+ * signal_use_fd:
+ *
+ * TRUE once nih_signal_init_fd() has been called.
+ **/
+static int signal_use_fd = FALSE;
+
+
+/* Prototypes for static functions */
+static int  nih_signal_fd_update   (void);
+static int  nih_signal_fd_set      (int signum, int read);
+static void nih_signal_fd_reader   (void *data, NihIoWatch *watch,
+				    NihIoEvents events);
+static void nih_signal_dispatch    (const NihSignalInfo *info);
+
+
 /**
  * nih_signals:
  *
@@ -143,6 +211,133 @@ nih_signal_init (void)
 		nih_signals = NIH_MUST (nih_list_new (NULL));
 }
 
+/**
+ * nih_signal_init_fd:
+ *
+ * Arranges for signals set to nih_signal_handler() to be read from a
+ * signalfd watched by the main loop, rather than caught by the handler.
+ * Those signals are blocked from normal delivery, and handlers are called
+ * once for each signal read, with the details of the sender in the info
+ * member of the NihSignal structure.
+ *
+ * Signals set to nih_signal_handler() before this function is called
+ * will need to be set again.  Blocked signals are inherited by child
+ * processes, so nih_signal_reset() should be called in the child before
+ * executing another program.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+nih_signal_init_fd (void)
+{
+	nih_signal_init ();
+
+	if (! signal_use_fd) {
+		sigemptyset (&signal_fd_mask);
+		signal_use_fd = TRUE;
+	}
+
+	if (nih_signal_fd_update () < 0) {
+		signal_use_fd = FALSE;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * nih_signal_fd_update:
+ *
+ * Creates the signalfd if necessary, or updates it with the current mask.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+nih_signal_fd_update (void)
+{
+	if (! signal_use_fd)
+		return 0;
+
+	if ((signal_fd >= 0) && (signal_fd_forks != nih_io_forks)) {
+		nih_free (signal_fd_watch);
+		close (signal_fd);
+
+		signal_fd_watch = NULL;
+		signal_fd = -1;
+	}
+
+	if (signal_fd >= 0) {
+		if (signalfd (signal_fd, &signal_fd_mask, 0) < 0)
+			nih_return_system_error (-1);
+
+		return 0;
+	}
+
+	signal_fd = signalfd (-1, &signal_fd_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		nih_return_system_error (-1);
+
+	signal_fd_watch = nih_io_add_watch (NULL, signal_fd, NIH_IO_READ,
+					    nih_signal_fd_reader, NULL);
+	if (! signal_fd_watch) {
+		nih_error_raise_no_memory ();
+		close (signal_fd);
+		signal_fd = -1;
+		return -1;
+	}
+
+	signal_fd_forks = nih_io_forks;
+
+	return 0;
+}
+
+/**
+ * nih_signal_fd_set:
+ * @signum: signal number,
+ * @read: whether to read from the signalfd.
+ *
+ * Adds @signum to, or removes it from, the signals read from the
+ * signalfd, blocking or unblocking its normal delivery to match.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+nih_signal_fd_set (int signum,
+		   int read)
+{
+	sigset_t mask;
+
+	nih_assert (signum > 0);
+	nih_assert (signum < NUM_SIGNALS);
+
+	if (! signal_use_fd)
+		return 0;
+
+	if (sigismember (&signal_fd_mask, signum) == (read ? 1 : 0))
+		return 0;
+
+	sigemptyset (&mask);
+	sigaddset (&mask, signum);
+
+	if (read) {
+		sigaddset (&signal_fd_mask, signum);
+		if (nih_signal_fd_update () < 0) {
+			sigdelset (&signal_fd_mask, signum);
+			return -1;
+		}
+
+		sigprocmask (SIG_BLOCK, &mask, NULL);
+	} else {
+		sigdelset (&signal_fd_mask, signum);
+		sigprocmask (SIG_UNBLOCK, &mask, NULL);
+
+		if (nih_signal_fd_update () < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 
 /**
  * nih_signal_set_handler:
@@ -152,7 +347,12 @@ nih_signal_init (void)
  * Sets signal @signum to call the @handler function when raised, with
  * sensible defaults for the flags and signal mask.
  *
- * Returns: zero on success, negative value on invalid signal.
+ * If nih_signal_init_fd() has been called and @handler is
+ * nih_signal_handler(), the signal is instead blocked and read from the
+ * signalfd.
+ *
+ * Returns: zero on success, negative value on invalid signal or if
+ * the signalfd could not be updated.
  **/
 int
 nih_signal_set_handler (int    signum,
@@ -173,7 +373,7 @@ nih_signal_set_handler (int    signum,
 	if (sigaction (signum, &act, NULL) < 0)
 		return -1;
 
-	return 0;
+	return nih_signal_fd_set (signum, handler == nih_signal_handler);
 }
 
 /**
@@ -200,7 +400,7 @@ nih_signal_set_default (int signum)
 	if (sigaction (signum, &act, NULL) < 0)
 		return -1;
 
-	return 0;
+	return nih_signal_fd_set (signum, FALSE);
 }
 
 /**
@@ -227,19 +427,37 @@ nih_signal_set_ignore (int signum)
 	if (sigaction (signum, &act, NULL) < 0)
 		return -1;
 
-	return 0;
+	return nih_signal_fd_set (signum, FALSE);
 }
 
 /**
  * nih_signal_reset:
  *
  * Resets all signals to their default handling.
+ *
+ * In a child process, signals read from a signalfd inherited from the
+ * parent are unblocked and the signalfd closed, without the work of
+ * creating new ones in their place; the watch on it is discarded without
+ * updating the epoll instance, which belongs to the parent.
  **/
 void
 nih_signal_reset (void)
 {
 	int i;
 
+	if ((signal_fd >= 0) && (signal_fd_forks != nih_io_forks)) {
+		sigprocmask (SIG_UNBLOCK, &signal_fd_mask, NULL);
+		sigemptyset (&signal_fd_mask);
+
+		nih_list_remove (&signal_fd_watch->entry);
+		nih_list_remove (&signal_fd_watch->fd_entry);
+		nih_free (signal_fd_watch);
+		close (signal_fd);
+
+		signal_fd_watch = NULL;
+		signal_fd = -1;
+	}
+
 	for (i = 1; i < NUM_SIGNALS; i++)
 		nih_signal_set_default (i);
 }
@@ -295,6 +513,8 @@ nih_signal_add_handler (const void       *parent,
 	signal->handler = handler;
 	signal->data = data;
 
+	memset (&signal->info, 0, sizeof (NihSignalInfo));
+
 	nih_list_add (nih_signals, &signal->entry);
 
 	return signal;
@@ -317,6 +537,7 @@ nih_signal_handler (int signum)
 	nih_assert (signum < NUM_SIGNALS);
 
 	signals_caught[signum]++;
+	signals_pending = 1;
 
 	nih_main_loop_interrupt ();
 }
@@ -328,26 +549,106 @@ nih_signal_handler (int signum)
  * if that signal has been raised since the last time nih_signal_poll() was
  * called.
  *
+ * Signals read from a signalfd are dispatched as they are read, so are
+ * not handled here.
+ *
  * It is safe for the handler to remove itself.
  **/
 void
 nih_signal_poll (void)
 {
-	int s;
+	NihSignalInfo info;
+	int           s;
 
 	nih_signal_init ();
 
+	if (! signals_pending)
+		return;
+
+	signals_pending = 0;
+
+	for (s = 1; s < NUM_SIGNALS; s++) {
+		if (! signals_caught[s])
+			continue;
+
+		signals_caught[s] = 0;
+
+		memset (&info, 0, sizeof (info));
+		info.signum = s;
+
+		nih_signal_dispatch (&info);
+	}
+}
+
+/**
+ * nih_signal_fd_reader:
+ * @data: not used,
+ * @watch: watch on the signalfd,
+ * @events: events that occurred.
+ *
+ * Called when signals are ready to be read from the signalfd, reads them
+ * in batches and calls the handlers for each one.
+ **/
+static void
+nih_signal_fd_reader (void        *data,
+		      NihIoWatch  *watch,
+		      NihIoEvents  events)
+{
+	struct signalfd_siginfo siginfo[NIH_SIGNAL_FD_BATCH];
+	ssize_t                 len;
+	size_t                  i;
+
+	nih_assert (watch != NULL);
+
+	for (;;) {
+		len = read (watch->fd, siginfo, sizeof (siginfo));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		for (i = 0; i < (size_t)len / sizeof (struct signalfd_siginfo);
+		     i++) {
+			NihSignalInfo info;
+
+			info.signum = siginfo[i].ssi_signo;
+			info.code = siginfo[i].ssi_code;
+			info.pid = siginfo[i].ssi_pid;
+			info.uid = siginfo[i].ssi_uid;
+			info.status = siginfo[i].ssi_status;
+
+			nih_signal_dispatch (&info);
+		}
+
+		/* A short read means there are no more signals waiting */
+		if ((size_t)len < sizeof (siginfo))
+			break;
+	}
+}
+
+/**
+ * nih_signal_dispatch:
+ * @info: details of signal raised.
+ *
+ * Calls the function of each registered signal handler for the signal
+ * in @info.
+ **/
+static void
+nih_signal_dispatch (const NihSignalInfo *info)
+{
+	nih_assert (info != NULL);
+
 	NIH_LIST_FOREACH_SAFE (nih_signals, iter) {
 		NihSignal *signal = (NihSignal *)iter;
 
-		if (! signals_caught[signal->signum])
+		if (signal->signum != info->signum)
 			continue;
 
+		memcpy (&signal->info, info, sizeof (NihSignalInfo));
 		signal->handler (signal->data, signal);
 	}
-
-	for (s = 0; s < NUM_SIGNALS; s++)
-		signals_caught[s] = 0;
 }
 
 
@@ -23,6 +23,8 @@
 #include <nih/macros.h>
 #include <nih/list.h>
 
+#include <sys/types.h>
+
 #include <signal.h>
 
 
@@ -38,12 +40,33 @@
 typedef struct nih_signal NihSignal;
 typedef void (*NihSignalHandler) (void *data, NihSignal *signal);
 
+/**
+ * NihSignalInfo:
+ * @signum: signal raised,
+ * @code: reason the signal was sent (SI_USER, CLD_EXITED, etc.),
+ * @pid: process that sent the signal,
+ * @uid: real user id of the process that sent the signal,
+ * @status: exit status or signal (SIGCHLD).
+ *
+ * Details of a raised signal; these are only known when the signal was
+ * read from a signalfd, see nih_signal_init_fd(), otherwise only @signum
+ * is set.
+ **/
+typedef struct nih_signal_info {
+	int   signum;
+	int   code;
+	pid_t pid;
+	uid_t uid;
+	int   status;
+} NihSignalInfo;
+
 /**
  * NihSignal:
  * @entry: list header,
  * @signum: signal to catch,
  * @handler: function called when caught,
- * @data: pointer passed to @handler.
+ * @data: pointer passed to @handler,
+ * @info: details of the signal being handled.
  *
  * This structure contains information about a function that should be
  * called whenever a particular signal is raised.  The calling is done
@@ -52,6 +75,9 @@ typedef void (*NihSignalHandler) (void *data, NihSignal *signal);
  *
  * The callback can be removed by using nih_list_remove() as they are
  * held in a list internally.
+ *
+ * While @handler is being called, @info holds the details of the signal
+ * that was raised.
  **/
 struct nih_signal {
 	NihList           entry;
@@ -59,6 +85,8 @@ struct nih_signal {
 
 	NihSignalHandler  handler;
 	void             *data;
+
+	NihSignalInfo     info;
 };
 
 
@@ -68,6 +96,8 @@ extern NihList *nih_signals;
 
 
 void        nih_signal_init        (void);
+int         nih_signal_init_fd     (void)
+	__attribute__ ((warn_unused_result));
 
 int         nih_signal_set_handler (int signum, void (*handler)(int));
 int         nih_signal_set_default (int signum);
@@ -34,6 +34,7 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/array.h>
 #include <nih/logging.h>
 
 #include "string.h"
@@ -390,19 +391,17 @@ nih_str_split (const void *parent,
 	       const char *delim,
 	       int         repeat)
 {
-	char   **array;
-	size_t   len;
+	NihArray array;
+	char **  ret;
 
 	nih_assert (str != NULL);
 	nih_assert (delim != NULL);
 
-	len = 0;
-	array = nih_str_array_new (parent);
-	if (! array)
-		return NULL;
+	nih_array_init (&array, parent, NULL, 0);
 
 	while (*str) {
-		const char  *ptr;
+		nih_local char *token = NULL;
+		const char     *ptr;
 
 		/* Skip initial delimiters */
 		while (repeat && *str && strchr (delim, *str))
@@ -420,18 +419,26 @@ nih_str_split (const void *parent,
 		if (repeat && (str == ptr))
 			continue;
 
-		if (! nih_str_array_addn (&array, parent, &len,
-					  ptr, str - ptr)) {
-			nih_free (array);
-			return NULL;
-		}
+		token = nih_strndup (NULL, ptr, str - ptr);
+		if ((! token) || (nih_array_addp (&array, token) < 0))
+			goto error;
 
 		/* Skip over the delimiter */
 		if (*str)
 			str++;
 	}
 
-	return array;
+	ret = (char **)nih_array_trim (&array);
+	if (! ret)
+		goto error;
+
+	return ret;
+
+error:
+	if (array.elems)
+		nih_free (array.elems);
+
+	return NULL;
 }
 
 
@@ -589,6 +596,9 @@ nih_str_array_addn (char       ***array,
  * this is less efficient as it necessates counting the length on each
  * invocation.
  *
+ * The array is reallocated each time, so when building a long array it's
+ * better to use an NihArray, which leaves room to grow.
+ *
  * If the array pointed to by @array is NULL, the array will be allocated
  * and @ptr the first element, and if @parent is not NULL, it should be a
  * pointer to another object which will be used as a parent for the returned
@@ -716,7 +726,8 @@ nih_str_array_append (char         ***array,
 		      size_t         *len,
 		      char * const   *args)
 {
-	size_t        c_len, o_len;
+	NihArray      new_array;
+	size_t        c_len, o_len, nargs;
 	int           free_on_error = FALSE;
 	char * const *arg;
 
@@ -737,26 +748,39 @@ nih_str_array_append (char         ***array,
 
 	o_len = c_len;
 
+	for (nargs = 0, arg = args; *arg; arg++)
+		nargs++;
+
+	/* Make room for all of the new elements at once, rather than
+	 * growing the array for each.
+	 */
+	nih_array_init (&new_array, parent, (void **)*array, c_len);
+	if (nih_array_reserve (&new_array, c_len + nargs) < 0)
+		return NULL;
+
+	*array = (char **)new_array.elems;
+
 	for (arg = args; *arg; arg++) {
-		if (! nih_str_array_add (array, parent, &c_len, *arg)) {
-			if (*array) {
-				for (; c_len > o_len; c_len--)
-					nih_free ((*array)[c_len - 1]);
+		nih_local char *new_str = NULL;
 
-				(*array)[o_len] = NULL;
+		new_str = nih_strdup (NULL, *arg);
+		if (! new_str) {
+			nih_array_truncate (&new_array, o_len);
 
-				if (free_on_error) {
-					nih_free (*array);
-					*array = NULL;
-				}
+			if (free_on_error) {
+				nih_free (*array);
+				*array = NULL;
 			}
 
 			return NULL;
 		}
+
+		if (nih_array_addp (&new_array, new_str) < 0)
+			nih_assert_not_reached ();
 	}
 
 	if (len)
-		*len = c_len;
+		*len = new_array.len;
 
 	return *array;
 }
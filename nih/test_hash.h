@@ -36,8 +36,9 @@
  * Check that the hash table @_hash is empty.
  **/
 #define TEST_HASH_EMPTY(_hash) \
-	for (size_t _hash_i = 0; _hash_i < (_hash)->size; _hash_i++) \
-		if (! NIH_LIST_EMPTY (&(_hash)->bins[_hash_i])) \
+	for (size_t _hash_i = 0; _hash_i < (_hash)->old_size + (_hash)->size; \
+	     _hash_i++) \
+		if (! NIH_LIST_EMPTY (_NIH_HASH_BIN ((_hash), _hash_i))) \
 			TEST_FAILED ("hash %p (%s) not empty as expected", \
 				     (_hash), #_hash)
 
@@ -50,8 +51,10 @@
 #define TEST_HASH_NOT_EMPTY(_hash) \
 	do { \
 		int _hash_empty = 1; \
-		for (size_t _hash_i = 0; _hash_i < (_hash)->size; _hash_i++) \
-			if (! NIH_LIST_EMPTY (&(_hash)->bins[_hash_i])) \
+		for (size_t _hash_i = 0; \
+		     _hash_i < (_hash)->old_size + (_hash)->size; \
+		     _hash_i++) \
+			if (! NIH_LIST_EMPTY (_NIH_HASH_BIN ((_hash), _hash_i))) \
 				_hash_empty = 0; \
 		if (_hash_empty) \
 			TEST_FAILED ("hash %p (%s) empty, expected multiple members", \
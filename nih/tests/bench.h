@@ -0,0 +1,343 @@
+/* libnih
+ *
+ * bench.h - harness for the benchmarks
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NIH_BENCH_H
+#define NIH_BENCH_H
+
+/**
+ * Each benchmark is a block of code following the BENCH() macro, which
+ * runs it a number of times to warm up and then a number of times to
+ * measure; within the block, the code being measured is surrounded by
+ * calls to bench_start() and bench_stop(), anything else in the block
+ * being set up or cleanup that isn't measured.
+ *
+ *	BENCH (entries, "hash/lookup/%d", entries) {
+ *		hash = build (entries);
+ *
+ *		bench_start ();
+ *		for (i = 0; i < entries; i++)
+ *			nih_hash_lookup (hash, keys[i]);
+ *		bench_stop ();
+ *
+ *		nih_free (hash);
+ *	}
+ *
+ * Once the block has been run, the best and median time per operation
+ * is reported along with the number of allocations made per operation,
+ * counted by wrapping the malloc() and realloc() used by nih_alloc().
+ *
+ * Benchmarks call bench_init() at the start of main(), which accepts
+ * the following options:
+ *
+ *  --json	  write one JSON object per benchmark on each line,
+ *  --reps=N	  number of times each benchmark is measured,
+ *  --warmup=N	  number of times each benchmark is run beforehand.
+ **/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/logging.h>
+
+
+/**
+ * BENCH_REPS:
+ *
+ * Default number of times each benchmark is measured.
+ **/
+#define BENCH_REPS 5
+
+/**
+ * BENCH_WARMUP:
+ *
+ * Default number of times each benchmark is run before being measured.
+ **/
+#define BENCH_WARMUP 1
+
+/**
+ * BENCH_MAX_REPS:
+ *
+ * Largest number of measurements kept for each benchmark.
+ **/
+#define BENCH_MAX_REPS 100
+
+
+/* Wrapped to count the allocations made, as the test suite does */
+extern void *(*__nih_malloc)(size_t size);
+extern void *(*__nih_realloc)(void *ptr, size_t size);
+
+
+static const char *bench_program = NULL;
+static int         bench_json = FALSE;
+static int         bench_reps = BENCH_REPS;
+static int         bench_warmup = BENCH_WARMUP;
+
+static char        bench_name[256];
+static size_t      bench_ops;
+static int         bench_rep;
+static double      bench_samples[BENCH_MAX_REPS];
+static int         bench_nsamples;
+static size_t      bench_sample_allocs;
+
+static size_t      bench_allocs = 0;
+static double      bench_start_ns;
+static size_t      bench_start_allocs;
+
+
+/**
+ * BENCH:
+ * @_ops: number of operations measured each time,
+ * @...: printf-style format and arguments for the name of the benchmark.
+ *
+ * Runs the following block of code to warm up and then to measure it,
+ * reporting the results once done; the block should call bench_start()
+ * and bench_stop() around the operations it measures.
+ **/
+#define BENCH(_ops, ...)						\
+	for (bench_begin ((_ops), __VA_ARGS__); bench_next (); )
+
+
+/**
+ * bench_now:
+ *
+ * Returns: current time in nanoseconds.
+ **/
+static inline __attribute__ ((used)) double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline __attribute__ ((used)) void *
+bench_malloc (size_t size)
+{
+	bench_allocs++;
+
+	return malloc (size);
+}
+
+static inline __attribute__ ((used)) void *
+bench_realloc (void * ptr,
+	       size_t size)
+{
+	bench_allocs++;
+
+	return realloc (ptr, size);
+}
+
+
+/**
+ * bench_init:
+ * @argc: number of arguments,
+ * @argv: arguments.
+ *
+ * Parses the options given to the benchmark program and arranges for
+ * the allocations made by nih_alloc() to be counted.
+ **/
+static inline __attribute__ ((used)) void
+bench_init (int   argc,
+	    char *argv[])
+{
+	int i;
+
+	bench_program = strrchr (argv[0], '/');
+	bench_program = bench_program ? bench_program + 1 : argv[0];
+
+	for (i = 1; i < argc; i++) {
+		if (! strcmp (argv[i], "--json")) {
+			bench_json = TRUE;
+		} else if (! strncmp (argv[i], "--reps=", 7)) {
+			bench_reps = atoi (argv[i] + 7);
+		} else if (! strncmp (argv[i], "--warmup=", 9)) {
+			bench_warmup = atoi (argv[i] + 9);
+		} else {
+			fprintf (stderr, "%s: unrecognised option: %s\n",
+				 bench_program, argv[i]);
+			exit (1);
+		}
+	}
+
+	if ((bench_reps < 1) || (bench_reps > BENCH_MAX_REPS)) {
+		fprintf (stderr, "%s: repetitions must be between 1 and %d\n",
+			 bench_program, BENCH_MAX_REPS);
+		exit (1);
+	}
+
+	if (bench_warmup < 0)
+		bench_warmup = 0;
+
+	__nih_malloc = bench_malloc;
+	__nih_realloc = bench_realloc;
+}
+
+
+/**
+ * bench_begin:
+ * @ops: number of operations measured each time,
+ * @format: printf-style format for the name of the benchmark.
+ *
+ * Called by the BENCH() macro to begin a benchmark.
+ **/
+static inline __attribute__ ((used, format (printf, 2, 3))) void
+bench_begin (size_t      ops,
+	     const char *format,
+	     ...)
+{
+	va_list args;
+
+	nih_assert (bench_program != NULL);
+	nih_assert (ops > 0);
+
+	va_start (args, format);
+	vsnprintf (bench_name, sizeof (bench_name), format, args);
+	va_end (args);
+
+	bench_ops = ops;
+	bench_rep = 0;
+	bench_nsamples = 0;
+	bench_sample_allocs = 0;
+}
+
+/**
+ * bench_start:
+ *
+ * Begins measuring the operations of the current benchmark.
+ **/
+static inline __attribute__ ((used)) void
+bench_start (void)
+{
+	bench_start_allocs = bench_allocs;
+	bench_start_ns = bench_now ();
+}
+
+/**
+ * bench_sample:
+ * @ns: time taken in nanoseconds,
+ * @allocs: number of allocations made.
+ *
+ * Records a measurement of the operations of the current benchmark that
+ * the caller has taken itself, rather than with bench_start() and
+ * bench_stop(); it's ignored while warming up.
+ **/
+static inline __attribute__ ((used)) void
+bench_sample (double ns,
+	      size_t allocs)
+{
+	nih_assert (bench_rep > 0);
+
+	if (bench_rep <= bench_warmup)
+		return;
+
+	nih_assert (bench_nsamples < BENCH_MAX_REPS);
+
+	bench_samples[bench_nsamples++] = ns;
+	bench_sample_allocs += allocs;
+}
+
+/**
+ * bench_stop:
+ *
+ * Finishes measuring the operations of the current benchmark.
+ **/
+static inline __attribute__ ((used)) void
+bench_stop (void)
+{
+	double end;
+
+	end = bench_now ();
+
+	bench_sample (end - bench_start_ns, bench_allocs - bench_start_allocs);
+}
+
+
+static int
+bench_cmp (const void *a,
+	   const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * bench_report:
+ *
+ * Reports the results of the current benchmark.
+ **/
+static inline __attribute__ ((used)) void
+bench_report (void)
+{
+	double best, median, allocs;
+
+	nih_assert (bench_nsamples > 0);
+
+	qsort (bench_samples, bench_nsamples, sizeof (double), bench_cmp);
+
+	best = bench_samples[0] / bench_ops;
+	median = bench_samples[bench_nsamples / 2] / bench_ops;
+	allocs = (double)bench_sample_allocs / bench_nsamples / bench_ops;
+
+	if (bench_json) {
+		printf ("{\"program\": \"%s\", \"name\": \"%s\", "
+			"\"ops\": %zu, \"reps\": %d, \"warmup\": %d, "
+			"\"ns_per_op\": %.3f, \"median_ns_per_op\": %.3f, "
+			"\"allocs_per_op\": %.3f}\n",
+			bench_program, bench_name, bench_ops, bench_nsamples,
+			bench_warmup, best, median, allocs);
+	} else {
+		printf ("%-40s %8zu ops: %10.1f ns/op (median %10.1f), "
+			"%7.2f allocs/op\n",
+			bench_name, bench_ops, best, median, allocs);
+	}
+
+	fflush (stdout);
+}
+
+/**
+ * bench_next:
+ *
+ * Called by the BENCH() macro before each run of the block, reporting
+ * the results once it has been run enough times.
+ *
+ * Returns: TRUE if the block should be run again, FALSE once done.
+ **/
+static inline __attribute__ ((used)) int
+bench_next (void)
+{
+	if (bench_rep == bench_warmup + bench_reps) {
+		bench_report ();
+		return FALSE;
+	}
+
+	bench_rep++;
+
+	return TRUE;
+}
+
+#endif /* NIH_BENCH_H */
@@ -0,0 +1,225 @@
+/* libnih
+ *
+ * bench_alloc.c - benchmarks for nih/alloc.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_OBJECTS:
+ *
+ * Number of objects in each hierarchy torn down.
+ **/
+#define BENCH_OBJECTS 100000
+
+/**
+ * BENCH_CHURN:
+ *
+ * Number of objects live at once while churning.
+ **/
+#define BENCH_CHURN 1024
+
+/**
+ * BENCH_LIMIT:
+ *
+ * Limit passed to nih_free_deferred_poll(), as the main loop does.
+ **/
+#define BENCH_LIMIT 1024
+
+
+static void *
+build_wide (void)
+{
+	void *root;
+	int   i;
+
+	root = NIH_MUST (nih_alloc (NULL, 64));
+	for (i = 1; i < BENCH_OBJECTS; i++)
+		NIH_MUST (nih_alloc (root, 64));
+
+	return root;
+}
+
+static void *
+build_deep (void)
+{
+	void *root;
+	void *parent;
+	int   i;
+
+	root = parent = NIH_MUST (nih_alloc (NULL, 64));
+	for (i = 1; i < BENCH_OBJECTS; i++)
+		parent = NIH_MUST (nih_alloc (parent, 64));
+
+	return root;
+}
+
+
+static void
+bench_churn (const char *name)
+{
+	void *objects[BENCH_CHURN];
+	int   i, j;
+
+	/* Objects of mixed small sizes freed in a different order to that
+	 * they were allocated, so that freed memory is reused out of order.
+	 */
+	BENCH (BENCH_OBJECTS, "churn/%s", name) {
+		memset (objects, 0, sizeof (objects));
+
+		bench_start ();
+		for (i = 0; i < BENCH_OBJECTS; i++) {
+			j = (i * 7) % BENCH_CHURN;
+
+			if (objects[j])
+				nih_free (objects[j]);
+
+			objects[j] = NIH_MUST (nih_alloc (NULL,
+							  16 + (i % 8) * 8));
+		}
+		bench_stop ();
+
+		for (j = 0; j < BENCH_CHURN; j++)
+			if (objects[j])
+				nih_free (objects[j]);
+	}
+
+	/* Objects allocated beneath a parent, each releasing the earlier
+	 * one it replaces with nih_unref().
+	 */
+	BENCH (BENCH_OBJECTS, "churn/%s/ref", name) {
+		void *parent;
+
+		parent = NIH_MUST (nih_alloc (NULL, 64));
+		memset (objects, 0, sizeof (objects));
+
+		bench_start ();
+		for (i = 0; i < BENCH_OBJECTS; i++) {
+			j = i % BENCH_CHURN;
+
+			if (objects[j])
+				nih_unref (objects[j], parent);
+
+			objects[j] = NIH_MUST (nih_alloc (parent, 32));
+		}
+		bench_stop ();
+
+		nih_free (parent);
+	}
+}
+
+static void
+bench_teardown (const char *name,
+		void *    (*build) (void))
+{
+	void *root;
+
+	BENCH (BENCH_OBJECTS, "teardown/%s/nih_free", name) {
+		root = build ();
+
+		bench_start ();
+		nih_free (root);
+		bench_stop ();
+	}
+
+	BENCH (BENCH_OBJECTS, "teardown/%s/nih_free_deferred", name) {
+		root = build ();
+
+		bench_start ();
+		nih_free_deferred (root);
+		bench_stop ();
+
+		while (nih_free_deferred_poll (BENCH_LIMIT))
+			;
+	}
+
+	/* The whole time taken to release the objects from the main loop,
+	 * and the longest that any one poll blocks it for.
+	 */
+	BENCH (BENCH_OBJECTS, "teardown/%s/deferred_total", name) {
+		root = build ();
+
+		bench_start ();
+		nih_free_deferred (root);
+		while (nih_free_deferred_poll (BENCH_LIMIT))
+			;
+		bench_stop ();
+	}
+
+	BENCH (1, "teardown/%s/longest_poll", name) {
+		double worst = 0;
+		int    more;
+
+		root = build ();
+		nih_free_deferred (root);
+
+		do {
+			double start, end;
+
+			start = bench_now ();
+			more = nih_free_deferred_poll (BENCH_LIMIT);
+			end = bench_now ();
+
+			if (end - start > worst)
+				worst = end - start;
+		} while (more);
+
+		bench_sample (worst, 0);
+	}
+}
+
+static void *
+build_arena (void)
+{
+	void *root;
+	int   i;
+
+	root = NIH_MUST (nih_arena_new (NULL));
+	for (i = 1; i < BENCH_OBJECTS; i++)
+		NIH_MUST (nih_alloc (root, 64));
+
+	return root;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench_churn ("malloc");
+
+	bench_teardown ("wide", build_wide);
+	bench_teardown ("deep", build_deep);
+	bench_teardown ("arena", build_arena);
+
+	/* Pools can't be turned off again once in use */
+	nih_alloc_pool_init ();
+
+	bench_churn ("pool");
+
+	return 0;
+}
@@ -0,0 +1,430 @@
+/* libnih
+ *
+ * bench_btree.c - benchmarks for nih/btree.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/tree.h>
+#include <nih/btree.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_LIST_MAX:
+ *
+ * Largest number of entries the sorted list is benchmarked with, since
+ * each insert and lookup walks half of it on average.
+ **/
+#define BENCH_LIST_MAX 10000
+
+
+typedef struct list_entry {
+	NihList entry;
+	int     key;
+} ListEntry;
+
+typedef struct tree_entry {
+	NihTree node;
+	int     key;
+} TreeEntry;
+
+typedef struct index_entry {
+	NihTreeIndexNode node;
+	int              key;
+} IndexEntry;
+
+
+static int *keys;
+static int  entries;
+
+
+static NihList *
+build_list (void)
+{
+	NihList   *list;
+	ListEntry *entry;
+	int        i;
+
+	list = NIH_MUST (nih_list_new (NULL));
+	entry = NIH_MUST (nih_alloc (list, sizeof (ListEntry) * entries));
+
+	for (i = 0; i < entries; i++) {
+		NihList *iter;
+
+		nih_list_init (&entry[i].entry);
+		entry[i].key = keys[i];
+
+		for (iter = list->next; iter != list; iter = iter->next)
+			if (((ListEntry *)iter)->key > keys[i])
+				break;
+
+		nih_list_add (iter, &entry[i].entry);
+	}
+
+	return list;
+}
+
+static void
+bench_list (void)
+{
+	NihList *list;
+	long     sum;
+	int      i;
+
+	BENCH (entries, "NihList/%d/add", entries) {
+		bench_start ();
+		list = build_list ();
+		bench_stop ();
+
+		nih_free (list);
+	}
+
+	BENCH (entries, "NihList/%d/lookup", entries) {
+		list = build_list ();
+
+		bench_start ();
+		for (i = 0; i < entries; i++) {
+			NihList *iter;
+
+			for (iter = list->next; iter != list;
+			     iter = iter->next)
+				if (((ListEntry *)iter)->key >= i)
+					break;
+
+			if ((iter == list)
+			    || (((ListEntry *)iter)->key != i))
+				nih_assert_not_reached ();
+		}
+		bench_stop ();
+
+		nih_free (list);
+	}
+
+	BENCH (entries, "NihList/%d/iterate", entries) {
+		list = build_list ();
+		sum = 0;
+
+		bench_start ();
+		NIH_LIST_FOREACH (list, iter)
+			sum += ((ListEntry *)iter)->key;
+		bench_stop ();
+
+		nih_assert (sum == (long)entries * (entries - 1) / 2);
+
+		nih_free (list);
+	}
+}
+
+
+static TreeEntry *
+build_tree (void)
+{
+	TreeEntry *entry;
+	NihTree   *root = NULL;
+	int        i;
+
+	entry = NIH_MUST (nih_alloc (NULL, sizeof (TreeEntry) * entries));
+
+	for (i = 0; i < entries; i++) {
+		NihTree *node = root;
+
+		nih_tree_init (&entry[i].node);
+		entry[i].key = keys[i];
+
+		if (! root) {
+			root = &entry[i].node;
+			continue;
+		}
+
+		for (;;) {
+			NihTreeWhere where;
+			NihTree *    next;
+
+			if (keys[i] < ((TreeEntry *)node)->key) {
+				where = NIH_TREE_LEFT;
+				next = node->left;
+			} else {
+				where = NIH_TREE_RIGHT;
+				next = node->right;
+			}
+
+			if (! next) {
+				nih_tree_add (node, &entry[i].node, where);
+				break;
+			}
+
+			node = next;
+		}
+	}
+
+	/* The first entry is the root */
+	return entry;
+}
+
+static void
+bench_tree (void)
+{
+	TreeEntry *entry;
+	long       sum;
+	int        i;
+
+	BENCH (entries, "NihTree/%d/add", entries) {
+		bench_start ();
+		entry = build_tree ();
+		bench_stop ();
+
+		nih_free (entry);
+	}
+
+	BENCH (entries, "NihTree/%d/lookup", entries) {
+		entry = build_tree ();
+
+		bench_start ();
+		for (i = 0; i < entries; i++) {
+			NihTree *node = &entry[0].node;
+
+			while (node && (((TreeEntry *)node)->key != i))
+				node = (i < ((TreeEntry *)node)->key
+					? node->left : node->right);
+
+			if (! node)
+				nih_assert_not_reached ();
+		}
+		bench_stop ();
+
+		nih_free (entry);
+	}
+
+	BENCH (entries, "NihTree/%d/iterate", entries) {
+		entry = build_tree ();
+		sum = 0;
+
+		bench_start ();
+		NIH_TREE_FOREACH (&entry[0].node, iter)
+			sum += ((TreeEntry *)iter)->key;
+		bench_stop ();
+
+		nih_assert (sum == (long)entries * (entries - 1) / 2);
+
+		nih_free (entry);
+	}
+}
+
+
+static const void *
+index_key (NihTree *node)
+{
+	return &((IndexEntry *)node)->key;
+}
+
+static int
+index_cmp (const void *key1,
+	   const void *key2)
+{
+	int a = *(const int *)key1, b = *(const int *)key2;
+
+	return (a > b) - (a < b);
+}
+
+static NihTreeIndex *
+build_index (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry;
+	int           i;
+
+	index = NIH_MUST (nih_tree_index_new (NULL, index_key, index_cmp));
+	entry = NIH_MUST (nih_alloc (index, sizeof (IndexEntry) * entries));
+
+	for (i = 0; i < entries; i++) {
+		nih_tree_init (&entry[i].node.node);
+		entry[i].key = keys[i];
+
+		nih_tree_index_add (index, &entry[i].node);
+	}
+
+	return index;
+}
+
+static void
+bench_index (void)
+{
+	NihTreeIndex *index;
+	long          sum;
+	int           i;
+
+	BENCH (entries, "NihTreeIndex/%d/add", entries) {
+		bench_start ();
+		index = build_index ();
+		bench_stop ();
+
+		nih_free (index);
+	}
+
+	BENCH (entries, "NihTreeIndex/%d/lookup", entries) {
+		index = build_index ();
+
+		bench_start ();
+		for (i = 0; i < entries; i++)
+			if (! nih_tree_index_lookup (index, &i))
+				nih_assert_not_reached ();
+		bench_stop ();
+
+		nih_free (index);
+	}
+
+	BENCH (entries, "NihTreeIndex/%d/iterate", entries) {
+		index = build_index ();
+		sum = 0;
+
+		bench_start ();
+		NIH_TREE_INDEX_FOREACH (index, iter)
+			sum += ((IndexEntry *)iter)->key;
+		bench_stop ();
+
+		nih_assert (sum == (long)entries * (entries - 1) / 2);
+
+		nih_free (index);
+	}
+}
+
+
+static int
+btree_cmp (const void *key1,
+	   const void *key2)
+{
+	intptr_t a = (intptr_t)key1, b = (intptr_t)key2;
+
+	return (a > b) - (a < b);
+}
+
+static NihBTree *
+build_btree (void)
+{
+	NihBTree *btree;
+	int       i;
+
+	btree = NIH_MUST (nih_btree_new (NULL, btree_cmp));
+
+	for (i = 0; i < entries; i++)
+		NIH_MUST (nih_btree_add (btree, (void *)(intptr_t)keys[i],
+					 NULL) == 0);
+
+	return btree;
+}
+
+static void
+bench_btree (void)
+{
+	NihBTree *btree;
+	long      sum;
+	int       i;
+
+	BENCH (entries, "NihBTree/%d/add", entries) {
+		bench_start ();
+		btree = build_btree ();
+		bench_stop ();
+
+		nih_free (btree);
+	}
+
+	BENCH (entries, "NihBTree/%d/lookup", entries) {
+		btree = build_btree ();
+
+		bench_start ();
+		for (i = 0; i < entries; i++) {
+			NihBTreeCursor cursor;
+
+			if ((! nih_btree_lower_bound (btree,
+						      (void *)(intptr_t)i,
+						      &cursor))
+			    || ((intptr_t)nih_btree_cursor_key (&cursor)
+				!= i))
+				nih_assert_not_reached ();
+		}
+		bench_stop ();
+
+		nih_free (btree);
+	}
+
+	BENCH (entries, "NihBTree/%d/iterate", entries) {
+		btree = build_btree ();
+		sum = 0;
+
+		bench_start ();
+		NIH_BTREE_FOREACH (btree, iter)
+			sum += (intptr_t)nih_btree_cursor_key (iter);
+		bench_stop ();
+
+		nih_assert (sum == (long)entries * (entries - 1) / 2);
+
+		nih_free (btree);
+	}
+}
+
+
+static void
+bench (int count)
+{
+	int i;
+
+	/* Each key from zero to count, shuffled */
+	entries = count;
+	keys = NIH_MUST (nih_alloc (NULL, sizeof (int) * entries));
+	for (i = 0; i < entries; i++)
+		keys[i] = i;
+
+	srand (1);
+	for (i = entries - 1; i > 0; i--) {
+		int j = rand () % (i + 1), tmp;
+
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+
+	if (entries <= BENCH_LIST_MAX)
+		bench_list ();
+
+	bench_tree ();
+	bench_index ();
+	bench_btree ();
+
+	nih_free (keys);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench (1000);
+	bench (10000);
+	bench (1000000);
+
+	return 0;
+}
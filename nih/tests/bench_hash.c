@@ -0,0 +1,232 @@
+/* libnih
+ *
+ * bench_hash.c - benchmarks for nih/hash.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/string.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_ENTRIES:
+ *
+ * Number of entries in each hash table with long keys.
+ **/
+#define BENCH_ENTRIES 100000
+
+/**
+ * BENCH_PREFIX:
+ *
+ * Length of the prefix shared by every long key, so that comparing two
+ * keys that differ is as expensive as comparing two that match.
+ **/
+#define BENCH_PREFIX 256
+
+
+typedef struct plain_entry {
+	NihList     entry;
+	const char *key;
+} PlainEntry;
+
+typedef struct cached_entry {
+	NihHashEntry entry;
+	const char  *key;
+} CachedEntry;
+
+
+static char **keys;
+static char **missing;
+
+
+static char **
+make_keys (int         entries,
+	   int         prefix_len,
+	   const char *suffix)
+{
+	char   prefix[prefix_len + 1];
+	char **array;
+	int    i;
+
+	memset (prefix, 'x', prefix_len);
+	prefix[prefix_len] = '\0';
+
+	array = NIH_MUST (nih_alloc (NULL, sizeof (char *) * entries));
+	for (i = 0; i < entries; i++)
+		array[i] = NIH_MUST (nih_sprintf (array, "%s%s%d",
+						  prefix, suffix, i));
+
+	return array;
+}
+
+static NihHash *
+build_plain (int entries,
+	     int size)
+{
+	NihHash *hash;
+	int      i;
+
+	hash = NIH_MUST (nih_hash_string_new (NULL, size));
+	for (i = 0; i < entries; i++) {
+		PlainEntry *entry;
+
+		entry = NIH_MUST (nih_new (hash, PlainEntry));
+		nih_list_init (&entry->entry);
+		entry->key = keys[i];
+
+		nih_hash_add (hash, &entry->entry);
+	}
+
+	return hash;
+}
+
+static NihHash *
+build_cached (int entries,
+	      int size)
+{
+	NihHash *hash;
+	int      i;
+
+	hash = NIH_MUST (nih_hash_string_cached_new (NULL, size));
+	for (i = 0; i < entries; i++) {
+		CachedEntry *entry;
+
+		entry = NIH_MUST (nih_new (hash, CachedEntry));
+		nih_list_init (&entry->entry.entry);
+		entry->key = keys[i];
+
+		nih_hash_add (hash, &entry->entry.entry);
+	}
+
+	return hash;
+}
+
+static NihHash *
+build_grown (NihHash *(*build) (int, int),
+	     int        entries)
+{
+	NihHash *hash;
+
+	hash = build (entries, 0);
+
+	/* Finish growing before timing the lookups */
+	while (hash->old_bins)
+		nih_hash_lookup (hash, keys[0]);
+
+	return hash;
+}
+
+
+static void
+bench (const char *name,
+       int         entries,
+       NihHash * (*build) (int, int))
+{
+	NihHash *hash;
+	int      i;
+
+	BENCH (entries, "%s/%d/add", name, entries) {
+		bench_start ();
+		hash = build (entries, 0);
+		bench_stop ();
+
+		nih_free (hash);
+	}
+
+	BENCH (entries, "%s/%d/add_sized", name, entries) {
+		bench_start ();
+		hash = build (entries, entries);
+		bench_stop ();
+
+		nih_free (hash);
+	}
+
+	BENCH (entries, "%s/%d/hit", name, entries) {
+		hash = build_grown (build, entries);
+
+		bench_start ();
+		for (i = 0; i < entries; i++)
+			if (! nih_hash_lookup (hash, keys[i]))
+				nih_assert_not_reached ();
+		bench_stop ();
+
+		nih_free (hash);
+	}
+
+	BENCH (entries, "%s/%d/miss", name, entries) {
+		hash = build_grown (build, entries);
+
+		bench_start ();
+		for (i = 0; i < entries; i++)
+			if (nih_hash_lookup (hash, missing[i]))
+				nih_assert_not_reached ();
+		bench_stop ();
+
+		nih_free (hash);
+	}
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	int entries;
+
+	bench_init (argc, argv);
+
+	/* Short keys in tables of increasing size, so that the table grows
+	 * more and moves further out of the cache.
+	 */
+	keys = make_keys (BENCH_ENTRIES * 10, 0, "key");
+	missing = make_keys (BENCH_ENTRIES * 10, 0, "missing");
+
+	for (entries = 10; entries <= BENCH_ENTRIES * 10; entries *= 10)
+		bench ("plain", entries, build_plain);
+
+	nih_free (keys);
+	nih_free (missing);
+
+	/* Long keys with a common prefix, so that comparing them costs
+	 * far more than comparing their hashes.
+	 */
+	keys = make_keys (BENCH_ENTRIES, BENCH_PREFIX, "");
+	missing = make_keys (BENCH_ENTRIES, BENCH_PREFIX, "-");
+
+	bench ("long/plain", BENCH_ENTRIES, build_plain);
+	bench ("long/cached", BENCH_ENTRIES, build_cached);
+
+	nih_hash_set_string_hash ((NihHashFunction)nih_hash_string_word_hash);
+	nih_hash_seed_init ();
+
+	bench ("long/word", BENCH_ENTRIES, build_plain);
+	bench ("long/word+cached", BENCH_ENTRIES, build_cached);
+
+	nih_free (keys);
+	nih_free (missing);
+
+	return 0;
+}
@@ -0,0 +1,446 @@
+/* libnih
+ *
+ * bench_io.c - benchmarks for nih/io.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_LINES:
+ *
+ * Number of lines pushed through each buffer.
+ **/
+#define BENCH_LINES 100000
+
+/**
+ * BENCH_BACKLOG:
+ *
+ * Number of lines kept in each buffer, as a stream that can't be
+ * written as quickly as lines are added.
+ **/
+#define BENCH_BACKLOG 200
+
+/**
+ * BENCH_PAYLOADS:
+ *
+ * Number of large payloads written to each stream.
+ **/
+#define BENCH_PAYLOADS 1000
+
+/**
+ * BENCH_BURSTS:
+ *
+ * Number of bursts of datagrams received by each socket.
+ **/
+#define BENCH_BURSTS 500
+
+/**
+ * BENCH_BURST:
+ *
+ * Number of datagrams in each burst.
+ **/
+#define BENCH_BURST 64
+
+/**
+ * BENCH_CHUNK:
+ *
+ * Size of each piece of data written to a stream split into records.
+ **/
+#define BENCH_CHUNK 4096
+
+
+static void
+bench (const char *name,
+       int         sliding)
+{
+	const char   line[] = "Oct 16 12:00:00 host daemon[1234]: message\n";
+	NihIoBuffer *buf;
+	char        *str;
+	size_t       len;
+	int          i;
+
+	/* Lines pushed onto the end and written from the front a line at a
+	 * time, as the send buffer of a busy stream.
+	 */
+	BENCH (BENCH_LINES, "buffer/%s/push_shrink", name) {
+		buf = NIH_MUST (nih_io_buffer_new (NULL));
+		if (sliding)
+			nih_io_buffer_set_sliding (buf);
+
+		for (i = 0; i < BENCH_BACKLOG; i++)
+			NIH_ZERO (nih_io_buffer_push (buf, line,
+						      sizeof (line) - 1));
+
+		bench_start ();
+		for (i = 0; i < BENCH_LINES; i++) {
+			NIH_ZERO (nih_io_buffer_push (buf, line,
+						      sizeof (line) - 1));
+			nih_io_buffer_shrink (buf, sizeof (line) - 1);
+		}
+		bench_stop ();
+
+		nih_free (buf);
+	}
+
+	/* Lines read into the end and popped from the front, as the
+	 * receive buffer of a busy stream.
+	 */
+	BENCH (BENCH_LINES, "buffer/%s/reserve_pop", name) {
+		buf = NIH_MUST (nih_io_buffer_new (NULL));
+		if (sliding)
+			nih_io_buffer_set_sliding (buf);
+
+		for (i = 0; i < BENCH_BACKLOG; i++)
+			NIH_ZERO (nih_io_buffer_push (buf, line,
+						      sizeof (line) - 1));
+
+		bench_start ();
+		for (i = 0; i < BENCH_LINES; i++) {
+			char *room;
+
+			room = NIH_MUST (nih_io_buffer_reserve (buf, 80, &len));
+			memcpy (room, line, sizeof (line) - 1);
+			nih_io_buffer_commit (buf, sizeof (line) - 1);
+
+			len = sizeof (line) - 1;
+			str = NIH_MUST (nih_io_buffer_pop (NULL, buf, &len));
+			nih_free (str);
+		}
+		bench_stop ();
+
+		nih_free (buf);
+	}
+}
+
+static void
+flush (NihIo *io)
+{
+	fd_set readfds, writefds, exceptfds;
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (io->watch->fd, &writefds);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+}
+
+static void
+bench_stream (size_t size)
+{
+	NihIo *io;
+	char  *payload;
+	int    i;
+
+	io = NIH_MUST (nih_io_reopen (NULL, open ("/dev/null", O_WRONLY),
+				      NIH_IO_STREAM, NULL, NULL, NULL, NULL));
+
+	payload = NIH_MUST (nih_alloc (NULL, size));
+	memset (payload, 'x', size);
+
+	/* Each payload framed by a small header and trailer, copied in
+	 * to the send buffer or referenced in the chain.
+	 */
+	BENCH (BENCH_PAYLOADS, "stream/write/%zu", size) {
+		bench_start ();
+		for (i = 0; i < BENCH_PAYLOADS; i++) {
+			NIH_ZERO (nih_io_printf (io, "BEGIN %zu\n", size));
+			NIH_ZERO (nih_io_write (io, payload, size));
+			NIH_ZERO (nih_io_write (io, "END\n", 4));
+			flush (io);
+		}
+		bench_stop ();
+	}
+
+	BENCH (BENCH_PAYLOADS, "stream/write_ref/%zu", size) {
+		bench_start ();
+		for (i = 0; i < BENCH_PAYLOADS; i++) {
+			NIH_ZERO (nih_io_printf (io, "BEGIN %zu\n", size));
+			NIH_ZERO (nih_io_write_ref (io, payload, size));
+			NIH_ZERO (nih_io_write (io, "END\n", 4));
+			flush (io);
+		}
+		bench_stop ();
+	}
+
+	nih_free (payload);
+	nih_free (io);
+}
+
+
+static void
+receive (NihIo *io)
+{
+	fd_set readfds, writefds, exceptfds;
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (io->watch->fd, &readfds);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+}
+
+static void
+bench_message (const char *name,
+	       size_t      slots)
+{
+	const char          msg[] = "<30>Oct 16 12:00:00 host daemon[1234]: message";
+	struct sockaddr_in  addr;
+	socklen_t           addrlen;
+	NihIo              *io;
+	NihIoMessage       *message;
+	int                 sock, i, j;
+	double              ns;
+	size_t              allocs;
+
+	/* Bursts of datagrams sent over the loopback, as a syslog daemon
+	 * receives them; only receiving them is measured.
+	 */
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addrlen = sizeof (addr);
+
+	io = NIH_MUST (nih_io_reopen (NULL, socket (PF_INET, SOCK_DGRAM, 0),
+				      NIH_IO_MESSAGE, NULL, NULL, NULL, NULL));
+	nih_assert (bind (io->watch->fd, (struct sockaddr *)&addr,
+			  addrlen) == 0);
+	nih_assert (getsockname (io->watch->fd, (struct sockaddr *)&addr,
+				 &addrlen) == 0);
+	NIH_ZERO (nih_io_set_recv_batch (io, slots, 0));
+
+	sock = socket (PF_INET, SOCK_DGRAM, 0);
+	nih_assert (connect (sock, (struct sockaddr *)&addr, addrlen) == 0);
+
+	BENCH (BENCH_BURSTS * BENCH_BURST, "message/%s/recv", name) {
+		ns = 0;
+		allocs = 0;
+
+		for (i = 0; i < BENCH_BURSTS; i++) {
+			double start;
+			size_t start_allocs;
+
+			for (j = 0; j < BENCH_BURST; j++)
+				nih_assert (send (sock, msg, sizeof (msg) - 1,
+						  0) > 0);
+
+			start_allocs = bench_allocs;
+			start = bench_now ();
+			receive (io);
+			ns += bench_now () - start;
+			allocs += bench_allocs - start_allocs;
+
+			for (j = 0; j < BENCH_BURST; j++) {
+				message = nih_io_read_message (NULL, io);
+				nih_assert (message != NULL);
+				nih_free (message);
+			}
+		}
+
+		bench_sample (ns, allocs);
+	}
+
+	close (sock);
+	nih_free (io);
+}
+
+
+static void
+bench_message_send (void)
+{
+	const char          msg[] = "host.cpu.load:0.42|g";
+	struct sockaddr_in  addr;
+	socklen_t           addrlen;
+	NihIo              *io;
+	NihIoMessage       *message;
+	int                 sock, i, j;
+	double              ns;
+	size_t              allocs;
+
+	/* Bursts of small datagrams queued each time around the main loop,
+	 * as a metrics emitter sends them; only sending them is measured.
+	 */
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addrlen = sizeof (addr);
+
+	sock = socket (PF_INET, SOCK_DGRAM, 0);
+	nih_assert (bind (sock, (struct sockaddr *)&addr, addrlen) == 0);
+	nih_assert (getsockname (sock, (struct sockaddr *)&addr,
+				 &addrlen) == 0);
+
+	io = NIH_MUST (nih_io_reopen (NULL, socket (PF_INET, SOCK_DGRAM, 0),
+				      NIH_IO_MESSAGE, NULL, NULL, NULL, NULL));
+	nih_assert (connect (io->watch->fd, (struct sockaddr *)&addr,
+			     addrlen) == 0);
+
+	BENCH (BENCH_BURSTS * BENCH_BURST, "message/send") {
+		ns = 0;
+		allocs = 0;
+
+		for (i = 0; i < BENCH_BURSTS; i++) {
+			double start;
+			size_t start_allocs;
+
+			for (j = 0; j < BENCH_BURST; j++) {
+				message = NIH_MUST (nih_io_message_new (NULL));
+				NIH_ZERO (nih_io_buffer_push (message->data, msg,
+							      sizeof (msg) - 1));
+				nih_io_send_message (io, message);
+				nih_discard (message);
+			}
+
+			start_allocs = bench_allocs;
+			start = bench_now ();
+			flush (io);
+			ns += bench_now () - start;
+			allocs += bench_allocs - start_allocs;
+
+			nih_assert (NIH_LIST_EMPTY (io->send_q));
+
+			for (j = 0; j < BENCH_BURST; j++) {
+				char buf[BUFSIZ];
+
+				nih_assert (recv (sock, buf, sizeof (buf), 0) > 0);
+			}
+		}
+
+		bench_sample (ns, allocs);
+	}
+
+	close (sock);
+	nih_free (io);
+}
+
+
+static size_t bench_records_read;
+
+static void
+get_reader (void       *data,
+	    NihIo      *io,
+	    const char *buf,
+	    size_t      len)
+{
+	char *str;
+
+	while ((str = nih_io_get (NULL, io, "\n")) != NULL) {
+		bench_records_read++;
+		nih_free (str);
+	}
+}
+
+static void
+record_reader (void              *data,
+	       NihIo             *io,
+	       const NihIoRecord *records,
+	       size_t             nrecords)
+{
+	bench_records_read += nrecords;
+}
+
+static void
+bench_records (const char *name,
+	       int         records,
+	       size_t      line_len,
+	       size_t      nlines)
+{
+	NihIo *io;
+	char  *data, chunk[BENCH_CHUNK];
+	size_t len, off;
+	int    fds[2];
+
+	/* Lines of the given length written to a pipe a piece at a time
+	 * and read with nih_io_get() by the reader, or handed over by a
+	 * record reader.
+	 */
+	nih_assert (pipe (fds) == 0);
+	io = NIH_MUST (nih_io_reopen (NULL, fds[0], NIH_IO_STREAM,
+				      get_reader, NULL, NULL, NULL));
+	if (records)
+		nih_io_set_record_reader (io, '\n', record_reader);
+
+	len = line_len * nlines;
+	data = NIH_MUST (nih_alloc (NULL, len));
+	for (off = 0; off < len; off++)
+		data[off] = ((off % line_len) == line_len - 1) ? '\n' : 'x';
+
+	BENCH (nlines, "records/%s/%zu", name, line_len) {
+		bench_records_read = 0;
+
+		bench_start ();
+		for (off = 0; off < len; off += BENCH_CHUNK) {
+			size_t  size = nih_min (len - off, (size_t)BENCH_CHUNK);
+			ssize_t ret;
+
+			memcpy (chunk, data + off, size);
+			ret = write (fds[1], chunk, size);
+			nih_assert (ret == (ssize_t)size);
+			receive (io);
+		}
+		bench_stop ();
+
+		nih_assert (bench_records_read == nlines);
+	}
+
+	nih_free (data);
+	nih_free (io);
+	close (fds[1]);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench ("moving", FALSE);
+	bench ("sliding", TRUE);
+
+	bench_stream (BUFSIZ);
+	bench_stream (1024 * 1024);
+
+	bench_message ("single", 0);
+	bench_message ("batch", BENCH_BURST);
+	bench_message_send ();
+
+	bench_records ("get", FALSE, 80, 100000);
+	bench_records ("record", TRUE, 80, 100000);
+	bench_records ("get", FALSE, 256 * 1024, 16);
+	bench_records ("record", TRUE, 256 * 1024, 16);
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+/* libnih
+ *
+ * bench_map.c - benchmarks for nih/map.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/map.h>
+#include <nih/string.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_LOOKUPS:
+ *
+ * Number of lookups timed for each table, cycling through its keys.
+ **/
+#define BENCH_LOOKUPS 1000000
+
+
+typedef struct bench_entry {
+	NihList     entry;
+	const char *name;
+} BenchEntry;
+
+
+static char **
+make_keys (int         entries,
+	   const char *format)
+{
+	char **array;
+	int    i;
+
+	array = NIH_MUST (nih_alloc (NULL, sizeof (char *) * entries));
+	for (i = 0; i < entries; i++)
+		array[i] = NIH_MUST (nih_sprintf (array, format, i));
+
+	return array;
+}
+
+static void
+time_hash (NihHash *hash,
+	   char   **keys,
+	   int      entries,
+	   int      found)
+{
+	int i;
+
+	BENCH (BENCH_LOOKUPS, "NihHash/%d/%s", entries,
+	       found ? "hit" : "miss") {
+		bench_start ();
+		for (i = 0; i < BENCH_LOOKUPS; i++)
+			if ((nih_hash_lookup (hash, keys[i % entries]) != NULL)
+			    != found)
+				nih_assert_not_reached ();
+		bench_stop ();
+	}
+}
+
+static void
+time_map (NihMap *map,
+	  char  **keys,
+	  int     entries,
+	  int     found)
+{
+	int i;
+
+	BENCH (BENCH_LOOKUPS, "NihMap/%d/%s", entries,
+	       found ? "hit" : "miss") {
+		bench_start ();
+		for (i = 0; i < BENCH_LOOKUPS; i++)
+			if ((nih_map_lookup (map, keys[i % entries]) != NULL)
+			    != found)
+				nih_assert_not_reached ();
+		bench_stop ();
+	}
+}
+
+static void
+bench (int entries)
+{
+	NihHash *hash;
+	NihMap  *map;
+	char   **keys;
+	char   **missing;
+	int      i;
+
+	keys = make_keys (entries, "/com/ubuntu/Upstart/jobs/job%d");
+	missing = make_keys (entries, "/com/ubuntu/Upstart/jobs/missing%d");
+
+	hash = NIH_MUST (nih_hash_string_new (NULL, entries));
+	map = NIH_MUST (nih_map_string_new (NULL, entries));
+
+	for (i = 0; i < entries; i++) {
+		BenchEntry *entry;
+
+		entry = NIH_MUST (nih_new (hash, BenchEntry));
+		nih_list_init (&entry->entry);
+		entry->name = keys[i];
+
+		nih_hash_add (hash, &entry->entry);
+		NIH_MUST (nih_map_set (map, entry->name, entry) == 0);
+	}
+
+	/* Finish growing before timing the lookups */
+	while (hash->old_bins)
+		nih_hash_lookup (hash, keys[0]);
+
+	time_hash (hash, keys, entries, TRUE);
+	time_hash (hash, missing, entries, FALSE);
+	time_map (map, keys, entries, TRUE);
+	time_map (map, missing, entries, FALSE);
+
+	nih_free (map);
+	nih_free (hash);
+	nih_free (missing);
+	nih_free (keys);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench (100);
+	bench (10000);
+	bench (1000000);
+
+	return 0;
+}
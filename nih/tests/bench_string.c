@@ -0,0 +1,124 @@
+/* libnih
+ *
+ * bench_string.c - benchmarks for nih/string.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+/**
+ * BENCH_PIECES:
+ *
+ * Number of pieces appended to each string or array.
+ **/
+#define BENCH_PIECES 10000
+
+
+static void
+bench (const char *piece)
+{
+	size_t len = strlen (piece);
+	char * str;
+	char **array;
+	size_t array_len;
+	int    i;
+
+	BENCH (BENCH_PIECES, "nih_strcat/%zu", len) {
+		str = NULL;
+
+		bench_start ();
+		for (i = 0; i < BENCH_PIECES; i++)
+			NIH_MUST (nih_strcat (&str, NULL, piece));
+		bench_stop ();
+
+		nih_assert (strlen (str) == len * BENCH_PIECES);
+		nih_free (str);
+	}
+
+	BENCH (BENCH_PIECES, "nih_strncat/%zu", len) {
+		str = NULL;
+
+		bench_start ();
+		for (i = 0; i < BENCH_PIECES; i++)
+			NIH_MUST (nih_strncat (&str, NULL, piece, len));
+		bench_stop ();
+
+		nih_free (str);
+	}
+
+	BENCH (BENCH_PIECES, "nih_strcat_sprintf/%zu", len) {
+		str = NULL;
+
+		bench_start ();
+		for (i = 0; i < BENCH_PIECES; i++)
+			NIH_MUST (nih_strcat_sprintf (&str, NULL, "%s", piece));
+		bench_stop ();
+
+		nih_free (str);
+	}
+
+	BENCH (BENCH_PIECES, "nih_str_array_add/%zu", len) {
+		array_len = 0;
+		array = NIH_MUST (nih_str_array_new (NULL));
+
+		bench_start ();
+		for (i = 0; i < BENCH_PIECES; i++)
+			NIH_MUST (nih_str_array_add (&array, NULL,
+						     &array_len, piece));
+		bench_stop ();
+
+		nih_free (array);
+	}
+
+	/* Splitting the pieces joined by spaces back into an array */
+	str = NULL;
+	for (i = 0; i < BENCH_PIECES; i++)
+		NIH_MUST (nih_strcat_sprintf (&str, NULL, i ? " %s" : "%s",
+					      piece));
+
+	BENCH (BENCH_PIECES, "nih_str_split/%zu", len) {
+		bench_start ();
+		array = NIH_MUST (nih_str_split (NULL, str, " ", TRUE));
+		bench_stop ();
+
+		nih_free (array);
+	}
+
+	nih_free (str);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench ("x");
+	bench ("/com/ubuntu/Upstart/jobs");
+
+	return 0;
+}
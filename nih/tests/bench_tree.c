@@ -0,0 +1,161 @@
+/* libnih
+ *
+ * bench_tree.c - benchmarks for nih/tree.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/tree.h>
+#include <nih/logging.h>
+
+#include "bench.h"
+
+
+static int entries;
+
+
+static NihTreeEntry *
+build (NihTreeEntry **nodes)
+{
+	NihTreeEntry *root = NULL;
+	int           i;
+
+	/* Random keys make a tree of reasonable depth without balancing */
+	srand (1);
+	for (i = 0; i < entries; i++) {
+		NihTreeEntry *node = root;
+
+		nodes[i] = NIH_MUST (nih_tree_entry_new (NULL));
+		nodes[i]->int_data = rand ();
+
+		if (! root) {
+			root = nodes[i];
+			continue;
+		}
+
+		for (;;) {
+			NihTreeWhere where;
+			NihTree *    next;
+
+			if (nodes[i]->int_data < node->int_data) {
+				where = NIH_TREE_LEFT;
+				next = node->node.left;
+			} else {
+				where = NIH_TREE_RIGHT;
+				next = node->node.right;
+			}
+
+			if (! next) {
+				nih_tree_add (&node->node, &nodes[i]->node,
+					      where);
+				break;
+			}
+
+			node = (NihTreeEntry *)next;
+		}
+	}
+
+	return root;
+}
+
+static int
+sum_visitor (long    *sum,
+	     NihTree *node)
+{
+	*sum += ((NihTreeEntry *)node)->int_data;
+
+	return 0;
+}
+
+
+static void
+bench (int count)
+{
+	NihTreeEntry **nodes;
+	NihTreeEntry  *root;
+	long           sum1 = 0, sum2 = 0;
+	int            i;
+
+	entries = count;
+	nodes = NIH_MUST (nih_alloc (NULL, sizeof (NihTreeEntry *) * entries));
+
+	root = build (nodes);
+
+	BENCH (entries, "NIH_TREE_FOREACH/%d", entries) {
+		sum1 = 0;
+
+		bench_start ();
+		NIH_TREE_FOREACH (&root->node, iter)
+			sum1 += ((NihTreeEntry *)iter)->int_data;
+		bench_stop ();
+	}
+
+	BENCH (entries, "nih_tree_visit/%d", entries) {
+		sum2 = 0;
+
+		bench_start ();
+		nih_tree_visit (&root->node, (NihTreeVisitor)sum_visitor,
+				&sum2);
+		bench_stop ();
+	}
+
+	nih_assert (sum1 == sum2);
+
+	nih_tree_free_all (&root->node);
+
+	/* Without nih_tree_free_all() the nodes must be found before any
+	 * can be freed, since the iterator can't step from a freed node.
+	 */
+	BENCH (entries, "NIH_TREE_FOREACH_POST/%d/free", entries) {
+		root = build (nodes);
+
+		bench_start ();
+		i = 0;
+		NIH_TREE_FOREACH_POST (&root->node, iter)
+			nodes[i++] = (NihTreeEntry *)iter;
+		for (i = 0; i < entries; i++)
+			nih_free (nodes[i]);
+		bench_stop ();
+	}
+
+	BENCH (entries, "nih_tree_free_all/%d", entries) {
+		root = build (nodes);
+
+		bench_start ();
+		nih_tree_free_all (&root->node);
+		bench_stop ();
+	}
+
+	nih_free (nodes);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	bench_init (argc, argv);
+
+	bench (1000);
+	bench (1000000);
+
+	return 0;
+}
@@ -189,6 +189,40 @@ test_realloc (void)
 	nih_free (ptr3);
 
 
+	/* Check that nih_realloc works if the block has multiple parents,
+	 * both before and after the reference stored within the block.
+	 */
+	TEST_FEATURE ("with multiple parents");
+	ptr1 = nih_alloc (NULL, 10);
+	ptr2 = nih_alloc (NULL, 10);
+	ptr3 = nih_alloc (ptr1, 10);
+	nih_ref (ptr3, ptr2);
+
+	ptr3 = nih_realloc (ptr3, ptr1, 4096);
+	memset (ptr3, 'x', 4096);
+
+	TEST_ALLOC_SIZE (ptr3, 4096);
+	TEST_ALLOC_PARENT (ptr3, ptr1);
+	TEST_ALLOC_PARENT (ptr3, ptr2);
+
+	nih_free (ptr1);
+
+	TEST_ALLOC_PARENT (ptr3, ptr2);
+
+	ptr3 = nih_realloc (ptr3, ptr2, 8096);
+	memset (ptr3, 'x', 8096);
+
+	TEST_ALLOC_PARENT (ptr3, ptr2);
+	TEST_ALLOC_NOT_PARENT (ptr3, NULL);
+
+	nih_ref (ptr3, NULL);
+	nih_free (ptr2);
+
+	TEST_ALLOC_PARENT (ptr3, NULL);
+
+	nih_free (ptr3);
+
+
 	/* Check that nih_realloc returns NULL and doesn't alter the block
 	 * if the allocator fails.
 	 */
@@ -266,6 +300,15 @@ child_destructor_test (Child *child)
 	return 0;
 }
 
+static int free_count = 0;
+
+static void
+my_count_free (void *ptr)
+{
+	free_count++;
+	free (ptr);
+}
+
 void
 test_free (void)
 {
@@ -387,6 +430,87 @@ test_free (void)
 	__nih_free = free;
 }
 
+void
+test_free_deferred (void)
+{
+	void *ptr1;
+	void *ptr2;
+	void *ptr3;
+	int   ret;
+
+	TEST_FUNCTION ("nih_free_deferred");
+
+	/* Check that the destructors of an object and its children are
+	 * called immediately, returning that of the object, but that the
+	 * memory isn't freed until nih_free_deferred_poll() is called;
+	 * which frees no more than the limit given.
+	 */
+	TEST_FEATURE ("with children");
+	ptr1 = nih_alloc (NULL, 10);
+	ptr2 = nih_alloc (ptr1, 10);
+	ptr3 = nih_alloc (ptr2, 10);
+	nih_alloc_set_destructor (ptr1, destructor_called);
+	nih_alloc_set_destructor (ptr3, child_destructor_called);
+	destructor_was_called = 0;
+	child_destructor_was_called = 0;
+
+	__nih_free = my_count_free;
+	free_count = 0;
+
+	ret = nih_free_deferred (ptr1);
+
+	TEST_TRUE (destructor_was_called);
+	TEST_TRUE (child_destructor_was_called);
+	TEST_EQ (ret, 2);
+	TEST_EQ (free_count, 0);
+
+	ret = nih_free_deferred_poll (2);
+
+	TEST_TRUE (ret);
+	TEST_EQ (free_count, 2);
+
+	ret = nih_free_deferred_poll (2);
+
+	TEST_FALSE (ret);
+	TEST_EQ (free_count, 3);
+
+	__nih_free = free;
+
+
+	/* Check that a child with another parent is not freed, and that
+	 * objects freed separately are all released with no limit.
+	 */
+	TEST_FEATURE ("with multiple objects");
+	ptr1 = nih_alloc (NULL, 10);
+	ptr2 = nih_alloc (ptr1, 10);
+	ptr3 = nih_alloc (NULL, 10);
+	nih_ref (ptr2, ptr3);
+
+	nih_free_deferred (ptr1);
+
+	TEST_ALLOC_PARENT (ptr2, ptr3);
+	TEST_FALSE (nih_alloc_parent (ptr2, NULL));
+
+	nih_free_deferred (ptr3);
+
+	__nih_free = my_count_free;
+	free_count = 0;
+
+	ret = nih_free_deferred_poll (0);
+
+	TEST_FALSE (ret);
+	TEST_EQ (free_count, 3);
+
+	__nih_free = free;
+
+
+	/* Check that there's nothing to do if nothing has been freed. */
+	TEST_FEATURE ("with nothing freed");
+	ret = nih_free_deferred_poll (0);
+
+	TEST_FALSE (ret);
+}
+
 
 void
 test_discard (void)
@@ -594,7 +718,26 @@ test_unref (void)
 	TEST_FALSE (destructor_was_called);
 	TEST_ALLOC_PARENT (ptr2, ptr3);
 
+
+	/* Check that we can reference the object again from its first
+	 * parent, and remove the other parent.
+	 */
+	TEST_FEATURE ("with first parent referenced again");
+	nih_ref (ptr2, ptr1);
+
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+	TEST_ALLOC_PARENT (ptr2, ptr3);
+
+	nih_unref (ptr2, ptr3);
+
+	TEST_FALSE (destructor_was_called);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+	TEST_ALLOC_NOT_PARENT (ptr2, ptr3);
+
 	nih_free (ptr1);
+
+	TEST_TRUE (destructor_was_called);
+
 	nih_free (ptr3);
 
 
@@ -821,6 +964,556 @@ test_local (void)
 }
 
 
+void
+test_arena (void)
+{
+	NihArena *arena;
+	void *    parent;
+	void *    ptr1;
+	void *    ptr2;
+	void *    ptrs[100];
+	int       i;
+
+	TEST_FUNCTION ("nih_arena_new");
+
+
+	/* Check that an arena can be allocated, and that it may be freed
+	 * again.
+	 */
+	TEST_FEATURE ("with no parent");
+	TEST_ALLOC_FAIL {
+		arena = nih_arena_new (NULL);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (arena, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_PARENT (arena, NULL);
+
+		nih_free (arena);
+	}
+
+
+	/* Check that an arena may have a parent, and is freed with it. */
+	TEST_FEATURE ("with parent");
+	parent = nih_alloc (NULL, 10);
+	arena = nih_arena_new (parent);
+
+	TEST_ALLOC_PARENT (arena, parent);
+
+	ptr1 = nih_alloc (arena, 10);
+	nih_alloc_set_destructor (ptr1, destructor_called);
+	destructor_was_called = 0;
+
+	nih_free (parent);
+
+	TEST_TRUE (destructor_was_called);
+
+
+	/* Check that descendants of an arena may be allocated and used
+	 * like any other object, and that when the arena is freed they
+	 * are all freed at once, just by freeing its chunk.
+	 */
+	TEST_FEATURE ("with descendants");
+	arena = nih_arena_new (NULL);
+
+	for (i = 0; i < 100; i++) {
+		ptrs[i] = nih_alloc (i ? ptrs[i / 2] : arena, 100);
+		memset (ptrs[i], 'x', 100);
+
+		TEST_ALLOC_SIZE (ptrs[i], 100);
+		TEST_ALLOC_PARENT (ptrs[i], i ? ptrs[i / 2] : arena);
+	}
+
+	nih_ref (ptrs[99], ptrs[1]);
+	nih_unref (ptrs[98], ptrs[49]);
+
+	__nih_free = my_count_free;
+	free_count = 0;
+
+	nih_free (arena);
+
+	__nih_free = free;
+
+	TEST_EQ (free_count, 3);
+
+
+	/* Check that large objects, and objects reallocated, within the
+	 * arena retain their contents.
+	 */
+	TEST_FEATURE ("with large and reallocated descendants");
+	arena = nih_arena_new (NULL);
+
+	ptr1 = nih_alloc (arena, 100000);
+	memset (ptr1, 'x', 100000);
+
+	ptr2 = nih_alloc (ptr1, 10);
+	memcpy (ptr2, "test", 5);
+
+	ptr2 = nih_realloc (ptr2, ptr1, 5);
+	TEST_ALLOC_SIZE (ptr2, 5);
+	TEST_EQ_STR ((char *)ptr2, "test");
+
+	ptr2 = nih_realloc (ptr2, ptr1, 1000);
+	TEST_ALLOC_SIZE (ptr2, 1000);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+	TEST_EQ_STR ((char *)ptr2, "test");
+
+	ptr1 = nih_realloc (ptr1, arena, 200000);
+	TEST_ALLOC_PARENT (ptr1, arena);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+	TEST_EQ (((char *)ptr1)[99999], 'x');
+
+	nih_free (arena);
+
+
+	/* Check that destructors of objects in the arena are still called
+	 * when it is freed.
+	 */
+	TEST_FEATURE ("with destructor");
+	arena = nih_arena_new (NULL);
+
+	ptr1 = nih_alloc (arena, 10);
+	ptr2 = nih_alloc (ptr1, 10);
+
+	nih_alloc_set_destructor (ptr2, destructor_called);
+	destructor_was_called = 0;
+
+	nih_free (arena);
+
+	TEST_TRUE (destructor_was_called);
+
+
+	/* Check that an object in the arena referenced both by the arena
+	 * and another object in it is freed along with the arena, without
+	 * the reference being mistaken for one from outside it.
+	 */
+	TEST_FEATURE ("with object referenced twice");
+	arena = nih_arena_new (NULL);
+
+	ptr1 = nih_alloc (arena, 10);
+	ptr2 = nih_alloc (ptr1, 10);
+	nih_ref (ptr2, arena);
+
+	nih_alloc_set_destructor (ptr2, destructor_called);
+	destructor_was_called = 0;
+
+	nih_free (arena);
+
+	TEST_TRUE (destructor_was_called);
+
+
+	/* Check that an object in the arena referenced from outside it
+	 * survives the arena being freed, along with its children, and
+	 * is freed when the last reference is removed.
+	 */
+	TEST_FEATURE ("with escaped object");
+	parent = nih_alloc (NULL, 10);
+	arena = nih_arena_new (NULL);
+
+	ptr1 = nih_alloc (arena, 10);
+	ptr2 = nih_alloc (ptr1, 10);
+	memcpy (ptr2, "test", 5);
+
+	nih_ref (ptr1, parent);
+
+	nih_free (arena);
+
+	TEST_ALLOC_PARENT (ptr1, parent);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+	TEST_EQ_STR ((char *)ptr2, "test");
+
+	ptr2 = nih_alloc (ptr1, 10);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+
+	nih_alloc_set_destructor (ptr2, destructor_called);
+	destructor_was_called = 0;
+
+	nih_free (parent);
+
+	TEST_TRUE (destructor_was_called);
+
+
+	/* Check that an object outside the arena referenced by an object
+	 * in it is unreferenced when the arena is freed.
+	 */
+	TEST_FEATURE ("with reference to outside object");
+	arena = nih_arena_new (NULL);
+
+	ptr1 = nih_alloc (arena, 10);
+	ptr2 = nih_alloc (NULL, 10);
+
+	nih_ref (ptr2, ptr1);
+	nih_alloc_set_destructor (ptr2, destructor_called);
+	destructor_was_called = 0;
+
+	nih_free (arena);
+
+	TEST_FALSE (destructor_was_called);
+	TEST_ALLOC_PARENT (ptr2, NULL);
+
+	nih_free (ptr2);
+
+	TEST_TRUE (destructor_was_called);
+}
+
+
+void
+test_pool (void)
+{
+	NihAllocPoolStats stats[16], before[16], during[16];
+	void *            ptr1;
+	void *            ptr2;
+	void *            ptr3;
+	size_t            npools, i;
+
+	TEST_FUNCTION ("nih_alloc_pool_init");
+	nih_alloc_pool_init ();
+
+	npools = nih_alloc_pool_stats (before, 16);
+
+	TEST_GT (npools, 1);
+	TEST_LE (npools, 16);
+
+
+	/* Check that once pools are in use, a small allocation is taken
+	 * from a pool, while the reference to its parent is stored within
+	 * it.
+	 */
+	TEST_FEATURE ("with small allocation");
+	ptr1 = nih_alloc (NULL, 10);
+	memset (ptr1, 'x', 10);
+
+	TEST_ALLOC_SIZE (ptr1, 10);
+	TEST_ALLOC_PARENT (ptr1, NULL);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	TEST_EQ (stats[0].in_use, before[0].in_use + 1);
+	TEST_EQ (stats[0].allocs, before[0].allocs + 1);
+	TEST_GT (stats[0].slabs, 0);
+	TEST_EQ (stats[npools - 1].in_use, before[npools - 1].in_use);
+
+
+	/* Check that a reference from an additional parent is taken from
+	 * the pool of references, and returned to it.
+	 */
+	TEST_FEATURE ("with additional parent");
+	ptr2 = nih_alloc (NULL, 10);
+	nih_ref (ptr1, ptr2);
+
+	TEST_ALLOC_PARENT (ptr1, ptr2);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	TEST_EQ (stats[npools - 1].in_use, before[npools - 1].in_use + 1);
+
+	nih_unref (ptr1, ptr2);
+	nih_free (ptr2);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	TEST_EQ (stats[npools - 1].in_use, before[npools - 1].in_use);
+
+
+	/* Check that a child is taken from the pool of its size class. */
+	TEST_FEATURE ("with child allocation");
+	nih_alloc_pool_stats (during, 16);
+
+	ptr2 = nih_alloc (ptr1, 200);
+	memset (ptr2, 'y', 200);
+
+	TEST_ALLOC_SIZE (ptr2, 200);
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	for (i = 0; i < npools - 1; i++)
+		if (stats[i].in_use != during[i].in_use)
+			break;
+
+	TEST_LT (i, npools - 1);
+	TEST_GE (stats[i].size, 200);
+
+
+	/* Check that an object reallocated within its size class keeps
+	 * its chunk.
+	 */
+	TEST_FEATURE ("with reallocation within size class");
+	ptr3 = nih_realloc (ptr2, ptr1, 201);
+
+	TEST_EQ_P (ptr3, ptr2);
+	TEST_ALLOC_SIZE (ptr3, 201);
+
+
+	/* Check that an object reallocated beyond its size class is
+	 * copied, keeping its contents, parents and children.
+	 */
+	TEST_FEATURE ("with reallocation beyond size class");
+	ptr2 = nih_alloc (ptr1, 8);
+	ptr3 = nih_realloc (ptr1, NULL, 4096);
+
+	TEST_NE_P (ptr3, NULL);
+	TEST_ALLOC_SIZE (ptr3, 4096);
+	TEST_ALLOC_PARENT (ptr3, NULL);
+	TEST_ALLOC_PARENT (ptr2, ptr3);
+	TEST_EQ_MEM (ptr3, "xxxxxxxxxx", 10);
+
+
+	/* Check that freeing objects returns them and their references
+	 * to their pools.
+	 */
+	TEST_FEATURE ("with objects freed");
+	nih_free (ptr3);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	for (i = 0; i < npools; i++)
+		TEST_EQ (stats[i].in_use, before[i].in_use);
+
+
+	/* Check that a freed chunk is re-used. */
+	TEST_FEATURE ("with re-use of freed chunk");
+	ptr1 = nih_alloc (NULL, 10);
+	nih_free (ptr1);
+	ptr2 = nih_alloc (NULL, 10);
+
+	TEST_EQ_P (ptr2, ptr1);
+
+	nih_free (ptr2);
+
+
+	/* Check that an allocation larger than the largest size class is
+	 * not taken from a pool.
+	 */
+	TEST_FEATURE ("with large allocation");
+	nih_alloc_pool_stats (before, 16);
+
+	ptr1 = nih_alloc (NULL, 8096);
+	memset (ptr1, 'x', 8096);
+
+	TEST_ALLOC_SIZE (ptr1, 8096);
+
+	nih_alloc_pool_stats (stats, 16);
+
+	for (i = 0; i < npools - 1; i++)
+		TEST_EQ (stats[i].allocs, before[i].allocs);
+
+	nih_free (ptr1);
+
+
+	/* Check that nih_alloc returns NULL if a new slab cannot be
+	 * allocated.
+	 */
+	TEST_FEATURE ("with failed slab allocation");
+	ptr1 = nih_alloc (NULL, 8096);
+
+	nih_alloc_pool_stats (before, 16);
+
+	__nih_malloc = malloc_null;
+	for (i = 0; i <= before[0].free; i++) {
+		ptr2 = nih_alloc (ptr1, 10);
+		if (! ptr2)
+			break;
+	}
+	__nih_malloc = malloc;
+
+	TEST_EQ_P (ptr2, NULL);
+	TEST_EQ (i, before[0].free);
+
+	nih_free (ptr1);
+}
+
+static NihAllocSiteStats *
+find_site (NihAllocSiteStats *stats,
+	   size_t             nsites,
+	   int                line)
+{
+	size_t i;
+
+	for (i = 0; i < nsites; i++)
+		if (stats[i].file && (! strcmp (stats[i].file, "test.c"))
+		    && (stats[i].line == line))
+			return &stats[i];
+
+	return NULL;
+}
+
+void
+test_stats (void)
+{
+	NihAllocStats      stats;
+	NihAllocSiteStats  sites[16];
+	NihAllocSiteStats *site;
+	NihArena *         arena;
+	FILE *             output;
+	void *             ptr1;
+	void *             ptr2;
+	void *             ptr3;
+	size_t             nsites;
+
+	TEST_FUNCTION ("nih_alloc_stats_init");
+	nih_alloc_stats_init ();
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 0);
+	TEST_EQ (stats.bytes, 0);
+	TEST_EQ (stats.allocs, 0);
+	TEST_EQ (stats.sites, 0);
+
+
+	/* Check that an object allocated once statistics are enabled is
+	 * counted, and attributed to the site given.
+	 */
+	TEST_FEATURE ("with allocation at site");
+	ptr1 = nih_alloc_at (NULL, 100, "test.c", 42);
+	memset (ptr1, 'x', 100);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 1);
+	TEST_EQ (stats.bytes, 100);
+	TEST_EQ (stats.peak_objects, 1);
+	TEST_EQ (stats.peak_bytes, 100);
+	TEST_EQ (stats.allocs, 1);
+	TEST_EQ (stats.sites, 1);
+	TEST_EQ (stats.fanout[0], 1);
+
+	nsites = nih_alloc_site_stats (sites, 16);
+
+	TEST_EQ (nsites, 1);
+	TEST_EQ_STR (sites[0].file, "test.c");
+	TEST_EQ (sites[0].line, 42);
+	TEST_EQ (sites[0].objects, 1);
+	TEST_EQ (sites[0].bytes, 100);
+	TEST_EQ (sites[0].allocs, 1);
+
+
+	/* Check that objects allocated without a site are attributed to
+	 * an unknown site, and that the fanout histogram counts the
+	 * children of the parent.
+	 */
+	TEST_FEATURE ("with children");
+	ptr2 = nih_alloc_at (ptr1, 10, NULL, 0);
+	ptr3 = nih_alloc_at (ptr1, 10, NULL, 0);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 3);
+	TEST_EQ (stats.bytes, 120);
+	TEST_EQ (stats.fanout[0], 2);
+	TEST_EQ (stats.fanout[1], 0);
+	TEST_EQ (stats.fanout[2], 1);
+
+	nsites = nih_alloc_site_stats (sites, 16);
+
+	TEST_EQ (nsites, 2);
+	TEST_EQ_P (sites[0].file, NULL);
+	TEST_EQ (sites[0].objects, 2);
+	TEST_EQ (sites[0].bytes, 20);
+
+	nih_unref (ptr3, ptr1);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 2);
+	TEST_EQ (stats.fanout[0], 1);
+	TEST_EQ (stats.fanout[1], 1);
+	TEST_EQ (stats.fanout[2], 0);
+
+
+	/* Check that reallocating an object changes the size counted. */
+	TEST_FEATURE ("with reallocation");
+	ptr1 = nih_realloc (ptr1, NULL, 200);
+	TEST_EQ (((char *)ptr1)[99], 'x');
+	TEST_ALLOC_PARENT (ptr2, ptr1);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.bytes, 210);
+	TEST_EQ (stats.peak_bytes, 210);
+
+	nsites = nih_alloc_site_stats (sites, 16);
+	site = find_site (sites, nsites, 42);
+
+	TEST_NE_P (site, NULL);
+	TEST_EQ (site->bytes, 200);
+	TEST_EQ (site->peak_bytes, 200);
+
+
+	/* Check that freeing objects removes them from the statistics,
+	 * but not from the peaks or number of allocations.
+	 */
+	TEST_FEATURE ("with free");
+	nih_free (ptr1);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 0);
+	TEST_EQ (stats.bytes, 0);
+	TEST_EQ (stats.peak_objects, 3);
+	TEST_EQ (stats.peak_bytes, 210);
+	TEST_EQ (stats.allocs, 3);
+	TEST_EQ (stats.fanout[0], 0);
+	TEST_EQ (stats.fanout[1], 0);
+
+	nsites = nih_alloc_site_stats (sites, 16);
+	site = find_site (sites, nsites, 42);
+
+	TEST_NE_P (site, NULL);
+	TEST_EQ (site->objects, 0);
+	TEST_EQ (site->bytes, 0);
+	TEST_EQ (site->allocs, 1);
+
+
+	/* Check that objects in an arena are removed from the statistics
+	 * when the arena is freed.
+	 */
+	TEST_FEATURE ("with arena");
+	arena = nih_arena_new (NULL);
+	ptr1 = nih_alloc_at (arena, 100, "test.c", 43);
+	ptr2 = nih_alloc_at (ptr1, 100, "test.c", 43);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 2);
+	TEST_EQ (stats.bytes, 200);
+
+	nih_free (arena);
+
+	nih_alloc_stats (&stats);
+
+	TEST_EQ (stats.objects, 0);
+	TEST_EQ (stats.bytes, 0);
+
+
+	/* Check that the statistics can be written to a file descriptor,
+	 * including those of sites with live objects.
+	 */
+	TEST_FEATURE ("with dump");
+	ptr1 = nih_alloc_at (NULL, 100, "test.c", 42);
+
+	output = tmpfile ();
+	nih_alloc_stats_dump (fileno (output));
+	rewind (output);
+
+	TEST_FILE_EQ (output, ("nih_alloc: 1 objects, 100 bytes; "
+			       "peak 3 objects, 210 bytes; "
+			       "6 allocations\n"));
+	TEST_FILE_MATCH (output, "nih_alloc: fanout 0:1 1:0 2:0 *\n");
+	TEST_FILE_EQ (output, ("nih_alloc: test.c:42: 1 objects, "
+			       "100 bytes; peak 200 bytes; "
+			       "2 allocations\n"));
+	TEST_FILE_END (output);
+
+	fclose (output);
+
+	nih_free (ptr1);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -829,11 +1522,15 @@ main (int   argc,
 	test_alloc ();
 	test_realloc ();
 	test_free ();
+	test_free_deferred ();
 	test_discard ();
 	test_ref ();
 	test_unref ();
 	test_parent ();
 	test_local ();
+	test_arena ();
+	test_pool ();
+	test_stats ();
 
 	return 0;
 }
@@ -0,0 +1,281 @@
+/* libnih
+ *
+ * test_array.c - test suite for nih/array.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/array.h>
+
+
+void
+test_init (void)
+{
+	NihArray   array;
+	char     **elems;
+
+	TEST_FUNCTION ("nih_array_init");
+
+	/* Check that an array initialised without elements has none
+	 * allocated.
+	 */
+	TEST_FEATURE ("without elements");
+	nih_array_init (&array, &array, NULL, 0);
+
+	TEST_EQ_P (array.elems, NULL);
+	TEST_EQ (array.len, 0);
+	TEST_EQ (array.size, 0);
+	TEST_EQ_P (array.parent, &array);
+
+
+	/* Check that an array initialised with an existing array of
+	 * strings uses the room it has.
+	 */
+	TEST_FEATURE ("with elements");
+	elems = nih_str_split (NULL, "foo bar", " ", FALSE);
+	nih_array_init (&array, NULL, (void **)elems, 2);
+
+	TEST_EQ_P (array.elems, (void **)elems);
+	TEST_EQ (array.len, 2);
+	TEST_EQ (array.size, 2);
+
+	nih_free (elems);
+}
+
+void
+test_reserve (void)
+{
+	NihArray   array;
+	char      *str;
+	int        ret;
+
+	/* Check that reserving room allocates exactly that, with the
+	 * array still NULL-terminated, and that when it fails the array
+	 * is unchanged.
+	 */
+	TEST_FUNCTION ("nih_array_reserve");
+	TEST_ALLOC_FAIL {
+		nih_array_init (&array, NULL, NULL, 0);
+
+		TEST_ALLOC_SAFE {
+			str = nih_strdup (NULL, "foo");
+			assert0 (nih_array_addp (&array, str));
+			nih_discard (str);
+		}
+
+		ret = nih_array_reserve (&array, 10);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ (array.size, 4);
+			TEST_EQ (array.len, 1);
+			TEST_EQ_STR ((char *)array.elems[0], "foo");
+
+			nih_free (array.elems);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (array.size, 10);
+		TEST_EQ (array.len, 1);
+		TEST_ALLOC_SIZE (array.elems, sizeof (void *) * 11);
+		TEST_EQ_STR ((char *)array.elems[0], "foo");
+		TEST_EQ_P (array.elems[1], NULL);
+
+		/* Reserving less room than there is does nothing */
+		TEST_EQ (nih_array_reserve (&array, 2), 0);
+		TEST_EQ (array.size, 10);
+
+		nih_free (array.elems);
+	}
+}
+
+void
+test_addp (void)
+{
+	NihArray  array;
+	char     *str;
+	int       ret, i;
+
+	TEST_FUNCTION ("nih_array_addp");
+
+	/* Check that adding the first element allocates the elements
+	 * array with the parent given, and that the element is referenced
+	 * by it.
+	 */
+	TEST_FEATURE ("with first element");
+	TEST_ALLOC_FAIL {
+		nih_array_init (&array, NULL, NULL, 0);
+
+		TEST_ALLOC_SAFE {
+			str = nih_strdup (NULL, "foo");
+		}
+
+		ret = nih_array_addp (&array, str);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (array.elems, NULL);
+			TEST_EQ (array.len, 0);
+
+			nih_free (str);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (array.len, 1);
+		TEST_EQ (array.size, 4);
+		TEST_EQ_P (array.elems[0], str);
+		TEST_EQ_P (array.elems[1], NULL);
+		TEST_ALLOC_PARENT (str, array.elems);
+
+		nih_discard (str);
+		nih_free (array.elems);
+	}
+
+
+	/* Check that adding many elements doubles the room each time
+	 * the array is full, keeping it NULL-terminated.
+	 */
+	TEST_FEATURE ("with many elements");
+	nih_array_init (&array, NULL, NULL, 0);
+
+	for (i = 0; i < 1000; i++) {
+		str = nih_sprintf (NULL, "%d", i);
+		TEST_EQ (nih_array_addp (&array, str), 0);
+		nih_discard (str);
+
+		TEST_EQ_P (array.elems[i + 1], NULL);
+	}
+
+	TEST_EQ (array.len, 1000);
+	TEST_EQ (array.size, 1024);
+
+	for (i = 0; i < 1000; i++) {
+		char expected[8];
+
+		sprintf (expected, "%d", i);
+		TEST_EQ_STR ((char *)array.elems[i], expected);
+	}
+
+	nih_free (array.elems);
+}
+
+void
+test_truncate (void)
+{
+	NihArray  array;
+	char     *str;
+	int       i;
+
+	/* Check that truncating the array frees the elements removed,
+	 * keeping those before them, without changing the room.
+	 */
+	TEST_FUNCTION ("nih_array_truncate");
+	nih_array_init (&array, NULL, NULL, 0);
+
+	for (i = 0; i < 3; i++) {
+		str = nih_sprintf (NULL, "%d", i);
+		TEST_EQ (nih_array_addp (&array, str), 0);
+		nih_discard (str);
+	}
+
+	str = array.elems[2];
+	TEST_FREE_TAG (str);
+
+	nih_array_truncate (&array, 2);
+
+	TEST_FREE (str);
+	TEST_EQ (array.len, 2);
+	TEST_EQ (array.size, 4);
+	TEST_EQ_STR ((char *)array.elems[1], "1");
+	TEST_EQ_P (array.elems[2], NULL);
+
+	nih_free (array.elems);
+}
+
+void
+test_trim (void)
+{
+	NihArray   array;
+	void     **elems;
+	char      *str;
+
+	TEST_FUNCTION ("nih_array_trim");
+
+	/* Check that trimming an array with no elements allocates an
+	 * empty NULL-terminated one.
+	 */
+	TEST_FEATURE ("without elements");
+	TEST_ALLOC_FAIL {
+		nih_array_init (&array, NULL, NULL, 0);
+
+		elems = nih_array_trim (&array);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (elems, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (elems, sizeof (void *));
+		TEST_EQ_P (elems[0], NULL);
+		TEST_EQ_P (array.elems, elems);
+
+		nih_free (elems);
+	}
+
+
+	/* Check that trimming an array with spare room reallocates it to
+	 * fit exactly.
+	 */
+	TEST_FEATURE ("with spare room");
+	nih_array_init (&array, NULL, NULL, 0);
+
+	str = nih_strdup (NULL, "foo");
+	TEST_EQ (nih_array_addp (&array, str), 0);
+	nih_discard (str);
+
+	elems = nih_array_trim (&array);
+
+	TEST_NE_P (elems, NULL);
+	TEST_ALLOC_SIZE (elems, sizeof (void *) * 2);
+	TEST_EQ (array.size, 1);
+	TEST_EQ_STR ((char *)elems[0], "foo");
+	TEST_EQ_P (elems[1], NULL);
+	TEST_ALLOC_PARENT (elems[0], elems);
+
+	nih_free (elems);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_init ();
+	test_reserve ();
+	test_addp ();
+	test_truncate ();
+	test_trim ();
+
+	return 0;
+}
@@ -0,0 +1,643 @@
+/* libnih
+ *
+ * test_btree.c - test suite for nih/btree.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/btree.h>
+
+
+#define KEY(_i) ((const void *)(uintptr_t)(_i))
+#define VALUE(_i) ((void *)(uintptr_t)(_i))
+#define INT(_p) ((int)(uintptr_t)(_p))
+
+
+static int
+int_cmp (const void *key1,
+	 const void *key2)
+{
+	return (INT (key1) > INT (key2)) - (INT (key1) < INT (key2));
+}
+
+static NihBTreeNode *check_leaf;
+static size_t        check_entries;
+
+static int
+check_node (NihBTree     *btree,
+	    NihBTreeNode *node,
+	    NihBTreeNode *parent,
+	    int           lo,
+	    int           hi)
+{
+	size_t i;
+	int    depth = 0;
+
+	if (node->parent != parent)
+		TEST_FAILED ("wrong parent for node %p, expected %p got %p",
+			     node, parent, node->parent);
+
+	if (node->count > NIH_BTREE_KEYS)
+		TEST_FAILED ("too many keys in node %p, got %zu",
+			     node, node->count);
+
+	if (parent && (node->count < NIH_BTREE_MIN_KEYS))
+		TEST_FAILED ("too few keys in node %p, got %zu",
+			     node, node->count);
+
+	for (i = 0; i < node->count; i++) {
+		if (i && (int_cmp (node->keys[i - 1], node->keys[i]) > 0))
+			TEST_FAILED ("keys out of order in node %p at %zu",
+				     node, i);
+
+		if ((INT (node->keys[i]) < lo) || (INT (node->keys[i]) > hi))
+			TEST_FAILED ("key %d out of range in node %p",
+				     INT (node->keys[i]), node);
+	}
+
+	if (node->leaf) {
+		if (node != check_leaf)
+			TEST_FAILED ("wrong leaf, expected %p got %p",
+				     check_leaf, node);
+
+		check_leaf = node->next;
+		check_entries += node->count;
+
+		return 0;
+	}
+
+	for (i = 0; i <= node->count; i++) {
+		NihBTreeNode *first;
+		int           child;
+
+		for (first = node->children[i]; ! first->leaf;
+		     first = first->children[0])
+			;
+
+		if (i && (first->keys[0] != node->keys[i - 1]))
+			TEST_FAILED ("stale separator %zu in node %p",
+				     i - 1, node);
+
+		child = check_node (btree, node->children[i], node,
+				    i ? INT (node->keys[i - 1]) : lo,
+				    i < node->count ? INT (node->keys[i]) : hi);
+		if (i && (child != depth))
+			TEST_FAILED ("leaves at different depths in node %p",
+				     node);
+
+		depth = child;
+	}
+
+	return depth + 1;
+}
+
+static void
+check_btree (NihBTree *btree)
+{
+	if (! btree->root) {
+		TEST_EQ_P (btree->first, NULL);
+		TEST_EQ_P (btree->last, NULL);
+		TEST_EQ (btree->entries, 0);
+		return;
+	}
+
+	TEST_EQ_P (btree->first->prev, NULL);
+	TEST_EQ_P (btree->last->next, NULL);
+
+	check_leaf = btree->first;
+	check_entries = 0;
+
+	check_node (btree, btree->root, NULL, INT_MIN, INT_MAX);
+
+	TEST_EQ_P (check_leaf, NULL);
+	TEST_EQ (check_entries, btree->entries);
+}
+
+
+void
+test_new (void)
+{
+	NihBTree *btree;
+
+	/* Check that nih_btree_new allocates a new empty B-tree with
+	 * nih_alloc, with no nodes until entries are added.  If allocation
+	 * fails, we should get NULL returned.
+	 */
+	TEST_FUNCTION ("nih_btree_new");
+	TEST_ALLOC_FAIL {
+		btree = nih_btree_new (NULL, int_cmp);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (btree, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (btree, sizeof (NihBTree));
+		TEST_EQ_P (btree->root, NULL);
+		TEST_EQ_P (btree->first, NULL);
+		TEST_EQ_P (btree->last, NULL);
+		TEST_EQ (btree->entries, 0);
+		TEST_EQ_P (btree->cmp_function, int_cmp);
+
+		nih_free (btree);
+	}
+}
+
+void
+test_add (void)
+{
+	NihBTree       *btree;
+	NihBTreeCursor  cursor;
+	int             ret, i;
+
+	TEST_FUNCTION ("nih_btree_add");
+
+	/* Check that adding an entry to an empty B-tree allocates a leaf
+	 * node as a child of the B-tree holding it.
+	 */
+	TEST_FEATURE ("with empty B-tree");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			btree = nih_btree_new (NULL, int_cmp);
+		}
+
+		ret = nih_btree_add (btree, KEY (1), btree);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (btree->root, NULL);
+			TEST_EQ (btree->entries, 0);
+
+			nih_free (btree);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (btree->entries, 1);
+		TEST_ALLOC_PARENT (btree->root, btree);
+		TEST_TRUE (btree->root->leaf);
+		TEST_EQ (btree->root->count, 1);
+		TEST_EQ_P (btree->first, btree->root);
+		TEST_EQ_P (btree->last, btree->root);
+		TEST_EQ_P (nih_btree_lookup (btree, KEY (1)), btree);
+
+		nih_free (btree);
+	}
+
+
+	/* Check that adding an entry to a full leaf splits it, along with
+	 * the root above it; and that if allocation fails, the B-tree is
+	 * left unchanged.
+	 */
+	TEST_FEATURE ("with full nodes");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			btree = nih_btree_new (NULL, int_cmp);
+			for (i = 0; i < NIH_BTREE_KEYS; i++)
+				assert0 (nih_btree_add (btree, KEY (i * 2),
+							NULL));
+		}
+
+		ret = nih_btree_add (btree, KEY (7), NULL);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ (btree->entries, NIH_BTREE_KEYS);
+			TEST_TRUE (btree->root->leaf);
+			TEST_FALSE (nih_btree_lower_bound (btree, KEY (7),
+							   &cursor)
+				    && (INT (nih_btree_cursor_key (&cursor))
+					== 7));
+		} else {
+			TEST_EQ (ret, 0);
+			TEST_EQ (btree->entries, NIH_BTREE_KEYS + 1);
+			TEST_FALSE (btree->root->leaf);
+			TEST_EQ (btree->root->count, 1);
+			TEST_NE_P (btree->first, btree->last);
+		}
+
+		check_btree (btree);
+
+		nih_free (btree);
+	}
+
+
+	/* Check that many entries added in order, or in no particular
+	 * order, are kept sorted in a valid B-tree.
+	 */
+	TEST_FEATURE ("with many entries");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	for (i = 0; i < 10000; i++) {
+		TEST_EQ (nih_btree_add (btree, KEY (i), NULL), 0);
+
+		if (! (i % 1000))
+			check_btree (btree);
+	}
+
+	for (i = 0; i < 10000; i++) {
+		int key = (i * 7919) % 10000 + 10000;
+
+		TEST_EQ (nih_btree_add (btree, KEY (key), NULL), 0);
+	}
+
+	TEST_EQ (btree->entries, 20000);
+	check_btree (btree);
+
+	i = 0;
+	NIH_BTREE_FOREACH (btree, iter) {
+		TEST_EQ (INT (nih_btree_cursor_key (iter)), i);
+		i++;
+	}
+
+	TEST_EQ (i, 20000);
+
+	nih_free (btree);
+
+
+	/* Check that entries with the same key are kept in the order they
+	 * were added, even when they span several leaves.
+	 */
+	TEST_FEATURE ("with duplicate keys");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	for (i = 0; i < 100; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i % 3), VALUE (i)), 0);
+
+	check_btree (btree);
+
+	i = 0;
+	NIH_BTREE_FOREACH (btree, iter) {
+		int key = i < 34 ? 0 : i < 67 ? 1 : 2;
+		int pos = i < 34 ? i : i < 67 ? i - 34 : i - 67;
+
+		TEST_EQ (INT (nih_btree_cursor_key (iter)), key);
+		TEST_EQ (INT (nih_btree_cursor_value (iter)), pos * 3 + key);
+		i++;
+	}
+
+	TEST_EQ (i, 100);
+
+	nih_free (btree);
+}
+
+void
+test_lookup (void)
+{
+	NihBTree *btree;
+	int       i;
+
+	TEST_FUNCTION ("nih_btree_lookup");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	/* Check that NULL is returned for an empty B-tree. */
+	TEST_FEATURE ("with empty B-tree");
+	TEST_EQ_P (nih_btree_lookup (btree, KEY (0)), NULL);
+
+	for (i = 0; i < 1000; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i * 2), VALUE (i + 1)),
+			 0);
+
+
+	/* Check that each entry is found by its key. */
+	TEST_FEATURE ("with key in B-tree");
+	for (i = 0; i < 1000; i++)
+		TEST_EQ_P (nih_btree_lookup (btree, KEY (i * 2)),
+			   VALUE (i + 1));
+
+
+	/* Check that NULL is returned for keys not in the B-tree. */
+	TEST_FEATURE ("with key not in B-tree");
+	for (i = -1; i < 2000; i += 2)
+		TEST_EQ_P (nih_btree_lookup (btree, KEY (i)), NULL);
+
+	nih_free (btree);
+}
+
+void
+test_remove (void)
+{
+	NihBTree *btree;
+	char     *keys[200];
+	int       i;
+
+	TEST_FUNCTION ("nih_btree_remove");
+
+	/* Check that removing the only entry frees the root leaf. */
+	TEST_FEATURE ("with only entry");
+	btree = nih_btree_new (NULL, int_cmp);
+	TEST_EQ (nih_btree_add (btree, KEY (1), NULL), 0);
+
+	TEST_TRUE (nih_btree_remove (btree, KEY (1)));
+
+	check_btree (btree);
+
+
+	/* Check that FALSE is returned for a key not in the B-tree. */
+	TEST_FEATURE ("with key not in B-tree");
+	TEST_FALSE (nih_btree_remove (btree, KEY (1)));
+
+	TEST_EQ (nih_btree_add (btree, KEY (1), NULL), 0);
+	TEST_FALSE (nih_btree_remove (btree, KEY (2)));
+	TEST_EQ (btree->entries, 1);
+
+	nih_free (btree);
+
+
+	/* Check that removing many entries in no particular order keeps
+	 * the B-tree valid, merging nodes until it's empty again.
+	 */
+	TEST_FEATURE ("with many entries");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	for (i = 0; i < 10000; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i), NULL), 0);
+
+	for (i = 0; i < 10000; i++) {
+		int key = (i * 7919) % 10000;
+
+		TEST_TRUE (nih_btree_remove (btree, KEY (key)));
+		TEST_FALSE (nih_btree_remove (btree, KEY (key)));
+
+		if (! (i % 500))
+			check_btree (btree);
+	}
+
+	check_btree (btree);
+	TEST_EQ_P (btree->root, NULL);
+
+	nih_free (btree);
+
+
+	/* Check that keys may be freed once their entry is removed, since
+	 * none are left behind as separators.
+	 */
+	TEST_FEATURE ("with freed keys");
+	btree = nih_btree_new (NULL, (NihCmpFunction)strcmp);
+
+	for (i = 0; i < 200; i++) {
+		keys[i] = nih_sprintf (NULL, "key %03d", i);
+		TEST_EQ (nih_btree_add (btree, keys[i], keys[i]), 0);
+	}
+
+	for (i = 0; i < 200; i += 2) {
+		TEST_TRUE (nih_btree_remove (btree, keys[i]));
+
+		memset (keys[i], 0xff, strlen (keys[i]));
+		nih_free (keys[i]);
+	}
+
+	for (i = 1; i < 200; i += 2) {
+		char key[16];
+
+		sprintf (key, "key %03d", i);
+		TEST_EQ_P (nih_btree_lookup (btree, key), keys[i]);
+		TEST_TRUE (nih_btree_remove (btree, key));
+
+		nih_free (keys[i]);
+	}
+
+	TEST_EQ_P (btree->root, NULL);
+
+	nih_free (btree);
+}
+
+void
+test_cursor (void)
+{
+	NihBTree       *btree;
+	NihBTreeCursor  cursor;
+	int             i;
+
+	btree = nih_btree_new (NULL, int_cmp);
+
+	/* Check that positioning a cursor in an empty B-tree places it
+	 * at the end.
+	 */
+	TEST_FUNCTION ("nih_btree_first");
+	TEST_FEATURE ("with empty B-tree");
+	TEST_FALSE (nih_btree_first (btree, &cursor));
+	TEST_EQ_P (cursor.btree, btree);
+	TEST_EQ_P (cursor.node, NULL);
+
+	TEST_FALSE (nih_btree_last (btree, &cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+	TEST_FALSE (nih_btree_lower_bound (btree, KEY (0), &cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+	TEST_FALSE (nih_btree_upper_bound (btree, KEY (0), &cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+	TEST_FALSE (nih_btree_cursor_prev (&cursor));
+
+	for (i = 0; i < 1000; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i * 2), NULL), 0);
+
+
+	/* Check that a cursor at the first entry can be moved forwards
+	 * through every entry, reaching the end.
+	 */
+	TEST_FEATURE ("with entries");
+	TEST_TRUE (nih_btree_first (btree, &cursor));
+	for (i = 0; i < 1000; i++) {
+		TEST_NE_P (cursor.node, NULL);
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)), i * 2);
+
+		TEST_EQ (nih_btree_cursor_next (&cursor), i < 999);
+	}
+
+	TEST_EQ_P (cursor.node, NULL);
+
+
+	/* Check that a cursor at the end moves back to the last entry,
+	 * and from there backwards through every entry; moving before the
+	 * first leaves it at the end.
+	 */
+	TEST_FUNCTION ("nih_btree_cursor_prev");
+	for (i = 999; i >= 0; i--) {
+		TEST_TRUE (nih_btree_cursor_prev (&cursor));
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)), i * 2);
+	}
+
+	TEST_FALSE (nih_btree_cursor_prev (&cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+
+	/* Check that nih_btree_last positions the cursor at the last
+	 * entry.
+	 */
+	TEST_FUNCTION ("nih_btree_last");
+	TEST_TRUE (nih_btree_last (btree, &cursor));
+	TEST_EQ (INT (nih_btree_cursor_key (&cursor)), 1998);
+	TEST_FALSE (nih_btree_cursor_next (&cursor));
+
+
+	/* Check that nih_btree_lower_bound positions the cursor at the
+	 * entry with the key given, or the following entry if there is
+	 * none; and at the end if every key is less.
+	 */
+	TEST_FUNCTION ("nih_btree_lower_bound");
+	for (i = -1; i < 1999; i++) {
+		TEST_TRUE (nih_btree_lower_bound (btree, KEY (i), &cursor));
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)),
+			 (i + 1) / 2 * 2);
+	}
+
+	TEST_FALSE (nih_btree_lower_bound (btree, KEY (1999), &cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+
+	/* Check that nih_btree_upper_bound positions the cursor at the
+	 * entry following the key given, and at the end if there is none.
+	 */
+	TEST_FUNCTION ("nih_btree_upper_bound");
+	for (i = -1; i < 1998; i++) {
+		TEST_TRUE (nih_btree_upper_bound (btree, KEY (i), &cursor));
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)),
+			 (i + 2) / 2 * 2);
+	}
+
+	TEST_FALSE (nih_btree_upper_bound (btree, KEY (1998), &cursor));
+	TEST_EQ_P (cursor.node, NULL);
+
+	nih_free (btree);
+
+
+	/* Check that the lower and upper bounds of a key with many
+	 * entries surround all of them.
+	 */
+	TEST_FEATURE ("with duplicate keys");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	for (i = 0; i < 300; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i / 100), VALUE (i)), 0);
+
+	TEST_TRUE (nih_btree_lower_bound (btree, KEY (1), &cursor));
+	TEST_EQ_P (nih_btree_cursor_value (&cursor), VALUE (100));
+
+	TEST_TRUE (nih_btree_upper_bound (btree, KEY (1), &cursor));
+	TEST_EQ_P (nih_btree_cursor_value (&cursor), VALUE (200));
+
+	TEST_TRUE (nih_btree_cursor_prev (&cursor));
+	TEST_EQ_P (nih_btree_cursor_value (&cursor), VALUE (199));
+
+	nih_free (btree);
+}
+
+void
+test_cursor_remove (void)
+{
+	NihBTree       *btree;
+	NihBTreeCursor  cursor;
+	int             i, ret;
+
+	/* Check that removing entries at a cursor while iterating leaves
+	 * the cursor at the following entry each time, so that every
+	 * other entry can be removed, and the B-tree stays valid.
+	 */
+	TEST_FUNCTION ("nih_btree_cursor_remove");
+	TEST_FEATURE ("with every other entry");
+	btree = nih_btree_new (NULL, int_cmp);
+
+	for (i = 0; i < 10000; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i), NULL), 0);
+
+	ret = nih_btree_first (btree, &cursor);
+	while (ret) {
+		i = INT (nih_btree_cursor_key (&cursor));
+
+		if (i % 2) {
+			ret = nih_btree_cursor_next (&cursor);
+			continue;
+		}
+
+		ret = nih_btree_cursor_remove (&cursor);
+		if (ret)
+			TEST_EQ (INT (nih_btree_cursor_key (&cursor)), i + 1);
+	}
+
+	TEST_EQ (btree->entries, 5000);
+	check_btree (btree);
+
+	i = 1;
+	NIH_BTREE_FOREACH (btree, iter) {
+		TEST_EQ (INT (nih_btree_cursor_key (iter)), i);
+		i += 2;
+	}
+
+
+	/* Check that removing the entries from the front, as with a queue,
+	 * leaves the cursor at each following entry until the B-tree is
+	 * empty.
+	 */
+	TEST_FEATURE ("with every entry");
+	ret = nih_btree_first (btree, &cursor);
+	for (i = 1; ret; i += 2) {
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)), i);
+		ret = nih_btree_cursor_remove (&cursor);
+	}
+
+	TEST_EQ (i, 10001);
+	TEST_EQ_P (cursor.node, NULL);
+	check_btree (btree);
+
+
+	/* Check that removing entries from the back leaves the cursor at
+	 * the end each time.
+	 */
+	TEST_FEATURE ("with last entry");
+	for (i = 0; i < 1000; i++)
+		TEST_EQ (nih_btree_add (btree, KEY (i), NULL), 0);
+
+	for (i = 999; i >= 0; i--) {
+		TEST_TRUE (nih_btree_last (btree, &cursor));
+		TEST_EQ (INT (nih_btree_cursor_key (&cursor)), i);
+		TEST_FALSE (nih_btree_cursor_remove (&cursor));
+
+		if (! (i % 100))
+			check_btree (btree);
+	}
+
+	TEST_EQ_P (btree->root, NULL);
+
+	nih_free (btree);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_new ();
+	test_add ();
+	test_lookup ();
+	test_remove ();
+	test_cursor ();
+	test_cursor_remove ();
+
+	return 0;
+}
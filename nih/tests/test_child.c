@@ -36,6 +36,7 @@
 #include <nih/alloc.h>
 #include <nih/list.h>
 #include <nih/string.h>
+#include <nih/io.h>
 #include <nih/child.h>
 
 
@@ -119,11 +120,12 @@ test_add_watch (void)
 void
 test_poll (void)
 {
-	NihChildWatch *watch;
+	NihChildWatch *watch, *generic, *others[1000];
 	siginfo_t      siginfo;
 	pid_t          pid, child;
 	unsigned long  data;
 	char           corefile[PATH_MAX + 1];
+	int            i;
 
 	TEST_FUNCTION ("nih_child_poll");
 
@@ -613,6 +615,77 @@ test_poll (void)
 	nih_free (watch);
 
 
+	/* Check that when there are many watches on other pids, only the
+	 * watch on the pid that died is triggered.
+	 */
+	TEST_FEATURE ("with many pid-specific watchers");
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	for (i = 0; i < 1000; i++)
+		others[i] = nih_child_add_watch (NULL, pid + 1 + i,
+						 NIH_CHILD_ALL,
+						 my_handler, &others[i]);
+
+	watch = nih_child_add_watch (NULL, pid, NIH_CHILD_KILLED,
+				     my_handler, &watch);
+
+	TEST_FREE_TAG (watch);
+
+	handler_called = 0;
+	last_data = NULL;
+	last_pid = 0;
+
+	kill (pid, SIGTERM);
+	waitid (P_PID, pid, &siginfo, WEXITED | WNOWAIT);
+
+	nih_child_poll ();
+
+	TEST_EQ (handler_called, 1);
+	TEST_EQ_P (last_data, &watch);
+	TEST_EQ (last_pid, pid);
+	TEST_FREE (watch);
+
+	for (i = 0; i < 1000; i++)
+		nih_free (others[i]);
+
+
+	/* Check that the watches on the pid that died are called before
+	 * the generic watches, even when the generic watch was added
+	 * first.
+	 */
+	TEST_FEATURE ("with generic and pid-specific watchers");
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	generic = nih_child_add_watch (NULL, -1, NIH_CHILD_ALL,
+				       my_handler, &generic);
+	watch = nih_child_add_watch (NULL, pid, NIH_CHILD_ALL,
+				     my_handler, &watch);
+
+	TEST_FREE_TAG (watch);
+
+	handler_called = 0;
+	last_data = NULL;
+	last_pid = 0;
+
+	kill (pid, SIGTERM);
+	waitid (P_PID, pid, &siginfo, WEXITED | WNOWAIT);
+
+	nih_child_poll ();
+
+	TEST_EQ (handler_called, 2);
+	TEST_EQ_P (last_data, &generic);
+	TEST_EQ (last_pid, pid);
+	TEST_FREE (watch);
+
+	nih_free (generic);
+
+
 	/* Check that a poll when nothing has died does nothing. */
 	TEST_FEATURE ("with nothing dead");
 
@@ -647,12 +720,123 @@ test_poll (void)
 }
 
 
+void
+test_init_pidfd (void)
+{
+	NihChildWatch *watch, *stopped;
+	siginfo_t      siginfo;
+	pid_t          pid;
+
+	TEST_FUNCTION ("nih_child_init_pidfd");
+	nih_child_init_pidfd ();
+
+
+	/* Check that a child watched only for termination is reaped
+	 * when its pidfd becomes readable, rather than by nih_child_poll().
+	 */
+	TEST_FEATURE ("with termination");
+
+	TEST_CHILD (pid) {
+		exit (42);
+	}
+
+	watch = nih_child_add_watch (NULL, pid, NIH_CHILD_EXITED,
+				     my_handler, &watch);
+
+	TEST_FREE_TAG (watch);
+
+	handler_called = 0;
+	last_data = NULL;
+	last_pid = 0;
+	last_event = -1;
+	last_status = 0;
+
+	waitid (P_PID, pid, &siginfo, WEXITED | WNOWAIT);
+
+	nih_child_poll ();
+
+	TEST_FALSE (handler_called);
+	TEST_NOT_FREE (watch);
+
+	nih_io_epoll_wait (1000);
+
+	TEST_TRUE (handler_called);
+	TEST_EQ_P (last_data, &watch);
+	TEST_EQ (last_pid, pid);
+	TEST_EQ (last_event, NIH_CHILD_EXITED);
+	TEST_EQ (last_status, 42);
+	TEST_FREE (watch);
+
+
+	/* Check that a child watched for other events is still reaped
+	 * by nih_child_poll().
+	 */
+	TEST_FEATURE ("with watch for stopped child");
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	watch = nih_child_add_watch (NULL, pid, NIH_CHILD_KILLED,
+				     my_handler, &watch);
+	stopped = nih_child_add_watch (NULL, pid, NIH_CHILD_STOPPED,
+				       my_handler, &stopped);
+
+	TEST_FREE_TAG (watch);
+
+	handler_called = 0;
+	last_data = NULL;
+	last_pid = 0;
+
+	kill (pid, SIGTERM);
+	waitid (P_PID, pid, &siginfo, WEXITED | WNOWAIT);
+
+	nih_child_poll ();
+
+	TEST_EQ (handler_called, 1);
+	TEST_EQ_P (last_data, &watch);
+	TEST_EQ (last_pid, pid);
+	TEST_FREE (watch);
+
+
+	/* Check that once the other watch has been removed, a child
+	 * watched for termination is left for its pidfd.
+	 */
+	TEST_FEATURE ("with other watch removed");
+	nih_free (stopped);
+
+	TEST_CHILD (pid) {
+		pause ();
+	}
+
+	watch = nih_child_add_watch (NULL, pid, NIH_CHILD_KILLED,
+				     my_handler, &watch);
+
+	TEST_FREE_TAG (watch);
+
+	handler_called = 0;
+
+	kill (pid, SIGTERM);
+	waitid (P_PID, pid, &siginfo, WEXITED | WNOWAIT);
+
+	nih_child_poll ();
+
+	TEST_FALSE (handler_called);
+
+	nih_io_epoll_wait (1000);
+
+	TEST_EQ (handler_called, 1);
+	TEST_FREE (watch);
+}
+
+
 int
 main (int   argc,
       char *argv[])
 {
 	test_add_watch ();
 	test_poll ();
+	test_init_pidfd ();
 
 	return 0;
 }
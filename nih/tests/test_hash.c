@@ -21,10 +21,13 @@
 
 #include <nih/test.h>
 
+#include <string.h>
+
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
 #include <nih/hash.h>
+#include <nih/string.h>
 
 
 typedef struct hash_entry {
@@ -46,6 +49,26 @@ new_entry (void       *parent,
 	return (NihList *)entry;
 }
 
+typedef struct cached_entry {
+	NihHashEntry entry;
+	const char  *key;
+} CachedEntry;
+
+static NihList *
+new_cached_entry (void       *parent,
+		  const char *key)
+{
+	CachedEntry *entry;
+
+	entry = nih_new (parent, CachedEntry);
+
+	nih_list_init (&entry->entry.entry);
+	entry->entry.hash = 0;
+	entry->key = key;
+
+	return (NihList *)entry;
+}
+
 static const void *
 my_key_function (NihList *entry)
 {
@@ -159,6 +182,41 @@ test_new (void)
 		nih_free (hash);
 	}
 }
+void
+test_cached_new (void)
+{
+	NihHash *hash;
+
+	/* Check that we can create a hash table that caches the hash of
+	 * each entry; it should be the same as an ordinary hash table
+	 * other than being marked as such.
+	 */
+	TEST_FUNCTION ("nih_hash_cached_new");
+	TEST_ALLOC_FAIL {
+		hash = nih_hash_cached_new (NULL, 0,
+					    my_key_function,
+					    my_hash_function,
+					    my_cmp_function);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (hash, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (hash, sizeof(NihHash));
+		TEST_EQ_P (hash->key_function, my_key_function);
+		TEST_EQ_P (hash->hash_function, my_hash_function);
+		TEST_EQ_P (hash->cmp_function, my_cmp_function);
+		TEST_TRUE (hash->cached);
+
+		TEST_EQ (hash->size, 17);
+		TEST_NE_P (hash->bins, NULL);
+		TEST_ALLOC_PARENT (hash->bins, hash);
+
+		nih_free (hash);
+	}
+}
+
 
 void
 test_string_new (void)
@@ -584,6 +642,252 @@ test_foreach_safe (void)
 }
 
 
+static int cmp_calls = 0;
+
+static uint32_t
+first_char_hash (const char *key)
+{
+	return key[0];
+}
+
+static int
+counting_cmp (const char *key1,
+	      const char *key2)
+{
+	cmp_calls++;
+
+	return strcmp (key1, key2);
+}
+
+void
+test_cached (void)
+{
+	NihHash *hash;
+	NihList *entry1, *entry2, *entry3, *ptr;
+	char     key[16];
+	int      i;
+
+	TEST_FUNCTION ("nih_hash_search");
+
+	/* Check that with a hash table that caches the hash of each entry,
+	 * the hash is stored in the entry when added and the comparison
+	 * function is only called for entries with a matching hash.  The
+	 * hash function used places both 'a' and 'r' in the same bin.
+	 */
+	TEST_FEATURE ("with cached hash");
+	hash = nih_hash_cached_new (NULL, 0,
+				    (NihKeyFunction)nih_hash_entry_string_key,
+				    (NihHashFunction)first_char_hash,
+				    (NihCmpFunction)counting_cmp);
+
+	entry1 = new_cached_entry (hash, "a1");
+	entry2 = new_cached_entry (hash, "r1");
+	entry3 = new_cached_entry (hash, "a2");
+
+	nih_hash_add (hash, entry1);
+	nih_hash_add (hash, entry2);
+	TEST_EQ_P (nih_hash_add_unique (hash, entry3), entry3);
+
+	TEST_EQ (((NihHashEntry *)entry1)->hash, 'a');
+	TEST_EQ (((NihHashEntry *)entry2)->hash, 'r');
+	TEST_EQ (((NihHashEntry *)entry3)->hash, 'a');
+
+	cmp_calls = 0;
+	TEST_EQ_P (nih_hash_lookup (hash, "r1"), entry2);
+	TEST_EQ (cmp_calls, 1);
+
+	cmp_calls = 0;
+	TEST_EQ_P (nih_hash_lookup (hash, "a2"), entry3);
+	TEST_EQ (cmp_calls, 2);
+
+	cmp_calls = 0;
+	TEST_EQ_P (nih_hash_lookup (hash, "z1"), NULL);
+	TEST_EQ (cmp_calls, 0);
+
+	ptr = new_cached_entry (hash, "r1");
+	TEST_EQ_P (nih_hash_replace (hash, ptr), entry2);
+	TEST_EQ (((NihHashEntry *)ptr)->hash, 'r');
+	TEST_EQ_P (nih_hash_lookup (hash, "r1"), ptr);
+
+	nih_list_remove (entry1);
+	TEST_EQ_P (nih_hash_lookup (hash, "a1"), NULL);
+
+	nih_free (hash);
+
+
+	/* Check that a hash table that caches the hash of each entry can
+	 * grow, moving entries by their stored hash.
+	 */
+	TEST_FEATURE ("with cached hash while growing");
+	hash = nih_hash_string_cached_new (NULL, 0);
+
+	for (i = 0; i < 1000; i++) {
+		ptr = new_cached_entry (hash, NIH_MUST (nih_sprintf (hash, "%d",
+								     i)));
+		nih_hash_add (hash, ptr);
+	}
+
+	TEST_GT (hash->size, 17);
+
+	do {
+		for (i = 0; i < 1000; i++) {
+			sprintf (key, "%d", i);
+			ptr = nih_hash_lookup (hash, key);
+
+			TEST_NE_P (ptr, NULL);
+			TEST_EQ_STR (((CachedEntry *)ptr)->key, key);
+			TEST_EQ (((NihHashEntry *)ptr)->hash,
+				 nih_hash_string_hash (key));
+		}
+	} while (hash->old_bins);
+
+	nih_free (hash);
+}
+
+
+void
+test_grow (void)
+{
+	NihHash *hash;
+	NihList *entry[1000], *ptr, *dup;
+	size_t   old_size, moved;
+	char     key[16];
+	int      i, count;
+
+	TEST_FUNCTION ("nih_hash_add");
+
+	/* Check that adding many more entries than the hash was created
+	 * for causes it to grow, with the entries moved into the new bins
+	 * by subsequent lookups; every entry should be found throughout
+	 * and the old bins freed at the end.
+	 */
+	TEST_FEATURE ("with many entries");
+	hash = nih_hash_string_new (NULL, 0);
+
+	for (i = 0; i < 1000; i++) {
+		entry[i] = new_entry (hash, NIH_MUST (nih_sprintf (hash, "%d",
+								   i)));
+		nih_hash_add (hash, entry[i]);
+	}
+
+	TEST_GT (hash->size, 17);
+
+	while (hash->old_bins) {
+		for (i = 0; i < 1000; i++) {
+			sprintf (key, "%d", i);
+			TEST_EQ_P (nih_hash_lookup (hash, key), entry[i]);
+		}
+	}
+
+	TEST_EQ (hash->old_size, 0);
+	TEST_GT (hash->size, 17);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf (key, "%d", i);
+		TEST_EQ_P (nih_hash_lookup (hash, key), entry[i]);
+	}
+
+	nih_free (hash);
+
+
+	/* Check that while the hash is growing, iterating it visits every
+	 * entry exactly once and no entries are moved until the loop has
+	 * finished, even when lookups are performed.
+	 */
+	TEST_FEATURE ("with iteration while growing");
+	hash = nih_hash_string_new (NULL, 0);
+
+	for (i = 0; (i < 1000) && (! hash->old_bins); i++) {
+		entry[i] = new_entry (hash, NIH_MUST (nih_sprintf (hash, "%d",
+								   i)));
+		nih_hash_add (hash, entry[i]);
+	}
+
+	TEST_NE_P (hash->old_bins, NULL);
+	old_size = hash->old_size;
+	moved = hash->moved;
+
+	count = 0;
+	NIH_HASH_FOREACH (hash, iter) {
+		TEST_EQ_P (nih_hash_lookup (hash, ((HashEntry *)iter)->key),
+			   iter);
+		count++;
+	}
+
+	TEST_EQ (count, i);
+	TEST_EQ (hash->old_size, old_size);
+	TEST_EQ (hash->moved, moved);
+	TEST_EQ (hash->iterating, 0);
+
+	count = 0;
+	NIH_HASH_FOREACH_SAFE (hash, iter) {
+		nih_list_remove (iter);
+		count++;
+	}
+
+	TEST_EQ (count, i);
+	TEST_EQ (hash->iterating, 0);
+	TEST_HASH_EMPTY (hash);
+
+	nih_free (hash);
+
+
+	/* Check that entries with the same key are still found in the
+	 * order they were added while the hash is growing, and that an
+	 * entry may be removed with nih_list_remove().
+	 */
+	TEST_FEATURE ("with duplicate keys while growing");
+	hash = nih_hash_string_new (NULL, 0);
+
+	dup = new_entry (hash, "dup");
+	nih_hash_add (hash, dup);
+
+	for (i = 0; (i < 1000) && (! hash->old_bins); i++) {
+		entry[i] = new_entry (hash, NIH_MUST (nih_sprintf (hash, "%d",
+								   i)));
+		nih_hash_add (hash, entry[i]);
+	}
+
+	TEST_NE_P (hash->old_bins, NULL);
+
+	ptr = new_entry (hash, "dup");
+	nih_hash_add (hash, ptr);
+
+	TEST_EQ_P (nih_hash_lookup (hash, "dup"), dup);
+	TEST_EQ_P (nih_hash_search (hash, "dup", dup), ptr);
+	TEST_EQ_P (nih_hash_search (hash, "dup", ptr), NULL);
+
+	nih_list_remove (dup);
+
+	TEST_EQ_P (nih_hash_lookup (hash, "dup"), ptr);
+	TEST_EQ_P (nih_hash_search (hash, "dup", ptr), NULL);
+
+	nih_free (hash);
+
+
+	/* Check that a hash with entries repeatedly added and removed,
+	 * but never many at once, does not grow.
+	 */
+	TEST_FEATURE ("with entries removed");
+	hash = nih_hash_string_new (NULL, 0);
+
+	for (i = 0; i < 10000; i++) {
+		ptr = new_entry (hash, "entry");
+		nih_hash_add (hash, ptr);
+
+		TEST_EQ_P (nih_hash_lookup (hash, "entry"), ptr);
+
+		nih_list_remove (ptr);
+		nih_free (ptr);
+	}
+
+	TEST_EQ (hash->size, 17);
+	TEST_EQ_P (hash->old_bins, NULL);
+
+	nih_free (hash);
+}
+
+
 void
 test_string_key (void)
 {
@@ -605,12 +909,142 @@ test_string_key (void)
 	nih_free (entry);
 }
 
+void
+test_entry_string_key (void)
+{
+	NihList    *entry;
+	const char *key;
+
+
+	/* Check that the entry string key function returns a pointer to
+	 * the key following the NihHashEntry in our test structure.
+	 */
+	TEST_FUNCTION ("nih_hash_entry_string_key");
+	entry = new_cached_entry (NULL, "my entry");
+
+	key = nih_hash_entry_string_key (entry);
+
+	TEST_EQ_P (key, ((CachedEntry *)entry)->key);
+	TEST_EQ_STR (key, "my entry");
+
+	nih_free (entry);
+}
+
+void
+test_string_word_hash (void)
+{
+	char     buf[80], key[64];
+	uint32_t hashes[64];
+	int      i, j;
+
+	TEST_FUNCTION ("nih_hash_string_word_hash");
+
+	/* Check that the same string always has the same hash wherever
+	 * it is in memory, however it is aligned.
+	 */
+	TEST_FEATURE ("with unaligned strings");
+	for (i = 0; i < 8; i++) {
+		strcpy (buf + i, "/com/ubuntu/Upstart/jobs/dbus/_");
+
+		TEST_EQ (nih_hash_string_word_hash (buf + i),
+			 nih_hash_string_word_hash (
+				 "/com/ubuntu/Upstart/jobs/dbus/_"));
+	}
+
+
+	/* Check that strings of each length up to several words, which
+	 * differ only in length, all have different hashes.
+	 */
+	TEST_FEATURE ("with different lengths");
+	memset (key, 'a', sizeof (key));
+	for (i = 0; i < 64; i++) {
+		key[i] = '\0';
+		hashes[i] = nih_hash_string_word_hash (key);
+		key[i] = 'a';
+
+		for (j = 0; j < i; j++)
+			TEST_NE (hashes[i], hashes[j]);
+	}
+
+
+	/* Check that strings differing in only one character, wherever
+	 * it is, have different hashes.
+	 */
+	TEST_FEATURE ("with different characters");
+	memset (key, 'a', sizeof (key));
+	key[40] = '\0';
+	for (i = 0; i < 40; i++) {
+		key[i] = 'b';
+		hashes[i] = nih_hash_string_word_hash (key);
+		key[i] = 'a';
+
+		TEST_NE (hashes[i], nih_hash_string_word_hash (key));
+		for (j = 0; j < i; j++)
+			TEST_NE (hashes[i], hashes[j]);
+	}
+}
+
+void
+test_set_string_hash (void)
+{
+	NihHash *hash;
+
+	/* Check that the selected string hash function is used by hash
+	 * tables created afterwards, but not those that already exist.
+	 */
+	TEST_FUNCTION ("nih_hash_set_string_hash");
+	hash = nih_hash_string_new (NULL, 0);
+
+	nih_hash_set_string_hash (
+		(NihHashFunction)nih_hash_string_word_hash);
+
+	TEST_EQ_P (nih_hash_string_function,
+		   (NihHashFunction)nih_hash_string_word_hash);
+	TEST_EQ_P (hash->hash_function,
+		   (NihHashFunction)nih_hash_string_hash);
+	nih_free (hash);
+
+	hash = nih_hash_string_new (NULL, 0);
+	TEST_EQ_P (hash->hash_function,
+		   (NihHashFunction)nih_hash_string_word_hash);
+	nih_free (hash);
+
+	nih_hash_set_string_hash ((NihHashFunction)nih_hash_string_hash);
+
+	hash = nih_hash_string_new (NULL, 0);
+	TEST_EQ_P (hash->hash_function,
+		   (NihHashFunction)nih_hash_string_hash);
+	nih_free (hash);
+}
+
+void
+test_seed_init (void)
+{
+	uint32_t before, after, fnv;
+
+	/* Check that choosing a random seed changes the word hash of
+	 * strings, but not the default hash.
+	 */
+	TEST_FUNCTION ("nih_hash_seed_init");
+	before = nih_hash_string_word_hash ("/com/ubuntu/Upstart");
+	fnv = nih_hash_string_hash ("/com/ubuntu/Upstart");
+
+	nih_hash_seed_init ();
+
+	after = nih_hash_string_word_hash ("/com/ubuntu/Upstart");
+
+	TEST_NE (after, before);
+	TEST_EQ (nih_hash_string_word_hash ("/com/ubuntu/Upstart"), after);
+	TEST_EQ (nih_hash_string_hash ("/com/ubuntu/Upstart"), fnv);
+}
+
 
 int
 main (int   argc,
       char *argv[])
 {
 	test_new ();
+	test_cached_new ();
 	test_string_new ();
 	test_add ();
 	test_add_unique ();
@@ -619,7 +1053,13 @@ main (int   argc,
 	test_lookup ();
 	test_foreach ();
 	test_foreach_safe ();
+	test_cached ();
+	test_grow ();
 	test_string_key ();
+	test_entry_string_key ();
+	test_string_word_hash ();
+	test_set_string_hash ();
+	test_seed_init ();
 
 	return 0;
 }
@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -40,6 +41,7 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/string.h>
 #include <nih/list.h>
 #include <nih/io.h>
 #include <nih/logging.h>
@@ -222,6 +224,254 @@ test_handle_fds (void)
 }
 
 
+void
+test_epoll_wait (void)
+{
+	NihIoWatch   *watch1, *watch2, *watch3;
+	int           fds[2], fd, dupfd, ret, status;
+	unsigned int  forks;
+	pid_t         pid;
+
+	TEST_FUNCTION ("nih_io_epoll_wait");
+	fd = nih_io_epoll_fd ();
+	TEST_GE (fd, 0);
+
+	assert0 (pipe (fds));
+	watch1 = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				   my_watcher, &watch1);
+	watch2 = nih_io_add_watch (NULL, fds[1], NIH_IO_NONE,
+				   my_watcher, &watch2);
+	watch3 = nih_io_add_watch (NULL, fds[0], NIH_IO_EXCEPT,
+				   my_watcher, &watch3);
+
+	/* Check that nothing is called, and that we don't block, when
+	 * there are no events on any watched descriptor.
+	 */
+	TEST_FEATURE ("with no events");
+	watcher_called = 0;
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (watcher_called, 0);
+
+
+	/* Check that a watch added for no events can be changed to watch
+	 * for writability, and that only that watch is called when the
+	 * event occurs.
+	 */
+	TEST_FEATURE ("with updated watch");
+	watcher_called = 0;
+	last_data = NULL;
+	last_watch = NULL;
+	last_events = 0;
+
+	watch2->events = NIH_IO_WRITE;
+	nih_io_watch_update (watch2);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ (last_events, NIH_IO_WRITE);
+	TEST_EQ_P (last_watch, watch2);
+	TEST_EQ_P (last_data, &watch2);
+
+	watch2->events = NIH_IO_NONE;
+	nih_io_watch_update (watch2);
+
+
+	/* Check that a watch for readability is called when there is data
+	 * to be read, and that another watch on the same descriptor for
+	 * different events is not called.
+	 */
+	TEST_FEATURE ("with data to read");
+	watcher_called = 0;
+	last_data = NULL;
+	last_watch = NULL;
+	last_events = 0;
+
+	assert (write (fds[1], "test", 4) == 4);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ (last_events, NIH_IO_READ);
+	TEST_EQ_P (last_watch, watch1);
+	TEST_EQ_P (last_data, &watch1);
+
+
+	/* Check that a watch removed from the list is no longer called,
+	 * even without being updated.
+	 */
+	TEST_FEATURE ("with removed watch");
+	watcher_called = 0;
+
+	nih_list_remove (&watch1->entry);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (watcher_called, 0);
+
+
+	/* Check that a watch placed back in the list is called again
+	 * once updated.
+	 */
+	TEST_FEATURE ("with watch placed back in list");
+	watcher_called = 0;
+	last_watch = NULL;
+
+	nih_list_add (nih_io_watches, &watch1->entry);
+	nih_io_watch_update (watch1);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ_P (last_watch, watch1);
+
+
+	/* Check that a freed watch is no longer called. */
+	TEST_FEATURE ("with freed watch");
+	watcher_called = 0;
+
+	nih_free (watch1);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (watcher_called, 0);
+
+
+	/* Check that a regular file, which cannot be polled, is always
+	 * treated as being ready.
+	 */
+	TEST_FEATURE ("with regular file");
+	watcher_called = 0;
+	last_watch = NULL;
+	last_events = 0;
+
+	nih_free (watch3);
+	close (fds[0]);
+	close (fds[1]);
+
+	fd = fileno (tmpfile ());
+	watch1 = nih_io_add_watch (NULL, fd, NIH_IO_READ,
+				   my_watcher, &watch1);
+
+	ret = nih_io_epoll_wait (-1);
+
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ (last_events, NIH_IO_READ);
+	TEST_EQ_P (last_watch, watch1);
+
+	nih_free (watch1);
+	nih_free (watch2);
+
+	close (fd);
+
+
+	/* Check that a registration left behind by closing the descriptor
+	 * before freeing its watch, while a duplicate remains open, is
+	 * dropped the first time it wakes us rather than waking us again.
+	 */
+	TEST_FEATURE ("with descriptor closed before watch");
+	watcher_called = 0;
+
+	assert0 (pipe (fds));
+	dupfd = dup (fds[0]);
+	assert (write (fds[1], "test", 4) == 4);
+
+	watch1 = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				   my_watcher, &watch1);
+
+	close (fds[0]);
+	nih_free (watch1);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (watcher_called, 0);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (watcher_called, 0);
+
+	close (dupfd);
+	close (fds[1]);
+
+
+	/* Check that a descriptor the kernel refuses to register, because
+	 * it's already closed, is treated as being ready so that the
+	 * watcher finds out rather than never being called.
+	 */
+	TEST_FEATURE ("with closed descriptor");
+	watcher_called = 0;
+	last_watch = NULL;
+	last_events = 0;
+
+	assert0 (pipe (fds));
+	close (fds[0]);
+
+	watch1 = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				   my_watcher, &watch1);
+
+	ret = nih_io_epoll_wait (0);
+
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ (last_events, NIH_IO_READ);
+	TEST_EQ_P (last_watch, watch1);
+
+	nih_free (watch1);
+	close (fds[1]);
+
+
+	/* Check that a child process gets its own epoll instance, with the
+	 * existing watches registered with it, rather than sharing that of
+	 * its parent.
+	 */
+	TEST_FEATURE ("with child process");
+	fd = nih_io_epoll_fd ();
+	forks = nih_io_forks;
+
+	assert0 (pipe (fds));
+	assert (write (fds[1], "test", 4) == 4);
+
+	watch1 = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				   my_watcher, &watch1);
+
+	TEST_CHILD (pid) {
+		watcher_called = 0;
+		last_watch = NULL;
+
+		if (nih_io_forks == forks)
+			exit (10);
+		if (nih_io_epoll_fd () == fd)
+			exit (20);
+		if (nih_io_epoll_wait (0) != 1)
+			exit (30);
+		if ((watcher_called != 1) || (last_watch != watch1))
+			exit (40);
+
+		exit (0);
+	}
+
+	waitpid (pid, &status, 0);
+
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+	TEST_EQ (nih_io_forks, forks);
+	TEST_EQ (nih_io_epoll_fd (), fd);
+
+	nih_free (watch1);
+	close (fds[0]);
+	close (fds[1]);
+}
+
+
 void
 test_buffer_new (void)
 {
@@ -243,6 +493,8 @@ test_buffer_new (void)
 		TEST_EQ_P (buf->buf, NULL);
 		TEST_EQ (buf->size, 0);
 		TEST_EQ (buf->len, 0);
+		TEST_EQ (buf->offset, 0);
+		TEST_FALSE (buf->sliding);
 
 		nih_free (buf);
 	}
@@ -590,6 +842,236 @@ test_buffer_push (void)
 }
 
 
+void
+test_buffer_set_sliding (void)
+{
+	NihIoBuffer *buf;
+	char        *mem, *str;
+	size_t       len;
+	int          ret;
+
+	TEST_FUNCTION ("nih_io_buffer_set_sliding");
+	buf = nih_io_buffer_new (NULL);
+	nih_io_buffer_set_sliding (buf);
+
+	TEST_TRUE (buf->sliding);
+
+	assert0 (nih_io_buffer_push (buf,
+				     "this is a test of the buffer code", 33));
+	TEST_ALLOC_PARENT (buf->buf, buf);
+	TEST_ALLOC_SIZE (buf->buf, BUFSIZ);
+	TEST_EQ (buf->size, BUFSIZ);
+	TEST_EQ (buf->offset, 0);
+
+	mem = buf->buf;
+
+
+	/* Check that shrinking a sliding buffer advances the start of the
+	 * buffer past the bytes removed, rather than moving the rest of
+	 * the data up.
+	 */
+	TEST_FEATURE ("with shrink");
+	nih_io_buffer_shrink (buf, 14);
+
+	TEST_EQ_P (buf->buf, mem + 14);
+	TEST_EQ (buf->offset, 14);
+	TEST_EQ (buf->size, BUFSIZ - 14);
+	TEST_EQ (buf->len, 19);
+	TEST_EQ_MEM (buf->buf, " of the buffer code", 19);
+
+
+	/* Check that popping from a sliding buffer also advances it. */
+	TEST_FEATURE ("with pop");
+	len = 7;
+	str = nih_io_buffer_pop (NULL, buf, &len);
+
+	TEST_EQ (len, 7);
+	TEST_EQ_STR (str, " of the");
+	TEST_EQ_P (buf->buf, mem + 21);
+	TEST_EQ (buf->offset, 21);
+	TEST_EQ (buf->size, BUFSIZ - 21);
+	TEST_EQ (buf->len, 12);
+	TEST_EQ_MEM (buf->buf, " buffer code", 12);
+
+	nih_free (str);
+
+
+	/* Check that pushing more data than there is room for beyond the
+	 * start of the buffer moves the data back to the start of the
+	 * allocation, since more bytes have been consumed than remain.
+	 */
+	TEST_FEATURE ("with push moving data back");
+	TEST_ALLOC_FAIL {
+		buf->buf = mem + 21;
+		buf->offset = 21;
+		buf->size = BUFSIZ - 21;
+		buf->len = 12;
+		memcpy (buf->buf, " buffer code", 12);
+
+		ret = nih_io_buffer_resize (buf, BUFSIZ - 25);
+
+		TEST_EQ (ret, 0);
+		TEST_EQ_P (buf->buf, mem);
+		TEST_EQ (buf->offset, 0);
+		TEST_EQ (buf->size, BUFSIZ);
+		TEST_EQ (buf->len, 12);
+		TEST_EQ_MEM (buf->buf, " buffer code", 12);
+	}
+
+
+	/* Check that needing more room than the allocation has doubles it,
+	 * moving the data to the start.
+	 */
+	TEST_FEATURE ("with growth");
+	TEST_ALLOC_FAIL {
+		buf->buf = mem + 21;
+		buf->offset = 21;
+		buf->size = BUFSIZ - 21;
+		buf->len = 12;
+		memcpy (buf->buf, " buffer code", 12);
+
+		ret = nih_io_buffer_resize (buf, BUFSIZ * 2);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (buf->buf, mem);
+			TEST_EQ (buf->offset, 0);
+			TEST_EQ (buf->size, BUFSIZ);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_ALLOC_PARENT (buf->buf, buf);
+		TEST_ALLOC_SIZE (buf->buf, BUFSIZ * 4);
+		TEST_EQ (buf->offset, 0);
+		TEST_EQ (buf->size, BUFSIZ * 4);
+		TEST_EQ (buf->len, 12);
+		TEST_EQ_MEM (buf->buf, " buffer code", 12);
+
+		TEST_ALLOC_SAFE {
+			mem = nih_realloc (buf->buf, buf, BUFSIZ);
+			buf->buf = mem;
+			buf->size = BUFSIZ;
+		}
+	}
+
+
+	/* Check that emptying a sliding buffer keeps its memory, starting
+	 * again at the beginning.
+	 */
+	TEST_FEATURE ("with request to empty buffer");
+	buf->buf = mem + 21;
+	buf->offset = 21;
+	buf->size = BUFSIZ - 21;
+	buf->len = 12;
+
+	nih_io_buffer_shrink (buf, 12);
+
+	TEST_EQ_P (buf->buf, mem);
+	TEST_EQ (buf->offset, 0);
+	TEST_EQ (buf->size, BUFSIZ);
+	TEST_EQ (buf->len, 0);
+
+
+	/* Check that the memory of an empty sliding buffer is freed by
+	 * resizing it with no extra room.
+	 */
+	TEST_FEATURE ("with release of memory");
+	ret = nih_io_buffer_resize (buf, 0);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ_P (buf->buf, NULL);
+	TEST_EQ (buf->offset, 0);
+	TEST_EQ (buf->size, 0);
+
+	nih_free (buf);
+}
+
+void
+test_buffer_reserve (void)
+{
+	NihIoBuffer *buf;
+	char        *room;
+	size_t       len;
+
+	TEST_FUNCTION ("nih_io_buffer_reserve");
+	buf = nih_io_buffer_new (NULL);
+
+	/* Check that we can reserve room in an empty buffer, which will
+	 * allocate it and return the start of it along with all of the
+	 * room available.
+	 */
+	TEST_FEATURE ("with empty buffer");
+	TEST_ALLOC_FAIL {
+		buf->len = 0;
+		buf->size = 0;
+		len = 0;
+		room = nih_io_buffer_reserve (buf, 80, &len);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (room, NULL);
+			continue;
+		}
+
+		TEST_EQ_P (room, buf->buf);
+		TEST_ALLOC_SIZE (buf->buf, BUFSIZ);
+		TEST_EQ (buf->size, BUFSIZ);
+		TEST_EQ (buf->len, 0);
+		TEST_EQ (len, BUFSIZ);
+	}
+
+
+	/* Check that reserving room in a buffer with data in it returns
+	 * the room after the data.
+	 */
+	TEST_FEATURE ("with data in the buffer");
+	TEST_ALLOC_FAIL {
+		buf->len = 4;
+		buf->size = BUFSIZ;
+		len = 0;
+		room = nih_io_buffer_reserve (buf, 80, &len);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (room, NULL);
+			continue;
+		}
+
+		TEST_EQ_P (room, buf->buf + 4);
+		TEST_EQ (buf->size, BUFSIZ);
+		TEST_EQ (buf->len, 4);
+		TEST_EQ (len, BUFSIZ - 4);
+	}
+
+	nih_free (buf);
+}
+
+void
+test_buffer_commit (void)
+{
+	NihIoBuffer *buf;
+	char        *room;
+	size_t       len;
+
+	/* Check that committing data placed in the room of a buffer adds
+	 * it to the end of the buffer.
+	 */
+	TEST_FUNCTION ("nih_io_buffer_commit");
+	buf = nih_io_buffer_new (NULL);
+	assert0 (nih_io_buffer_push (buf, "test", 4));
+
+	room = nih_io_buffer_reserve (buf, 14, &len);
+	assert (room != NULL);
+	memcpy (room, "ing the buffer code", 14);
+
+	nih_io_buffer_commit (buf, 14);
+
+	TEST_EQ (buf->len, 18);
+	TEST_EQ_MEM (buf->buf, "testing the buffer code", 18);
+
+	nih_free (buf);
+}
+
+
 void
 test_message_new (void)
 {
@@ -1167,6 +1649,38 @@ my_reader (void       *data,
 	last_len = len;
 }
 
+static int records_called = 0;
+static size_t records_total = 0;
+static char *last_records = NULL;
+
+static void
+my_record_reader (void              *data,
+		  NihIo             *io,
+		  const NihIoRecord *records,
+		  size_t             nrecords)
+{
+	size_t i;
+
+	records_called++;
+	records_total += nrecords;
+
+	if (! data) {
+		nih_free (io);
+		return;
+	}
+
+	last_data = data;
+
+	if (last_records)
+		nih_free (last_records);
+	last_records = NIH_MUST (nih_strdup (NULL, ""));
+
+	for (i = 0; i < nrecords; i++)
+		NIH_MUST (nih_strcat_sprintf (&last_records, NULL, "%.*s|",
+					      (int)records[i].len,
+					      records[i].buf));
+}
+
 static void
 my_close_handler (void  *data,
 		  NihIo *io)
@@ -1227,6 +1741,8 @@ test_reopen (void)
 		TEST_EQ_P (io->data, &io);
 		TEST_FALSE (io->shutdown);
 		TEST_EQ_P (io->free, NULL);
+		TEST_EQ_P (io->record_reader, NULL);
+		TEST_EQ (io->record_scan, 0);
 
 		TEST_ALLOC_PARENT (io->watch, io);
 		TEST_EQ (io->watch->fd, fds[0]);
@@ -1271,6 +1787,8 @@ test_reopen (void)
 		TEST_EQ_P (io->data, &io);
 		TEST_FALSE (io->shutdown);
 		TEST_EQ_P (io->free, NULL);
+		TEST_EQ (io->family, -1);
+		TEST_EQ_P (io->recv_batch, NULL);
 
 		TEST_ALLOC_PARENT (io->watch, io);
 		TEST_EQ (io->watch->fd, fds[0]);
@@ -1437,7 +1955,7 @@ void
 test_destroy (void)
 {
 	NihIo *io;
-	int    fds[2];
+	int    fds[2], dupfd;
 
 	TEST_FUNCTION ("nih_io_destroy");
 
@@ -1486,20 +2004,45 @@ test_destroy (void)
 
 	close (fds[1]);
 	nih_error_pop_context ();
+
+
+	/* Check that the descriptor is removed from the epoll instance
+	 * before it is closed, so a duplicate of it that remains open
+	 * doesn't keep a registration that would wake us.
+	 */
+	TEST_FEATURE ("with duplicated file descriptor");
+	nih_error_push_context ();
+	assert0 (pipe (fds));
+	dupfd = dup (fds[0]);
+	assert (write (fds[1], "test", 4) == 4);
+	error_called = 0;
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_STREAM,
+			    NULL, NULL, my_error_handler, &io);
+
+	nih_free (io);
+
+	TEST_FALSE (error_called);
+	TEST_EQ (nih_io_epoll_wait (0), 0);
+
+	close (dupfd);
+	close (fds[1]);
+	nih_error_pop_context ();
 }
 
 void
 test_watcher (void)
 {
-	NihIo         *io;
-	NihIoMessage  *msg, *msg2;
-	int            fds[2];
-	ssize_t        len;
-	struct msghdr  msghdr;
-	struct iovec   iov[1];
-	char           buf[BUFSIZ * 2];
-	fd_set         readfds, writefds, exceptfds;
-	FILE          *output;
+	NihIo          *io;
+	NihIoMessage   *msg, *msg2;
+	char           *str;
+	int             fds[2], pfds[2], i;
+	ssize_t         len;
+	struct msghdr   msghdr;
+	struct iovec    iov[1];
+	char            buf[BUFSIZ * 2], cbuf[CMSG_SPACE (sizeof (int))];
+	struct cmsghdr *cmsg;
+	fd_set          readfds, writefds, exceptfds;
+	FILE           *output;
 
 	TEST_FUNCTION ("nih_io_watcher");
 
@@ -1772,6 +2315,42 @@ test_watcher (void)
 		TEST_FALSE (io->watch->events & NIH_IO_WRITE);
 	}
 
+
+	/* Check that data referenced in the chain is written in order
+	 * with the data copied before and after it, and that the
+	 * reference to it is dropped once it has been written.
+	 */
+	TEST_FEATURE ("with referenced data to write");
+	str = nih_strdup (NULL, "and this is referenced\n");
+	assert0 (nih_io_printf (io, "this is copied\n"));
+	assert0 (nih_io_write_ref (io, str, strlen (str)));
+	assert0 (nih_io_printf (io, "as is this\n"));
+
+	TEST_FREE_TAG (str);
+
+	TEST_TRUE (io->watch->events & NIH_IO_WRITE);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_NOT_FREE (str);
+	nih_discard (str);
+
+	TEST_FREE (str);
+
+	rewind (output);
+
+	TEST_FILE_EQ (output, "this is a test\n");
+	TEST_FILE_EQ (output, "so is this\n");
+	TEST_FILE_EQ (output, "this is copied\n");
+	TEST_FILE_EQ (output, "and this is referenced\n");
+	TEST_FILE_EQ (output, "as is this\n");
+	TEST_FILE_END (output);
+
+	TEST_EQ (io->send_buf->len, 0);
+	TEST_LIST_EMPTY (&io->send_chunks);
+
+	TEST_FALSE (io->watch->events & NIH_IO_WRITE);
+
 	fclose (output);
 
 
@@ -1814,6 +2393,133 @@ test_watcher (void)
 	nih_error_pop_context ();
 
 
+	/* Check that a stream split into records calls the record reader
+	 * with the complete records received, rather than the reader, and
+	 * removes them from the buffer; an incomplete record is left in the
+	 * buffer having been searched.
+	 */
+	TEST_FEATURE ("with records to read");
+	assert0 (pipe (fds));
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_STREAM,
+			    my_reader, my_close_handler, my_error_handler,
+			    &io);
+	nih_io_set_record_reader (io, '\n', my_record_reader);
+
+	assert (write (fds[1], "one\ntwo\n\nthr", 12) == 12);
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (fds[0], &readfds);
+
+	read_called = 0;
+	records_called = 0;
+	records_total = 0;
+	last_data = NULL;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (read_called, 0);
+	TEST_EQ (records_called, 1);
+	TEST_EQ (records_total, 3);
+	TEST_EQ_P (last_data, &io);
+	TEST_EQ_STR (last_records, "one|two||");
+
+	TEST_EQ (io->recv_buf->len, 3);
+	TEST_EQ_MEM (io->recv_buf->buf, "thr", 3);
+	TEST_EQ (io->record_scan, 3);
+
+
+	/* Check that the rest of an incomplete record completes it, and
+	 * that nothing is handed to the record reader while none are.
+	 */
+	TEST_FEATURE ("with rest of record to read");
+	assert (write (fds[1], "ee", 2) == 2);
+
+	records_called = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (records_called, 0);
+	TEST_EQ (io->record_scan, 5);
+
+	assert (write (fds[1], "\nfour", 5) == 5);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (read_called, 0);
+	TEST_EQ (records_called, 1);
+	TEST_EQ_STR (last_records, "three|");
+
+	TEST_EQ (io->recv_buf->len, 4);
+	TEST_EQ_MEM (io->recv_buf->buf, "four", 4);
+	TEST_EQ (io->record_scan, 4);
+
+
+	/* Check that more records than fit in one batch are handed to the
+	 * record reader in several batches.
+	 */
+	TEST_FEATURE ("with more records than a batch");
+	assert (write (fds[1], "\n", 1) == 1);
+	for (i = 0; i < 99; i++)
+		assert (write (fds[1], "record\n", 7) == 7);
+
+	records_called = 0;
+	records_total = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (records_called, 2);
+	TEST_EQ (records_total, 100);
+	TEST_EQ (io->recv_buf->len, 0);
+	TEST_EQ (io->record_scan, 0);
+
+
+	/* Check that records exactly filling a batch and the buffer are
+	 * handed over once, and that the now empty buffer isn't searched
+	 * again.
+	 */
+	TEST_FEATURE ("with exactly a batch of records");
+	for (i = 0; i < 64; i++)
+		assert (write (fds[1], "record\n", 7) == 7);
+
+	records_called = 0;
+	records_total = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (records_called, 1);
+	TEST_EQ (records_total, 64);
+	TEST_EQ (io->recv_buf->len, 0);
+	TEST_EQ (io->record_scan, 0);
+
+
+	/* Check that the record reader can call nih_free(), resulting in
+	 * the structure being closed once it has finished the watcher
+	 * function.
+	 */
+	TEST_FEATURE ("with free called in record reader");
+	io->data = NULL;
+
+	TEST_FREE_TAG (io);
+
+	assert (write (fds[1], "one\ntwo\n", 8) == 8);
+
+	records_called = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_FREE (io);
+	TEST_EQ (records_called, 1);
+	TEST_LT (fcntl (fds[0], F_GETFD), 0);
+	TEST_EQ (errno, EBADF);
+
+	close (fds[1]);
+
+	nih_free (last_records);
+	last_records = NULL;
+
+
 	/* Check that a message to be read on a socket watched by NihIo ends
 	 * up in the receive queue, and results in the reader function being
 	 * called just once with the right arguments.
@@ -1925,62 +2631,227 @@ test_watcher (void)
 	 * removes the oldest message, the second invocation should be with
 	 * the new message.
 	 */
-	TEST_FEATURE ("with message removed during call");
-	read_called = 0;
-	remove_message = 1;
+	TEST_FEATURE ("with message removed during call");
+	read_called = 0;
+	remove_message = 1;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_LIST_NOT_EMPTY (io->recv_q);
+
+	msg = (NihIoMessage *)io->recv_q->next;
+
+	TEST_ALLOC_SIZE (msg, sizeof (NihIoMessage));
+	TEST_ALLOC_PARENT (msg, io);
+
+	TEST_EQ (msg->data->len, 12);
+	TEST_EQ_MEM (msg->data->buf, "another test", 12);
+
+	TEST_EQ (read_called, 2);
+	TEST_EQ_P (last_data, &io);
+	TEST_EQ_P (last_str, msg->data->buf);
+	TEST_EQ (last_len, msg->data->len);
+
+
+	/* Check that the reader is only called once if the message is
+	 * removed, and that has no ill effect.
+	 */
+	TEST_FEATURE ("with last message removed during call");
+	read_called = 0;
+	remove_message = 1;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_LIST_EMPTY (io->recv_q);
+
+	TEST_EQ (read_called, 1);
+
+
+	/* Check that the reader function can call nih_free(), resulting
+	 * in the structure being closed once it has finished the watcher
+	 * function.
+	 */
+	TEST_FEATURE ("with close called in reader for message");
+	io->data = NULL;
+
+	TEST_FREE_TAG (io);
+
+	memcpy (buf, "test with close", 15);
+	iov[0].iov_len = 15;
+
+	sendmsg (fds[1], &msghdr, 0);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_FREE (io);
+	TEST_LT (fcntl (fds[0], F_GETFD), 0);
+	TEST_EQ (errno, EBADF);
+
+	close (fds[1]);
+
+
+	/* Check that messages are received in batches when a receive batch
+	 * has been set, each ending up in the receive queue in order with
+	 * the reader called once; a burst larger than the batch should be
+	 * received by further batches, leaving the socket empty.
+	 */
+	TEST_FEATURE ("with batch of messages to read");
+	socketpair (PF_UNIX, SOCK_DGRAM, 0, fds);
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_MESSAGE,
+			    my_reader, my_close_handler, my_error_handler,
+			    &io);
+	TEST_EQ (io->family, PF_UNIX);
+	assert0 (nih_io_set_recv_batch (io, 4, 0));
+
+	for (i = 0; i < 6; i++) {
+		sprintf (buf, "message %d", i);
+		iov[0].iov_len = 9;
+
+		sendmsg (fds[1], &msghdr, 0);
+	}
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (fds[0], &readfds);
+
+	read_called = 0;
+	last_data = NULL;
+	last_str = NULL;
+	last_len = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	i = 0;
+	NIH_LIST_FOREACH (io->recv_q, iter) {
+		char expected[20];
+
+		msg = (NihIoMessage *)iter;
+
+		TEST_ALLOC_SIZE (msg, sizeof (NihIoMessage));
+		TEST_ALLOC_PARENT (msg, io);
+
+		sprintf (expected, "message %d", i++);
+		TEST_EQ (msg->data->len, 9);
+		TEST_EQ_MEM (msg->data->buf, expected, 9);
+	}
+	TEST_EQ (i, 6);
+
+	TEST_EQ (read_called, 1);
+	TEST_EQ_P (last_data, &io);
+	TEST_EQ_STRN (last_str, "message 0");
+	TEST_EQ (last_len, 9);
+
+	TEST_LT (recv (fds[0], buf, sizeof (buf), 0), 0);
+	TEST_EQ (errno, EAGAIN);
+
+	nih_free (io);
+	close (fds[1]);
+
+
+	/* Check that the default size of a receive batch has room for a
+	 * message larger than BUFSIZ.
+	 */
+	TEST_FEATURE ("with batch and large message to read");
+	socketpair (PF_UNIX, SOCK_DGRAM, 0, fds);
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_MESSAGE,
+			    my_reader, my_close_handler, my_error_handler,
+			    &io);
+	assert0 (nih_io_set_recv_batch (io, 4, 0));
+
+	memset (buf, 'x', sizeof (buf));
+	assert (send (fds[1], buf, sizeof (buf), 0) == sizeof (buf));
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (fds[0], &readfds);
+
+	read_called = 0;
+	last_len = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_EQ (read_called, 1);
+	TEST_EQ (last_len, sizeof (buf));
+
+	msg = (NihIoMessage *)io->recv_q->next;
+	TEST_EQ (msg->data->len, sizeof (buf));
+	TEST_EQ_MEM (msg->data->buf, buf, sizeof (buf));
+
+	nih_free (io);
+	close (fds[1]);
+
+
+	/* Check that a message too large for the slots of a receive batch
+	 * is discarded rather than queued truncated, closing any file
+	 * descriptor it carried, with the error handler called with
+	 * EMSGSIZE after the reader has been given the others.
+	 */
+	TEST_FEATURE ("with batch and message too large to read");
+	socketpair (PF_UNIX, SOCK_DGRAM, 0, fds);
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_MESSAGE,
+			    my_reader, my_close_handler, my_error_handler,
+			    &io);
+	assert0 (nih_io_set_recv_batch (io, 4, 16));
 
-	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+	assert (send (fds[1], "message 0", 9, 0) == 9);
 
-	TEST_LIST_NOT_EMPTY (io->recv_q);
+	assert0 (pipe (pfds));
 
-	msg = (NihIoMessage *)io->recv_q->next;
+	memset (buf, 'x', 32);
+	iov[0].iov_len = 32;
+	msghdr.msg_control = cbuf;
+	msghdr.msg_controllen = sizeof (cbuf);
 
-	TEST_ALLOC_SIZE (msg, sizeof (NihIoMessage));
-	TEST_ALLOC_PARENT (msg, io);
+	cmsg = CMSG_FIRSTHDR (&msghdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+	memcpy (CMSG_DATA (cmsg), &pfds[1], sizeof (int));
 
-	TEST_EQ (msg->data->len, 12);
-	TEST_EQ_MEM (msg->data->buf, "another test", 12);
+	assert (sendmsg (fds[1], &msghdr, 0) == 32);
 
-	TEST_EQ (read_called, 2);
-	TEST_EQ_P (last_data, &io);
-	TEST_EQ_P (last_str, msg->data->buf);
-	TEST_EQ (last_len, msg->data->len);
+	msghdr.msg_control = NULL;
+	msghdr.msg_controllen = 0;
+	close (pfds[1]);
 
+	assert (send (fds[1], "message 2", 9, 0) == 9);
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+	FD_SET (fds[0], &readfds);
 
-	/* Check that the reader is only called once if the message is
-	 * removed, and that has no ill effect.
-	 */
-	TEST_FEATURE ("with last message removed during call");
 	read_called = 0;
-	remove_message = 1;
+	error_called = 0;
+	last_error = NULL;
 
 	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
 
-	TEST_LIST_EMPTY (io->recv_q);
-
 	TEST_EQ (read_called, 1);
+	TEST_EQ (error_called, 1);
+	TEST_EQ (last_error->number, EMSGSIZE);
+	nih_free (last_error);
 
+	i = 0;
+	NIH_LIST_FOREACH (io->recv_q, iter) {
+		char expected[20];
 
-	/* Check that the reader function can call nih_free(), resulting
-	 * in the structure being closed once it has finished the watcher
-	 * function.
-	 */
-	TEST_FEATURE ("with close called in reader for message");
-	io->data = NULL;
-
-	TEST_FREE_TAG (io);
-
-	memcpy (buf, "test with close", 15);
-	iov[0].iov_len = 15;
+		msg = (NihIoMessage *)iter;
 
-	sendmsg (fds[1], &msghdr, 0);
+		sprintf (expected, "message %d", i);
+		TEST_EQ (msg->data->len, 9);
+		TEST_EQ_MEM (msg->data->buf, expected, 9);
 
-	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+		i += 2;
+	}
+	TEST_EQ (i, 4);
 
-	TEST_FREE (io);
-	TEST_LT (fcntl (fds[0], F_GETFD), 0);
-	TEST_EQ (errno, EBADF);
+	TEST_EQ (read (pfds[0], buf, sizeof (buf)), 0);
+	close (pfds[0]);
 
+	nih_free (io);
 	close (fds[1]);
 
 
@@ -2181,6 +3052,105 @@ test_watcher (void)
 	TEST_EQ_MEM (buf, "another test", 12);
 
 
+	/* Check that a burst of messages, more than fit in a batch or in the
+	 * socket at once, is sent in order; those that can't be sent yet
+	 * remain in the queue, without an error, until the socket is
+	 * writable again.
+	 */
+	TEST_FEATURE ("with burst of messages to write");
+	for (i = 0; i < 1000; i++) {
+		msg = nih_io_message_new (NULL);
+		assert0 (nih_io_buffer_push (msg->data, buf,
+					     sprintf (buf, "message %03d",
+						      i)));
+		nih_io_send_message (io, msg);
+		nih_discard (msg);
+	}
+
+	error_called = 0;
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_LIST_NOT_EMPTY (io->send_q);
+	TEST_TRUE (io->watch->events & NIH_IO_WRITE);
+	TEST_FALSE (error_called);
+
+	i = 0;
+	for (;;) {
+		while ((len = recv (fds[1], buf, sizeof (buf),
+				    MSG_DONTWAIT)) > 0) {
+			char expected[20];
+
+			sprintf (expected, "message %03d", i++);
+			TEST_EQ (len, 11);
+			TEST_EQ_MEM (buf, expected, 11);
+		}
+
+		if (NIH_LIST_EMPTY (io->send_q))
+			break;
+
+		nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+	}
+
+	TEST_EQ (i, 1000);
+	TEST_FALSE (io->watch->events & NIH_IO_WRITE);
+	TEST_FALSE (error_called);
+
+
+	/* Check that a message with control data among the others is sent
+	 * in order with its control data.
+	 */
+	TEST_FEATURE ("with control message among messages to write");
+	msg = nih_io_message_new (NULL);
+	assert0 (nih_io_buffer_push (msg->data, "first", 5));
+	nih_io_send_message (io, msg);
+	nih_discard (msg);
+
+	msg = nih_io_message_new (NULL);
+	assert0 (nih_io_buffer_push (msg->data, "second", 6));
+	assert0 (nih_io_message_add_control (msg, SOL_SOCKET, SCM_RIGHTS,
+					     sizeof (int), &fds[1]));
+	nih_io_send_message (io, msg);
+	nih_discard (msg);
+
+	msg = nih_io_message_new (NULL);
+	assert0 (nih_io_buffer_push (msg->data, "third", 5));
+	nih_io_send_message (io, msg);
+	nih_discard (msg);
+
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_LIST_EMPTY (io->send_q);
+	TEST_FALSE (io->watch->events & NIH_IO_WRITE);
+
+	len = recvmsg (fds[1], &msghdr, 0);
+
+	TEST_EQ (len, 5);
+	TEST_EQ_MEM (buf, "first", 5);
+
+	msghdr.msg_control = cbuf;
+	msghdr.msg_controllen = sizeof (cbuf);
+
+	len = recvmsg (fds[1], &msghdr, 0);
+
+	TEST_EQ (len, 6);
+	TEST_EQ_MEM (buf, "second", 6);
+
+	cmsg = CMSG_FIRSTHDR (&msghdr);
+	TEST_NE_P (cmsg, NULL);
+	TEST_EQ (cmsg->cmsg_level, SOL_SOCKET);
+	TEST_EQ (cmsg->cmsg_type, SCM_RIGHTS);
+	close (*(int *)CMSG_DATA (cmsg));
+
+	msghdr.msg_control = NULL;
+	msghdr.msg_controllen = 0;
+
+	len = recvmsg (fds[1], &msghdr, 0);
+
+	TEST_EQ (len, 5);
+	TEST_EQ_MEM (buf, "third", 5);
+
+
 	/* Check that an attempt to write to a closed descriptor results in
 	 * the error handler being called directly, rather than needing to
 	 * wait for a read again.
@@ -2336,6 +3306,113 @@ test_send_message (void)
 }
 
 
+void
+test_set_recv_batch (void)
+{
+	NihIo          *io;
+	NihIoRecvBatch *batch;
+	NihError       *err;
+	int             fds[2], ret;
+
+	TEST_FUNCTION ("nih_io_set_recv_batch");
+	socketpair (PF_UNIX, SOCK_DGRAM, 0, fds);
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_MESSAGE,
+			    NULL, NULL, NULL, NULL);
+
+
+	/* Check that a receive batch can be set on a datagram socket,
+	 * allocated as a child of the structure.
+	 */
+	TEST_FEATURE ("with slots");
+	TEST_ALLOC_FAIL {
+		ret = nih_io_set_recv_batch (io, 8, 0);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (io->recv_batch, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_NE_P (io->recv_batch, NULL);
+		TEST_ALLOC_PARENT (io->recv_batch, io);
+	}
+
+
+	/* Check that setting a new receive batch replaces the old one,
+	 * which is freed.
+	 */
+	TEST_FEATURE ("with existing batch");
+	assert0 (nih_io_set_recv_batch (io, 8, 0));
+	batch = io->recv_batch;
+	TEST_FREE_TAG (batch);
+
+	ret = nih_io_set_recv_batch (io, 2, 1024);
+
+	TEST_EQ (ret, 0);
+	TEST_FREE (batch);
+	TEST_NE_P (io->recv_batch, NULL);
+	TEST_ALLOC_PARENT (io->recv_batch, io);
+
+
+	/* Check that setting zero slots frees the receive batch, returning
+	 * the structure to receiving messages one at a time.
+	 */
+	TEST_FEATURE ("with zero slots");
+	batch = io->recv_batch;
+	TEST_FREE_TAG (batch);
+
+	ret = nih_io_set_recv_batch (io, 0, 0);
+
+	TEST_EQ (ret, 0);
+	TEST_FREE (batch);
+	TEST_EQ_P (io->recv_batch, NULL);
+
+	nih_free (io);
+	close (fds[1]);
+}
+
+
+void
+test_set_record_reader (void)
+{
+	NihIo *io;
+	int    fds[2];
+
+	TEST_FUNCTION ("nih_io_set_record_reader");
+	assert0 (pipe (fds));
+	io = nih_io_reopen (NULL, fds[0], NIH_IO_STREAM,
+			    NULL, NULL, NULL, NULL);
+
+
+	/* Check that a record reader can be set on a stream along with its
+	 * delimiter, searching the buffer from the start.
+	 */
+	TEST_FEATURE ("with reader");
+	io->record_scan = 10;
+
+	nih_io_set_record_reader (io, '\n', my_record_reader);
+
+	TEST_EQ_P (io->record_reader, my_record_reader);
+	TEST_EQ (io->record_delim, '\n');
+	TEST_EQ (io->record_scan, 0);
+
+
+	/* Check that the record reader can be unset again. */
+	TEST_FEATURE ("with NULL reader");
+	nih_io_set_record_reader (io, '\0', NULL);
+
+	TEST_EQ_P (io->record_reader, NULL);
+
+	nih_free (io);
+	close (fds[1]);
+}
+
+
 void
 test_read (void)
 {
@@ -2684,6 +3761,98 @@ test_write (void)
 	nih_free (io);
 }
 
+void
+test_write_ref (void)
+{
+	NihIo      *io;
+	NihIoChunk *chunk;
+	char       *str;
+	int         ret, fds[2];
+
+	TEST_FUNCTION ("nih_io_write_ref");
+	assert0 (pipe (fds));
+	close (fds[0]);
+
+	io = nih_io_reopen (NULL, fds[1], NIH_IO_STREAM,
+			    NULL, NULL, NULL, NULL);
+	assert0 (nih_io_write (io, "test", 4));
+
+	/* Check that referenced data is placed in a chunk on the chain of
+	 * the NihIo after the data in the send buffer, with the chunk
+	 * holding a reference to it rather than a copy.
+	 */
+	TEST_FEATURE ("with data in the buffer");
+	str = nih_strdup (NULL, "this is a test of the io code");
+
+	TEST_ALLOC_FAIL {
+		ret = nih_io_write_ref (io, str, 14);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_LIST_EMPTY (&io->send_chunks);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (io->send_buf->len, 4);
+		TEST_LIST_NOT_EMPTY (&io->send_chunks);
+
+		chunk = (NihIoChunk *)io->send_chunks.next;
+		TEST_ALLOC_PARENT (chunk, io);
+		TEST_ALLOC_PARENT (str, chunk);
+		TEST_EQ_P (chunk->data, str);
+		TEST_EQ (chunk->len, 14);
+		TEST_EQ (chunk->room, 0);
+		TEST_EQ_P (chunk->entry.next, &io->send_chunks);
+
+		TEST_TRUE (io->watch->events & NIH_IO_WRITE);
+
+		nih_free (chunk);
+	}
+
+	assert0 (nih_io_write_ref (io, str, 14));
+
+
+	/* Check that data written after referenced data is copied into a
+	 * new chunk after it, rather than into the send buffer.
+	 */
+	TEST_FEATURE ("with copied data after");
+	TEST_ALLOC_FAIL {
+		ret = nih_io_write (io, " of the io code", 15);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (io->send_chunks.next->next,
+				   &io->send_chunks);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (io->send_buf->len, 4);
+
+		chunk = (NihIoChunk *)io->send_chunks.next->next;
+		TEST_ALLOC_PARENT (chunk, io);
+		TEST_EQ (chunk->len, 15);
+		TEST_EQ_MEM (chunk->data, " of the io code", 15);
+		TEST_EQ (chunk->room, BUFSIZ - 15);
+		TEST_EQ_P (chunk->entry.next, &io->send_chunks);
+
+		/* More data is copied into the same chunk */
+		TEST_ALLOC_SAFE {
+			assert0 (nih_io_write (io, "!", 1));
+		}
+
+		TEST_EQ_P (io->send_chunks.prev, &chunk->entry);
+		TEST_EQ (chunk->len, 16);
+		TEST_EQ_MEM (chunk->data, " of the io code!", 16);
+
+		nih_free (chunk);
+	}
+
+	nih_free (io);
+	nih_free (str);
+}
+
 void
 test_get (void)
 {
@@ -2778,6 +3947,59 @@ test_get (void)
 	nih_free (str);
 
 
+	/* Check that any of several delimiters ends the string, the first
+	 * found being used.
+	 */
+	TEST_FEATURE ("with several delimiters");
+	assert0 (nih_io_buffer_push (io->recv_buf, "key=value;next", 14));
+	str = nih_io_get (NULL, io, ";=");
+
+	TEST_ALLOC_SIZE (str, 4);
+	TEST_EQ_STR (str, "key");
+
+	TEST_EQ (io->recv_buf->len, 10);
+	TEST_EQ_MEM (io->recv_buf->buf, "value;next", 10);
+
+	nih_free (str);
+
+	str = nih_io_get (NULL, io, ";=");
+
+	TEST_ALLOC_SIZE (str, 6);
+	TEST_EQ_STR (str, "value");
+
+	TEST_EQ (io->recv_buf->len, 4);
+	TEST_EQ_MEM (io->recv_buf->buf, "next", 4);
+
+	nih_free (str);
+
+
+	/* Check that with no delimiters, only the NULL terminator ends the
+	 * string.
+	 */
+	TEST_FEATURE ("with no delimiters");
+	assert0 (nih_io_buffer_push (io->recv_buf, "\nline\0", 6));
+	str = nih_io_get (NULL, io, "");
+
+	TEST_ALLOC_SIZE (str, 10);
+	TEST_EQ_STR (str, "next\nline");
+
+	TEST_EQ (io->recv_buf->len, 0);
+
+	nih_free (str);
+
+
+	/* Check that an empty buffer returns NULL whatever the delimiters.
+	 */
+	TEST_FEATURE ("with empty buffer");
+	str = nih_io_get (NULL, io, "\n");
+
+	TEST_EQ_P (str, NULL);
+
+	str = nih_io_get (NULL, io, " \t");
+
+	TEST_EQ_P (str, NULL);
+
+
 	/* Check that if we empty the buffer of a shutdown socket, the
 	 * socket is closed and freed.
 	 */
@@ -3167,11 +4389,15 @@ main (int   argc,
 	test_add_watch ();
 	test_select_fds ();
 	test_handle_fds ();
+	test_epoll_wait ();
 	test_buffer_new ();
 	test_buffer_resize ();
 	test_buffer_pop ();
 	test_buffer_shrink ();
 	test_buffer_push ();
+	test_buffer_set_sliding ();
+	test_buffer_reserve ();
+	test_buffer_commit ();
 	test_message_new ();
 	test_message_add_control ();
 	test_message_recv ();
@@ -3182,8 +4408,11 @@ main (int   argc,
 	test_watcher ();
 	test_read_message ();
 	test_send_message ();
+	test_set_recv_batch ();
+	test_set_record_reader ();
 	test_read ();
 	test_write ();
+	test_write_ref ();
 	test_get ();
 	test_printf ();
 	test_set_nonblock ();
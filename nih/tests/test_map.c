@@ -0,0 +1,450 @@
+/* libnih
+ *
+ * test_map.c - test suite for nih/map.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/map.h>
+
+
+static uint32_t
+same_hash (const char *key)
+{
+	return 42;
+}
+
+static char **
+make_keys (const void *parent,
+	   int         count)
+{
+	char **keys;
+	int    i;
+
+	keys = NIH_MUST (nih_alloc (parent, sizeof (char *) * count));
+	for (i = 0; i < count; i++)
+		keys[i] = NIH_MUST (nih_sprintf (keys, "key %d", i));
+
+	return keys;
+}
+
+
+void
+test_new (void)
+{
+	NihMap *map;
+	size_t  i;
+
+	TEST_FUNCTION ("nih_map_new");
+
+	/* Check that we can create a small map; the smallest number of
+	 * slots should be allocated as a child of the map, all empty.
+	 */
+	TEST_FEATURE ("with zero size");
+	TEST_ALLOC_FAIL {
+		map = nih_map_new (NULL, 0,
+				   (NihHashFunction)nih_hash_string_hash,
+				   (NihCmpFunction)nih_hash_string_cmp);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (map, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (map, sizeof (NihMap));
+		TEST_EQ_P (map->hash_function,
+			   (NihHashFunction)nih_hash_string_hash);
+		TEST_EQ_P (map->cmp_function,
+			   (NihCmpFunction)nih_hash_string_cmp);
+
+		TEST_EQ (map->size, 8);
+		TEST_EQ (map->entries, 0);
+		TEST_EQ (map->empty, 8);
+		TEST_ALLOC_PARENT (map->slots, map);
+
+		for (i = 0; i < map->size; i++)
+			TEST_EQ (map->ctrl[i], 0x80);
+
+		nih_free (map);
+	}
+
+
+	/* Check that the number of slots is large enough to hold the
+	 * number of entries given without growing.
+	 */
+	TEST_FEATURE ("with larger size");
+	TEST_ALLOC_FAIL {
+		map = nih_map_string_new (NULL, 100);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (map, NULL);
+			continue;
+		}
+
+		TEST_EQ (map->size, 128);
+		TEST_EQ (map->empty, 128);
+
+		nih_free (map);
+	}
+}
+
+
+void
+test_set (void)
+{
+	NihMap *map;
+	char  **keys;
+	char    key[16];
+	int     ret, i;
+
+	TEST_FUNCTION ("nih_map_set");
+
+	/* Check that setting a key adds an entry to the map that can be
+	 * looked up again, and that setting it again replaces the value
+	 * and key without adding another entry.
+	 */
+	TEST_FEATURE ("with new and existing key");
+	map = nih_map_string_new (NULL, 0);
+
+	ret = nih_map_set (map, "foo", "bar");
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (map->entries, 1);
+	TEST_EQ_STR ((char *)nih_map_lookup (map, "foo"), "bar");
+
+	strcpy (key, "foo");
+	ret = nih_map_set (map, key, "baz");
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (map->entries, 1);
+	TEST_EQ_STR ((char *)nih_map_lookup (map, "foo"), "baz");
+
+	NIH_MAP_FOREACH (map, iter) {
+		TEST_EQ_P (iter->key, key);
+	}
+
+	nih_free (map);
+
+
+	/* Check that adding more entries than the map has room for causes
+	 * it to grow, and that when that fails the map is left unchanged
+	 * with all of the entries still found.
+	 */
+	TEST_FEATURE ("with map growing");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			map = nih_map_string_new (NULL, 0);
+			keys = make_keys (map, 8);
+
+			for (i = 0; i < 7; i++)
+				assert0 (nih_map_set (map, keys[i], keys[i]));
+		}
+
+		TEST_EQ (map->size, 8);
+
+		ret = nih_map_set (map, keys[7], keys[7]);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ (map->size, 8);
+			TEST_EQ (map->entries, 7);
+			TEST_EQ_P (nih_map_lookup (map, keys[7]), NULL);
+		} else {
+			TEST_EQ (ret, 0);
+			TEST_EQ (map->size, 16);
+			TEST_EQ (map->entries, 8);
+			TEST_ALLOC_PARENT (map->slots, map);
+			TEST_EQ_P (nih_map_lookup (map, keys[7]), keys[7]);
+		}
+
+		for (i = 0; i < 7; i++)
+			TEST_EQ_P (nih_map_lookup (map, keys[i]), keys[i]);
+
+		nih_free (map);
+	}
+
+
+	/* Check that when every key has the same hash, entries are placed
+	 * in following groups and can all be found and removed.
+	 */
+	TEST_FEATURE ("with same hash");
+	map = nih_map_new (NULL, 0, (NihHashFunction)same_hash,
+			   (NihCmpFunction)nih_hash_string_cmp);
+	keys = make_keys (map, 100);
+
+	for (i = 0; i < 100; i++)
+		TEST_EQ (nih_map_set (map, keys[i], keys[i]), 0);
+
+	TEST_EQ (map->entries, 100);
+
+	for (i = 0; i < 100; i++)
+		TEST_EQ_P (nih_map_lookup (map, keys[i]), keys[i]);
+
+	for (i = 0; i < 100; i += 2)
+		TEST_TRUE (nih_map_remove (map, keys[i]));
+
+	for (i = 0; i < 100; i++) {
+		if (i % 2) {
+			TEST_EQ_P (nih_map_lookup (map, keys[i]), keys[i]);
+		} else {
+			TEST_EQ_P (nih_map_lookup (map, keys[i]), NULL);
+		}
+	}
+
+	TEST_EQ (map->entries, 50);
+
+	nih_free (map);
+}
+
+
+void
+test_lookup (void)
+{
+	NihMap *map;
+	char  **keys;
+	int     i;
+
+	TEST_FUNCTION ("nih_map_lookup");
+	map = nih_map_string_new (NULL, 0);
+	keys = make_keys (map, 1000);
+
+	for (i = 0; i < 1000; i++)
+		TEST_EQ (nih_map_set (map, keys[i], keys[i]), 0);
+
+	/* Check that each entry is found by its key, even when given
+	 * a different pointer to the same string.
+	 */
+	TEST_FEATURE ("with key in map");
+	for (i = 0; i < 1000; i++) {
+		char key[16];
+
+		sprintf (key, "key %d", i);
+		TEST_EQ_P (nih_map_lookup (map, key), keys[i]);
+	}
+
+
+	/* Check that NULL is returned for a key not in the map. */
+	TEST_FEATURE ("with key not in map");
+	TEST_EQ_P (nih_map_lookup (map, "key 1000"), NULL);
+	TEST_EQ_P (nih_map_lookup (map, "key"), NULL);
+
+	nih_free (map);
+}
+
+
+void
+test_remove (void)
+{
+	NihMap *map;
+	int     i;
+
+	TEST_FUNCTION ("nih_map_remove");
+
+	/* Check that removing an entry means it's no longer found, and
+	 * that TRUE is returned.
+	 */
+	TEST_FEATURE ("with key in map");
+	map = nih_map_string_new (NULL, 0);
+	TEST_EQ (nih_map_set (map, "foo", "bar"), 0);
+	TEST_EQ (nih_map_set (map, "baz", "frodo"), 0);
+
+	TEST_TRUE (nih_map_remove (map, "foo"));
+
+	TEST_EQ (map->entries, 1);
+	TEST_EQ_P (nih_map_lookup (map, "foo"), NULL);
+	TEST_EQ_STR ((char *)nih_map_lookup (map, "baz"), "frodo");
+
+
+	/* Check that FALSE is returned for a key not in the map. */
+	TEST_FEATURE ("with key not in map");
+	TEST_FALSE (nih_map_remove (map, "foo"));
+
+	TEST_EQ (map->entries, 1);
+
+	nih_free (map);
+
+
+	/* Check that a map with entries repeatedly added and removed, but
+	 * never many at once, does not grow.
+	 */
+	TEST_FEATURE ("with entries added and removed");
+	map = nih_map_int_new (NULL, 0);
+
+	for (i = 0; i < 10000; i++) {
+		TEST_EQ (nih_map_set (map, NIH_MAP_INT_KEY (i), map), 0);
+		TEST_EQ_P (nih_map_lookup (map, NIH_MAP_INT_KEY (i)), map);
+
+		if (i >= 4)
+			TEST_TRUE (nih_map_remove (map, NIH_MAP_INT_KEY (i - 4)));
+	}
+
+	TEST_EQ (map->entries, 4);
+	TEST_EQ (map->size, 8);
+
+	for (i = 10000 - 4; i < 10000; i++)
+		TEST_EQ_P (nih_map_lookup (map, NIH_MAP_INT_KEY (i)), map);
+
+	nih_free (map);
+}
+
+
+void
+test_int (void)
+{
+	NihMap *map;
+	int     i;
+
+	/* Check that a map with integer keys can hold many entries, each
+	 * found by its key.
+	 */
+	TEST_FUNCTION ("nih_map_int_new");
+	map = nih_map_int_new (NULL, 0);
+
+	for (i = 0; i < 10000; i++)
+		TEST_EQ (nih_map_set (map, NIH_MAP_INT_KEY (i * 8),
+				      (void *)(uintptr_t)(i + 1)), 0);
+
+	TEST_EQ (map->entries, 10000);
+
+	for (i = 0; i < 10000; i++) {
+		TEST_EQ_P (nih_map_lookup (map, NIH_MAP_INT_KEY (i * 8)),
+			   (void *)(uintptr_t)(i + 1));
+		TEST_EQ_P (nih_map_lookup (map, NIH_MAP_INT_KEY (i * 8 + 1)),
+			   NULL);
+	}
+
+	nih_free (map);
+}
+
+
+void
+test_foreach (void)
+{
+	NihMap *map;
+	char  **keys;
+	int     seen[100];
+	int     i;
+
+	/* Check that NIH_MAP_FOREACH visits each entry in the map exactly
+	 * once.
+	 */
+	TEST_FUNCTION ("NIH_MAP_FOREACH");
+	map = nih_map_string_new (NULL, 0);
+	keys = make_keys (map, 100);
+
+	for (i = 0; i < 100; i++) {
+		TEST_EQ (nih_map_set (map, keys[i], &seen[i]), 0);
+		seen[i] = 0;
+	}
+
+	NIH_MAP_FOREACH (map, iter) {
+		(*(int *)iter->value)++;
+	}
+
+	for (i = 0; i < 100; i++)
+		TEST_EQ (seen[i], 1);
+
+	nih_free (map);
+}
+
+void
+test_foreach_safe (void)
+{
+	NihMap *map;
+	char  **keys;
+	int     count, i;
+
+	TEST_FUNCTION ("NIH_MAP_FOREACH_SAFE");
+
+	/* Check that NIH_MAP_FOREACH_SAFE visits each entry in the map,
+	 * and that it's safe to remove the entries while doing so.
+	 */
+	TEST_FEATURE ("with entries removed");
+	map = nih_map_string_new (NULL, 0);
+	keys = make_keys (map, 100);
+
+	for (i = 0; i < 100; i++)
+		TEST_EQ (nih_map_set (map, keys[i], keys[i]), 0);
+
+	count = 0;
+	NIH_MAP_FOREACH_SAFE (map, iter) {
+		TEST_EQ_P (iter->key, iter->value);
+		TEST_TRUE (nih_map_remove (map, iter->key));
+		count++;
+	}
+
+	TEST_EQ (count, 100);
+	TEST_EQ (map->entries, 0);
+	TEST_EQ (map->iterating, 0);
+	TEST_EQ_P (_nih_map_next (map, NULL), NULL);
+
+	nih_free (map);
+
+
+	/* Check that entries may be added while iterating, without the
+	 * map growing until the loop exits.
+	 */
+	TEST_FEATURE ("with entries added");
+	map = nih_map_string_new (NULL, 0);
+	keys = make_keys (map, 8);
+
+	for (i = 0; i < 4; i++)
+		TEST_EQ (nih_map_set (map, keys[i], keys[i]), 0);
+
+	i = 4;
+	NIH_MAP_FOREACH_SAFE (map, iter) {
+		if (i < 7)
+			TEST_EQ (nih_map_set (map, keys[i], keys[i]), 0);
+		i++;
+	}
+
+	TEST_EQ (map->entries, 7);
+	TEST_EQ (map->size, 8);
+	TEST_EQ (map->iterating, 0);
+
+	TEST_EQ (nih_map_set (map, keys[7], keys[7]), 0);
+	TEST_EQ (map->size, 16);
+
+	for (i = 0; i < 8; i++)
+		TEST_EQ_P (nih_map_lookup (map, keys[i]), keys[i]);
+
+	nih_free (map);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_new ();
+	test_set ();
+	test_lookup ();
+	test_remove ();
+	test_int ();
+	test_foreach ();
+	test_foreach_safe ();
+
+	return 0;
+}
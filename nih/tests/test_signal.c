@@ -25,10 +25,19 @@
 #include <valgrind/valgrind.h>
 #endif /* HAVE_VALGRIND_VALGRIND_H */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
+#include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/io.h>
 #include <nih/signal.h>
 
 
@@ -191,12 +200,15 @@ static int handler_called = 0;
 static void *last_data;
 static NihSignal *last_signal;
 
+static NihSignalInfo last_info;
+
 static void
 my_handler (void *data, NihSignal *signal)
 {
 	handler_called++;
 	last_data = data;
 	last_signal = signal;
+	last_info = signal->info;
 }
 
 void
@@ -296,6 +308,143 @@ test_poll (void)
 }
 
 
+static int
+count_fds (void)
+{
+	DIR           *dir;
+	struct dirent *ent;
+	int            count = 0;
+
+	dir = opendir ("/proc/self/fd");
+	assert (dir != NULL);
+
+	while ((ent = readdir (dir)) != NULL)
+		if (ent->d_name[0] != '.')
+			count++;
+
+	closedir (dir);
+
+	return count;
+}
+
+void
+test_init_fd (void)
+{
+	NihSignal *signal1, *signal2;
+	sigset_t   mask;
+	pid_t      pid;
+	int        ret, fds, status;
+
+	TEST_FUNCTION ("nih_signal_init_fd");
+	ret = nih_signal_init_fd ();
+
+	TEST_EQ (ret, 0);
+
+	signal1 = nih_signal_add_handler (NULL, SIGUSR1, my_handler, &signal1);
+	signal2 = nih_signal_add_handler (NULL, SIGUSR2, my_handler, &signal2);
+
+
+	/* Check that setting a signal to nih_signal_handler() blocks it
+	 * so that it may be read from the signalfd instead.
+	 */
+	TEST_FEATURE ("with signal set to handler");
+	ret = nih_signal_set_handler (SIGUSR1, nih_signal_handler);
+
+	TEST_EQ (ret, 0);
+
+	assert0 (sigprocmask (SIG_BLOCK, NULL, &mask));
+	TEST_TRUE (sigismember (&mask, SIGUSR1));
+
+	ret = nih_signal_set_handler (SIGUSR2, nih_signal_handler);
+
+	TEST_EQ (ret, 0);
+
+
+	/* Check that a signal read from the signalfd results in only
+	 * the callback for that signal being run, with the details of
+	 * the sender, and that nih_signal_poll() does not run it again.
+	 */
+	TEST_FEATURE ("with one signal");
+	handler_called = 0;
+	last_data = NULL;
+	last_signal = NULL;
+	memset (&last_info, 0, sizeof (last_info));
+
+	kill (getpid (), SIGUSR1);
+	nih_io_epoll_wait (1000);
+	nih_signal_poll ();
+
+	TEST_EQ (handler_called, 1);
+	TEST_EQ_P (last_signal, signal1);
+	TEST_EQ_P (last_data, &signal1);
+	TEST_EQ (last_info.signum, SIGUSR1);
+	TEST_EQ (last_info.code, SI_USER);
+	TEST_EQ (last_info.pid, getpid ());
+	TEST_EQ (last_info.uid, getuid ());
+
+
+	/* Check that multiple signals are read in one go. */
+	TEST_FEATURE ("with multiple signals");
+	handler_called = 0;
+
+	kill (getpid (), SIGUSR1);
+	kill (getpid (), SIGUSR2);
+	nih_io_epoll_wait (1000);
+
+	TEST_EQ (handler_called, 2);
+
+
+	/* Check that setting the signal back to its default unblocks it
+	 * again.
+	 */
+	TEST_FEATURE ("with signal set to default");
+	ret = nih_signal_set_default (SIGUSR1);
+
+	TEST_EQ (ret, 0);
+
+	assert0 (sigprocmask (SIG_BLOCK, NULL, &mask));
+	TEST_FALSE (sigismember (&mask, SIGUSR1));
+	TEST_TRUE (sigismember (&mask, SIGUSR2));
+
+
+	/* Check that resetting signals in a child process unblocks them
+	 * and closes the inherited signalfd without creating anything in
+	 * its place, and that the parent can still read from its own.
+	 */
+	TEST_FEATURE ("with reset in child process");
+	TEST_CHILD (pid) {
+		fds = count_fds ();
+
+		nih_signal_reset ();
+
+		assert0 (sigprocmask (SIG_BLOCK, NULL, &mask));
+		TEST_FALSE (sigismember (&mask, SIGUSR2));
+		TEST_EQ (count_fds (), fds - 1);
+
+		exit (0);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+	handler_called = 0;
+
+	kill (getpid (), SIGUSR2);
+	nih_io_epoll_wait (1000);
+
+	TEST_EQ (handler_called, 1);
+
+	nih_signal_reset ();
+
+	assert0 (sigprocmask (SIG_BLOCK, NULL, &mask));
+	TEST_FALSE (sigismember (&mask, SIGUSR2));
+
+	nih_free (signal1);
+	nih_free (signal2);
+}
+
+
 void
 test_to_name (void)
 {
@@ -384,6 +533,7 @@ main (int   argc,
 	test_reset ();
 	test_add_handler ();
 	test_poll ();
+	test_init_fd ();
 	test_to_name ();
 	test_from_name ();
 
@@ -25,7 +25,9 @@
 #include <string.h>
 
 #include <nih/macros.h>
+#include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/io.h>
 #include <nih/timer.h>
 
 
@@ -66,8 +68,8 @@ test_add_timeout (void)
 		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
 		TEST_LIST_NOT_EMPTY (&timer->entry);
 		TEST_EQ (timer->type, NIH_TIMER_TIMEOUT);
-		TEST_GE (timer->due, t1.tv_sec + 10);
-		TEST_LE (timer->due, t2.tv_sec + 10);
+		TEST_GE (timer->due.tv_sec, t1.tv_sec + 10);
+		TEST_LE (timer->due.tv_sec, t2.tv_sec + 10);
 		TEST_EQ (timer->timeout, 10);
 		TEST_EQ_P (timer->callback, my_callback);
 		TEST_EQ_P (timer->data, &timer);
@@ -79,6 +81,83 @@ test_add_timeout (void)
 	}
 }
 
+void
+test_add_timeout_ms (void)
+{
+	NihTimer *      timer;
+	struct timespec t1;
+	struct timespec t2;
+
+	/* Check that we can add a timeout function in milliseconds, and
+	 * that the due time is set including the nanoseconds part.
+	 */
+	TEST_FUNCTION ("nih_timer_add_timeout_ms");
+	nih_timer_poll ();
+	TEST_ALLOC_FAIL {
+		assert0 (clock_gettime (CLOCK_MONOTONIC, &t1));
+		timer = nih_timer_add_timeout_ms (NULL, 2500,
+						  my_callback, &timer);
+		assert0 (clock_gettime (CLOCK_MONOTONIC, &t2));
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (timer, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
+		TEST_LIST_NOT_EMPTY (&timer->entry);
+		TEST_EQ (timer->type, NIH_TIMER_TIMEOUT);
+		TEST_EQ (timer->timeout, 2);
+		TEST_EQ (timer->timeout_nsec, 500000000);
+		TEST_GE ((timer->due.tv_sec - t1.tv_sec) * 1000000000LL
+			 + timer->due.tv_nsec - t1.tv_nsec, 2500000000LL);
+		TEST_LE ((timer->due.tv_sec - t2.tv_sec) * 1000000000LL
+			 + timer->due.tv_nsec - t2.tv_nsec, 2500000000LL);
+		TEST_GE (timer->due.tv_nsec, 0);
+		TEST_LT (timer->due.tv_nsec, 1000000000);
+		TEST_EQ_P (timer->callback, my_callback);
+		TEST_EQ_P (timer->data, &timer);
+
+		/* Check that the timer is the next one due. */
+		TEST_EQ_P (nih_timer_next_due (), timer);
+
+		nih_free (timer);
+	}
+}
+
+void
+test_add_timeout_ns (void)
+{
+	NihTimer *timer;
+
+	/* Check that we can add a timeout function in nanoseconds, and
+	 * that the timeout is split into seconds and nanoseconds.
+	 */
+	TEST_FUNCTION ("nih_timer_add_timeout_ns");
+	nih_timer_poll ();
+	TEST_ALLOC_FAIL {
+		timer = nih_timer_add_timeout_ns (NULL, 3000000050ULL,
+						  my_callback, &timer);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (timer, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
+		TEST_LIST_NOT_EMPTY (&timer->entry);
+		TEST_EQ (timer->type, NIH_TIMER_TIMEOUT);
+		TEST_EQ (timer->timeout, 3);
+		TEST_EQ (timer->timeout_nsec, 50);
+		TEST_EQ_P (timer->callback, my_callback);
+		TEST_EQ_P (timer->data, &timer);
+
+		TEST_EQ_P (nih_timer_next_due (), timer);
+
+		nih_free (timer);
+	}
+}
+
 void
 test_add_periodic (void)
 {
@@ -104,8 +183,8 @@ test_add_periodic (void)
 		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
 		TEST_LIST_NOT_EMPTY (&timer->entry);
 		TEST_EQ (timer->type, NIH_TIMER_PERIODIC);
-		TEST_GE (timer->due, t1.tv_sec + 25);
-		TEST_LE (timer->due, t2.tv_sec + 25);
+		TEST_GE (timer->due.tv_sec, t1.tv_sec + 25);
+		TEST_LE (timer->due.tv_sec, t2.tv_sec + 25);
 		TEST_EQ (timer->timeout, 25);
 		TEST_EQ_P (timer->callback, my_callback);
 		TEST_EQ_P (timer->data, &timer);
@@ -117,6 +196,67 @@ test_add_periodic (void)
 	}
 }
 
+void
+test_add_periodic_ms (void)
+{
+	NihTimer *timer;
+
+	/* Check that we can add a periodic function in milliseconds,
+	 * and that the period is split into seconds and nanoseconds.
+	 */
+	TEST_FUNCTION ("nih_timer_add_periodic_ms");
+	nih_timer_poll ();
+	TEST_ALLOC_FAIL {
+		timer = nih_timer_add_periodic_ms (NULL, 50,
+						   my_callback, &timer);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (timer, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
+		TEST_LIST_NOT_EMPTY (&timer->entry);
+		TEST_EQ (timer->type, NIH_TIMER_PERIODIC);
+		TEST_EQ (timer->period, 0);
+		TEST_EQ (timer->period_nsec, 50000000);
+		TEST_EQ_P (timer->callback, my_callback);
+		TEST_EQ_P (timer->data, &timer);
+
+		TEST_EQ_P (nih_timer_next_due (), timer);
+
+		nih_free (timer);
+	}
+}
+
+void
+test_add_periodic_ns (void)
+{
+	NihTimer *timer;
+
+	/* Check that we can add a periodic function in nanoseconds. */
+	TEST_FUNCTION ("nih_timer_add_periodic_ns");
+	nih_timer_poll ();
+	TEST_ALLOC_FAIL {
+		timer = nih_timer_add_periodic_ns (NULL, 1000001000ULL,
+						   my_callback, &timer);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (timer, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (timer, sizeof (NihTimer));
+		TEST_EQ (timer->type, NIH_TIMER_PERIODIC);
+		TEST_EQ (timer->period, 1);
+		TEST_EQ (timer->period_nsec, 1000);
+
+		TEST_EQ_P (nih_timer_next_due (), timer);
+
+		nih_free (timer);
+	}
+}
+
 void
 test_add_scheduled (void)
 {
@@ -166,7 +306,9 @@ test_add_scheduled (void)
 void
 test_next_due (void)
 {
-	NihTimer *timer1, *timer2, *timer3;
+	NihTimer *timer1, *timer2, *timer3, *last;
+	NihTimer *timers[500];
+	int       i;
 
 	/* Check that timers become due in the correct order by scheduling
 	 * three in a random order, and then iterating through until there
@@ -187,6 +329,100 @@ test_next_due (void)
 	nih_free (timer3);
 
 	TEST_EQ_P (nih_timer_next_due (), NULL);
+
+
+	/* Check that timers due within the same second are ordered by
+	 * their sub-second due time.
+	 */
+	TEST_FEATURE ("with sub-second timers");
+	timer1 = nih_timer_add_timeout_ms (NULL, 300, my_callback, &timer1);
+	timer2 = nih_timer_add_timeout_ms (NULL, 100, my_callback, &timer2);
+	timer3 = nih_timer_add_timeout_ms (NULL, 200, my_callback, &timer3);
+
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+	nih_free (timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer3);
+	nih_free (timer3);
+
+	TEST_EQ_P (nih_timer_next_due (), timer1);
+	nih_free (timer1);
+
+	TEST_EQ_P (nih_timer_next_due (), NULL);
+
+
+	/* Check that a timer removed from the list is skipped, and that
+	 * a large number of timers freed in an arbitrary order always
+	 * leaves the earliest timer as the next due.
+	 */
+	TEST_FEATURE ("with many timers");
+	for (i = 0; i < 500; i++)
+		timers[i] = nih_timer_add_timeout_ms (
+			NULL, 1000 + (i * 7919) % 500, my_callback, NULL);
+
+	nih_list_remove (&timers[499]->entry);
+
+	for (i = 0; i < 500; i += 2)
+		nih_free (timers[i]);
+
+	last = NULL;
+	while ((timer1 = nih_timer_next_due ()) != NULL) {
+		TEST_NE_P (timer1, timers[499]);
+
+		if (last)
+			TEST_TRUE ((last->due.tv_sec < timer1->due.tv_sec)
+				   || ((last->due.tv_sec == timer1->due.tv_sec)
+				       && (last->due.tv_nsec
+					   <= timer1->due.tv_nsec)));
+
+		nih_list_remove (&timer1->entry);
+		last = timer1;
+	}
+
+	for (i = 1; i < 500; i += 2)
+		nih_free (timers[i]);
+}
+
+
+void
+test_update (void)
+{
+	NihTimer *timer1, *timer2;
+
+	/* Check that changing the due time of a timer and calling
+	 * nih_timer_update() reorders it in the queue.
+	 */
+	TEST_FUNCTION ("nih_timer_update");
+	TEST_FEATURE ("with changed due time");
+	timer1 = nih_timer_add_timeout (NULL, 10, my_callback, &timer1);
+	timer2 = nih_timer_add_timeout (NULL, 20, my_callback, &timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer1);
+
+	timer2->due.tv_sec = timer1->due.tv_sec - 1;
+	nih_timer_update (timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+
+
+	/* Check that a timer removed from the list and placed back into
+	 * it is queued again once updated.
+	 */
+	TEST_FEATURE ("with timer placed back in list");
+	nih_list_remove (&timer2->entry);
+	nih_timer_update (timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer1);
+
+	nih_list_add (nih_timers, &timer2->entry);
+	nih_timer_update (timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+
+	nih_free (timer1);
+	nih_free (timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), NULL);
 }
 
 
@@ -215,7 +451,7 @@ test_poll (void)
 	last_timer = NULL;
 
 	assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
-	timer1->due = now.tv_sec - 5;
+	timer1->due.tv_sec = now.tv_sec - 5;
 	nih_timer_poll ();
 
 	TEST_EQ (callback_called, 1);
@@ -234,7 +470,7 @@ test_poll (void)
 	last_timer = NULL;
 
 	assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
-	timer2->due = now.tv_sec - 5;
+	timer2->due.tv_sec = now.tv_sec - 5;
 
 	assert0 (clock_gettime (CLOCK_MONOTONIC, &t1));
 	nih_timer_poll ();
@@ -244,11 +480,184 @@ test_poll (void)
 	TEST_EQ_P (last_timer, timer2);
 	TEST_EQ_P (last_data, &timer2);
 	TEST_NOT_FREE (timer2);
-	TEST_GE (timer2->due, t1.tv_sec + 20);
-	TEST_LE (timer2->due, t2.tv_sec + 20);
+	TEST_GE (timer2->due.tv_sec, t1.tv_sec + 20);
+	TEST_LE (timer2->due.tv_sec, t2.tv_sec + 20);
+
+
+	/* Check that a periodic timer is only triggered once in each poll,
+	 * even if its period has already passed by the time it is placed
+	 * back in the queue.
+	 */
+	TEST_FEATURE ("with short periodic timer");
+	nih_free (timer2);
+
+	timer2 = nih_timer_add_periodic_ns (NULL, 1, my_callback, &timer2);
+
+	callback_called = 0;
+
+	assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
+	timer2->due.tv_sec = now.tv_sec - 5;
+	nih_timer_update (timer2);
+
+	nih_timer_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+
+	nih_free (timer2);
+}
+
+void
+test_set_clock (void)
+{
+	NihTimer *      timer1, *timer2;
+	struct timespec now;
+	int             ret;
+
+	/* Check that a timer uses the monotonic clock unless changed. */
+	TEST_FUNCTION ("nih_timer_set_clock");
+	TEST_FEATURE ("with default clock");
+	timer1 = nih_timer_add_timeout (NULL, 10, my_callback, &timer1);
+
+	TEST_EQ (timer1->clock, CLOCK_MONOTONIC);
+
+
+	/* Check that changing the clock of a timer keeps the time
+	 * remaining until it is due, measured against the new clock.
+	 */
+	TEST_FEATURE ("with realtime clock");
+	ret = nih_timer_set_clock (timer1, CLOCK_REALTIME);
+	assert0 (clock_gettime (CLOCK_REALTIME, &now));
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (timer1->clock, CLOCK_REALTIME);
+	TEST_GE (timer1->due.tv_sec, now.tv_sec + 9);
+	TEST_LE (timer1->due.tv_sec, now.tv_sec + 10);
+
+	TEST_EQ_P (nih_timer_next_due (), timer1);
+
+
+	/* Check that timers using different clocks are compared by the
+	 * time remaining until they are due.
+	 */
+	TEST_FEATURE ("with timers using different clocks");
+	timer2 = nih_timer_add_timeout (NULL, 5, my_callback, &timer2);
+	ret = nih_timer_set_clock (timer2, CLOCK_BOOTTIME);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (timer2->clock, CLOCK_BOOTTIME);
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+
+	ret = nih_timer_set_clock (timer1, CLOCK_MONOTONIC);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ_P (nih_timer_next_due (), timer2);
+
+
+	/* Check that a timer due now using another clock is triggered
+	 * by nih_timer_poll().
+	 */
+	TEST_FEATURE ("with timer due using another clock");
+	timer2->due.tv_sec = 0;
+	timer2->due.tv_nsec = 0;
+	nih_timer_update (timer2);
+
+	callback_called = 0;
+	last_data = NULL;
+	nih_timer_poll ();
+
+	TEST_EQ (callback_called, 1);
+	TEST_EQ_P (last_data, &timer2);
+
+	TEST_EQ_P (nih_timer_next_due (), timer1);
+
+	nih_free (timer1);
+
+	TEST_EQ_P (nih_timer_next_due (), NULL);
+}
+
+void
+test_next_timeout (void)
+{
+	NihTimer *      timer1, *timer2;
+	struct timespec timeout;
+	int             ret;
+
+	/* Check that there is no timeout when there are no timers. */
+	TEST_FUNCTION ("nih_timer_next_timeout");
+	TEST_FEATURE ("with no timers");
+	ret = nih_timer_next_timeout (&timeout);
+
+	TEST_FALSE (ret);
+
 
+	/* Check that the timeout is the time remaining until the next
+	 * timer is due.
+	 */
+	TEST_FEATURE ("with timers");
+	timer1 = nih_timer_add_timeout (NULL, 10, my_callback, &timer1);
+	timer2 = nih_timer_add_timeout_ms (NULL, 2500, my_callback, &timer2);
+
+	ret = nih_timer_next_timeout (&timeout);
+
+	TEST_TRUE (ret);
+	TEST_EQ (timeout.tv_sec, 2);
+	TEST_GE (timeout.tv_nsec, 0);
+	TEST_LT (timeout.tv_nsec, 500000000);
 
 	nih_free (timer2);
+
+
+	/* Check that the timeout is zero when a timer is overdue. */
+	TEST_FEATURE ("with overdue timer");
+	timer1->due.tv_sec = 0;
+	timer1->due.tv_nsec = 0;
+	nih_timer_update (timer1);
+
+	ret = nih_timer_next_timeout (&timeout);
+
+	TEST_TRUE (ret);
+	TEST_EQ (timeout.tv_sec, 0);
+	TEST_EQ (timeout.tv_nsec, 0);
+
+	nih_free (timer1);
+}
+
+void
+test_init_fd (void)
+{
+	NihTimer *      timer;
+	struct timespec timeout;
+	int             ret;
+
+	/* Check that once timers are triggered by a timerfd, a watch
+	 * is added for it and the main loop need not sleep for a timeout.
+	 */
+	TEST_FUNCTION ("nih_timer_init_fd");
+	nih_io_init ();
+	nih_timer_init_fd ();
+
+	TEST_FEATURE ("with timer added");
+	timer = nih_timer_add_timeout_ms (NULL, 10, my_callback, &timer);
+
+	TEST_LIST_NOT_EMPTY (nih_io_watches);
+
+	ret = nih_timer_next_timeout (&timeout);
+
+	TEST_FALSE (ret);
+
+
+	/* Check that the timer is triggered once the timerfd expires. */
+	TEST_FEATURE ("with timer due");
+	callback_called = 0;
+	last_data = NULL;
+
+	nih_io_epoll_wait (1000);
+
+	TEST_EQ (callback_called, 1);
+	TEST_EQ_P (last_data, &timer);
+
+	TEST_EQ_P (nih_timer_next_due (), NULL);
 }
 
 
@@ -257,10 +666,18 @@ main (int   argc,
       char *argv[])
 {
 	test_add_timeout ();
+	test_add_timeout_ms ();
+	test_add_timeout_ns ();
 	test_add_periodic ();
+	test_add_periodic_ms ();
+	test_add_periodic_ns ();
 	test_add_scheduled ();
+	test_update ();
+	test_set_clock ();
 	test_next_due ();
+	test_next_timeout ();
 	test_poll ();
+	test_init_fd ();
 
 	return 0;
 }
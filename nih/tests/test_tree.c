@@ -2201,6 +2201,767 @@ test_prev_post_full (void)
 }
 
 
+typedef struct visit_record {
+	NihTree *nodes[12];
+	int      len;
+	int      stop;
+} VisitRecord;
+
+static int
+my_visitor (VisitRecord *record,
+	    NihTree     *node)
+{
+	if (record->len == record->stop)
+		return -1;
+
+	record->nodes[record->len++] = node;
+
+	return 0;
+}
+
+static void
+visit_tree (NihTree *node[12])
+{
+	int i;
+
+	for (i = 0; i < 12; i++)
+		node[i] = nih_tree_new (NULL);
+
+	nih_tree_add (node['a' - 97], node['b' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['a' - 97], node['c' - 97], NIH_TREE_RIGHT);
+	nih_tree_add (node['b' - 97], node['d' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['c' - 97], node['e' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['c' - 97], node['f' - 97], NIH_TREE_RIGHT);
+	nih_tree_add (node['d' - 97], node['g' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['e' - 97], node['h' - 97], NIH_TREE_RIGHT);
+	nih_tree_add (node['f' - 97], node['i' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['f' - 97], node['j' - 97], NIH_TREE_RIGHT);
+	nih_tree_add (node['g' - 97], node['k' - 97], NIH_TREE_LEFT);
+	nih_tree_add (node['h' - 97], node['l' - 97], NIH_TREE_LEFT);
+}
+
+void
+test_visit (void)
+{
+	NihTree     *node[12], *expect[12];
+	VisitRecord  record;
+	int          i, len, ret;
+
+	TEST_FUNCTION ("nih_tree_visit");
+	visit_tree (node);
+
+	/* Check that every node of the tree is visited once, in the same
+	 * order that NIH_TREE_FOREACH iterates them.
+	 */
+	TEST_FEATURE ("with full tree");
+	len = 0;
+	NIH_TREE_FOREACH (node['a' - 97], iter)
+		expect[len++] = iter;
+
+	record.len = 0;
+	record.stop = -1;
+
+	ret = nih_tree_visit (node['a' - 97], (NihTreeVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.len, 12);
+	for (i = 0; i < len; i++)
+		TEST_EQ_P (record.nodes[i], expect[i]);
+
+
+	/* Check that only the nodes below the one given are visited when
+	 * it is part of a larger tree.
+	 */
+	TEST_FEATURE ("with partial tree");
+	len = 0;
+	NIH_TREE_FOREACH (node['c' - 97], iter)
+		expect[len++] = iter;
+
+	record.len = 0;
+	record.stop = -1;
+
+	ret = nih_tree_visit (node['c' - 97], (NihTreeVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.len, 7);
+	for (i = 0; i < len; i++)
+		TEST_EQ_P (record.nodes[i], expect[i]);
+
+
+	/* Check that the walk stops when the visitor returns a negative
+	 * value, and that value is returned.
+	 */
+	TEST_FEATURE ("with visitor stopping walk");
+	record.len = 0;
+	record.stop = 3;
+
+	ret = nih_tree_visit (node['a' - 97], (NihTreeVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, -1);
+	TEST_EQ (record.len, 3);
+
+
+	/* Check that a NULL tree has nothing to visit. */
+	TEST_FEATURE ("with empty tree");
+	record.len = 0;
+	record.stop = -1;
+
+	ret = nih_tree_visit (NULL, (NihTreeVisitor)my_visitor, &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.len, 0);
+
+	for (i = 0; i < 12; i++)
+		nih_free (node[i]);
+}
+
+void
+test_visit_pre (void)
+{
+	NihTree     *node[12], *expect[12];
+	VisitRecord  record;
+	int          i, len, ret;
+
+	/* Check that every node of the tree is visited once, in the same
+	 * order that NIH_TREE_FOREACH_PRE iterates them.
+	 */
+	TEST_FUNCTION ("nih_tree_visit_pre");
+	visit_tree (node);
+
+	len = 0;
+	NIH_TREE_FOREACH_PRE (node['a' - 97], iter)
+		expect[len++] = iter;
+
+	record.len = 0;
+	record.stop = -1;
+
+	ret = nih_tree_visit_pre (node['a' - 97], (NihTreeVisitor)my_visitor,
+				  &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.len, 12);
+	for (i = 0; i < len; i++)
+		TEST_EQ_P (record.nodes[i], expect[i]);
+
+	for (i = 0; i < 12; i++)
+		nih_free (node[i]);
+}
+
+void
+test_visit_post (void)
+{
+	NihTree     *node[12], *expect[12];
+	VisitRecord  record;
+	int          i, len, ret;
+
+	/* Check that every node of the tree is visited once, in the same
+	 * order that NIH_TREE_FOREACH_POST iterates them.
+	 */
+	TEST_FUNCTION ("nih_tree_visit_post");
+	visit_tree (node);
+
+	len = 0;
+	NIH_TREE_FOREACH_POST (node['a' - 97], iter)
+		expect[len++] = iter;
+
+	record.len = 0;
+	record.stop = -1;
+
+	ret = nih_tree_visit_post (node['a' - 97], (NihTreeVisitor)my_visitor,
+				   &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.len, 12);
+	for (i = 0; i < len; i++)
+		TEST_EQ_P (record.nodes[i], expect[i]);
+
+	for (i = 0; i < 12; i++)
+		nih_free (node[i]);
+}
+
+void
+test_partition (void)
+{
+	NihTree     *node[12], *subtrees[4], *nodes[3];
+	VisitRecord  record;
+	size_t       len, nnodes, i;
+
+	TEST_FUNCTION ("nih_tree_partition");
+	visit_tree (node);
+
+	/* Check that the tree is divided a level at a time, replacing each
+	 * root with two children by them, and that the subtrees and the
+	 * nodes replaced together hold every node of the tree once.
+	 */
+	TEST_FEATURE ("with full tree");
+	len = nih_tree_partition (node['a' - 97], 4, subtrees,
+				  nodes, &nnodes);
+
+	TEST_EQ (len, 4);
+	TEST_EQ (nnodes, 3);
+	TEST_EQ_P (nodes[0], node['a' - 97]);
+	TEST_EQ_P (nodes[1], node['c' - 97]);
+	TEST_EQ_P (nodes[2], node['f' - 97]);
+	TEST_EQ_P (subtrees[0], node['b' - 97]);
+	TEST_EQ_P (subtrees[1], node['e' - 97]);
+	TEST_EQ_P (subtrees[2], node['i' - 97]);
+	TEST_EQ_P (subtrees[3], node['j' - 97]);
+
+	record.len = 0;
+	record.stop = -1;
+
+	for (i = 0; i < len; i++)
+		TEST_EQ (nih_tree_visit (subtrees[i],
+					 (NihTreeVisitor)my_visitor,
+					 &record), 0);
+
+	TEST_EQ (record.len + nnodes, 12);
+
+
+	/* Check that the tree is not divided further than there are roots
+	 * with two children.
+	 */
+	TEST_FEATURE ("with more subtrees than possible");
+	len = nih_tree_partition (node['b' - 97], 4, subtrees,
+				  nodes, &nnodes);
+
+	TEST_EQ (len, 1);
+	TEST_EQ (nnodes, 0);
+	TEST_EQ_P (subtrees[0], node['b' - 97]);
+
+
+	/* Check that asking for a single subtree returns the whole tree. */
+	TEST_FEATURE ("with single subtree");
+	len = nih_tree_partition (node['a' - 97], 1, subtrees,
+				  NULL, &nnodes);
+
+	TEST_EQ (len, 1);
+	TEST_EQ (nnodes, 0);
+	TEST_EQ_P (subtrees[0], node['a' - 97]);
+
+
+	/* Check that a NULL tree has no subtrees. */
+	TEST_FEATURE ("with empty tree");
+	len = nih_tree_partition (NULL, 4, subtrees, nodes, &nnodes);
+
+	TEST_EQ (len, 0);
+	TEST_EQ (nnodes, 0);
+
+	for (i = 0; i < 12; i++)
+		nih_free (node[i]);
+}
+
+void
+test_free_all (void)
+{
+	NihTree *node[12];
+	int      i;
+
+	TEST_FUNCTION ("nih_tree_free_all");
+
+	/* Check that freeing a whole tree frees every node in it. */
+	TEST_FEATURE ("with full tree");
+	visit_tree (node);
+
+	for (i = 0; i < 12; i++)
+		TEST_FREE_TAG (node[i]);
+
+	nih_tree_free_all (node['a' - 97]);
+
+	for (i = 0; i < 12; i++)
+		TEST_FREE (node[i]);
+
+
+	/* Check that freeing part of a tree removes it from its parent
+	 * first, leaving the rest of the tree alone.
+	 */
+	TEST_FEATURE ("with partial tree");
+	visit_tree (node);
+
+	for (i = 0; i < 12; i++)
+		TEST_FREE_TAG (node[i]);
+
+	nih_tree_free_all (node['c' - 97]);
+
+	TEST_EQ_P (node['a' - 97]->right, NULL);
+	TEST_EQ_P (node['a' - 97]->left, node['b' - 97]);
+
+	TEST_FREE (node['c' - 97]);
+	TEST_FREE (node['f' - 97]);
+	TEST_FREE (node['l' - 97]);
+	TEST_NOT_FREE (node['a' - 97]);
+	TEST_NOT_FREE (node['k' - 97]);
+
+	nih_tree_free_all (node['a' - 97]);
+
+	TEST_FREE (node['a' - 97]);
+	TEST_FREE (node['k' - 97]);
+}
+
+
+typedef struct index_entry {
+	NihTreeIndexNode node;
+	int              key;
+} IndexEntry;
+
+static const void *
+index_key (NihTree *node)
+{
+	return &((IndexEntry *)node)->key;
+}
+
+static int
+index_cmp (const int *key1,
+	   const int *key2)
+{
+	return (*key1 > *key2) - (*key1 < *key2);
+}
+
+static int
+index_filter (int     *count,
+	      NihTree *node)
+{
+	(*count)++;
+
+	return FALSE;
+}
+
+static int
+index_check (NihTree *node,
+	     NihTree *parent)
+{
+	int left, right;
+
+	if (! node)
+		return 0;
+
+	if (node->parent != parent)
+		TEST_FAILED ("wrong parent for node %d, expected %p got %p",
+			     ((IndexEntry *)node)->key, parent, node->parent);
+
+	left = index_check (node->left, node);
+	right = index_check (node->right, node);
+
+	if ((left > right + 1) || (right > left + 1))
+		TEST_FAILED ("node %d not balanced, left %d right %d",
+			     ((IndexEntry *)node)->key, left, right);
+
+	if (((NihTreeIndexNode *)node)->height != nih_max (left, right) + 1)
+		TEST_FAILED ("wrong height for node %d, expected %d got %d",
+			     ((IndexEntry *)node)->key, nih_max (left, right) + 1,
+			     ((NihTreeIndexNode *)node)->height);
+
+	return nih_max (left, right) + 1;
+}
+
+static IndexEntry *
+index_entry_new (const void *parent,
+		 int         key)
+{
+	IndexEntry *entry;
+
+	entry = NIH_MUST (nih_new (parent, IndexEntry));
+	nih_tree_init (&entry->node.node);
+	entry->key = key;
+
+	return entry;
+}
+
+
+void
+test_index_new (void)
+{
+	NihTreeIndex *index;
+
+	/* Check that nih_tree_index_new allocates a new empty index with
+	 * nih_alloc, with the functions given.  If allocation fails, we
+	 * should get NULL returned.
+	 */
+	TEST_FUNCTION ("nih_tree_index_new");
+	TEST_ALLOC_FAIL {
+		index = nih_tree_index_new (NULL, index_key,
+					    (NihTreeCmpFunction)index_cmp);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (index, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (index, sizeof (NihTreeIndex));
+		TEST_EQ_P (index->root, NULL);
+		TEST_EQ (index->entries, 0);
+		TEST_EQ_P (index->key_function, index_key);
+		TEST_EQ_P (index->cmp_function, (NihTreeCmpFunction)index_cmp);
+
+		nih_free (index);
+	}
+}
+
+void
+test_index_add (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry[1000], *dup[3];
+	NihTree      *ret, *iter;
+	int           i;
+
+	TEST_FUNCTION ("nih_tree_index_add");
+
+	/* Check that adding nodes with keys in order keeps the tree
+	 * balanced, rather than each becoming the right child of the last,
+	 * and that in-order iteration gives the nodes in order.
+	 */
+	TEST_FEATURE ("with keys in order");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	for (i = 0; i < 1000; i++) {
+		entry[i] = index_entry_new (index, i);
+
+		ret = nih_tree_index_add (index, &entry[i]->node);
+
+		TEST_EQ_P (ret, &entry[i]->node.node);
+	}
+
+	TEST_EQ (index->entries, 1000);
+	TEST_EQ_P (index->root->parent, NULL);
+	TEST_LE (index_check (index->root, NULL), 11);
+
+	iter = NULL;
+	for (i = 0; i < 1000; i++) {
+		iter = nih_tree_next (index->root, iter);
+		TEST_EQ_P (iter, &entry[i]->node.node);
+	}
+
+	TEST_EQ_P (nih_tree_next (index->root, iter), NULL);
+
+	iter = NULL;
+	for (i = 999; i >= 0; i--) {
+		iter = nih_tree_prev (index->root, iter);
+		TEST_EQ_P (iter, &entry[i]->node.node);
+	}
+
+	nih_free (index);
+
+
+	/* Check that adding nodes with keys in no particular order still
+	 * keeps the tree balanced and sorted.
+	 */
+	TEST_FEATURE ("with keys out of order");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	for (i = 0; i < 1000; i++) {
+		entry[i] = index_entry_new (index, (i * 7919) % 1000);
+		nih_tree_index_add (index, &entry[i]->node);
+	}
+
+	TEST_EQ (index->entries, 1000);
+	TEST_LE (index_check (index->root, NULL), 14);
+
+	i = 0;
+	NIH_TREE_FOREACH (index->root, iter) {
+		TEST_EQ (((IndexEntry *)iter)->key, i);
+		i++;
+	}
+
+	TEST_EQ (i, 1000);
+
+
+	/* Check that nodes with the same key as one already in the index
+	 * are added after it, in the order they were added.
+	 */
+	TEST_FEATURE ("with duplicate keys");
+	for (i = 0; i < 3; i++) {
+		dup[i] = index_entry_new (index, 500);
+		nih_tree_index_add (index, &dup[i]->node);
+	}
+
+	TEST_EQ (index->entries, 1003);
+	index_check (index->root, NULL);
+
+	iter = nih_tree_index_lookup (index, &dup[0]->key);
+	TEST_EQ (((IndexEntry *)iter)->key, 500);
+	TEST_NE_P (iter, &dup[0]->node.node);
+
+	for (i = 0; i < 3; i++) {
+		iter = nih_tree_next (index->root, iter);
+		TEST_EQ_P (iter, &dup[i]->node.node);
+	}
+
+	iter = nih_tree_next (index->root, iter);
+	TEST_EQ (((IndexEntry *)iter)->key, 501);
+
+	nih_free (index);
+}
+
+void
+test_index_add_unique (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry1, *entry2, *entry3;
+	NihTree      *ret;
+
+	TEST_FUNCTION ("nih_tree_index_add_unique");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+	entry1 = index_entry_new (index, 1);
+	entry2 = index_entry_new (index, 2);
+	entry3 = index_entry_new (index, 1);
+
+	/* Check that nodes with keys not in the index are added and
+	 * returned.
+	 */
+	TEST_FEATURE ("with key not in index");
+	ret = nih_tree_index_add_unique (index, &entry1->node);
+
+	TEST_EQ_P (ret, &entry1->node.node);
+
+	ret = nih_tree_index_add_unique (index, &entry2->node);
+
+	TEST_EQ_P (ret, &entry2->node.node);
+	TEST_EQ (index->entries, 2);
+
+
+	/* Check that a node with a key already in the index is not added,
+	 * and the existing node is returned instead.
+	 */
+	TEST_FEATURE ("with key in index");
+	ret = nih_tree_index_add_unique (index, &entry3->node);
+
+	TEST_EQ_P (ret, &entry1->node.node);
+	TEST_EQ (index->entries, 2);
+	TEST_EQ_P (entry3->node.node.parent, NULL);
+	TEST_NE_P (index->root, &entry3->node.node);
+
+	nih_free (index);
+}
+
+void
+test_index_lookup (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry[100];
+	NihTree      *ret;
+	int           i, key;
+
+	TEST_FUNCTION ("nih_tree_index_lookup");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	/* Check that looking up a key in an empty index returns NULL. */
+	TEST_FEATURE ("with empty index");
+	key = 0;
+	ret = nih_tree_index_lookup (index, &key);
+
+	TEST_EQ_P (ret, NULL);
+
+	for (i = 0; i < 100; i++) {
+		entry[i] = index_entry_new (index, i * 2);
+		nih_tree_index_add (index, &entry[i]->node);
+	}
+
+
+	/* Check that each node is found by its key. */
+	TEST_FEATURE ("with key in index");
+	for (i = 0; i < 100; i++) {
+		key = i * 2;
+		ret = nih_tree_index_lookup (index, &key);
+
+		TEST_EQ_P (ret, &entry[i]->node.node);
+	}
+
+
+	/* Check that NULL is returned for keys not in the index. */
+	TEST_FEATURE ("with key not in index");
+	for (key = -1; key < 200; key += 2) {
+		ret = nih_tree_index_lookup (index, &key);
+
+		TEST_EQ_P (ret, NULL);
+	}
+
+	nih_free (index);
+}
+
+void
+test_index_lower_bound (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry[100];
+	NihTree      *ret;
+	int           i, key;
+
+	TEST_FUNCTION ("nih_tree_index_lower_bound");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	for (i = 0; i < 100; i++) {
+		entry[i] = index_entry_new (index, i * 2);
+		nih_tree_index_add (index, &entry[i]->node);
+	}
+
+	/* Check that a key in the index returns the node with that key. */
+	TEST_FEATURE ("with key in index");
+	for (i = 0; i < 100; i++) {
+		key = i * 2;
+		ret = nih_tree_index_lower_bound (index, &key);
+
+		TEST_EQ_P (ret, &entry[i]->node.node);
+	}
+
+
+	/* Check that a key not in the index returns the node with the
+	 * next greater key, and that iterating from there gives the rest.
+	 */
+	TEST_FEATURE ("with key not in index");
+	for (i = 0; i < 100; i++) {
+		key = i * 2 - 1;
+		ret = nih_tree_index_lower_bound (index, &key);
+
+		TEST_EQ_P (ret, &entry[i]->node.node);
+	}
+
+	key = 151;
+	ret = nih_tree_index_lower_bound (index, &key);
+	for (i = 76; i < 100; i++) {
+		TEST_EQ_P (ret, &entry[i]->node.node);
+		ret = nih_tree_next (index->root, ret);
+	}
+
+	TEST_EQ_P (ret, NULL);
+
+
+	/* Check that NULL is returned for a key greater than all those
+	 * in the index.
+	 */
+	TEST_FEATURE ("with key after last");
+	key = 199;
+	ret = nih_tree_index_lower_bound (index, &key);
+
+	TEST_EQ_P (ret, NULL);
+
+	nih_free (index);
+}
+
+void
+test_index_remove (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry[1000];
+	NihTree      *ret;
+	int           i, j, key;
+
+	TEST_FUNCTION ("nih_tree_index_remove");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	for (i = 0; i < 1000; i++) {
+		entry[i] = index_entry_new (index, i);
+		nih_tree_index_add (index, &entry[i]->node);
+	}
+
+	/* Check that removing the root node, which has two children, puts
+	 * another node in its place and leaves the removed node with no
+	 * parent or children.
+	 */
+	TEST_FEATURE ("with root node");
+	ret = index->root;
+	key = ((IndexEntry *)ret)->key;
+
+	TEST_EQ_P (nih_tree_index_remove (index, (NihTreeIndexNode *)ret), ret);
+
+	TEST_NE_P (index->root, ret);
+	TEST_EQ (index->entries, 999);
+	TEST_EQ_P (ret->parent, NULL);
+	TEST_EQ_P (ret->left, NULL);
+	TEST_EQ_P (ret->right, NULL);
+	TEST_EQ_P (nih_tree_index_lookup (index, &key), NULL);
+	index_check (index->root, NULL);
+
+	nih_tree_index_add (index, &entry[key]->node);
+
+
+	/* Check that removing nodes in no particular order keeps the tree
+	 * balanced and sorted, leaving it empty at the end.
+	 */
+	TEST_FEATURE ("with many nodes");
+	for (i = 0; i < 1000; i++) {
+		key = (i * 7919) % 1000;
+		nih_tree_index_remove (index, &entry[key]->node);
+
+		TEST_EQ (index->entries, (size_t)(999 - i));
+		TEST_EQ_P (nih_tree_index_lookup (index, &key), NULL);
+
+		if (i % 50)
+			continue;
+
+		index_check (index->root, NULL);
+
+		j = -1;
+		NIH_TREE_INDEX_FOREACH (index, iter) {
+			TEST_GT (((IndexEntry *)iter)->key, j);
+			j = ((IndexEntry *)iter)->key;
+		}
+	}
+
+	TEST_EQ_P (index->root, NULL);
+
+	nih_free (index);
+}
+
+void
+test_index_foreach (void)
+{
+	NihTreeIndex *index;
+	IndexEntry   *entry[10];
+	int           i, count;
+
+	TEST_FUNCTION ("NIH_TREE_INDEX_FOREACH");
+	index = nih_tree_index_new (NULL, index_key,
+				    (NihTreeCmpFunction)index_cmp);
+
+	/* Check that iterating an empty index visits nothing. */
+	TEST_FEATURE ("with empty index");
+	NIH_TREE_INDEX_FOREACH (index, iter) {
+		TEST_FAILED ("unexpected node %p", iter);
+	}
+
+
+	/* Check that each node is visited in order of its key. */
+	TEST_FEATURE ("with nodes");
+	for (i = 0; i < 10; i++) {
+		entry[i] = index_entry_new (index, 9 - i);
+		nih_tree_index_add (index, &entry[i]->node);
+	}
+
+	i = 0;
+	NIH_TREE_INDEX_FOREACH (index, iter) {
+		TEST_EQ_P (iter, &entry[9 - i]->node.node);
+		i++;
+	}
+
+	TEST_EQ (i, 10);
+
+
+	/* Check that the filter function is called for the nodes. */
+	TEST_FEATURE ("with filter");
+	i = count = 0;
+	NIH_TREE_INDEX_FOREACH_FULL (index, iter,
+				     (NihTreeFilter)index_filter, &count) {
+		TEST_EQ_P (iter, &entry[9 - i]->node.node);
+		i++;
+	}
+
+	TEST_EQ (i, 10);
+	TEST_GT (count, 0);
+
+	nih_free (index);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -2230,6 +2991,18 @@ main (int   argc,
 	test_next_post_full ();
 	test_foreach_post_full ();
 	test_prev_post_full ();
+	test_visit ();
+	test_visit_pre ();
+	test_visit_post ();
+	test_partition ();
+	test_free_all ();
+	test_index_new ();
+	test_index_add ();
+	test_index_add_unique ();
+	test_index_lookup ();
+	test_index_lower_bound ();
+	test_index_remove ();
+	test_index_foreach ();
 
 	return 0;
 }
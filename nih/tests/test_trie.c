@@ -0,0 +1,594 @@
+/* libnih
+ *
+ * test_trie.c - test suite for nih/trie.c
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/trie.h>
+
+
+static const char *paths[] = {
+	"/etc",
+	"/etc/init",
+	"/etc/init.d",
+	"/etc/init/foo.conf",
+	"/etc/init/bar.conf",
+	"/etc/initramfs",
+	"/usr/lib",
+	"/usr/local",
+	"/",
+	NULL
+};
+
+
+static size_t
+check_node (NihTrieNode *node,
+	    NihTrieNode *parent)
+{
+	size_t count, i;
+
+	TEST_EQ_P (node->parent, parent);
+	TEST_EQ (strlen (node->label), node->len);
+
+	/* Every node other than the root has a label, and either a value
+	 * or more than one child; otherwise it would have been merged.
+	 */
+	if (parent) {
+		TEST_GT (node->len, 0);
+		if (! node->value)
+			TEST_GE (node->nchildren, 2);
+	}
+
+	count = node->value ? 1 : 0;
+	for (i = 0; i < node->nchildren; i++) {
+		if (i > 0)
+			TEST_LT ((unsigned char)node->children[i - 1]->label[0],
+				 (unsigned char)node->children[i]->label[0]);
+
+		count += check_node (node->children[i], node);
+	}
+
+	return count;
+}
+
+static void
+check_trie (NihTrie *trie)
+{
+	TEST_EQ (check_node (trie->root, NULL), trie->entries);
+	TEST_EQ (trie->root->len, 0);
+}
+
+static NihTrie *
+paths_trie (void)
+{
+	NihTrie *trie;
+	int      i;
+
+	trie = nih_trie_new (NULL);
+	for (i = 0; paths[i]; i++)
+		assert0 (nih_trie_add (trie, paths[i], (void *)paths[i]));
+
+	return trie;
+}
+
+
+void
+test_new (void)
+{
+	NihTrie *trie;
+
+	/* Check that a new trie is allocated with an empty root node as
+	 * a child of it.
+	 */
+	TEST_FUNCTION ("nih_trie_new");
+	TEST_ALLOC_FAIL {
+		trie = nih_trie_new (NULL);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (trie, NULL);
+			continue;
+		}
+
+		TEST_ALLOC_SIZE (trie, sizeof (NihTrie));
+		TEST_EQ (trie->entries, 0);
+
+		TEST_NE_P (trie->root, NULL);
+		TEST_ALLOC_PARENT (trie->root, trie);
+		TEST_EQ_P (trie->root->value, NULL);
+		TEST_EQ (trie->root->nchildren, 0);
+
+		nih_free (trie);
+	}
+}
+
+void
+test_add (void)
+{
+	NihTrie *trie;
+	char     key[32];
+	int      ret, i;
+
+	TEST_FUNCTION ("nih_trie_add");
+
+	/* Check that adding a key beside an existing one splits the node
+	 * at the point they differ, and that when out of memory the trie
+	 * is unchanged.
+	 */
+	TEST_FEATURE ("with split label");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			trie = nih_trie_new (NULL);
+			assert0 (nih_trie_add (trie, "/etc/init", "init"));
+		}
+
+		ret = nih_trie_add (trie, "/etc/initramfs", "initramfs");
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ (trie->entries, 1);
+			TEST_EQ (trie->root->nchildren, 1);
+			TEST_EQ_STR (trie->root->children[0]->label,
+				     "/etc/init");
+			check_trie (trie);
+
+			nih_free (trie);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (trie->entries, 2);
+		TEST_EQ_STR (trie->root->children[0]->label, "/etc/init");
+		TEST_EQ (trie->root->children[0]->nchildren, 1);
+		TEST_EQ_STR (trie->root->children[0]->children[0]->label,
+			     "ramfs");
+		check_trie (trie);
+
+		nih_free (trie);
+	}
+
+
+	/* Check that adding a key that is a prefix of an existing one
+	 * splits the node with the new entry at the split.
+	 */
+	TEST_FEATURE ("with prefix of existing key");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			trie = nih_trie_new (NULL);
+			assert0 (nih_trie_add (trie, "/etc/init", "init"));
+		}
+
+		ret = nih_trie_add (trie, "/etc", "etc");
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ (trie->entries, 1);
+			check_trie (trie);
+
+			nih_free (trie);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+		TEST_EQ (trie->entries, 2);
+		TEST_EQ_STR (trie->root->children[0]->label, "/etc");
+		TEST_EQ_STR ((char *)trie->root->children[0]->value, "etc");
+		TEST_EQ_STR (trie->root->children[0]->children[0]->label,
+			     "/init");
+		check_trie (trie);
+
+		nih_free (trie);
+	}
+
+
+	/* Check that adding a key that already exists replaces its value
+	 * without adding an entry.
+	 */
+	TEST_FEATURE ("with existing key");
+	trie = paths_trie ();
+
+	TEST_EQ (nih_trie_add (trie, "/etc/init", "new"), 0);
+	TEST_EQ (trie->entries, 9);
+	TEST_EQ_STR ((char *)nih_trie_lookup (trie, "/etc/init"), "new");
+	check_trie (trie);
+
+	nih_free (trie);
+
+
+	/* Check that the empty key may be added, held by the root. */
+	TEST_FEATURE ("with empty key");
+	trie = nih_trie_new (NULL);
+
+	TEST_EQ (nih_trie_add (trie, "", "root"), 0);
+	TEST_EQ (trie->entries, 1);
+	TEST_EQ_STR ((char *)trie->root->value, "root");
+
+	nih_free (trie);
+
+
+	/* Check that many keys may be added, keeping the trie valid. */
+	TEST_FEATURE ("with many keys");
+	trie = nih_trie_new (NULL);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf (key, "/%d/%d", i % 7, i);
+		TEST_EQ (nih_trie_add (trie, key, trie), 0);
+	}
+
+	TEST_EQ (trie->entries, 1000);
+	check_trie (trie);
+
+	nih_free (trie);
+}
+
+void
+test_lookup (void)
+{
+	NihTrie *trie;
+	int      i;
+
+	TEST_FUNCTION ("nih_trie_lookup");
+	trie = paths_trie ();
+
+	/* Check that every key added can be found. */
+	TEST_FEATURE ("with keys added");
+	for (i = 0; paths[i]; i++)
+		TEST_EQ_P (nih_trie_lookup (trie, paths[i]), paths[i]);
+
+
+	/* Check that keys ending part way along a label, or after the
+	 * split between nodes, are not found.
+	 */
+	TEST_FEATURE ("with missing keys");
+	TEST_EQ_P (nih_trie_lookup (trie, "/et"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, "/etc/ini"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, "/usr"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, "/usr/lib/nih"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, "/var"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, ""), NULL);
+
+	nih_free (trie);
+}
+
+void
+test_lookup_prefix (void)
+{
+	NihTrie *trie;
+	size_t   len;
+
+	TEST_FUNCTION ("nih_trie_lookup_prefix");
+	trie = paths_trie ();
+
+	/* Check that the longest key that is a prefix of the string is
+	 * found, with its length.
+	 */
+	TEST_FEATURE ("with longer string");
+	TEST_EQ_STR ((char *)nih_trie_lookup_prefix (trie, "/etc/init/baz.conf", &len),
+		     "/etc/init");
+	TEST_EQ (len, 9);
+
+	TEST_EQ_STR ((char *)nih_trie_lookup_prefix (trie, "/etc/init.d/rc", &len),
+		     "/etc/init.d");
+	TEST_EQ (len, 11);
+
+
+	/* Check that a key matching the string exactly is found. */
+	TEST_FEATURE ("with exact key");
+	TEST_EQ_STR ((char *)nih_trie_lookup_prefix (trie, "/etc/initramfs", &len),
+		     "/etc/initramfs");
+	TEST_EQ (len, 14);
+
+
+	/* Check that the search stops part way along a label, returning
+	 * the last key passed.
+	 */
+	TEST_FEATURE ("with string ending within label");
+	TEST_EQ_STR ((char *)nih_trie_lookup_prefix (trie, "/usr/lo", &len), "/");
+	TEST_EQ (len, 1);
+
+
+	/* Check that NULL is returned when no key is a prefix. */
+	TEST_FEATURE ("with no prefix");
+	TEST_EQ_P (nih_trie_lookup_prefix (trie, "etc", &len), NULL);
+	TEST_EQ (len, 0);
+
+	nih_free (trie);
+}
+
+void
+test_remove (void)
+{
+	NihTrie *trie;
+	void    *ret;
+	int      i;
+
+	TEST_FUNCTION ("nih_trie_remove");
+
+	/* Check that removing a leaf entry frees its node, and merges the
+	 * parent into its remaining child when it has no value.
+	 */
+	TEST_FEATURE ("with leaf");
+	trie = nih_trie_new (NULL);
+	assert0 (nih_trie_add (trie, "/etc/init", "init"));
+	assert0 (nih_trie_add (trie, "/etc/initramfs", "initramfs"));
+	assert0 (nih_trie_add (trie, "/etc/init.d", "init.d"));
+
+	ret = nih_trie_remove (trie, "/etc/init");
+
+	TEST_EQ_STR ((char *)ret, "init");
+
+	TEST_EQ_STR (trie->root->children[0]->label, "/etc/init");
+	TEST_EQ_P (trie->root->children[0]->value, NULL);
+
+	ret = nih_trie_remove (trie, "/etc/init.d");
+
+	TEST_EQ_STR ((char *)ret, "init.d");
+	TEST_EQ (trie->entries, 1);
+	TEST_EQ (trie->root->nchildren, 1);
+	TEST_EQ_STR (trie->root->children[0]->label, "/etc/initramfs");
+	TEST_EQ_STR ((char *)trie->root->children[0]->value, "initramfs");
+	check_trie (trie);
+
+	nih_free (trie);
+
+
+	/* Check that removing an entry with children leaves them. */
+	TEST_FEATURE ("with children");
+	trie = paths_trie ();
+
+	ret = nih_trie_remove (trie, "/etc/init");
+
+	TEST_EQ_STR ((char *)ret, "/etc/init");
+	TEST_EQ (trie->entries, 8);
+	TEST_EQ_P (nih_trie_lookup (trie, "/etc/init"), NULL);
+	TEST_EQ_STR ((char *)nih_trie_lookup (trie, "/etc/init/foo.conf"),
+		     "/etc/init/foo.conf");
+	check_trie (trie);
+
+
+	/* Check that removing a key not in the trie returns NULL. */
+	TEST_FEATURE ("with missing key");
+	TEST_EQ_P (nih_trie_remove (trie, "/etc/init"), NULL);
+	TEST_EQ_P (nih_trie_remove (trie, "/usr"), NULL);
+	TEST_EQ (trie->entries, 8);
+
+
+	/* Check that removing every entry leaves just the root. */
+	TEST_FEATURE ("with all entries");
+	for (i = 0; paths[i]; i++) {
+		nih_trie_remove (trie, paths[i]);
+		check_trie (trie);
+	}
+
+	TEST_EQ (trie->entries, 0);
+	TEST_EQ (trie->root->nchildren, 0);
+
+	nih_free (trie);
+}
+
+
+typedef struct visit_record {
+	char *keys;
+	int   count;
+	int   stop;
+} VisitRecord;
+
+static int
+my_visitor (VisitRecord *record,
+	    const char  *key,
+	    void        *value)
+{
+	TEST_EQ_STR (key, (char *)value);
+
+	if (record->count++ == record->stop)
+		return -1;
+
+	NIH_MUST (nih_strcat_sprintf (&record->keys, NULL, "%s;", key));
+
+	return 0;
+}
+
+void
+test_visit (void)
+{
+	NihTrie     *trie;
+	VisitRecord  record;
+	int          ret;
+
+	TEST_FUNCTION ("nih_trie_visit");
+	trie = paths_trie ();
+
+	/* Check that every entry is visited in key order with an empty
+	 * prefix.
+	 */
+	TEST_FEATURE ("with empty prefix");
+	record.keys = NULL;
+	record.count = 0;
+	record.stop = -1;
+
+	ret = nih_trie_visit (trie, "", (NihTrieVisitor)my_visitor, &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.count, 9);
+	TEST_EQ_STR (record.keys, ("/;/etc;/etc/init;/etc/init.d;"
+				   "/etc/init/bar.conf;/etc/init/foo.conf;"
+				   "/etc/initramfs;/usr/lib;/usr/local;"));
+
+	nih_free (record.keys);
+
+
+	/* Check that only entries beginning with the prefix are visited. */
+	TEST_FEATURE ("with prefix");
+	record.keys = NULL;
+	record.count = 0;
+	record.stop = -1;
+
+	ret = nih_trie_visit (trie, "/etc/init/", (NihTrieVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ_STR (record.keys, "/etc/init/bar.conf;/etc/init/foo.conf;");
+
+	nih_free (record.keys);
+
+
+	/* Check that a prefix ending part way along a label visits the
+	 * entries beneath that node.
+	 */
+	TEST_FEATURE ("with prefix within label");
+	record.keys = NULL;
+	record.count = 0;
+	record.stop = -1;
+
+	ret = nih_trie_visit (trie, "/usr/l", (NihTrieVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ_STR (record.keys, "/usr/lib;/usr/local;");
+
+	nih_free (record.keys);
+
+
+	/* Check that nothing is visited for a prefix not in the trie. */
+	TEST_FEATURE ("with missing prefix");
+	record.count = 0;
+	record.stop = -1;
+
+	ret = nih_trie_visit (trie, "/usr/libexec", (NihTrieVisitor)my_visitor,
+			      &record);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (record.count, 0);
+
+
+	/* Check that the visitor may stop the walk. */
+	TEST_FEATURE ("with visitor stopping walk");
+	record.keys = NULL;
+	record.count = 0;
+	record.stop = 2;
+
+	ret = nih_trie_visit (trie, "", (NihTrieVisitor)my_visitor, &record);
+
+	TEST_EQ (ret, -1);
+	TEST_EQ (record.count, 3);
+	TEST_EQ_STR (record.keys, "/;/etc;");
+
+	nih_free (record.keys);
+
+	nih_free (trie);
+}
+
+
+static int
+remove_visitor (NihTrie    *trie,
+		const char *key,
+		void       *value)
+{
+	TEST_EQ_STR (key, (char *)value);
+	TEST_EQ_P (nih_trie_lookup (trie, key), NULL);
+
+	/* Removing the entry again is harmless */
+	TEST_EQ_P (nih_trie_remove (trie, key), NULL);
+
+	return 0;
+}
+
+void
+test_remove_prefix (void)
+{
+	NihTrie *trie;
+	size_t   count;
+
+	TEST_FUNCTION ("nih_trie_remove_prefix");
+
+	/* Check that every entry beginning with the prefix is removed and
+	 * passed to the visitor, which may use the trie, and that the
+	 * others are left.
+	 */
+	TEST_FEATURE ("with prefix");
+	trie = paths_trie ();
+
+	count = nih_trie_remove_prefix (trie, "/etc/init",
+					(NihTrieVisitor)remove_visitor, trie);
+
+	TEST_EQ (count, 5);
+	TEST_EQ (trie->entries, 4);
+	TEST_EQ_STR ((char *)nih_trie_lookup (trie, "/etc"), "/etc");
+	TEST_EQ_P (nih_trie_lookup (trie, "/etc/init.d"), NULL);
+	TEST_EQ_P (nih_trie_lookup (trie, "/etc/init/foo.conf"), NULL);
+	check_trie (trie);
+
+
+	/* Check that a prefix ending part way along a label removes the
+	 * entries beneath that node.
+	 */
+	TEST_FEATURE ("with prefix within label");
+	count = nih_trie_remove_prefix (trie, "/us", NULL, NULL);
+
+	TEST_EQ (count, 2);
+	TEST_EQ (trie->entries, 2);
+	TEST_EQ_P (nih_trie_lookup (trie, "/usr/lib"), NULL);
+	check_trie (trie);
+
+
+	/* Check that nothing is removed for a prefix not in the trie. */
+	TEST_FEATURE ("with missing prefix");
+	count = nih_trie_remove_prefix (trie, "/var", NULL, NULL);
+
+	TEST_EQ (count, 0);
+	TEST_EQ (trie->entries, 2);
+
+
+	/* Check that an empty prefix removes every entry, leaving a new
+	 * empty root.
+	 */
+	TEST_FEATURE ("with empty prefix");
+	count = nih_trie_remove_prefix (trie, "",
+					(NihTrieVisitor)remove_visitor, trie);
+
+	TEST_EQ (count, 2);
+	TEST_EQ (trie->entries, 0);
+	TEST_EQ (trie->root->nchildren, 0);
+	TEST_EQ_P (trie->root->value, NULL);
+	check_trie (trie);
+
+	TEST_EQ (nih_trie_add (trie, "/etc", "/etc"), 0);
+	TEST_EQ_STR ((char *)nih_trie_lookup (trie, "/etc"), "/etc");
+
+	nih_free (trie);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_new ();
+	test_add ();
+	test_lookup ();
+	test_lookup_prefix ();
+	test_remove ();
+	test_visit ();
+	test_remove_prefix ();
+
+	return 0;
+}
@@ -1536,6 +1536,76 @@ test_reader (void)
 	nih_free (last_path);
 
 
+	/* Check that when a watched sub-directory is moved away, the
+	 * watches on it and the directories beneath it are all removed.
+	 */
+	TEST_FEATURE ("with sub-directory moved away");
+	strcpy (filename, dirname);
+	strcat (filename, "/moo");
+	mkdir (filename, 0755);
+
+	strcat (filename, "/cow");
+	mkdir (filename, 0755);
+
+	create_called = 0;
+	last_path = NULL;
+
+	nfds = 0;
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+
+	nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+	select (nfds, &readfds, &writefds, &exceptfds, NULL);
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_TRUE (create_called);
+	TEST_NE_P (nih_trie_lookup (watch->handles, filename), NULL);
+	TEST_EQ (watch->handles->entries, 3);
+
+	nih_free (last_path);
+
+	TEST_FILENAME (newname);
+	strcpy (filename, dirname);
+	strcat (filename, "/moo");
+	rename (filename, newname);
+
+	delete_called = 0;
+	last_watch = NULL;
+	last_path = NULL;
+	last_data = NULL;
+
+	nfds = 0;
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+
+	nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+	select (nfds, &readfds, &writefds, &exceptfds, NULL);
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_TRUE (delete_called);
+	TEST_EQ_STR (last_path, filename);
+
+	TEST_EQ (watch->handles->entries, 1);
+	TEST_EQ_P (nih_trie_lookup (watch->handles, filename), NULL);
+
+	ptr = (NihWatchHandle *)watch->watches.next;
+	TEST_EQ_STR (ptr->path, dirname);
+	nih_list_remove (&ptr->entry);
+
+	TEST_LIST_EMPTY (&watch->watches);
+
+	nih_list_add (&watch->watches, &ptr->entry);
+
+	nih_free (last_path);
+
+	strcpy (filename, newname);
+	strcat (filename, "/cow");
+	rmdir (filename);
+	rmdir (newname);
+
+
 	/* Check that we can handle the directory itself being deleted,
 	 * the delete_handler should be called with the top-level path.
 	 * It should be safe to delete the entire watch this way.
@@ -24,18 +24,105 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <sys/timerfd.h>
+
 #include <time.h>
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/io.h>
 #include <nih/logging.h>
 #include <nih/error.h>
 
 #include "timer.h"
 
 
+/**
+ * NIH_TIMER_NOT_QUEUED:
+ *
+ * Value of the heap_index member of a timer that is not in the queue.
+ **/
+#define NIH_TIMER_NOT_QUEUED ((size_t)-1)
+
+/**
+ * NSEC_PER_SEC:
+ *
+ * Number of nanoseconds in a second.
+ **/
+#define NSEC_PER_SEC 1000000000L
+
+
+/**
+ * NihTimerQueue:
+ * @clock: clock that due times in the queue are measured against,
+ * @heap: binary heap of timers ordered by due time,
+ * @len: number of timers in @heap,
+ * @size: number of elements allocated for @heap,
+ * @count: number of allocated timers using @clock,
+ * @fd: timerfd armed to the top of @heap, or -1,
+ * @watch: watch on @fd,
+ * @forks: value of nih_io_forks when @fd was created,
+ * @armed: due time @fd is armed to.
+ *
+ * Each clock that timers may be measured against has its own queue of
+ * timers, in which the next timer due is always the first element.
+ * @size is kept at least as large as @count so that placing a timer into
+ * the heap never fails.
+ *
+ * Timers removed from the list are only removed from the heap once they
+ * reach the top, or nih_timer_update() is called.
+ **/
+typedef struct nih_timer_queue {
+	clockid_t        clock;
+	NihTimer       **heap;
+	size_t           len;
+	size_t           size;
+	size_t           count;
+
+	int              fd;
+	NihIoWatch      *watch;
+	unsigned int     forks;
+	struct timespec  armed;
+} NihTimerQueue;
+
+
+/* Prototypes for static functions */
+static NihTimer *     nih_timer_new          (const void *parent,
+					      NihTimerType type,
+					      time_t sec, long nsec,
+					      NihTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
+static int            nih_timer_destroy      (NihTimer *timer);
+static void           nih_timer_set_due      (NihTimer *timer,
+					      const struct timespec *now,
+					      time_t sec, long nsec);
+static void           nih_timer_remaining    (NihTimer *timer,
+					      struct timespec *remaining);
+static int            nih_timer_before       (NihTimer *timer1,
+					      NihTimer *timer2);
+static NihTimerQueue *nih_timer_queue        (clockid_t clock);
+static int            nih_timer_queue_grow   (NihTimerQueue *queue)
+	__attribute__ ((warn_unused_result));
+static NihTimer *     nih_timer_queue_top    (NihTimerQueue *queue);
+static void           nih_timer_queue_poll   (NihTimerQueue *queue);
+static void           nih_timer_queue_arm    (NihTimerQueue *queue);
+static void           nih_timer_fd_watcher   (NihTimerQueue *queue,
+					      NihIoWatch *watch,
+					      NihIoEvents events);
+static void           nih_timer_heap_place   (NihTimerQueue *queue,
+					      NihTimer *timer, size_t index);
+static void           nih_timer_heap_up      (NihTimerQueue *queue,
+					      NihTimer *timer);
+static void           nih_timer_heap_down    (NihTimerQueue *queue,
+					      NihTimer *timer);
+static void           nih_timer_heap_remove  (NihTimerQueue *queue,
+					      NihTimer *timer);
+
+
 /**
  * nih_timers:
  *
@@ -47,6 +134,25 @@
  **/
 NihList *nih_timers = NULL;
 
+/**
+ * nih_timer_queues:
+ *
+ * Queues of timers for each of the clocks that may be used.
+ **/
+static NihTimerQueue nih_timer_queues[] = {
+	{ CLOCK_MONOTONIC, NULL, 0, 0, 0, -1, NULL, 0, { 0, 0 } },
+	{ CLOCK_BOOTTIME,  NULL, 0, 0, 0, -1, NULL, 0, { 0, 0 } },
+	{ CLOCK_REALTIME,  NULL, 0, 0, 0, -1, NULL, 0, { 0, 0 } },
+};
+
+/**
+ * nih_timer_use_fd:
+ *
+ * TRUE once nih_timer_init_fd() has been called, in which case each queue
+ * of timers has a timerfd armed to its next due time.
+ **/
+static int nih_timer_use_fd = FALSE;
+
 
 /**
  * nih_timer_init:
@@ -58,6 +164,135 @@ nih_timer_init (void)
 {
 	if (! nih_timers)
 		nih_timers = NIH_MUST (nih_list_new (NULL));
+
+	/* Almost all timers use the monotonic clock, so allocate the
+	 * heap for that now.
+	 */
+	if (! nih_timer_queues[0].heap)
+		NIH_ZERO (nih_timer_queue_grow (&nih_timer_queues[0]));
+}
+
+/**
+ * nih_timer_init_fd:
+ *
+ * Arranges for timers to be triggered by a timerfd for each clock in use,
+ * armed to the due time of the next timer and watched by the main loop,
+ * rather than by the main loop calculating how long it may sleep for.
+ * This means the main loop wakes exactly when a timer is due, and
+ * timers using CLOCK_REALTIME or CLOCK_BOOTTIME are triggered correctly
+ * when the clock is changed or the system is suspended.
+ *
+ * If a timerfd cannot be created for a clock, timers using it continue
+ * to be handled by the main loop sleeping.
+ **/
+void
+nih_timer_init_fd (void)
+{
+	size_t i;
+
+	nih_timer_init ();
+
+	nih_timer_use_fd = TRUE;
+
+	for (i = 0; i < sizeof (nih_timer_queues) / sizeof (NihTimerQueue);
+	     i++)
+		nih_timer_queue_arm (&nih_timer_queues[i]);
+}
+
+
+/**
+ * nih_timer_new:
+ * @parent: parent object for new timer,
+ * @type: type of timer,
+ * @sec: seconds until the timer is first due,
+ * @nsec: additional nanoseconds until the timer is first due,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Allocates a new timer of @type, due in @sec seconds and @nsec
+ * nanoseconds time, and places it in the timer list and queue.
+ *
+ * Returns: the new timer information, or NULL if insufficient memory.
+ **/
+static NihTimer *
+nih_timer_new (const void   *parent,
+	       NihTimerType  type,
+	       time_t        sec,
+	       long          nsec,
+	       NihTimerCb    callback,
+	       void         *data)
+{
+	NihTimer *      timer;
+	struct timespec now;
+
+	nih_assert (callback != NULL);
+	nih_assert ((nsec >= 0) && (nsec < NSEC_PER_SEC));
+
+	nih_timer_init ();
+
+	/* Make sure there's room in the heap for every timer, so that it
+	 * can always be placed back in later.
+	 */
+	if (nih_timer_queue_grow (&nih_timer_queues[0]) < 0)
+		return NULL;
+
+	timer = nih_new (parent, NihTimer);
+	if (! timer)
+		return NULL;
+
+	nih_list_init (&timer->entry);
+	timer->clock = CLOCK_MONOTONIC;
+	timer->heap_index = NIH_TIMER_NOT_QUEUED;
+	nih_timer_queues[0].count++;
+
+	nih_alloc_set_destructor (timer, nih_timer_destroy);
+
+	timer->type = type;
+	timer->period = sec;
+	timer->timeout_nsec = (type == NIH_TIMER_TIMEOUT) ? nsec : 0;
+	timer->period_nsec = (type == NIH_TIMER_PERIODIC) ? nsec : 0;
+
+	timer->callback = callback;
+	timer->data = data;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+	nih_timer_set_due (timer, &now, sec, nsec);
+
+	nih_list_add (nih_timers, &timer->entry);
+	nih_timer_update (timer);
+
+	return timer;
+}
+
+/**
+ * nih_timer_destroy:
+ * @timer: timer to be destroyed.
+ *
+ * Removes @timer from the timer list and queue.
+ *
+ * Normally used or called from an nih_alloc() destructor.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_timer_destroy (NihTimer *timer)
+{
+	NihTimerQueue *queue;
+
+	nih_assert (timer != NULL);
+
+	queue = nih_timer_queue (timer->clock);
+
+	nih_list_destroy (&timer->entry);
+
+	if (timer->heap_index != NIH_TIMER_NOT_QUEUED) {
+		nih_timer_heap_remove (queue, timer);
+		nih_timer_queue_arm (queue);
+	}
+
+	queue->count--;
+
+	return 0;
 }
 
 
@@ -91,33 +326,60 @@ nih_timer_add_timeout (const void *parent,
 		       NihTimerCb  callback,
 		       void       *data)
 {
-	NihTimer *      timer;
-	struct timespec now;
-
 	nih_assert (callback != NULL);
 
-	nih_timer_init ();
-
-	timer = nih_new (parent, NihTimer);
-	if (! timer)
-		return NULL;
-
-	nih_list_init (&timer->entry);
-
-	nih_alloc_set_destructor (timer, nih_list_destroy);
-
-	timer->type = NIH_TIMER_TIMEOUT;
-	timer->timeout = timeout;
+	return nih_timer_new (parent, NIH_TIMER_TIMEOUT, timeout, 0,
+			      callback, data);
+}
 
-	timer->callback = callback;
-	timer->data = data;
+/**
+ * nih_timer_add_timeout_ms:
+ * @parent: parent object for new timer,
+ * @timeout: milliseconds to wait before triggering,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arranges for the @callback function to be called in @timeout
+ * milliseconds time, or the soonest period thereafter; otherwise this
+ * behaves exactly as nih_timer_add_timeout().
+ *
+ * Returns: the new timer information, or NULL if insufficient memory.
+ **/
+NihTimer *
+nih_timer_add_timeout_ms (const void *parent,
+			  uint64_t    timeout,
+			  NihTimerCb  callback,
+			  void       *data)
+{
+	nih_assert (callback != NULL);
 
-	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
-	timer->due = now.tv_sec + timeout;
+	return nih_timer_new (parent, NIH_TIMER_TIMEOUT, timeout / 1000,
+			      (timeout % 1000) * 1000000, callback, data);
+}
 
-	nih_list_add (nih_timers, &timer->entry);
+/**
+ * nih_timer_add_timeout_ns:
+ * @parent: parent object for new timer,
+ * @timeout: nanoseconds to wait before triggering,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arranges for the @callback function to be called in @timeout
+ * nanoseconds time, or the soonest period thereafter; otherwise this
+ * behaves exactly as nih_timer_add_timeout().
+ *
+ * Returns: the new timer information, or NULL if insufficient memory.
+ **/
+NihTimer *
+nih_timer_add_timeout_ns (const void *parent,
+			  uint64_t    timeout,
+			  NihTimerCb  callback,
+			  void       *data)
+{
+	nih_assert (callback != NULL);
 
-	return timer;
+	return nih_timer_new (parent, NIH_TIMER_TIMEOUT, timeout / NSEC_PER_SEC,
+			      timeout % NSEC_PER_SEC, callback, data);
 }
 
 /**
@@ -149,34 +411,64 @@ nih_timer_add_periodic (const void *parent,
 			NihTimerCb  callback,
 			void       *data)
 {
-	NihTimer *      timer;
-	struct timespec now;
-
 	nih_assert (callback != NULL);
 	nih_assert (period > 0);
 
-	nih_timer_init ();
-
-	timer = nih_new (parent, NihTimer);
-	if (! timer)
-		return NULL;
-
-	nih_list_init (&timer->entry);
-
-	nih_alloc_set_destructor (timer, nih_list_destroy);
-
-	timer->type = NIH_TIMER_PERIODIC;
-	timer->period = period;
+	return nih_timer_new (parent, NIH_TIMER_PERIODIC, period, 0,
+			      callback, data);
+}
 
-	timer->callback = callback;
-	timer->data = data;
+/**
+ * nih_timer_add_periodic_ms:
+ * @parent: parent object for new timer,
+ * @period: number of milliseconds between calls,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arranges for the @callback function to be called every @period
+ * milliseconds, or the soonest time thereafter; otherwise this behaves
+ * exactly as nih_timer_add_periodic().
+ *
+ * Returns: the new timer information, or NULL if insufficient memory.
+ **/
+NihTimer *
+nih_timer_add_periodic_ms (const void *parent,
+			   uint64_t    period,
+			   NihTimerCb  callback,
+			   void       *data)
+{
+	nih_assert (callback != NULL);
+	nih_assert (period > 0);
 
-	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
-	timer->due = now.tv_sec + period;
+	return nih_timer_new (parent, NIH_TIMER_PERIODIC, period / 1000,
+			      (period % 1000) * 1000000, callback, data);
+}
 
-	nih_list_add (nih_timers, &timer->entry);
+/**
+ * nih_timer_add_periodic_ns:
+ * @parent: parent object for new timer,
+ * @period: number of nanoseconds between calls,
+ * @callback: function to be called,
+ * @data: pointer to pass to function as first argument.
+ *
+ * Arranges for the @callback function to be called every @period
+ * nanoseconds, or the soonest time thereafter; otherwise this behaves
+ * exactly as nih_timer_add_periodic().
+ *
+ * Returns: the new timer information, or NULL if insufficient memory.
+ **/
+NihTimer *
+nih_timer_add_periodic_ns (const void *parent,
+			   uint64_t    period,
+			   NihTimerCb  callback,
+			   void       *data)
+{
+	nih_assert (callback != NULL);
+	nih_assert (period > 0);
 
-	return timer;
+	return nih_timer_new (parent, NIH_TIMER_PERIODIC,
+			      period / NSEC_PER_SEC, period % NSEC_PER_SEC,
+			      callback, data);
 }
 
 /**
@@ -213,67 +505,615 @@ nih_timer_add_scheduled (const void       *parent,
 	nih_assert (callback != NULL);
 	nih_assert (schedule != NULL);
 
-	nih_timer_init ();
-
-	timer = nih_new (parent, NihTimer);
+	timer = nih_timer_new (parent, NIH_TIMER_SCHEDULED, 0, 0,
+			       callback, data);
 	if (! timer)
 		return NULL;
 
-	nih_list_init (&timer->entry);
+	memcpy (&timer->schedule, schedule, sizeof (NihTimerSchedule));
 
-	nih_alloc_set_destructor (timer, nih_list_destroy);
+	/* FIXME Not implemented */
+	timer->due.tv_sec = 0;
+	timer->due.tv_nsec = 0;
+	nih_timer_update (timer);
 
-	timer->type = NIH_TIMER_SCHEDULED;
-	memcpy (&timer->schedule, schedule, sizeof (NihTimerSchedule));
+	return timer;
+}
 
-	timer->callback = callback;
-	timer->data = data;
 
-	/* FIXME Not implemented */
-	timer->due = 0;
+/**
+ * nih_timer_update:
+ * @timer: timer that has changed.
+ *
+ * This function must be called whenever the due time of @timer has been
+ * modified, or the timer has been placed back into the list of timers
+ * after being removed, so that the timer queue is kept in order.
+ *
+ * Removing a timer from the list is noticed without calling this function
+ * but calling it releases its place in the queue immediately.
+ **/
+void
+nih_timer_update (NihTimer *timer)
+{
+	NihTimerQueue *queue;
 
-	nih_list_add (nih_timers, &timer->entry);
+	nih_assert (timer != NULL);
 
-	return timer;
+	nih_timer_init ();
+
+	queue = nih_timer_queue (timer->clock);
+
+	if (NIH_LIST_EMPTY (&timer->entry)) {
+		if (timer->heap_index != NIH_TIMER_NOT_QUEUED)
+			nih_timer_heap_remove (queue, timer);
+	} else if (timer->heap_index == NIH_TIMER_NOT_QUEUED) {
+		nih_assert (queue->len < queue->size);
+
+		nih_timer_heap_place (queue, timer, queue->len++);
+		nih_timer_heap_up (queue, timer);
+	} else {
+		nih_timer_heap_up (queue, timer);
+		nih_timer_heap_down (queue, timer);
+	}
+
+	nih_timer_queue_arm (queue);
+}
+
+/**
+ * nih_timer_set_clock:
+ * @timer: timer to change,
+ * @clock: new clock.
+ *
+ * Changes the clock that the due time of @timer is measured against to
+ * @clock, which may be CLOCK_MONOTONIC (the default), CLOCK_BOOTTIME to
+ * include time the system spends suspended, or CLOCK_REALTIME to follow
+ * changes to the system clock.  The time remaining until @timer is due is
+ * preserved.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+int
+nih_timer_set_clock (NihTimer  *timer,
+		     clockid_t  clock)
+{
+	NihTimerQueue * old_queue;
+	NihTimerQueue * queue;
+	struct timespec remaining, now;
+
+	nih_assert (timer != NULL);
+
+	nih_timer_init ();
+
+	old_queue = nih_timer_queue (timer->clock);
+	queue = nih_timer_queue (clock);
+	if (queue == old_queue)
+		return 0;
+
+	if (nih_timer_queue_grow (queue) < 0)
+		return -1;
+
+	/* Scheduled timers have an absolute due time, everything else
+	 * is relative to when it was added.
+	 */
+	if (timer->type != NIH_TIMER_SCHEDULED) {
+		nih_timer_remaining (timer, &remaining);
+		nih_assert (clock_gettime (clock, &now) == 0);
+
+		if (remaining.tv_sec < 0) {
+			remaining.tv_sec = 0;
+			remaining.tv_nsec = 0;
+		}
+
+		nih_timer_set_due (timer, &now, remaining.tv_sec,
+				   remaining.tv_nsec);
+	}
+
+	if (timer->heap_index != NIH_TIMER_NOT_QUEUED) {
+		nih_timer_heap_remove (old_queue, timer);
+		nih_timer_queue_arm (old_queue);
+	}
+
+	old_queue->count--;
+	queue->count++;
+
+	timer->clock = clock;
+	nih_timer_update (timer);
+
+	return 0;
 }
 
 
 /**
- * nih_timer_next_due:
+ * nih_timer_set_due:
+ * @timer: timer to set,
+ * @now: current time,
+ * @sec: seconds from @now,
+ * @nsec: additional nanoseconds from @now.
  *
- * Iterates the complete list of timers looking for the one with the
- * lowest due time, so that the timer returned is either due to be triggered
- * now or in some period's time.
+ * Sets the due time of @timer to @sec seconds and @nsec nanoseconds
+ * after @now.
+ **/
+static void
+nih_timer_set_due (NihTimer              *timer,
+		   const struct timespec *now,
+		   time_t                 sec,
+		   long                   nsec)
+{
+	nih_assert (timer != NULL);
+	nih_assert (now != NULL);
+
+	timer->due.tv_sec = now->tv_sec + sec;
+	timer->due.tv_nsec = now->tv_nsec + nsec;
+	if (timer->due.tv_nsec >= NSEC_PER_SEC) {
+		timer->due.tv_sec++;
+		timer->due.tv_nsec -= NSEC_PER_SEC;
+	}
+}
+
+/**
+ * nih_timer_remaining:
+ * @timer: timer to check,
+ * @remaining: pointer to store result in.
  *
- * Normally used to determine how long we can sleep for by subtracting the
- * current time from the due time of the next timer.
+ * Calculates the time remaining until @timer is due, which is negative
+ * if the due time has passed.  @remaining always has a positive
+ * nanoseconds part.
+ **/
+static void
+nih_timer_remaining (NihTimer        *timer,
+		     struct timespec *remaining)
+{
+	struct timespec now;
+
+	nih_assert (timer != NULL);
+	nih_assert (remaining != NULL);
+
+	nih_assert (clock_gettime (timer->clock, &now) == 0);
+
+	remaining->tv_sec = timer->due.tv_sec - now.tv_sec;
+	remaining->tv_nsec = timer->due.tv_nsec - now.tv_nsec;
+	if (remaining->tv_nsec < 0) {
+		remaining->tv_sec--;
+		remaining->tv_nsec += NSEC_PER_SEC;
+	}
+}
+
+/**
+ * nih_timer_before:
+ * @timer1: first timer,
+ * @timer2: second timer.
+ *
+ * Compares the due times of @timer1 and @timer2.
+ *
+ * Returns: TRUE if @timer1 is due before @timer2, FALSE otherwise.
+ **/
+static int
+nih_timer_before (NihTimer *timer1,
+		  NihTimer *timer2)
+{
+	nih_assert (timer1 != NULL);
+	nih_assert (timer2 != NULL);
+
+	if (timer1->due.tv_sec != timer2->due.tv_sec)
+		return timer1->due.tv_sec < timer2->due.tv_sec;
+
+	return timer1->due.tv_nsec < timer2->due.tv_nsec;
+}
+
+/**
+ * nih_timer_queue:
+ * @clock: clock to look up.
+ *
+ * Returns: the queue of timers for @clock.
+ **/
+static NihTimerQueue *
+nih_timer_queue (clockid_t clock)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (nih_timer_queues) / sizeof (NihTimerQueue);
+	     i++)
+		if (nih_timer_queues[i].clock == clock)
+			return &nih_timer_queues[i];
+
+	nih_assert_not_reached ();
+}
+
+/**
+ * nih_timer_queue_grow:
+ * @queue: queue to grow.
+ *
+ * Ensures that the heap of @queue has room for another timer using its
+ * clock.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+nih_timer_queue_grow (NihTimerQueue *queue)
+{
+	NihTimer **new_heap;
+	size_t     new_size;
+
+	nih_assert (queue != NULL);
+
+	if (queue->count + 1 <= queue->size)
+		return 0;
+
+	new_size = queue->size ? queue->size * 2 : 64;
+	new_heap = nih_realloc (queue->heap, NULL,
+				sizeof (NihTimer *) * new_size);
+	if (! new_heap)
+		return -1;
+
+	queue->heap = new_heap;
+	queue->size = new_size;
+
+	return 0;
+}
+
+/**
+ * nih_timer_queue_top:
+ * @queue: queue to check.
+ *
+ * Returns the timer at the top of @queue, first discarding any that
+ * have been removed from the list since they were queued.
+ *
+ * Returns: next timer due in @queue, or NULL if there are none.
+ **/
+static NihTimer *
+nih_timer_queue_top (NihTimerQueue *queue)
+{
+	nih_assert (queue != NULL);
+
+	while (queue->len) {
+		NihTimer *timer = queue->heap[0];
+
+		if (! NIH_LIST_EMPTY (&timer->entry))
+			return timer;
+
+		nih_timer_heap_remove (queue, timer);
+	}
+
+	return NULL;
+}
+
+/**
+ * nih_timer_queue_arm:
+ * @queue: queue to arm.
+ *
+ * Arms the timerfd of @queue to the due time of the timer at its top,
+ * creating the timerfd if necessary; the timerfd is only re-armed if that
+ * due time has changed.
+ *
+ * Does nothing unless nih_timer_init_fd() has been called.
+ **/
+static void
+nih_timer_queue_arm (NihTimerQueue *queue)
+{
+	struct itimerspec value;
+	NihTimer *        timer;
+
+	nih_assert (queue != NULL);
+
+	if (! nih_timer_use_fd)
+		return;
+
+	timer = nih_timer_queue_top (queue);
+
+	memset (&value, 0, sizeof (value));
+	if (timer) {
+		/* A zero value would disarm the timer */
+		value.it_value.tv_sec = timer->due.tv_sec;
+		value.it_value.tv_nsec = timer->due.tv_nsec;
+		if ((value.it_value.tv_sec <= 0)
+		    && (value.it_value.tv_nsec <= 0))
+			value.it_value.tv_nsec = 1;
+	}
+
+	if ((queue->fd >= 0) && (queue->forks == nih_io_forks)
+	    && (value.it_value.tv_sec == queue->armed.tv_sec)
+	    && (value.it_value.tv_nsec == queue->armed.tv_nsec))
+		return;
+
+	/* A timerfd is shared with a child process after fork(), so the
+	 * child must create its own.
+	 */
+	if ((queue->fd >= 0) && (queue->forks != nih_io_forks)) {
+		nih_free (queue->watch);
+		close (queue->fd);
+
+		queue->watch = NULL;
+		queue->fd = -1;
+	}
+
+	if (queue->fd < 0) {
+		if (! timer)
+			return;
+
+		queue->fd = timerfd_create (queue->clock,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+		if (queue->fd < 0)
+			return;
+
+		queue->watch = nih_io_add_watch (
+			NULL, queue->fd, NIH_IO_READ,
+			(NihIoWatcher)nih_timer_fd_watcher, queue);
+		if (! queue->watch) {
+			close (queue->fd);
+			queue->fd = -1;
+			return;
+		}
+
+		queue->forks = nih_io_forks;
+	}
+
+	if (timerfd_settime (queue->fd, TFD_TIMER_ABSTIME, &value, NULL) < 0)
+		return;
+
+	queue->armed = value.it_value;
+}
+
+/**
+ * nih_timer_fd_watcher:
+ * @queue: queue whose timerfd expired,
+ * @watch: watch on the timerfd,
+ * @events: events that occurred.
+ *
+ * Called when the timerfd of @queue expires, clears the expiration and
+ * triggers the timers that are now due.
+ **/
+static void
+nih_timer_fd_watcher (NihTimerQueue *queue,
+		      NihIoWatch    *watch,
+		      NihIoEvents    events)
+{
+	uint64_t expirations;
+
+	nih_assert (queue != NULL);
+	nih_assert (watch != NULL);
+
+	while (read (watch->fd, &expirations, sizeof (expirations)) < 0) {
+		if (errno != EINTR)
+			break;
+	}
+
+	/* The timerfd no longer reflects the due time we armed it to */
+	queue->armed.tv_sec = -1;
+
+	nih_timer_queue_poll (queue);
+	nih_timer_queue_arm (queue);
+}
+
+
+/**
+ * nih_timer_heap_place:
+ * @queue: queue containing heap,
+ * @timer: timer to place,
+ * @index: position in heap.
+ *
+ * Stores @timer at @index in the heap.
+ **/
+static void
+nih_timer_heap_place (NihTimerQueue *queue,
+		      NihTimer      *timer,
+		      size_t         index)
+{
+	nih_assert (queue != NULL);
+	nih_assert (timer != NULL);
+	nih_assert (index < queue->len);
+
+	queue->heap[index] = timer;
+	timer->heap_index = index;
+}
+
+/**
+ * nih_timer_heap_up:
+ * @queue: queue containing heap,
+ * @timer: timer to move.
+ *
+ * Moves @timer towards the top of the heap until it is not due before
+ * its parent.
+ **/
+static void
+nih_timer_heap_up (NihTimerQueue *queue,
+		   NihTimer      *timer)
+{
+	size_t index;
+
+	nih_assert (queue != NULL);
+	nih_assert (timer != NULL);
+
+	index = timer->heap_index;
+	while (index > 0) {
+		NihTimer *parent = queue->heap[(index - 1) / 2];
+
+		if (! nih_timer_before (timer, parent))
+			break;
+
+		nih_timer_heap_place (queue, parent, index);
+		index = (index - 1) / 2;
+	}
+
+	nih_timer_heap_place (queue, timer, index);
+}
+
+/**
+ * nih_timer_heap_down:
+ * @queue: queue containing heap,
+ * @timer: timer to move.
+ *
+ * Moves @timer towards the bottom of the heap until neither of its
+ * children are due before it.
+ **/
+static void
+nih_timer_heap_down (NihTimerQueue *queue,
+		     NihTimer      *timer)
+{
+	size_t index;
+
+	nih_assert (queue != NULL);
+	nih_assert (timer != NULL);
+
+	index = timer->heap_index;
+	for (;;) {
+		NihTimer *child;
+		size_t    child_index;
+
+		child_index = index * 2 + 1;
+		if (child_index >= queue->len)
+			break;
+
+		if ((child_index + 1 < queue->len)
+		    && nih_timer_before (queue->heap[child_index + 1],
+					 queue->heap[child_index]))
+			child_index++;
+
+		child = queue->heap[child_index];
+		if (! nih_timer_before (child, timer))
+			break;
+
+		nih_timer_heap_place (queue, child, index);
+		index = child_index;
+	}
+
+	nih_timer_heap_place (queue, timer, index);
+}
+
+/**
+ * nih_timer_heap_remove:
+ * @queue: queue containing heap,
+ * @timer: timer to remove.
+ *
+ * Removes @timer from the heap, moving the last timer into its place.
+ **/
+static void
+nih_timer_heap_remove (NihTimerQueue *queue,
+		       NihTimer      *timer)
+{
+	NihTimer *last;
+	size_t    index;
+
+	nih_assert (queue != NULL);
+	nih_assert (timer != NULL);
+	nih_assert (timer->heap_index < queue->len);
+
+	index = timer->heap_index;
+	timer->heap_index = NIH_TIMER_NOT_QUEUED;
+
+	last = queue->heap[--queue->len];
+	if (last == timer)
+		return;
+
+	nih_timer_heap_place (queue, last, index);
+	nih_timer_heap_up (queue, last);
+	nih_timer_heap_down (queue, last);
+}
+
+
+/**
+ * nih_timer_next_due:
+ *
+ * Compares the timers at the top of the queue for each clock, which have
+ * the lowest due times, so that the timer returned is either due to be
+ * triggered now or in some period's time.
  *
  * Returns: next timer due, or NULL if there are no timers.
  **/
 NihTimer *
 nih_timer_next_due (void)
 {
-	NihTimer *next;
+	NihTimer *      next = NULL;
+	struct timespec next_remaining;
+	size_t          i;
 
 	nih_timer_init ();
 
-	next = NULL;
-	NIH_LIST_FOREACH (nih_timers, iter) {
-		NihTimer *timer = (NihTimer *)iter;
+	for (i = 0; i < sizeof (nih_timer_queues) / sizeof (NihTimerQueue);
+	     i++) {
+		NihTimer *      timer;
+		struct timespec remaining;
 
-		if ((next == NULL) || (timer->due < next->due))
+		timer = nih_timer_queue_top (&nih_timer_queues[i]);
+		if (! timer)
+			continue;
+
+		if (! next) {
+			next = timer;
+			continue;
+		}
+
+		/* Timers using different clocks can only be compared by
+		 * how long remains until they are due.
+		 */
+		nih_timer_remaining (next, &next_remaining);
+		nih_timer_remaining (timer, &remaining);
+
+		if ((remaining.tv_sec < next_remaining.tv_sec)
+		    || ((remaining.tv_sec == next_remaining.tv_sec)
+			&& (remaining.tv_nsec < next_remaining.tv_nsec)))
 			next = timer;
 	}
 
 	return next;
 }
 
+/**
+ * nih_timer_next_timeout:
+ * @timeout: pointer to store result in.
+ *
+ * Calculates how long the main loop may sleep for before the next timer is
+ * due, ignoring timers that are triggered by a timerfd.  That way we don't
+ * sleep for any less or more time than we need to.
+ *
+ * Returns: TRUE if @timeout was set, FALSE if the main loop may sleep
+ * indefinitely.
+ **/
+int
+nih_timer_next_timeout (struct timespec *timeout)
+{
+	int    found = FALSE;
+	size_t i;
+
+	nih_assert (timeout != NULL);
+
+	nih_timer_init ();
+
+	for (i = 0; i < sizeof (nih_timer_queues) / sizeof (NihTimerQueue);
+	     i++) {
+		NihTimer *      timer;
+		struct timespec remaining;
+
+		if (nih_timer_queues[i].fd >= 0)
+			continue;
+
+		timer = nih_timer_queue_top (&nih_timer_queues[i]);
+		if (! timer)
+			continue;
+
+		nih_timer_remaining (timer, &remaining);
+		if (remaining.tv_sec < 0) {
+			remaining.tv_sec = 0;
+			remaining.tv_nsec = 0;
+		}
+
+		if ((! found)
+		    || (remaining.tv_sec < timeout->tv_sec)
+		    || ((remaining.tv_sec == timeout->tv_sec)
+			&& (remaining.tv_nsec < timeout->tv_nsec)))
+			*timeout = remaining;
+
+		found = TRUE;
+	}
+
+	return found;
+}
+
 
 /**
  * nih_timer_poll:
  *
- * Iterates the complete list of timers and triggers any for which the
- * due time is less than or equal to the current time by calling their
+ * Takes timers from the top of each queue for which the due time is less
+ * than or equal to the current time and triggers them by calling their
  * callback functions.
  *
  * Arranges for the timer to be rescheuled, unless it is a timeout in which
@@ -282,17 +1122,50 @@ nih_timer_next_due (void)
 void
 nih_timer_poll (void)
 {
-	struct timespec now;
+	size_t i;
 
 	nih_timer_init ();
 
-	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+	for (i = 0; i < sizeof (nih_timer_queues) / sizeof (NihTimerQueue);
+	     i++)
+		if (nih_timer_queues[i].len)
+			nih_timer_queue_poll (&nih_timer_queues[i]);
+}
 
-	NIH_LIST_FOREACH_SAFE (nih_timers, iter) {
-		NihTimer *timer = (NihTimer *)iter;
+/**
+ * nih_timer_queue_poll:
+ * @queue: queue to poll.
+ *
+ * Takes timers from the top of @queue for which the due time is less
+ * than or equal to the current time and triggers them.  Rescheduled timers
+ * are not placed back in the queue until all due timers have been
+ * triggered, so each is triggered no more than once.
+ **/
+static void
+nih_timer_queue_poll (NihTimerQueue *queue)
+{
+	struct timespec now;
+	NihList         rescheduled;
+
+	nih_assert (queue != NULL);
+
+	nih_assert (clock_gettime (queue->clock, &now) == 0);
+
+	nih_list_init (&rescheduled);
+
+	while (queue->len) {
+		NihTimer *timer = queue->heap[0];
 		int       free_when_done = FALSE;
 
-		if (timer->due > now.tv_sec)
+		if ((timer->due.tv_sec > now.tv_sec)
+		    || ((timer->due.tv_sec == now.tv_sec)
+			&& (timer->due.tv_nsec > now.tv_nsec)))
+			break;
+
+		nih_timer_heap_remove (queue, timer);
+
+		/* Removed from the list since it was queued */
+		if (NIH_LIST_EMPTY (&timer->entry))
 			continue;
 
 		switch (timer->type) {
@@ -301,11 +1174,15 @@ nih_timer_poll (void)
 			free_when_done = TRUE;
 			break;
 		case NIH_TIMER_PERIODIC:
-			timer->due = now.tv_sec + timer->period;
+			nih_timer_set_due (timer, &now, timer->period,
+					   timer->period_nsec);
+			nih_list_add (&rescheduled, &timer->entry);
 			break;
 		case NIH_TIMER_SCHEDULED:
 			/* FIXME Not implemented */
-			timer->due = 0;
+			timer->due.tv_sec = 0;
+			timer->due.tv_nsec = 0;
+			nih_list_add (&rescheduled, &timer->entry);
 			break;
 		}
 
@@ -316,4 +1193,16 @@ nih_timer_poll (void)
 		if (free_when_done)
 			nih_free (timer);
 	}
+
+	/* Place rescheduled timers that are still wanted back into the
+	 * list and queue.
+	 */
+	NIH_LIST_FOREACH_SAFE (&rescheduled, iter) {
+		NihTimer *timer = (NihTimer *)iter;
+
+		nih_list_add (nih_timers, &timer->entry);
+		nih_timer_update (timer);
+	}
+
+	nih_timer_queue_arm (queue);
 }
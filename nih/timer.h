@@ -24,6 +24,7 @@
 #include <nih/list.h>
 
 #include <time.h>
+#include <stdint.h>
 
 
 /**
@@ -74,13 +75,17 @@ typedef struct nih_timer_schedule {
 /**
  * NihTimer:
  * @entry: list header,
- * @due: time next due,
+ * @due: time next due, measured against @clock,
  * @type: type of timer,
  * @timeout: seconds after registration timer should be triggered (timeout),
  * @period: seconds between triggerings of timer (periodic),
  * @schedule: detail of when to call the timer (scheduled),
  * @callback: function called when timer triggered,
- * @data: pointer passed to callback.
+ * @data: pointer passed to callback,
+ * @timeout_nsec: nanoseconds part of @timeout (timeout),
+ * @period_nsec: nanoseconds part of @period (periodic),
+ * @clock: clock that @due is measured against,
+ * @heap_index: position in the queue of timers (used internally).
  *
  * Timers may be used whenever a function needs to be called later in
  * the process.  They are divided into three types, identified by @type.
@@ -90,11 +95,19 @@ typedef struct nih_timer_schedule {
  * Scheduled timers are called based on the information in @schedule.
  *
  * In all cases, a timer may be cancelled by calling nih_list_remove() on
- * it as they are held in a list internally.
+ * it as they are held in a list internally.  If you change @due, or
+ * place the timer back into the list, you must call
+ * nih_timer_update() afterwards so that the timer queue is kept in order;
+ * otherwise the timer may be triggered at the wrong time.
+ * Changes to @period and @period_nsec take effect when the timer is next
+ * triggered and need no such call.
+ *
+ * @due is measured against CLOCK_MONOTONIC unless changed with
+ * nih_timer_set_clock().
  **/
 struct nih_timer {
 	NihList       entry;
-	time_t        due;
+	struct timespec due;
 
 	NihTimerType  type;
 	union {
@@ -105,6 +118,12 @@ struct nih_timer {
 
 	NihTimerCb    callback;
 	void         *data;
+
+	long          timeout_nsec;
+	long          period_nsec;
+
+	clockid_t     clock;
+	size_t        heap_index;
 };
 
 
@@ -114,19 +133,37 @@ extern NihList *nih_timers;
 
 
 void      nih_timer_init          (void);
+void      nih_timer_init_fd       (void);
 
 NihTimer *nih_timer_add_timeout   (const void *parent, time_t timeout,
 				   NihTimerCb callback, void *data)
 	__attribute__ ((warn_unused_result, malloc));
+NihTimer *nih_timer_add_timeout_ms (const void *parent, uint64_t timeout,
+				    NihTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
+NihTimer *nih_timer_add_timeout_ns (const void *parent, uint64_t timeout,
+				    NihTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
 NihTimer *nih_timer_add_periodic  (const void *parent, time_t period,
 				   NihTimerCb callback, void *data)
 	__attribute__ ((warn_unused_result, malloc));
+NihTimer *nih_timer_add_periodic_ms (const void *parent, uint64_t period,
+				     NihTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
+NihTimer *nih_timer_add_periodic_ns (const void *parent, uint64_t period,
+				     NihTimerCb callback, void *data)
+	__attribute__ ((warn_unused_result, malloc));
 NihTimer *nih_timer_add_scheduled (const void *parent,
 				   NihTimerSchedule *schedule,
 				   NihTimerCb callback, void *data)
 	__attribute__ ((warn_unused_result, malloc));
 
+void      nih_timer_update         (NihTimer *timer);
+int       nih_timer_set_clock      (NihTimer *timer, clockid_t clock)
+	__attribute__ ((warn_unused_result));
+
 NihTimer *nih_timer_next_due       (void);
+int       nih_timer_next_timeout   (struct timespec *timeout);
 void      nih_timer_poll           (void);
 
 NIH_END_EXTERN
@@ -31,6 +31,30 @@
 #include "tree.h"
 
 
+/**
+ * HEIGHT:
+ * @_node: node to check.
+ *
+ * Macro to expand to the height of the subtree rooted at an NihTreeIndex
+ * node, which may be NULL for an empty subtree.
+ **/
+#define HEIGHT(_node) ((_node) ? ((NihTreeIndexNode *)(_node))->height : 0)
+
+
+/* Prototypes for static functions */
+static int  nih_tree_walk            (NihTree *tree, NihTreeVisitor pre,
+				      NihTreeVisitor in, NihTreeVisitor post,
+				      void *data);
+static int  nih_tree_free_node       (void *data, NihTree *node);
+static void nih_tree_index_replace   (NihTreeIndex *index, NihTree *parent,
+				      NihTree *node, NihTree *child);
+static void nih_tree_index_rotate    (NihTreeIndex *index, NihTree *node,
+				      NihTreeWhere where);
+static void nih_tree_index_rebalance (NihTreeIndex *index, NihTree *node);
+static NihTree *nih_tree_index_insert (NihTreeIndex *index,
+				       NihTreeIndexNode *node, int unique);
+
+
 /**
  * nih_tree_init:
  * @tree: tree node to be initialised.
@@ -619,3 +643,671 @@ nih_tree_prev_post_full (NihTree       *tree,
 		prev = tmp;
 	}
 }
+
+
+/**
+ * nih_tree_walk:
+ * @tree: tree to walk,
+ * @pre: function to call before a node's children,
+ * @in: function to call between a node's children,
+ * @post: function to call after a node's children,
+ * @data: pointer to pass to each function.
+ *
+ * Walks every node of @tree in a single pass, calling whichever of @pre,
+ * @in and @post are not NULL for each.  The position is carried from one
+ * node to the next rather than re-derived from the parent pointers, so
+ * each link is followed exactly twice, and no stack is needed.
+ *
+ * The parent of a node is found before @post is called for it, so @post
+ * may free the node; nodes above it must be left alone.
+ *
+ * Returns: zero once every node has been visited, or the negative value
+ * returned by a function to stop the walk.
+ **/
+static int
+nih_tree_walk (NihTree        *tree,
+	       NihTreeVisitor  pre,
+	       NihTreeVisitor  in,
+	       NihTreeVisitor  post,
+	       void           *data)
+{
+	NihTree *node = tree;
+	int      from = 0;
+	int      ret;
+
+	while (node) {
+		NihTree *parent;
+
+		/* from is zero when we've come down to node from its
+		 * parent, otherwise the side of node we've come back up from.
+		 */
+		if (from == 0) {
+			if (pre && ((ret = pre (data, node)) < 0))
+				return ret;
+
+			if (node->left) {
+				node = node->left;
+				continue;
+			}
+
+			from = NIH_TREE_LEFT;
+		}
+
+		if (from == NIH_TREE_LEFT) {
+			if (in && ((ret = in (data, node)) < 0))
+				return ret;
+
+			if (node->right) {
+				node = node->right;
+				from = 0;
+				continue;
+			}
+		}
+
+		parent = (node != tree) ? node->parent : NULL;
+		from = ((parent && (parent->left == node))
+			? NIH_TREE_LEFT : NIH_TREE_RIGHT);
+
+		if (post && ((ret = post (data, node)) < 0))
+			return ret;
+
+		node = parent;
+	}
+
+	return 0;
+}
+
+/**
+ * nih_tree_visit:
+ * @tree: tree to walk,
+ * @visitor: function to call for each node,
+ * @data: pointer to pass to @visitor.
+ *
+ * Calls @visitor for every node of @tree in order, in the same sequence
+ * as NIH_TREE_FOREACH() but in a single pass with no filter, so is the
+ * cheaper way to visit a whole tree.  @visitor must not change the tree.
+ *
+ * Returns: zero once every node has been visited, or the negative value
+ * returned by @visitor to stop the walk.
+ **/
+int
+nih_tree_visit (NihTree        *tree,
+		NihTreeVisitor  visitor,
+		void           *data)
+{
+	nih_assert (visitor != NULL);
+
+	return nih_tree_walk (tree, NULL, visitor, NULL, data);
+}
+
+/**
+ * nih_tree_visit_pre:
+ * @tree: tree to walk,
+ * @visitor: function to call for each node,
+ * @data: pointer to pass to @visitor.
+ *
+ * Calls @visitor for every node of @tree in pre-order, as
+ * NIH_TREE_FOREACH_PRE() would visit them.  @visitor must not change the
+ * tree.
+ *
+ * Returns: zero once every node has been visited, or the negative value
+ * returned by @visitor to stop the walk.
+ **/
+int
+nih_tree_visit_pre (NihTree        *tree,
+		    NihTreeVisitor  visitor,
+		    void           *data)
+{
+	nih_assert (visitor != NULL);
+
+	return nih_tree_walk (tree, visitor, NULL, NULL, data);
+}
+
+/**
+ * nih_tree_visit_post:
+ * @tree: tree to walk,
+ * @visitor: function to call for each node,
+ * @data: pointer to pass to @visitor.
+ *
+ * Calls @visitor for every node of @tree in post-order, as
+ * NIH_TREE_FOREACH_POST() would visit them.  Since each node is visited
+ * after its children, and never returned to, @visitor may free the node
+ * it is given, but must not change the nodes above it.
+ *
+ * Returns: zero once every node has been visited, or the negative value
+ * returned by @visitor to stop the walk.
+ **/
+int
+nih_tree_visit_post (NihTree        *tree,
+		     NihTreeVisitor  visitor,
+		     void           *data)
+{
+	nih_assert (visitor != NULL);
+
+	return nih_tree_walk (tree, NULL, NULL, visitor, data);
+}
+
+
+/**
+ * nih_tree_partition:
+ * @tree: tree to divide,
+ * @max: largest number of subtrees,
+ * @subtrees: array to store subtrees in,
+ * @nodes: array to store remaining nodes in,
+ * @nnodes: pointer to store number of @nodes in.
+ *
+ * Divides @tree into at most @max disjoint subtrees, storing their roots
+ * in @subtrees, so that they may be walked independently; for example by
+ * calling nih_tree_visit() for each from a different thread.  The tree is
+ * not changed, each subtree still has its parent pointer.
+ *
+ * The subtrees are found by repeatedly replacing a subtree whose root has
+ * two children with those children, working down the tree a level at a
+ * time, so a balanced tree is divided into subtrees of similar size.  The
+ * roots replaced are stored in @nodes, which must have room for @max - 1
+ * entries, and their number in @nnodes; together with the subtrees they
+ * make up the whole of @tree.
+ *
+ * Returns: number of subtrees stored in @subtrees, zero if @tree is NULL.
+ **/
+size_t
+nih_tree_partition (NihTree  *tree,
+		    size_t    max,
+		    NihTree **subtrees,
+		    NihTree **nodes,
+		    size_t   *nnodes)
+{
+	size_t len = 0;
+	int    split = TRUE;
+
+	nih_assert (max > 0);
+	nih_assert (subtrees != NULL);
+	nih_assert (nnodes != NULL);
+
+	*nnodes = 0;
+
+	if (! tree)
+		return 0;
+
+	subtrees[len++] = tree;
+
+	while (split && (len < max)) {
+		size_t level = len, i;
+
+		split = FALSE;
+		for (i = 0; (i < level) && (len < max); i++) {
+			NihTree *root = subtrees[i];
+
+			if (! (root->left && root->right))
+				continue;
+
+			nih_assert (nodes != NULL);
+			nodes[(*nnodes)++] = root;
+
+			subtrees[i] = root->left;
+			subtrees[len++] = root->right;
+			split = TRUE;
+		}
+	}
+
+	return len;
+}
+
+
+/**
+ * nih_tree_free_node:
+ * @data: not used,
+ * @node: node to free.
+ *
+ * Visitor function for nih_tree_free_all(); since the children of @node
+ * have already been freed, and its parent is about to be, @node is
+ * cleared first so that its destructor has nothing to unlink.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_tree_free_node (void    *data,
+		    NihTree *node)
+{
+	nih_assert (node != NULL);
+
+	nih_tree_init (node);
+	nih_free (node);
+
+	return 0;
+}
+
+/**
+ * nih_tree_free_all:
+ * @tree: tree to free.
+ *
+ * Removes @tree from any tree containing it and then frees it and every
+ * node below it with nih_free() in a single post-order pass.  Each node
+ * must be the start of an object allocated with nih_alloc(), as those
+ * returned by nih_tree_new() and nih_tree_entry_new() are; their
+ * destructors are run as usual, but find the node already unlinked.
+ **/
+void
+nih_tree_free_all (NihTree *tree)
+{
+	if (! tree)
+		return;
+
+	nih_tree_remove (tree);
+
+	nih_tree_walk (tree, NULL, NULL, nih_tree_free_node, NULL);
+}
+
+
+/**
+ * nih_tree_index_new:
+ * @parent: parent object for new index,
+ * @key_function: function used to obtain the key of a node,
+ * @cmp_function: function used to compare keys.
+ *
+ * Allocates a new, empty, balanced tree index.  Nodes added are ordered
+ * by the keys returned by @key_function, as compared by @cmp_function.
+ *
+ * The structure is allocated using nih_alloc() so can be used as a context
+ * to other allocations; nodes are not freed along with the index unless
+ * they are also its children.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned index.  When all parents
+ * of the returned index are freed, the returned index will also be
+ * freed.
+ *
+ * Returns: the new index or NULL if the allocation failed.
+ **/
+NihTreeIndex *
+nih_tree_index_new (const void         *parent,
+		    NihTreeKeyFunction  key_function,
+		    NihTreeCmpFunction  cmp_function)
+{
+	NihTreeIndex *index;
+
+	nih_assert (key_function != NULL);
+	nih_assert (cmp_function != NULL);
+
+	index = nih_new (parent, NihTreeIndex);
+	if (! index)
+		return NULL;
+
+	index->root = NULL;
+	index->entries = 0;
+
+	index->key_function = key_function;
+	index->cmp_function = cmp_function;
+
+	return index;
+}
+
+
+/**
+ * nih_tree_index_replace:
+ * @index: index containing @node,
+ * @parent: parent of @node,
+ * @node: node to be replaced,
+ * @child: node to replace it.
+ *
+ * Points the link from @parent to @node, or the root of @index if @parent
+ * is NULL, at @child instead.  The parent pointer of @child is updated,
+ * that of @node is left alone.
+ **/
+static void
+nih_tree_index_replace (NihTreeIndex *index,
+			NihTree      *parent,
+			NihTree      *node,
+			NihTree      *child)
+{
+	nih_assert (index != NULL);
+	nih_assert (node != NULL);
+
+	if (! parent) {
+		index->root = child;
+	} else if (parent->left == node) {
+		parent->left = child;
+	} else {
+		nih_assert (parent->right == node);
+		parent->right = child;
+	}
+
+	if (child)
+		child->parent = parent;
+}
+
+/**
+ * nih_tree_index_rotate:
+ * @index: index containing @node,
+ * @node: node to rotate,
+ * @where: direction to rotate.
+ *
+ * Rotates the subtree rooted at @node, such that @node becomes the child
+ * on the side given by @where of its child from the other side, which
+ * takes its place.  The heights of both nodes are updated.
+ **/
+static void
+nih_tree_index_rotate (NihTreeIndex *index,
+		       NihTree      *node,
+		       NihTreeWhere  where)
+{
+	NihTree *pivot;
+
+	nih_assert (index != NULL);
+	nih_assert (node != NULL);
+
+	if (where == NIH_TREE_LEFT) {
+		pivot = node->right;
+		nih_assert (pivot != NULL);
+
+		node->right = pivot->left;
+		if (node->right)
+			node->right->parent = node;
+
+		nih_tree_index_replace (index, node->parent, node, pivot);
+
+		pivot->left = node;
+	} else {
+		pivot = node->left;
+		nih_assert (pivot != NULL);
+
+		node->left = pivot->right;
+		if (node->left)
+			node->left->parent = node;
+
+		nih_tree_index_replace (index, node->parent, node, pivot);
+
+		pivot->right = node;
+	}
+
+	node->parent = pivot;
+
+	((NihTreeIndexNode *)node)->height
+		= nih_max (HEIGHT (node->left), HEIGHT (node->right)) + 1;
+	((NihTreeIndexNode *)pivot)->height
+		= nih_max (HEIGHT (pivot->left), HEIGHT (pivot->right)) + 1;
+}
+
+/**
+ * nih_tree_index_rebalance:
+ * @index: index containing @node,
+ * @node: lowest node whose subtree changed.
+ *
+ * Walks from @node up to the root of @index, updating the height of each
+ * node and rotating any whose subtrees differ in height by more than one.
+ * The walk stops early once a node's height is unchanged and it needed
+ * no rotation, since nothing above it can have changed either.
+ **/
+static void
+nih_tree_index_rebalance (NihTreeIndex *index,
+			  NihTree      *node)
+{
+	nih_assert (index != NULL);
+
+	while (node) {
+		NihTree *parent = node->parent;
+		int      left, right, height;
+
+		left = HEIGHT (node->left);
+		right = HEIGHT (node->right);
+
+		if (left > right + 1) {
+			if (HEIGHT (node->left->left)
+			    < HEIGHT (node->left->right))
+				nih_tree_index_rotate (index, node->left,
+						       NIH_TREE_LEFT);
+
+			nih_tree_index_rotate (index, node, NIH_TREE_RIGHT);
+		} else if (right > left + 1) {
+			if (HEIGHT (node->right->right)
+			    < HEIGHT (node->right->left))
+				nih_tree_index_rotate (index, node->right,
+						       NIH_TREE_RIGHT);
+
+			nih_tree_index_rotate (index, node, NIH_TREE_LEFT);
+		} else {
+			height = nih_max (left, right) + 1;
+			if (((NihTreeIndexNode *)node)->height == height)
+				return;
+
+			((NihTreeIndexNode *)node)->height = height;
+		}
+
+		node = parent;
+	}
+}
+
+/**
+ * nih_tree_index_insert:
+ * @index: index to add to,
+ * @node: node to be added,
+ * @unique: whether nodes with the same key are refused.
+ *
+ * Adds @node to @index in the position given by its key, after any nodes
+ * with the same key unless @unique is TRUE, and rebalances the tree.
+ *
+ * Returns: @node, or the existing node if @unique is TRUE and there was
+ * one with the same key.
+ **/
+static NihTree *
+nih_tree_index_insert (NihTreeIndex     *index,
+		       NihTreeIndexNode *node,
+		       int               unique)
+{
+	NihTree    *parent = NULL;
+	NihTree   **link;
+	const void *key;
+
+	nih_assert (index != NULL);
+	nih_assert (node != NULL);
+	nih_assert (node->node.parent == NULL);
+	nih_assert (node->node.left == NULL);
+	nih_assert (node->node.right == NULL);
+
+	key = index->key_function (&node->node);
+
+	link = &index->root;
+	while (*link) {
+		int cmp;
+
+		parent = *link;
+		cmp = index->cmp_function (key, index->key_function (parent));
+
+		if (cmp < 0) {
+			link = &parent->left;
+		} else if ((cmp > 0) || (! unique)) {
+			link = &parent->right;
+		} else {
+			return parent;
+		}
+	}
+
+	*link = &node->node;
+	node->node.parent = parent;
+	node->height = 1;
+
+	index->entries++;
+
+	nih_tree_index_rebalance (index, parent);
+
+	return &node->node;
+}
+
+/**
+ * nih_tree_index_add:
+ * @index: index to add to,
+ * @node: node to be added.
+ *
+ * Adds @node to @index in the position given by its key, which must be
+ * unchanged for as long as the node remains in the index; the tree is
+ * rebalanced as necessary.  Where there are already nodes with the same
+ * key, @node is placed after them.
+ *
+ * @node must not already be in a tree; it is not reparented with
+ * nih_alloc(), and should be removed from @index with
+ * nih_tree_index_remove() before being freed.
+ *
+ * Returns: @node.
+ **/
+NihTree *
+nih_tree_index_add (NihTreeIndex     *index,
+		    NihTreeIndexNode *node)
+{
+	return nih_tree_index_insert (index, node, FALSE);
+}
+
+/**
+ * nih_tree_index_add_unique:
+ * @index: index to add to,
+ * @node: node to be added.
+ *
+ * Adds @node to @index in the position given by its key, as
+ * nih_tree_index_add() does, but only if there is no node with the same
+ * key already in the index.
+ *
+ * Returns: @node, or the existing node with the same key in which case
+ * @node is not added.
+ **/
+NihTree *
+nih_tree_index_add_unique (NihTreeIndex     *index,
+			   NihTreeIndexNode *node)
+{
+	return nih_tree_index_insert (index, node, TRUE);
+}
+
+/**
+ * nih_tree_index_lookup:
+ * @index: index to search,
+ * @key: key to look for.
+ *
+ * Finds the node in @index whose key is equal to @key, as compared by the
+ * index's comparison function; where there is more than one, the first is
+ * returned and the others follow it with nih_tree_next().
+ *
+ * Returns: node found or NULL if there is no node with that key.
+ **/
+NihTree *
+nih_tree_index_lookup (NihTreeIndex *index,
+		       const void   *key)
+{
+	NihTree *node, *found = NULL;
+
+	nih_assert (index != NULL);
+
+	node = index->root;
+	while (node) {
+		int cmp;
+
+		cmp = index->cmp_function (key, index->key_function (node));
+		if (cmp < 0) {
+			node = node->left;
+		} else if (cmp > 0) {
+			node = node->right;
+		} else {
+			found = node;
+			node = node->left;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * nih_tree_index_lower_bound:
+ * @index: index to search,
+ * @key: key to look for.
+ *
+ * Finds the first node in @index whose key is not less than @key, as
+ * compared by the index's comparison function.  The nodes following it,
+ * with nih_tree_next(), are those with greater or equal keys; so this can
+ * be used to iterate a range of keys.
+ *
+ * Returns: node found or NULL if every key is less than @key.
+ **/
+NihTree *
+nih_tree_index_lower_bound (NihTreeIndex *index,
+			    const void   *key)
+{
+	NihTree *node, *found = NULL;
+
+	nih_assert (index != NULL);
+
+	node = index->root;
+	while (node) {
+		if (index->cmp_function (key, index->key_function (node)) <= 0) {
+			found = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * nih_tree_index_remove:
+ * @index: index containing @node,
+ * @node: node to be removed.
+ *
+ * Removes @node from @index and rebalances the tree.  The node is not
+ * freed, and is left as the root of a tree of its own so that it may be
+ * added to an index again or freed.
+ *
+ * Returns: @node.
+ **/
+NihTree *
+nih_tree_index_remove (NihTreeIndex     *index,
+		       NihTreeIndexNode *node)
+{
+	NihTree *self, *parent;
+
+	nih_assert (index != NULL);
+	nih_assert (node != NULL);
+	nih_assert (index->entries > 0);
+
+	self = &node->node;
+
+	if (self->left && self->right) {
+		NihTree *next;
+
+		/* Put the following node, which has no left child, in
+		 * place of this one; it's the nodes rather than their
+		 * contents that are moved, since the contents are the
+		 * caller's.
+		 */
+		next = self->right;
+		while (next->left)
+			next = next->left;
+
+		if (next->parent == self) {
+			parent = next;
+		} else {
+			parent = next->parent;
+
+			nih_tree_index_replace (index, parent, next,
+						next->right);
+
+			next->right = self->right;
+			next->right->parent = next;
+		}
+
+		next->left = self->left;
+		next->left->parent = next;
+
+		nih_tree_index_replace (index, self->parent, self, next);
+		((NihTreeIndexNode *)next)->height = node->height;
+	} else {
+		parent = self->parent;
+
+		nih_tree_index_replace (index, parent, self,
+					self->left ? self->left : self->right);
+	}
+
+	nih_tree_init (self);
+	index->entries--;
+
+	nih_tree_index_rebalance (index, parent);
+
+	return self;
+}
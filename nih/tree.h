@@ -63,6 +63,25 @@
  * NIH_TREE_FOREACH_FULL(), NIH_TREE_FOREACH_PRE_FULL() and
  * NIH_TREE_FOREACH_POST_FULL().  Versions which pass NULL for the filter
  * are provided without the _FULL extension.
+ *
+ * Where every node is to be visited, nih_tree_visit(), nih_tree_visit_pre()
+ * and nih_tree_visit_post() walk the whole tree in a single pass calling
+ * a function for each node, which is cheaper than calling the iteration
+ * functions for each.  A tree may be divided into disjoint subtrees, to
+ * be walked in parallel, with nih_tree_partition(); and a whole tree of
+ * allocated nodes freed at once with nih_tree_free_all().
+ *
+ * Where the tree is used as a sorted index, it may instead be kept
+ * balanced by an NihTreeIndex created with nih_tree_index_new(), given
+ * functions to obtain and compare the key of each node.  Nodes embed
+ * NihTreeIndexNode rather than NihTree, and are added with
+ * nih_tree_index_add(), found with nih_tree_index_lookup() or
+ * nih_tree_index_lower_bound() and removed with nih_tree_index_remove().
+ * The index's @root is an ordinary tree, so all of the above iteration
+ * functions may be used on it, giving the nodes in key order; though since
+ * the root changes as nodes are added and removed, and is NULL when the
+ * index is empty, NIH_TREE_INDEX_FOREACH() and
+ * NIH_TREE_INDEX_FOREACH_FULL() are provided for convenience.
  **/
 
 
@@ -138,6 +157,81 @@ typedef struct nih_tree_entry {
  **/
 typedef int (*NihTreeFilter) (void *data, NihTree *node);
 
+/**
+ * NihTreeVisitor:
+ * @data: data pointer,
+ * @node: node being visited.
+ *
+ * A tree visitor is a function that is called for each node when walking
+ * a tree with nih_tree_visit() and similar functions.
+ *
+ * Returns: zero to continue the walk, or a negative value to stop it.
+ **/
+typedef int (*NihTreeVisitor) (void *data, NihTree *node);
+
+/**
+ * NihTreeKeyFunction:
+ * @node: node to obtain key from.
+ *
+ * A key function is called to obtain the key of a node in an NihTreeIndex,
+ * usually a member of the structure that embeds the node.
+ *
+ * Returns: constant key.
+ **/
+typedef const void *(*NihTreeKeyFunction) (NihTree *node);
+
+/**
+ * NihTreeCmpFunction:
+ * @key1: key to compare,
+ * @key2: key to compare against.
+ *
+ * A comparison function is called to order the keys of nodes in an
+ * NihTreeIndex.
+ *
+ * Returns: integer less than, equal to or greater than zero if @key1 is
+ * respectively less than, equal to or greater than @key2.
+ **/
+typedef int (*NihTreeCmpFunction) (const void *key1, const void *key2);
+
+
+/**
+ * NihTreeIndexNode:
+ * @node: tree node,
+ * @height: height of the subtree rooted at this node.
+ *
+ * This structure must be placed at the start of your own structures to
+ * add them to an NihTreeIndex, and initialised with nih_tree_init() on
+ * @node.  The @height is maintained by the index and is only meaningful
+ * while the node is in one.
+ **/
+typedef struct nih_tree_index_node {
+	NihTree node;
+	int     height;
+} NihTreeIndexNode;
+
+/**
+ * NihTreeIndex:
+ * @root: root node of the tree, or NULL if empty,
+ * @entries: number of nodes in the tree,
+ * @key_function: function used to obtain the key of a node,
+ * @cmp_function: function used to compare keys.
+ *
+ * This structure represents a binary tree kept sorted by the keys of its
+ * nodes, and balanced such that the two subtrees of any node differ in
+ * height by at most one, so the depth of the tree never exceeds about
+ * 1.44 log2 of the number of nodes.
+ *
+ * The nodes in @root may be iterated using the tree iteration functions,
+ * but its structure must not be changed directly.
+ **/
+typedef struct nih_tree_index {
+	NihTree            *root;
+	size_t              entries;
+
+	NihTreeKeyFunction  key_function;
+	NihTreeCmpFunction  cmp_function;
+} NihTreeIndex;
+
 
 /**
  * NIH_TREE_FOREACH_FULL:
@@ -339,6 +433,46 @@ typedef int (*NihTreeFilter) (void *data, NihTree *node);
 	for (NihTree *iter = nih_tree_next_post ((tree), NULL); iter != NULL; \
 	     iter = nih_tree_next_post ((tree), iter))
 
+/**
+ * NIH_TREE_INDEX_FOREACH_FULL:
+ * @index: index to iterate,
+ * @iter: name of iterator variable,
+ * @filter: filter function to test each node,
+ * @data: data pointer to pass to @filter.
+ *
+ * Expands to a for statement that iterates over each node in @index in
+ * order of their keys, setting @iter to each node for the block within
+ * the loop.
+ *
+ * If @filter is given, it will be called for each node visited and must
+ * return FALSE otherwise the node and its children will be ignored.
+ *
+ * You should not add or remove nodes while iterating, since the tree
+ * is rebalanced by doing so.
+ **/
+#define NIH_TREE_INDEX_FOREACH_FULL(index, iter, filter, data)		\
+	for (NihTree *iter = ((index)->root				\
+			      ? nih_tree_next_full ((index)->root, NULL, \
+						    (filter), (data))	\
+			      : NULL);					\
+	     iter != NULL;						\
+	     iter = nih_tree_next_full ((index)->root, iter, (filter), (data)))
+
+/**
+ * NIH_TREE_INDEX_FOREACH:
+ * @index: index to iterate,
+ * @iter: name of iterator variable.
+ *
+ * Expands to a for statement that iterates over each node in @index in
+ * order of their keys, setting @iter to each node for the block within
+ * the loop.
+ *
+ * You should not add or remove nodes while iterating, since the tree
+ * is rebalanced by doing so.
+ **/
+#define NIH_TREE_INDEX_FOREACH(index, iter)				\
+	NIH_TREE_INDEX_FOREACH_FULL (index, iter, NULL, NULL)
+
 
 NIH_BEGIN_EXTERN
 
@@ -370,6 +504,34 @@ NihTree *     nih_tree_next_post_full (NihTree *tree, NihTree *node,
 NihTree *     nih_tree_prev_post_full (NihTree *tree, NihTree *node,
 				       NihTreeFilter filter, void *data);
 
+int           nih_tree_visit          (NihTree *tree, NihTreeVisitor visitor,
+				       void *data);
+int           nih_tree_visit_pre      (NihTree *tree, NihTreeVisitor visitor,
+				       void *data);
+int           nih_tree_visit_post     (NihTree *tree, NihTreeVisitor visitor,
+				       void *data);
+
+size_t        nih_tree_partition      (NihTree *tree, size_t max,
+				       NihTree **subtrees, NihTree **nodes,
+				       size_t *nnodes);
+
+void          nih_tree_free_all       (NihTree *tree);
+
+NihTreeIndex *nih_tree_index_new      (const void *parent,
+				       NihTreeKeyFunction key_function,
+				       NihTreeCmpFunction cmp_function)
+	__attribute__ ((warn_unused_result, malloc));
+
+NihTree *     nih_tree_index_add      (NihTreeIndex *index,
+				       NihTreeIndexNode *node);
+NihTree *     nih_tree_index_add_unique (NihTreeIndex *index,
+					 NihTreeIndexNode *node);
+NihTree *     nih_tree_index_lookup   (NihTreeIndex *index, const void *key);
+NihTree *     nih_tree_index_lower_bound (NihTreeIndex *index,
+					  const void *key);
+NihTree *     nih_tree_index_remove   (NihTreeIndex *index,
+				       NihTreeIndexNode *node);
+
 NIH_END_EXTERN
 
 #endif /* NIH_TREE_H */
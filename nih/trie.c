@@ -0,0 +1,797 @@
+/* libnih
+ *
+ * trie.c - compressed prefix tree keyed by strings
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/logging.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+
+#include "trie.h"
+
+
+/**
+ * NIH_TRIE_KEY_SIZE:
+ *
+ * Room allocated for the key beyond the prefix when visiting entries,
+ * increased as needed.
+ **/
+#define NIH_TRIE_KEY_SIZE 256
+
+
+/* Prototypes for static functions */
+static NihTrieNode *nih_trie_node_new    (NihTrie *trie, const char *label,
+					  size_t len)
+	__attribute__ ((warn_unused_result, malloc));
+static size_t       nih_trie_child_index (NihTrieNode *node, char c);
+static NihTrieNode *nih_trie_child       (NihTrieNode *node, char c);
+static NihTrieNode *nih_trie_find_prefix (NihTrie *trie, const char *prefix,
+					  size_t *len);
+static void         nih_trie_unlink      (NihTrieNode *node);
+static void         nih_trie_merge       (NihTrie *trie, NihTrieNode *node);
+static void         nih_trie_compact     (NihTrie *trie, NihTrieNode *node);
+static int          nih_trie_walk        (NihTrieNode *top, const char *prefix,
+					  size_t len, NihTrieVisitor visitor,
+					  void *data, int free_nodes,
+					  size_t *count);
+
+
+/**
+ * nih_trie_new:
+ * @parent: parent of new trie.
+ *
+ * Allocates a new, empty, trie.  The nodes of the trie are allocated as
+ * children of it, and freed along with it.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned trie.  When all parents
+ * of the returned trie are freed, the returned trie will also be
+ * freed.
+ *
+ * Returns: the new trie or NULL if the allocation failed.
+ **/
+NihTrie *
+nih_trie_new (const void *parent)
+{
+	NihTrie *trie;
+
+	trie = nih_new (parent, NihTrie);
+	if (! trie)
+		return NULL;
+
+	trie->entries = 0;
+
+	trie->root = nih_trie_node_new (trie, "", 0);
+	if (! trie->root) {
+		nih_free (trie);
+		return NULL;
+	}
+
+	return trie;
+}
+
+/**
+ * nih_trie_node_new:
+ * @trie: trie node is for,
+ * @label: label of node,
+ * @len: length of @label.
+ *
+ * Allocates a new node for @trie, as a child of it, with a copy of the
+ * first @len bytes of @label; the node has no parent, children or value.
+ *
+ * Returns: the new node or NULL if the allocation failed.
+ **/
+static NihTrieNode *
+nih_trie_node_new (NihTrie    *trie,
+		   const char *label,
+		   size_t      len)
+{
+	NihTrieNode *node;
+
+	nih_assert (trie != NULL);
+	nih_assert (label != NULL);
+
+	node = nih_alloc (trie, sizeof (NihTrieNode) + len + 1);
+	if (! node)
+		return NULL;
+
+	node->parent = NULL;
+	node->children = NULL;
+	node->nchildren = 0;
+	node->value = NULL;
+
+	node->len = len;
+	memcpy (node->label, label, len);
+	node->label[len] = '\0';
+
+	return node;
+}
+
+
+/**
+ * nih_trie_child_index:
+ * @node: node to search,
+ * @c: first byte of label.
+ *
+ * Searches the children of @node for the one whose label begins with @c.
+ *
+ * Returns: index of that child, or of where it would be inserted.
+ **/
+static size_t
+nih_trie_child_index (NihTrieNode *node,
+		      char         c)
+{
+	size_t lo = 0, hi;
+
+	nih_assert (node != NULL);
+
+	hi = node->nchildren;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if ((unsigned char)node->children[mid]->label[0]
+		    < (unsigned char)c) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * nih_trie_child:
+ * @node: node to search,
+ * @c: first byte of label.
+ *
+ * Returns: child of @node whose label begins with @c, or NULL.
+ **/
+static NihTrieNode *
+nih_trie_child (NihTrieNode *node,
+		char         c)
+{
+	size_t i;
+
+	nih_assert (node != NULL);
+
+	i = nih_trie_child_index (node, c);
+	if ((i < node->nchildren) && (node->children[i]->label[0] == c))
+		return node->children[i];
+
+	return NULL;
+}
+
+
+/**
+ * nih_trie_add:
+ * @trie: trie to add to,
+ * @key: key of entry,
+ * @value: value of entry.
+ *
+ * Adds an entry to @trie with a copy of @key, or if there is already an
+ * entry with that key, replaces its value with @value.
+ *
+ * Returns: zero on success, negative value on insufficient memory, in
+ * which case @trie is unchanged.
+ **/
+int
+nih_trie_add (NihTrie    *trie,
+	      const char *key,
+	      void       *value)
+{
+	NihTrieNode  *node, *leaf;
+	NihTrieNode **children;
+	size_t        i;
+
+	nih_assert (trie != NULL);
+	nih_assert (key != NULL);
+	nih_assert (value != NULL);
+
+	node = trie->root;
+	while (*key) {
+		NihTrieNode *child, *mid;
+		size_t       len;
+
+		i = nih_trie_child_index (node, *key);
+		if ((i == node->nchildren)
+		    || (node->children[i]->label[0] != *key))
+			break;
+
+		child = node->children[i];
+
+		len = 1;
+		while ((len < child->len) && (key[len] == child->label[len]))
+			len++;
+
+		if (len == child->len) {
+			node = child;
+			key += len;
+			continue;
+		}
+
+		/* The key differs from the child's label part way along, so
+		 * the label is split at that point with a new node holding
+		 * the common part; the key either ends there or continues
+		 * into a new leaf beside the child.
+		 */
+		mid = nih_trie_node_new (trie, child->label, len);
+		if (! mid)
+			return -1;
+
+		mid->children = nih_alloc (mid, sizeof (NihTrieNode *) * 2);
+		if (! mid->children) {
+			nih_free (mid);
+			return -1;
+		}
+
+		leaf = NULL;
+		if (key[len]) {
+			leaf = nih_trie_node_new (trie, key + len,
+						  strlen (key + len));
+			if (! leaf) {
+				nih_free (mid);
+				return -1;
+			}
+		}
+
+		memmove (child->label, child->label + len,
+			 child->len - len + 1);
+		child->len -= len;
+		child->parent = mid;
+
+		mid->parent = node;
+		node->children[i] = mid;
+
+		if (! leaf) {
+			mid->value = value;
+			mid->children[mid->nchildren++] = child;
+		} else if ((unsigned char)leaf->label[0]
+			   < (unsigned char)child->label[0]) {
+			mid->children[mid->nchildren++] = leaf;
+			mid->children[mid->nchildren++] = child;
+		} else {
+			mid->children[mid->nchildren++] = child;
+			mid->children[mid->nchildren++] = leaf;
+		}
+
+		if (leaf) {
+			leaf->parent = mid;
+			leaf->value = value;
+		}
+
+		trie->entries++;
+
+		return 0;
+	}
+
+	if (! *key) {
+		if (! node->value)
+			trie->entries++;
+
+		node->value = value;
+
+		return 0;
+	}
+
+	/* No child begins with the rest of the key, so it goes in a new
+	 * leaf beneath this node.
+	 */
+	leaf = nih_trie_node_new (trie, key, strlen (key));
+	if (! leaf)
+		return -1;
+
+	children = nih_realloc (node->children, node,
+				sizeof (NihTrieNode *) * (node->nchildren + 1));
+	if (! children) {
+		nih_free (leaf);
+		return -1;
+	}
+
+	node->children = children;
+	memmove (node->children + i + 1, node->children + i,
+		 sizeof (NihTrieNode *) * (node->nchildren - i));
+	node->children[i] = leaf;
+	node->nchildren++;
+
+	leaf->parent = node;
+	leaf->value = value;
+
+	trie->entries++;
+
+	return 0;
+}
+
+/**
+ * nih_trie_lookup:
+ * @trie: trie to search,
+ * @key: key to find.
+ *
+ * Finds the entry in @trie with @key.
+ *
+ * Returns: value of entry, or NULL if there is none.
+ **/
+void *
+nih_trie_lookup (NihTrie    *trie,
+		 const char *key)
+{
+	NihTrieNode *node;
+
+	nih_assert (trie != NULL);
+	nih_assert (key != NULL);
+
+	node = trie->root;
+	while (*key) {
+		node = nih_trie_child (node, *key);
+		if ((! node) || strncmp (node->label, key, node->len))
+			return NULL;
+
+		key += node->len;
+	}
+
+	return node->value;
+}
+
+/**
+ * nih_trie_lookup_prefix:
+ * @trie: trie to search,
+ * @key: string to match,
+ * @len: pointer to store length of key found in.
+ *
+ * Finds the entry in @trie with the longest key that is a prefix of @key,
+ * including @key itself.  Note that this is a prefix of the string; to
+ * match whole path components, add the keys with a trailing separator
+ * or check the byte that follows.
+ *
+ * If @len is not NULL, the length of the key found is stored in it.
+ *
+ * Returns: value of entry, or NULL if there is none.
+ **/
+void *
+nih_trie_lookup_prefix (NihTrie    *trie,
+			const char *key,
+			size_t     *len)
+{
+	NihTrieNode *node;
+	void        *value;
+	size_t       pos = 0;
+
+	nih_assert (trie != NULL);
+	nih_assert (key != NULL);
+
+	node = trie->root;
+	value = node->value;
+	if (len)
+		*len = 0;
+
+	while (key[pos]) {
+		node = nih_trie_child (node, key[pos]);
+		if ((! node) || strncmp (node->label, key + pos, node->len))
+			break;
+
+		pos += node->len;
+
+		if (node->value) {
+			value = node->value;
+			if (len)
+				*len = pos;
+		}
+	}
+
+	return value;
+}
+
+
+/**
+ * nih_trie_unlink:
+ * @node: node to remove.
+ *
+ * Removes @node from the children of its parent, without freeing it.
+ **/
+static void
+nih_trie_unlink (NihTrieNode *node)
+{
+	NihTrieNode *parent;
+	size_t       i;
+
+	nih_assert (node != NULL);
+	nih_assert (node->parent != NULL);
+
+	parent = node->parent;
+
+	i = nih_trie_child_index (parent, node->label[0]);
+	nih_assert (parent->children[i] == node);
+
+	memmove (parent->children + i, parent->children + i + 1,
+		 sizeof (NihTrieNode *) * (parent->nchildren - i - 1));
+	parent->nchildren--;
+
+	node->parent = NULL;
+}
+
+/**
+ * nih_trie_merge:
+ * @trie: trie containing @node,
+ * @node: node to merge.
+ *
+ * Merges @node, which has no value and a single child, into that child
+ * by prefixing the child's label with that of @node and freeing it.  The
+ * child must be reallocated to do this; if that fails the trie is left
+ * as it is, which is still correct but for the extra node.
+ **/
+static void
+nih_trie_merge (NihTrie     *trie,
+		NihTrieNode *node)
+{
+	NihTrieNode *child;
+	size_t       i;
+
+	nih_assert (trie != NULL);
+	nih_assert (node != NULL);
+	nih_assert (node->parent != NULL);
+	nih_assert (node->value == NULL);
+	nih_assert (node->nchildren == 1);
+
+	child = nih_realloc (node->children[0], trie,
+			     (sizeof (NihTrieNode) + node->len
+			      + node->children[0]->len + 1));
+	if (! child)
+		return;
+
+	memmove (child->label + node->len, child->label, child->len + 1);
+	memcpy (child->label, node->label, node->len);
+	child->len += node->len;
+
+	for (i = 0; i < child->nchildren; i++)
+		child->children[i]->parent = child;
+
+	i = nih_trie_child_index (node->parent, node->label[0]);
+	nih_assert (node->parent->children[i] == node);
+
+	node->parent->children[i] = child;
+	child->parent = node->parent;
+
+	nih_free (node);
+}
+
+/**
+ * nih_trie_compact:
+ * @trie: trie containing @node,
+ * @node: node that may no longer be needed.
+ *
+ * Called when @node has lost its value or a child; frees it if it has
+ * neither a value nor children, continuing up the trie, or merges it
+ * into its child if it has no value and just one child.
+ **/
+static void
+nih_trie_compact (NihTrie     *trie,
+		  NihTrieNode *node)
+{
+	nih_assert (trie != NULL);
+	nih_assert (node != NULL);
+
+	while ((node != trie->root) && (! node->value)) {
+		NihTrieNode *parent;
+
+		if (node->nchildren == 1) {
+			nih_trie_merge (trie, node);
+			break;
+		} else if (node->nchildren) {
+			break;
+		}
+
+		parent = node->parent;
+		nih_trie_unlink (node);
+		nih_free (node);
+
+		node = parent;
+	}
+}
+
+/**
+ * nih_trie_remove:
+ * @trie: trie to remove from,
+ * @key: key of entry.
+ *
+ * Removes the entry with @key from @trie, freeing any nodes no longer
+ * needed; this never fails.
+ *
+ * Returns: value of entry removed, or NULL if there was none.
+ **/
+void *
+nih_trie_remove (NihTrie    *trie,
+		 const char *key)
+{
+	NihTrieNode *node;
+	void        *value;
+
+	nih_assert (trie != NULL);
+	nih_assert (key != NULL);
+
+	node = trie->root;
+	while (*key) {
+		node = nih_trie_child (node, *key);
+		if ((! node) || strncmp (node->label, key, node->len))
+			return NULL;
+
+		key += node->len;
+	}
+
+	value = node->value;
+	if (! value)
+		return NULL;
+
+	node->value = NULL;
+	trie->entries--;
+
+	nih_trie_compact (trie, node);
+
+	return value;
+}
+
+
+/**
+ * nih_trie_find_prefix:
+ * @trie: trie to search,
+ * @prefix: prefix of keys,
+ * @len: pointer to store length of key above node in.
+ *
+ * Finds the highest node of @trie beneath which every key begins with
+ * @prefix; @prefix may end part way along the node's label.  The number
+ * of bytes of @prefix that make up the key of the node's parent is
+ * stored in @len.
+ *
+ * Returns: node found, or NULL if no key begins with @prefix.
+ **/
+static NihTrieNode *
+nih_trie_find_prefix (NihTrie    *trie,
+		      const char *prefix,
+		      size_t     *len)
+{
+	NihTrieNode *node;
+	size_t       pos = 0;
+
+	nih_assert (trie != NULL);
+	nih_assert (prefix != NULL);
+	nih_assert (len != NULL);
+
+	node = trie->root;
+	while (prefix[pos]) {
+		size_t rest;
+
+		node = nih_trie_child (node, prefix[pos]);
+		if (! node)
+			return NULL;
+
+		rest = strlen (prefix + pos);
+		if (rest <= node->len) {
+			if (memcmp (node->label, prefix + pos, rest))
+				return NULL;
+
+			*len = pos;
+			return node;
+		}
+
+		if (memcmp (node->label, prefix + pos, node->len))
+			return NULL;
+
+		pos += node->len;
+	}
+
+	*len = pos - node->len;
+	return node;
+}
+
+/**
+ * nih_trie_walk:
+ * @top: node to walk beneath,
+ * @prefix: key of parent of @top,
+ * @len: length of @prefix,
+ * @visitor: function to call for each entry,
+ * @data: pointer to pass to @visitor,
+ * @free_nodes: free each node after its children,
+ * @count: pointer to increment for each entry.
+ *
+ * Calls @visitor, if not NULL, for each entry at or beneath @top in key
+ * order, building the key of each as it goes.  The walk follows the
+ * parent pointers back up rather than using a stack.
+ *
+ * If @free_nodes is TRUE, each node is freed once it and its siblings
+ * have been left for the last time; @top must have been removed from the
+ * trie already, and the walk does not stop if @visitor returns a negative
+ * value.
+ *
+ * Returns: zero, or the negative value returned by @visitor.
+ **/
+static int
+nih_trie_walk (NihTrieNode    *top,
+	       const char     *prefix,
+	       size_t          len,
+	       NihTrieVisitor  visitor,
+	       void           *data,
+	       int             free_nodes,
+	       size_t         *count)
+{
+	nih_local char *key = NULL;
+	NihTrieNode    *node;
+	size_t          size;
+	int             ret = 0;
+
+	nih_assert (top != NULL);
+	nih_assert (prefix != NULL);
+
+	size = len + NIH_TRIE_KEY_SIZE;
+	key = NIH_MUST (nih_alloc (NULL, size));
+	memcpy (key, prefix, len);
+
+	node = top;
+	while (node) {
+		/* Come down to node, adding its label to the key */
+		if (len + node->len + 1 > size) {
+			size = (len + node->len + 1) * 2;
+			key = NIH_MUST (nih_realloc (key, NULL, size));
+		}
+
+		memcpy (key + len, node->label, node->len);
+		len += node->len;
+		key[len] = '\0';
+
+		if (node->value) {
+			if (count)
+				(*count)++;
+
+			if (visitor && (ret == 0))
+				ret = visitor (data, key, node->value);
+			if ((ret < 0) && (! free_nodes))
+				return ret;
+		}
+
+		if (node->nchildren) {
+			node = node->children[0];
+			continue;
+		}
+
+		/* Go back up until there's a following sibling; when freeing,
+		 * the siblings are freed together after the last since the
+		 * search for the following one reads their labels.
+		 */
+		while (node) {
+			NihTrieNode *parent = NULL, *next = NULL;
+
+			len -= node->len;
+
+			if (node != top) {
+				size_t i;
+
+				parent = node->parent;
+				i = nih_trie_child_index (parent,
+							  node->label[0]);
+				if (i + 1 < parent->nchildren) {
+					next = parent->children[i + 1];
+				} else if (free_nodes) {
+					for (i = 0; i < parent->nchildren; i++)
+						nih_free (parent->children[i]);
+				}
+			} else if (free_nodes) {
+				nih_free (node);
+			}
+
+			if (next) {
+				node = next;
+				break;
+			}
+
+			node = parent;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * nih_trie_visit:
+ * @trie: trie to walk,
+ * @prefix: prefix of keys to visit,
+ * @visitor: function to call for each entry,
+ * @data: pointer to pass to @visitor.
+ *
+ * Calls @visitor for each entry of @trie whose key begins with @prefix,
+ * which may be empty to visit them all, in key order.  @visitor must not
+ * change @trie.
+ *
+ * Returns: zero once every entry has been visited, or the negative value
+ * returned by @visitor to stop.
+ **/
+int
+nih_trie_visit (NihTrie        *trie,
+		const char     *prefix,
+		NihTrieVisitor  visitor,
+		void           *data)
+{
+	NihTrieNode *top;
+	size_t       len;
+
+	nih_assert (trie != NULL);
+	nih_assert (prefix != NULL);
+	nih_assert (visitor != NULL);
+
+	top = nih_trie_find_prefix (trie, prefix, &len);
+	if (! top)
+		return 0;
+
+	return nih_trie_walk (top, prefix, len, visitor, data, FALSE, NULL);
+}
+
+/**
+ * nih_trie_remove_prefix:
+ * @trie: trie to remove from,
+ * @prefix: prefix of keys to remove,
+ * @visitor: function to call for each entry removed,
+ * @data: pointer to pass to @visitor.
+ *
+ * Removes every entry of @trie whose key begins with @prefix, calling
+ * @visitor, if not NULL, for each in key order; its return value is
+ * ignored.  The entries are all removed from @trie before @visitor is
+ * called, so it may change @trie, for example by freeing the values
+ * removed even if that removes them again; the number of entries is
+ * updated once all have been visited.
+ *
+ * Returns: number of entries removed.
+ **/
+size_t
+nih_trie_remove_prefix (NihTrie        *trie,
+			const char     *prefix,
+			NihTrieVisitor  visitor,
+			void           *data)
+{
+	nih_local char *key = NULL;
+	NihTrieNode    *top;
+	size_t          len, count = 0;
+
+	nih_assert (trie != NULL);
+	nih_assert (prefix != NULL);
+
+	top = nih_trie_find_prefix (trie, prefix, &len);
+	if (! top)
+		return 0;
+
+	key = NIH_MUST (nih_strndup (NULL, prefix, len));
+
+	if (top == trie->root) {
+		trie->root = NIH_MUST (nih_trie_node_new (trie, "", 0));
+	} else {
+		NihTrieNode *parent = top->parent;
+
+		nih_trie_unlink (top);
+		nih_trie_compact (trie, parent);
+	}
+
+	nih_trie_walk (top, key, len, visitor, data, TRUE, &count);
+	trie->entries -= count;
+
+	return count;
+}
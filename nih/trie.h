@@ -0,0 +1,120 @@
+/* libnih
+ *
+ * Copyright © 2009 Scott James Remnant <scott@netsplit.com>.
+ * Copyright © 2009 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NIH_TRIE_H
+#define NIH_TRIE_H
+
+/**
+ * Provides a map from string keys to values, stored in a compressed
+ * prefix tree (radix trie) where each node holds the part of the key it
+ * adds to its parent's.  Keys sharing a prefix share the nodes for it, so
+ * hierarchical keys such as paths are found by following one node for
+ * each point at which they differ from the others, and all of the keys
+ * beginning with a prefix are found together beneath a single node.
+ *
+ * Tries are created with nih_trie_new(); the nodes are allocated as
+ * children of the trie, so are freed along with it.  Keys are copied into
+ * the nodes, values remain owned by the caller and may not be NULL.
+ *
+ * Entries are added with nih_trie_add(), found with nih_trie_lookup() and
+ * removed with nih_trie_remove().  nih_trie_lookup_prefix() finds the
+ * entry with the longest key that is a prefix of the string given.
+ *
+ * All of the entries whose keys begin with a prefix are visited in key
+ * order with nih_trie_visit(), and removed with nih_trie_remove_prefix();
+ * both take time in proportion to the number of entries found, not the
+ * size of the trie.
+ **/
+
+#include <nih/macros.h>
+
+
+/**
+ * NihTrieVisitor:
+ * @data: data pointer,
+ * @key: key of entry,
+ * @value: value of entry.
+ *
+ * A trie visitor is a function that is called for each entry found by
+ * nih_trie_visit() or nih_trie_remove_prefix().  @key is only valid for
+ * the duration of the call.
+ *
+ * Returns: zero to continue, or a negative value to stop.
+ **/
+typedef int (*NihTrieVisitor) (void *data, const char *key, void *value);
+
+
+/**
+ * NihTrieNode:
+ * @parent: parent node, or NULL for the root,
+ * @children: children ordered by the first byte of their label,
+ * @nchildren: number of @children,
+ * @value: value of the entry whose key ends here, or NULL,
+ * @len: length of @label,
+ * @label: part of the key added to that of @parent.
+ *
+ * This structure represents a node of a trie, the key of each node being
+ * the labels of those above it followed by its own.  Every node other
+ * than the root either has a @value or at least two @children.
+ **/
+typedef struct nih_trie_node {
+	struct nih_trie_node  *parent;
+	struct nih_trie_node **children;
+	size_t                 nchildren;
+
+	void                  *value;
+
+	size_t                 len;
+	char                   label[];
+} NihTrieNode;
+
+/**
+ * NihTrie:
+ * @root: root node, with an empty label,
+ * @entries: number of entries.
+ *
+ * This structure represents a trie; all members may be read but should
+ * not be changed directly.
+ **/
+typedef struct nih_trie {
+	NihTrieNode *root;
+	size_t       entries;
+} NihTrie;
+
+
+NIH_BEGIN_EXTERN
+
+NihTrie *nih_trie_new           (const void *parent)
+	__attribute__ ((warn_unused_result, malloc));
+
+int      nih_trie_add           (NihTrie *trie, const char *key, void *value)
+	__attribute__ ((warn_unused_result));
+void *   nih_trie_lookup        (NihTrie *trie, const char *key);
+void *   nih_trie_lookup_prefix (NihTrie *trie, const char *key,
+				 size_t *len);
+void *   nih_trie_remove        (NihTrie *trie, const char *key);
+
+int      nih_trie_visit         (NihTrie *trie, const char *prefix,
+				 NihTrieVisitor visitor, void *data);
+size_t   nih_trie_remove_prefix (NihTrie *trie, const char *prefix,
+				 NihTrieVisitor visitor, void *data);
+
+NIH_END_EXTERN
+
+#endif /* NIH_TRIE_H */
@@ -38,6 +38,7 @@
 #include <nih/string.h>
 #include <nih/list.h>
 #include <nih/hash.h>
+#include <nih/trie.h>
 #include <nih/io.h>
 #include <nih/file.h>
 #include <nih/watch.h>
@@ -59,6 +60,11 @@
 static NihWatchHandle *nih_watch_handle_by_wd   (NihWatch *watch, int wd);
 static NihWatchHandle *nih_watch_handle_by_path (NihWatch *watch,
 						 const char *path);
+static void            nih_watch_handle_remove  (NihWatch *watch,
+						 NihWatchHandle *handle);
+static int             nih_watch_remove_visitor (NihWatch *watch,
+						 const char *path,
+						 NihWatchHandle *handle);
 static int             nih_watch_add_visitor    (NihWatch *watch,
 						 const char *dirname,
 					         const char *path,
@@ -139,6 +145,7 @@ nih_watch_new (const void       *parent,
 	watch = NIH_MUST (nih_new (parent, NihWatch));
 	watch->path = NIH_MUST (nih_strdup (watch, path));
 	watch->created = NIH_MUST (nih_hash_string_new (watch, 0));
+	watch->handles = NIH_MUST (nih_trie_new (watch));
 
 	watch->subdirs = subdirs;
 	watch->create = create;
@@ -216,7 +223,8 @@ nih_watch_handle_by_wd (NihWatch *watch,
  * @watch: watch to search,
  * @path: path being watched.
  *
- * Searches @watch for the watch descriptor that is handling @path.
+ * Looks up the watch descriptor that is handling @path in the handles
+ * trie of @watch.
  *
  * Returns: NihWatchHandle for @path, or NULL if none known.
  **/
@@ -227,14 +235,56 @@ nih_watch_handle_by_path (NihWatch   *watch,
 	nih_assert (watch != NULL);
 	nih_assert (path != NULL);
 
-	NIH_LIST_FOREACH (&watch->watches, iter) {
-		NihWatchHandle *handle = (NihWatchHandle *)iter;
+	return nih_trie_lookup (watch->handles, path);
+}
 
-		if (! strcmp (handle->path, path))
-			return handle;
-	}
+/**
+ * nih_watch_handle_remove:
+ * @watch: watch containing @handle,
+ * @handle: handle to remove.
+ *
+ * Removes @handle from the handles trie of @watch, unless another handle
+ * has since been added for the same path, and frees it; which removes it
+ * from the watches list.
+ **/
+static void
+nih_watch_handle_remove (NihWatch       *watch,
+			 NihWatchHandle *handle)
+{
+	nih_assert (watch != NULL);
+	nih_assert (handle != NULL);
 
-	return NULL;
+	if (nih_trie_lookup (watch->handles, handle->path) == handle)
+		nih_trie_remove (watch->handles, handle->path);
+
+	nih_free (handle);
+}
+
+/**
+ * nih_watch_remove_visitor:
+ * @watch: watch containing @handle,
+ * @path: path being watched,
+ * @handle: handle removed.
+ *
+ * Callback function for nih_trie_remove_prefix(), used when a directory
+ * is deleted or moved away to free the handles for the paths beneath it,
+ * which have already been removed from the handles trie.
+ *
+ * Returns: zero.
+ **/
+static int
+nih_watch_remove_visitor (NihWatch       *watch,
+			  const char     *path,
+			  NihWatchHandle *handle)
+{
+	nih_assert (watch != NULL);
+	nih_assert (path != NULL);
+	nih_assert (handle != NULL);
+
+	nih_debug ("Ceasing watch on %s", handle->path);
+	nih_free (handle);
+
+	return 0;
 }
 
 
@@ -252,8 +302,8 @@ nih_watch_handle_by_path (NihWatch   *watch,
  * the path are also watched.
  *
  * An NihWatchHandle structure is allocated and stored in the watches
- * member of @watch, it is also a child of that structure; there is no
- * non-allocated version of this because of this.
+ * member of @watch, and in its handles trie; it is also a child of that
+ * structure; there is no non-allocated version of this because of this.
  *
  * Returns: zero on success, negative value on raised error.
  **/
@@ -290,6 +340,7 @@ nih_watch_add (NihWatch   *watch,
 	}
 
 	nih_list_add (&watch->watches, &handle->entry);
+	NIH_ZERO (nih_trie_add (watch->handles, handle->path, handle));
 
 	/* Recurse into sub-directories, attempting to add a watch for each
 	 * one; errors within the walk are warned automatically, so if this
@@ -302,7 +353,7 @@ nih_watch_add (NihWatch   *watch,
 
 		err = nih_error_get ();
 		if (err->number != ENOTDIR) {
-			nih_free (handle);
+			nih_watch_handle_remove (watch, handle);
 			return -1;
 		} else
 			nih_free (err);
@@ -490,7 +541,7 @@ nih_watch_handle (NihWatch       *watch,
 			return;
 
 		nih_debug ("Ceasing watch on %s", handle->path);
-		nih_free (handle);
+		nih_watch_handle_remove (watch, handle);
 		return;
 	}
 
@@ -580,6 +631,7 @@ nih_watch_handle (NihWatch       *watch,
 
 	} else if ((events & IN_DELETE) || (events & IN_MOVED_FROM)) {
 		NihWatchHandle *path_handle;
+		nih_local char *subdir = NULL;
 
 		/* Suppress the handler if the file was newly created. */
 		if ((! delayed) && watch->delete_handler)
@@ -594,7 +646,16 @@ nih_watch_handle (NihWatch       *watch,
 		path_handle = nih_watch_handle_by_path (watch, path);
 		if (path_handle) {
 			nih_debug ("Ceasing watch on %s", path_handle->path);
-			nih_free (path_handle);
+			nih_watch_handle_remove (watch, path_handle);
 		}
+
+		/* Likewise for any watches beneath it, since when a
+		 * directory is moved away we won't hear about those; they
+		 * are all found together in the handles trie.
+		 */
+		subdir = NIH_MUST (nih_sprintf (NULL, "%s/", path));
+		nih_trie_remove_prefix (watch->handles, subdir,
+					(NihTrieVisitor)nih_watch_remove_visitor,
+					watch);
 	}
 }
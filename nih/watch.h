@@ -27,6 +27,7 @@
 #include <nih/macros.h>
 #include <nih/list.h>
 #include <nih/hash.h>
+#include <nih/trie.h>
 #include <nih/file.h>
 #include <nih/io.h>
 
@@ -96,6 +97,7 @@ typedef void (*NihDeleteHandler) (void *data, NihWatch *watch,
  * @io: NihIo structure to watch @fd,
  * @path: full path to be watched,
  * @watches: list of watch descriptors,
+ * @handles: watch descriptors by path,
  * @subdirs: include sub-directories of @path,
  * @create: call @create_handler for existing files,
  * @filter: function to filter paths watched,
@@ -116,6 +118,7 @@ struct nih_watch {
 
 	char             *path;
 	NihList           watches;
+	NihTrie          *handles;
 
 	int               subdirs;
 	int               create;
@@ -139,7 +142,7 @@ struct nih_watch {
  *
  * This structure represents an inotify watch on an individual @path with
  * a unique watch descriptor @wd.  They are stored in the watches list of
- * an NihWatch structure.
+ * an NihWatch structure, and in its handles trie by @path.
  **/
 typedef struct nih_watch_handle {
 	NihList  entry;